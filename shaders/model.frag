@@ -0,0 +1,22 @@
+#version 450
+
+layout(location = 0) in vec2 texCoord;
+layout(location = 1) flat in uint textureIndex;
+
+layout(set = 1, binding = 0) uniform sampler2DArray textureArray;
+
+layout(location = 0) out vec4 outFragColor;
+
+void main()
+{
+	vec4 texColor = texture(textureArray, vec3(texCoord, float(textureIndex)));
+
+	// Treat #660066 as transparency, textures are sRGB so compare against its linear value.
+	// Texture packs store the colour key as alpha instead.
+	if (all(lessThan(abs(texColor.rgb - vec3(0.1329, 0.0, 0.1329)), vec3(0.002))) || texColor.a < 0.5)
+	{
+		discard;
+	}
+
+	outFragColor = vec4(texColor.rgb, 1.0f);
+}
@@ -0,0 +1,59 @@
+#version 450
+
+layout(location = 0) in vec3 vPos;
+layout(location = 1) in vec2 vTexCoord;
+layout(location = 2) in vec3 iOffset;
+layout(location = 3) in vec2 iRotationScale;
+// x: Layer, y: Texture array index, which only model_bindless.frag reads.
+layout(location = 4) in uvec2 iTexture;
+
+layout(location = 0) out vec2 texCoord;
+layout(location = 1) flat out uint textureIndex;
+layout(location = 2) flat out uint textureArrayIndex;
+
+layout(set = 0, binding = 0) uniform CameraBuffer {
+	mat4 view;
+	mat4 proj;
+	mat4 viewProj;
+	mat4 orthoProj;
+} cameraData;
+
+layout(push_constant) uniform constants
+{
+	vec4 data;
+} pushConstants;
+
+void main()
+{
+	float theta = radians(iRotationScale.x);
+	mat4 yRotation = mat4(
+		cos(theta),  0, sin(theta), 0,
+		0,           1, 0,          0,
+		-sin(theta), 0, cos(theta), 0,
+		0,           0, 0,          1);
+	mat4 zRotation = mat4(
+		cos(theta), -sin(theta), 0, 0,
+		sin(theta), cos(theta),  0, 0,
+		0,          0,           0, 0,
+		0,          0,           0, 1);
+
+	vec4 pos = vec4(vPos * iRotationScale.y, 1.0);
+
+	if (pushConstants.data.x != 0.0)
+	{
+		pos = cameraData.orthoProj * zRotation * pos + vec4(iOffset, 0.0);
+	}
+	else
+	{
+		pos = cameraData.viewProj * (yRotation * pos + vec4(iOffset, 0.0));
+	}
+
+	// Convert from GL's clip space, Vulkan's y axis points down and depth is [0, 1].
+	pos.y = -pos.y;
+	pos.z = (pos.z + pos.w) * 0.5;
+
+	gl_Position = pos;
+	texCoord = vTexCoord;
+	textureIndex = iTexture.x;
+	textureArrayIndex = iTexture.y;
+}
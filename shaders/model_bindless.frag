@@ -0,0 +1,27 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// model.frag for VKRenderer's bindless path, every texture array is bound at once and
+// instances pick theirs.
+layout(location = 0) in vec2 texCoord;
+layout(location = 1) flat in uint textureIndex;
+layout(location = 2) flat in uint textureArrayIndex;
+
+layout(set = 1, binding = 0) uniform sampler2DArray textureArrays[];
+
+layout(location = 0) out vec4 outFragColor;
+
+void main()
+{
+	// Instances of one draw may use different texture arrays, so the index isn't uniform.
+	vec4 texColor = texture(textureArrays[nonuniformEXT(textureArrayIndex)], vec3(texCoord, float(textureIndex)));
+
+	// Treat #660066 as transparency, textures are sRGB so compare against its linear value.
+	// Texture packs store the colour key as alpha instead.
+	if (all(lessThan(abs(texColor.rgb - vec3(0.1329, 0.0, 0.1329)), vec3(0.002))) || texColor.a < 0.5)
+	{
+		discard;
+	}
+
+	outFragColor = vec4(texColor.rgb, 1.0f);
+}
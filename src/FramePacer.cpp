@@ -0,0 +1,42 @@
+#include "FramePacer.h"
+
+#include <thread>
+
+// OS sleeps are coarse, so the last part of the wait is spent spinning.
+constexpr std::chrono::microseconds spinMargin(1500);
+
+void FramePacer::SetTargetFrameTime(double seconds)
+{
+	targetFrameTime = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(seconds));
+	nextFrameTime = std::chrono::steady_clock::now();
+}
+
+void FramePacer::Wait()
+{
+	if (targetFrameTime <= std::chrono::steady_clock::duration::zero())
+	{
+		return;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+
+	if (nextFrameTime - now > spinMargin)
+	{
+		std::this_thread::sleep_until(nextFrameTime - spinMargin);
+	}
+
+	while (std::chrono::steady_clock::now() < nextFrameTime)
+	{
+		std::this_thread::yield();
+	}
+
+	// Don't try to catch up after a long frame, that would just produce a burst of short ones.
+	now = std::chrono::steady_clock::now();
+	nextFrameTime += targetFrameTime;
+
+	if (nextFrameTime < now)
+	{
+		nextFrameTime = now + targetFrameTime;
+	}
+}
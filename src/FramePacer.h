@@ -0,0 +1,16 @@
+#pragma once
+
+#include <chrono>
+
+// Sleeps the CPU so frames start at most once every target frame time. Call Wait right
+// before input is sampled so the sleep doesn't add to input latency.
+class FramePacer
+{
+public:
+	void SetTargetFrameTime(double seconds);
+	void Wait();
+
+private:
+	std::chrono::steady_clock::duration targetFrameTime = {};
+	std::chrono::steady_clock::time_point nextFrameTime = {};
+};
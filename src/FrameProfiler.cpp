@@ -0,0 +1,107 @@
+#include "FrameProfiler.h"
+
+#include <algorithm>
+#include <vector>
+
+void TimingHistory::Add(double milliseconds)
+{
+	samples[next] = milliseconds;
+	next = (next + 1) % frameStatsHistorySize;
+	count = std::min(count + 1, frameStatsHistorySize);
+}
+
+TimingStats TimingHistory::Compute() const
+{
+	TimingStats stats = {};
+
+	if (count == 0)
+	{
+		return stats;
+	}
+
+	stats.last = samples[(next + frameStatsHistorySize - 1) % frameStatsHistorySize];
+
+	std::vector<double> sorted(samples, samples + count);
+
+	auto percentile = [&](double p) {
+		size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+		std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+		return sorted[index];
+	};
+
+	stats.p50 = percentile(0.50);
+	stats.p95 = percentile(0.95);
+	stats.p99 = percentile(0.99);
+
+	return stats;
+}
+
+std::chrono::steady_clock::time_point FrameProfiler::Now()
+{
+	return std::chrono::steady_clock::now();
+}
+
+void FrameProfiler::EndStage(ProfilerStage stage, std::chrono::steady_clock::time_point start)
+{
+	frameStageTimes[static_cast<size_t>(stage)] +=
+		std::chrono::duration<double, std::milli>(Now() - start).count();
+}
+
+void FrameProfiler::EndDraw(std::chrono::steady_clock::time_point start, size_t indexCount, size_t instanceCount)
+{
+	EndStage(ProfilerStage::Draw, start);
+	AddDraw(indexCount, instanceCount);
+}
+
+void FrameProfiler::AddDraw(size_t indexCount, size_t instanceCount)
+{
+	++frameDrawCount;
+	frameInstanceCount += instanceCount;
+	frameTriangleCount += static_cast<uint64_t>(indexCount / 3) * instanceCount;
+}
+
+void FrameProfiler::EndFrame()
+{
+	auto now = Now();
+
+	// The first frame has nothing to measure its length against.
+	if (lastFrameEnd != std::chrono::steady_clock::time_point{})
+	{
+		frameTimes.Add(std::chrono::duration<double, std::milli>(now - lastFrameEnd).count());
+	}
+
+	lastFrameEnd = now;
+
+	beginDrawingTimes.Add(frameStageTimes[static_cast<size_t>(ProfilerStage::BeginDrawing)]);
+	drawTimes.Add(frameStageTimes[static_cast<size_t>(ProfilerStage::Draw)]);
+	endDrawingTimes.Add(frameStageTimes[static_cast<size_t>(ProfilerStage::EndDrawing)]);
+
+	drawCount = frameDrawCount;
+	instanceCount = frameInstanceCount;
+	triangleCount = frameTriangleCount;
+
+	std::fill(std::begin(frameStageTimes), std::end(frameStageTimes), 0.0);
+	frameDrawCount = 0;
+	frameInstanceCount = 0;
+	frameTriangleCount = 0;
+}
+
+void FrameProfiler::AddGpuTime(double milliseconds)
+{
+	gpuTimes.Add(milliseconds);
+}
+
+FrameStats FrameProfiler::GetStats() const
+{
+	FrameStats stats = {};
+	stats.frameTime = frameTimes.Compute();
+	stats.beginDrawingTime = beginDrawingTimes.Compute();
+	stats.drawTime = drawTimes.Compute();
+	stats.endDrawingTime = endDrawingTimes.Compute();
+	stats.gpuTime = gpuTimes.Compute();
+	stats.drawCount = drawCount;
+	stats.instanceCount = instanceCount;
+	stats.triangleCount = triangleCount;
+
+	return stats;
+}
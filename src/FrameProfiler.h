@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Renderer.h"
+
+#include <chrono>
+
+constexpr size_t frameStatsHistorySize = 256;
+
+// Fixed size window of samples, percentiles are only computed when asked for.
+class TimingHistory
+{
+public:
+	void Add(double milliseconds);
+	TimingStats Compute() const;
+
+private:
+	double samples[frameStatsHistorySize] = {};
+	size_t count = 0;
+	size_t next = 0;
+};
+
+enum class ProfilerStage
+{
+	BeginDrawing,
+	Draw,
+	EndDrawing,
+};
+
+// Collects the CPU side of FrameStats, the renderers add GPU times as their queries resolve.
+class FrameProfiler
+{
+public:
+	static std::chrono::steady_clock::time_point Now();
+
+	void EndStage(ProfilerStage stage, std::chrono::steady_clock::time_point start);
+	void EndDraw(std::chrono::steady_clock::time_point start, size_t indexCount, size_t instanceCount);
+	// Counts a draw without timing it, for renderers that issue draws after queueing them.
+	void AddDraw(size_t indexCount, size_t instanceCount);
+	// Call once at the very end of EndDrawing.
+	void EndFrame();
+	void AddGpuTime(double milliseconds);
+
+	FrameStats GetStats() const;
+
+private:
+	TimingHistory frameTimes;
+	TimingHistory beginDrawingTimes;
+	TimingHistory drawTimes;
+	TimingHistory endDrawingTimes;
+	TimingHistory gpuTimes;
+
+	std::chrono::steady_clock::time_point lastFrameEnd = {};
+	double frameStageTimes[3] = {};
+	uint32_t frameDrawCount = 0;
+	uint64_t frameInstanceCount = 0;
+	uint64_t frameTriangleCount = 0;
+
+	uint32_t drawCount = 0;
+	uint64_t instanceCount = 0;
+	uint64_t triangleCount = 0;
+};
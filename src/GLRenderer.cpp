@@ -2,8 +2,17 @@
 
 #include <stdexcept>
 #include <cmath>
+#include <cstring>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "TexturePack.h"
+
+#ifdef GFPS_HEADLESS_EGL
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "../deps/stb_image.h"
 
@@ -69,8 +78,8 @@ constexpr char* fragmentShaderSource =
 "{\n"
 "   vec4 texColor = texture(textureArray, vec3(TexCoord, float(TextureIndex)));\n"
 
-"   // Treat #660066 as transparency.\n"
-"   if (texColor.r == 0.4 && texColor.g == 0.0 && texColor.b == 0.4)\n"
+"   // Treat #660066 as transparency, texture packs store it as alpha instead.\n"
+"   if ((texColor.r == 0.4 && texColor.g == 0.0 && texColor.b == 0.4) || texColor.a < 0.5)\n"
 "   {\n"
 "       discard;\n"
 "   }\n"
@@ -80,25 +89,22 @@ constexpr char* fragmentShaderSource =
 
 constexpr int32_t maxShaderErrorLen = 512;
 
-GLRenderer::GLRenderer(const std::string& windowName, int32_t windowWidth, int32_t windowHeight)
-	: width(windowWidth), height(windowHeight)
+GLRenderer::GLRenderer(const std::string& windowName, int32_t windowWidth, int32_t windowHeight,
+	const RendererConfig& config)
+	: config(config), isGpuTimerPending{}, gpuTimerIndex(0), window(nullptr), width(windowWidth),
+	height(windowHeight), offscreenFramebuffer(0), offscreenColor(0), offscreenDepth(0), eglDisplay(nullptr),
+	eglContext(nullptr), instanceCuller(workerPool)
 {
-
-	if (!glfwInit())
+	if (config.headless)
 	{
-		throw std::runtime_error("Failed to initialize glfw!");
+		InitHeadlessContext();
 	}
-
-	window = glfwCreateWindow(width, height, windowName.c_str(), nullptr, nullptr);
-
-	if (!window)
+	else
 	{
-		glfwTerminate();
-		throw std::runtime_error("Failed to create a window!");
+		InitWindowContext(windowName);
 	}
 
-	glfwMakeContextCurrent(window);
-	gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+	framePacer.SetTargetFrameTime(config.targetFrameTime);
 
 	vertexShader = glCreateShader(GL_VERTEX_SHADER);
 	glShaderSource(vertexShader, 1, &vertexShaderSource, nullptr);
@@ -127,7 +133,13 @@ GLRenderer::GLRenderer(const std::string& windowName, int32_t windowWidth, int32
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
 
-	stbi_set_flip_vertically_on_load(true);
+	InitInstanceRing();
+	glGenQueries(gpuTimerQueryCount, gpuTimerQueries);
+
+	if (config.headless)
+	{
+		InitOffscreenFramebuffer();
+	}
 
 	camera = Camera{
 		45.0f,
@@ -143,12 +155,146 @@ GLRenderer::GLRenderer(const std::string& windowName, int32_t windowWidth, int32
 	};
 }
 
+void GLRenderer::InitWindowContext(const std::string& windowName)
+{
+	if (!glfwInit())
+	{
+		throw std::runtime_error("Failed to initialize glfw!");
+	}
+
+	window = glfwCreateWindow(width, height, windowName.c_str(), nullptr, nullptr);
+
+	if (!window)
+	{
+		glfwTerminate();
+		throw std::runtime_error("Failed to create a window!");
+	}
+
+	glfwMakeContextCurrent(window);
+	gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+
+	// GL has no mailbox mode, the closest is presenting without waiting for vsync.
+	switch (config.presentMode)
+	{
+	case PresentMode::Immediate:
+	case PresentMode::Mailbox:
+		glfwSwapInterval(0);
+		break;
+	case PresentMode::Fifo:
+		glfwSwapInterval(1);
+		break;
+	case PresentMode::FifoRelaxed:
+	{
+		bool canTear = glfwExtensionSupported("WGL_EXT_swap_control_tear") ||
+			glfwExtensionSupported("GLX_EXT_swap_control_tear");
+		glfwSwapInterval(canTear ? -1 : 1);
+		break;
+	}
+	}
+}
+
+void GLRenderer::InitHeadlessContext()
+{
+#ifdef GFPS_HEADLESS_EGL
+	// The surfaceless platform needs no window system or GPU, Mesa's llvmpipe works with it.
+	EGLDisplay display = EGL_NO_DISPLAY;
+	auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+		eglGetProcAddress("eglGetPlatformDisplayEXT"));
+
+	if (getPlatformDisplay)
+	{
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	}
+
+	if (display == EGL_NO_DISPLAY)
+	{
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr))
+	{
+		throw std::runtime_error("Failed to initialize EGL!");
+	}
+
+	eglBindAPI(EGL_OPENGL_API);
+
+	// Nothing is ever drawn to an EGL surface, so any surface type will do.
+	EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, 0,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE,
+	};
+
+	EGLConfig eglConfig;
+	EGLint configCount = 0;
+	eglChooseConfig(display, configAttribs, &eglConfig, 1, &configCount);
+
+	EGLContext context = configCount > 0 ? eglCreateContext(display, eglConfig, EGL_NO_CONTEXT, nullptr) : EGL_NO_CONTEXT;
+
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+	{
+		eglTerminate(display);
+		throw std::runtime_error("Failed to create a surfaceless EGL context!");
+	}
+
+	eglDisplay = display;
+	eglContext = context;
+
+	gladLoadGLLoader((GLADloadproc)eglGetProcAddress);
+#else
+	throw std::runtime_error("GLRenderer was built without headless support, enable GFPS_HEADLESS_EGL!");
+#endif
+}
+
+void GLRenderer::InitOffscreenFramebuffer()
+{
+	glGenRenderbuffers(1, &offscreenColor);
+	glBindRenderbuffer(GL_RENDERBUFFER, offscreenColor);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+	glGenRenderbuffers(1, &offscreenDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, offscreenDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+	glGenFramebuffers(1, &offscreenFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, offscreenFramebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreenColor);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, offscreenDepth);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		throw std::runtime_error("Failed to create the offscreen framebuffer!");
+	}
+}
+
+void GLRenderer::DestroyOffscreenFramebuffer()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &offscreenFramebuffer);
+	glDeleteRenderbuffers(1, &offscreenColor);
+	glDeleteRenderbuffers(1, &offscreenDepth);
+}
+
 void GLRenderer::CloseWindow()
 {
+	DestroyInstanceRing();
+	glDeleteQueries(gpuTimerQueryCount, gpuTimerQueries);
+
 	glDeleteShader(vertexShader);
 	glDeleteShader(fragmentShader);
 	glDeleteProgram(shaderProgram);
 
+	if (config.headless)
+	{
+		DestroyOffscreenFramebuffer();
+
+#ifdef GFPS_HEADLESS_EGL
+		eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(eglDisplay, eglContext);
+		eglTerminate(eglDisplay);
+#endif
+	}
+
 	glfwTerminate();
 }
 
@@ -157,6 +303,12 @@ void GLRenderer::ResizeWindow(int32_t width, int32_t height)
 	this->width = width;
 	this->height = height;
 	glViewport(0, 0, width, height);
+
+	if (config.headless)
+	{
+		DestroyOffscreenFramebuffer();
+		InitOffscreenFramebuffer();
+	}
 }
 
 GLFWwindow* GLRenderer::GetWindowPtr()
@@ -171,48 +323,220 @@ void GLRenderer::SetClearColor(float r, float g, float b, float a)
 
 void GLRenderer::BeginDrawing()
 {
+	auto start = FrameProfiler::Now();
+
+	BeginGpuTimer();
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	BeginInstanceRingFrame();
+
+	frameProfiler.EndStage(ProfilerStage::BeginDrawing, start);
 }
 
 void GLRenderer::EndDrawing()
 {
+	auto start = FrameProfiler::Now();
+
+	FlushRenderQueue();
+	EndGpuTimer();
+	EndInstanceRingFrame();
+
+	if (config.headless)
+	{
+		// Nothing presents, so make sure the frame's commands actually reach the GPU.
+		glFlush();
+		frameProfiler.EndStage(ProfilerStage::EndDrawing, start);
+		framePacer.Wait();
+		frameProfiler.EndFrame();
+		return;
+	}
+
 	glfwSwapBuffers(window);
+	frameProfiler.EndStage(ProfilerStage::EndDrawing, start);
+	framePacer.Wait();
+	frameProfiler.EndFrame();
 	glfwPollEvents();
 }
 
-void GLRenderer::DrawModel(const Model* model, const TextureArray* textureArray, const Instances* instances)
+void GLRenderer::BeginGpuTimer()
 {
-	glBindTexture(GL_TEXTURE_2D, textureArray->texture);
-	glBindVertexArray(model->vao);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ebo);
+	uint32_t query = gpuTimerQueries[gpuTimerIndex];
+
+	// This slot was last used gpuTimerQueryCount frames ago, so its result is almost always ready.
+	if (isGpuTimerPending[gpuTimerIndex])
+	{
+		uint64_t elapsed;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+		frameProfiler.AddGpuTime(elapsed / 1000000.0);
+	}
+
+	glBeginQuery(GL_TIME_ELAPSED, query);
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, model->instanceOffsetVbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * instances->offsets.size(),
-		&instances->offsets[0], GL_DYNAMIC_DRAW);
+void GLRenderer::EndGpuTimer()
+{
+	glEndQuery(GL_TIME_ELAPSED);
+	isGpuTimerPending[gpuTimerIndex] = true;
+	gpuTimerIndex = (gpuTimerIndex + 1) % gpuTimerQueryCount;
+}
+
+FrameStats GLRenderer::GetFrameStats()
+{
+	return frameProfiler.GetStats();
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, model->instanceTextureIndexVbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * instances->textureIndices.size(),
-		&instances->textureIndices[0], GL_DYNAMIC_DRAW);
+void GLRenderer::DrawModel(const Model* model, const TextureArray* textureArray, const Instances* instances)
+{
+	auto start = FrameProfiler::Now();
+	size_t instanceCount = instances->offsets.size();
 
-	glBindBuffer(GL_ARRAY_BUFFER, model->instanceRotationVbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * instances->rotations.size(),
-		&instances->rotations[0], GL_DYNAMIC_DRAW);
+	if (instanceCount == 0)
+	{
+		return;
+	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, model->instanceScaleVbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * instances->scales.size(),
-		&instances->scales[0], GL_DYNAMIC_DRAW);
+	CheckInstances(instances);
 
-	glDrawElementsInstanced(GL_TRIANGLES, model->indexCount, GL_UNSIGNED_INT, 0,
-		instances->offsets.size());
+	// Cull straight into the queue so SoA instances are still only written once, then drop
+	// the space that culled instances would have used.
+	float depth = glm::distance(camera.pos, instances->offsets[0]);
+	PackedInstance* data = renderQueue.Push(RenderPass::Opaque, 0, model, textureArray, depth, instanceCount);
+	size_t visibleCount = instanceCuller.Cull(frustum, model->boundingRadius, instances, data);
+	renderQueue.TrimLast(visibleCount);
+	frameProfiler.EndStage(ProfilerStage::Draw, start);
 }
 
 void GLRenderer::DrawSprite(const Model* model, const TextureArray* textureArray, const Instances* instances)
 {
-	glUniform1i(camera.is2DLoc, true);
-	glDisable(GL_DEPTH_TEST);
-	DrawModel(model, textureArray, instances);
-	glEnable(GL_DEPTH_TEST);
-	glUniform1i(camera.is2DLoc, false);
+	auto start = FrameProfiler::Now();
+	size_t instanceCount = instances->offsets.size();
+
+	if (instanceCount == 0)
+	{
+		return;
+	}
+
+	CheckInstances(instances);
+
+	// Sprites are placed in screen space, so they aren't culled against the camera.
+	PackedInstance* data = renderQueue.Push(RenderPass::Overlay, 0, model, textureArray, 0.0f, instanceCount);
+	PackInstances(instances, data);
+	frameProfiler.EndStage(ProfilerStage::Draw, start);
+}
+
+void GLRenderer::DrawModel(const Model* model, const TextureArray* textureArray, const PackedInstances* instances)
+{
+	auto start = FrameProfiler::Now();
+	size_t instanceCount = instances->instances.size();
+
+	if (instanceCount == 0)
+	{
+		return;
+	}
+
+	// Culled like SoA instances, only the packing is skipped.
+	float depth = glm::distance(camera.pos, instances->instances[0].offset);
+	PackedInstance* data = renderQueue.Push(RenderPass::Opaque, 0, model, textureArray, depth, instanceCount);
+	size_t visibleCount = instanceCuller.Cull(frustum, model->boundingRadius, instances, data);
+	renderQueue.TrimLast(visibleCount);
+	frameProfiler.EndStage(ProfilerStage::Draw, start);
+}
+
+void GLRenderer::DrawSprite(const Model* model, const TextureArray* textureArray, const PackedInstances* instances)
+{
+	auto start = FrameProfiler::Now();
+	size_t instanceCount = instances->instances.size();
+
+	if (instanceCount == 0)
+	{
+		return;
+	}
+
+	PackedInstance* data = renderQueue.Push(RenderPass::Overlay, 0, model, textureArray, 0.0f, instanceCount);
+	memcpy(data, &instances->instances[0], sizeof(PackedInstance) * instanceCount);
+	frameProfiler.EndStage(ProfilerStage::Draw, start);
+}
+
+void GLRenderer::FlushRenderQueue()
+{
+	renderQueue.Sort();
+	size_t instanceCount = renderQueue.GetInstanceCount();
+
+	if (instanceCount == 0)
+	{
+		renderQueue.Clear();
+		return;
+	}
+
+	// Every batch's instances go into the ring with a single mapping.
+	size_t ringOffset;
+	uint8_t* data = MapInstanceRange(sizeof(PackedInstance) * instanceCount, &ringOffset);
+	renderQueue.WriteSortedInstances(reinterpret_cast<PackedInstance*>(data));
+	UnmapInstanceRange();
+	glBindBuffer(GL_ARRAY_BUFFER, instanceRing.buffer);
+
+	// There is only the one program, the pass decides Is2D and depth testing. Opaque is what
+	// every frame starts and ends with.
+	RenderPass pass = RenderPass::Opaque;
+	uint32_t boundTexture = 0;
+	uint32_t boundVao = 0;
+
+	for (const RenderBatch& batch : renderQueue.GetBatches())
+	{
+		if (batch.pass != pass)
+		{
+			bool is2D = batch.pass == RenderPass::Overlay;
+			glUniform1i(camera.is2DLoc, is2D);
+
+			if (is2D)
+			{
+				glDisable(GL_DEPTH_TEST);
+			}
+			else
+			{
+				glEnable(GL_DEPTH_TEST);
+			}
+
+			pass = batch.pass;
+		}
+
+		if (batch.textureArray.texture != boundTexture)
+		{
+			glBindTexture(GL_TEXTURE_2D_ARRAY, batch.textureArray.texture);
+			boundTexture = batch.textureArray.texture;
+		}
+
+		if (batch.model.vao != boundVao)
+		{
+			glBindVertexArray(batch.model.vao);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch.model.ebo);
+			boundVao = batch.model.vao;
+		}
+
+		// GL 3.3 has no base instance, so the instanced attributes point at the batch instead.
+		// All of them come from one interleaved binding in the ring.
+		constexpr int32_t stride = sizeof(PackedInstance);
+		size_t batchOffset = ringOffset + batch.firstInstance * sizeof(PackedInstance);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride,
+			(void*)(batchOffset + offsetof(PackedInstance, offset)));
+		glVertexAttribPointer(3, 1, GL_HALF_FLOAT, GL_FALSE, stride,
+			(void*)(batchOffset + offsetof(PackedInstance, rotation)));
+		glVertexAttribPointer(4, 1, GL_HALF_FLOAT, GL_FALSE, stride,
+			(void*)(batchOffset + offsetof(PackedInstance, scale)));
+		glVertexAttribIPointer(5, 1, GL_UNSIGNED_SHORT, stride,
+			(void*)(batchOffset + offsetof(PackedInstance, textureIndex)));
+
+		glDrawElementsInstanced(GL_TRIANGLES, batch.model.indexCount, GL_UNSIGNED_INT, 0,
+			batch.instanceCount);
+		frameProfiler.AddDraw(batch.model.indexCount, batch.instanceCount);
+	}
+
+	if (pass != RenderPass::Opaque)
+	{
+		glEnable(GL_DEPTH_TEST);
+		glUniform1i(camera.is2DLoc, false);
+	}
+
+	renderQueue.Clear();
 }
 
 Model GLRenderer::CreateModel(const std::vector<float>& vertices,
@@ -238,134 +562,260 @@ Model GLRenderer::CreateModel(const std::vector<float>& vertices,
 	glEnableVertexAttribArray(1);
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
 
-	uint32_t instanceOffsetVbo;
-	glGenBuffers(1, &instanceOffsetVbo);
-	glEnableVertexAttribArray(2);
-	glBindBuffer(GL_ARRAY_BUFFER, instanceOffsetVbo);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-	glVertexAttribDivisor(2, 1);
-
-	uint32_t instanceRotationVbo;
-	glGenBuffers(1, &instanceRotationVbo);
-	glEnableVertexAttribArray(3);
-	glBindBuffer(GL_ARRAY_BUFFER, instanceRotationVbo);
-	glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0);
-	glVertexAttribDivisor(3, 1);
-
-	uint32_t instanceScaleVbo;
-	glGenBuffers(1, &instanceScaleVbo);
-	glEnableVertexAttribArray(4);
-	glBindBuffer(GL_ARRAY_BUFFER, instanceScaleVbo);
-	glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)0);
-	glVertexAttribDivisor(4, 1);
-
-	uint32_t instanceTextureIndexVbo;
-	glGenBuffers(1, &instanceTextureIndexVbo);
-	glEnableVertexAttribArray(5);
-	glBindBuffer(GL_ARRAY_BUFFER, instanceTextureIndexVbo);
-	glVertexAttribPointer(5, 1, GL_UNSIGNED_INT, GL_FALSE, sizeof(uint32_t), (void*)0);
-	glVertexAttribDivisor(5, 1);
+	// Instance attributes are sourced from the instance ring, their pointers are set per draw.
+	for (uint32_t i = 2; i <= 5; ++i)
+	{
+		glEnableVertexAttribArray(i);
+		glVertexAttribDivisor(i, 1);
+	}
 
 	return Model{
 		vao, vbo, ebo,
-		instanceOffsetVbo,
-		instanceRotationVbo,
-		instanceScaleVbo,
-		instanceTextureIndexVbo,
 		indices.size(),
+		GetBoundingRadius(vertices),
 	};
 }
 
 void GLRenderer::UpdateModel(Model* model, const std::vector<float>& vertices, const std::vector<uint32_t>& indices)
 {
-	glGenBuffers(1, &model->vbo);
+	// The VAO's attributes and element binding refer to the existing buffers, so their
+	// storage is replaced rather than the buffers themselves.
+	glBindVertexArray(model->vao);
+
 	glBindBuffer(GL_ARRAY_BUFFER, model->vbo);
 	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
 
-	glGenBuffers(1, &model->ebo);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ebo);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), &indices[0],
 		GL_STATIC_DRAW);
+
+	model->indexCount = indices.size();
+	model->boundingRadius = GetBoundingRadius(vertices);
 }
 
 void GLRenderer::DestroyModel(Model* model)
 {
-	glDeleteBuffers(1, &model->vao);
+	glDeleteVertexArrays(1, &model->vao);
 	glDeleteBuffers(1, &model->vbo);
 	glDeleteBuffers(1, &model->ebo);
-	glDeleteBuffers(1, &model->instanceOffsetVbo);
-	glDeleteBuffers(1, &model->instanceRotationVbo);
-	glDeleteBuffers(1, &model->instanceTextureIndexVbo);
 }
 
 TextureArray GLRenderer::CreateTextureArray(const std::vector<std::string>& images)
 {
-	size_t imageCount = images.size();
+	TextureArrayLoad load = LoadTextureArrayAsync(images);
 
-	if (imageCount < 1)
+	return WaitTextureArrayLoad(&load);
+}
+
+TextureArrayLoad GLRenderer::LoadTextureArrayAsync(const std::vector<std::string>& images)
+{
+	if (images.size() < 1)
 	{
 		throw std::runtime_error("No images supplied when creating texture array!");
 	}
 
-	int32_t width;
-	int32_t height;
-	uint8_t* data;
+	uint32_t id = textureDecoder.Decode(images, 0);
+	pendingTextureArrays[id] = PendingTextureArray{ 0, static_cast<uint32_t>(images.size()), 0, 0 };
 
-	uint32_t texture;
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	return TextureArrayLoad{ id };
+}
 
-	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+bool GLRenderer::PollTextureArrayLoad(const TextureArrayLoad* load, TextureArray* outTextureArray)
+{
+	return UploadTextureLayers(load->id, false, outTextureArray);
+}
+
+TextureArray GLRenderer::WaitTextureArrayLoad(const TextureArrayLoad* load)
+{
+	TextureArray textureArray;
+
+	while (!UploadTextureLayers(load->id, true, &textureArray));
+
+	return textureArray;
+}
+
+bool GLRenderer::UploadTextureLayers(uint32_t loadId, bool wait, TextureArray* outTextureArray)
+{
+	auto it = pendingTextureArrays.find(loadId);
+
+	if (it == pendingTextureArrays.end())
+	{
+		throw std::runtime_error("Tried to poll an unknown texture array load!");
+	}
+
+	PendingTextureArray& pending = it->second;
+	std::vector<DecodedImage> images;
+	bool isDecoded;
 
-	for (int32_t i = 0; i < images.size(); ++i)
+	try
 	{
-		int32_t iWidth;
-		int32_t iHeight;
-		int32_t iChannelCount;
-		data = stbi_load(images[i].c_str(), &iWidth, &iHeight, &iChannelCount, 0);
+		isDecoded = textureDecoder.Collect(loadId, images, wait);
 
-		if (!data)
+		for (DecodedImage& image : images)
 		{
-			throw std::runtime_error(std::string("Failed to load: ") + images[0]);
+			if (image.channelCount != 3)
+			{
+				throw std::runtime_error("Failed to load non RGB image, wrong channel count!");
+			}
+
+			if (pending.texture == 0)
+			{
+				pending.width = image.width;
+				pending.height = image.height;
+				pending.texture = GenTextureArray();
+
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB, pending.width, pending.height, pending.layerCount, 0,
+					GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+			}
+			else if (image.width != pending.width || image.height != pending.height)
+			{
+				throw std::runtime_error("Can't create array of different sized textures!");
+			}
+
+			glBindTexture(GL_TEXTURE_2D_ARRAY, pending.texture);
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, image.layer, pending.width, pending.height, 1, GL_RGB,
+				GL_UNSIGNED_BYTE, image.pixels);
+
+			TextureDecoder::FreeImage(image);
 		}
-
-		if (iChannelCount != 3)
+	}
+	catch (...)
+	{
+		for (DecodedImage& image : images)
 		{
-			throw std::runtime_error("Failed to load non RGB image, wrong channel count!");
+			TextureDecoder::FreeImage(image);
 		}
 
-		if (i == 0)
-		{
-			width = iWidth;
-			height = iHeight;
+		textureDecoder.Cancel(loadId);
 
-			glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB, width, height, images.size(), 0,
-				GL_RGB, GL_UNSIGNED_BYTE, nullptr);
-		}
-		else if (iWidth != width || iHeight != height)
+		if (pending.texture != 0)
 		{
-			throw std::runtime_error("Can't create array of different sized textures!");
+			glDeleteTextures(1, &pending.texture);
 		}
 
-		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width, height, 1, GL_RGB,
-			GL_UNSIGNED_BYTE, data);
+		pendingTextureArrays.erase(it);
+		throw;
+	}
 
-		stbi_image_free(data);
+	if (!isDecoded)
+	{
+		return false;
 	}
 
+	glBindTexture(GL_TEXTURE_2D_ARRAY, pending.texture);
 	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
 
+	*outTextureArray = TextureArray{ pending.texture };
+	pendingTextureArrays.erase(it);
+
+	return true;
+}
+
+TextureArray GLRenderer::CreateTextureArrayFromPack(const std::string& packFile)
+{
+	TexturePack pack(packFile);
+	const TexturePackHeader& header = pack.GetHeader();
+
+	if (header.format == TexturePackFormat::BC1 && !GLAD_GL_EXT_texture_compression_s3tc)
+	{
+		throw std::runtime_error(std::string("Texture pack is BC1 compressed but S3TC isn't supported: ") + packFile);
+	}
+
+	uint32_t texture = GenTextureArray();
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, header.mipCount - 1);
+
+	// The pack is read straight from the mapping, there is nothing to decode.
+	for (uint32_t i = 0; i < header.mipCount; ++i)
+	{
+		const TexturePackLevel& level = pack.GetLevel(i);
+
+		if (header.format == TexturePackFormat::BC1)
+		{
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, i, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, level.width, level.height,
+				header.layerCount, 0, static_cast<GLsizei>(level.size), pack.GetLevelData(i));
+		}
+		else
+		{
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, i, GL_RGBA8, level.width, level.height, header.layerCount, 0,
+				GL_RGBA, GL_UNSIGNED_BYTE, pack.GetLevelData(i));
+		}
+	}
+
+	return TextureArray{ texture };
+}
+
+TextureArray GLRenderer::CreateDynamicTextureArray(int32_t width, int32_t height, uint32_t layerCount)
+{
+	uint32_t texture = GenTextureArray();
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+	std::vector<uint32_t> black(static_cast<size_t>(width) * height * layerCount, 0xFF000000);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, layerCount, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+		black.data());
+
+	dynamicTextureSizes[texture] = glm::ivec2(width, height);
+
 	return TextureArray{ texture };
 }
 
+void GLRenderer::UpdateTextureArrayLayer(const TextureArray* textureArray, uint32_t layer, const uint8_t* pixels)
+{
+	auto it = dynamicTextureSizes.find(textureArray->texture);
+
+	if (it == dynamicTextureSizes.end())
+	{
+		throw std::runtime_error("Only dynamic texture arrays can be updated!");
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray->texture);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, it->second.x, it->second.y, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+		pixels);
+}
+
+uint32_t GLRenderer::GenTextureArray()
+{
+	uint32_t texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	return texture;
+}
+
 void GLRenderer::DestroyTextureArray(TextureArray* textureArray)
 {
+	dynamicTextureSizes.erase(textureArray->texture);
 	glDeleteTextures(1, &textureArray->texture);
 }
 
+void GLRenderer::CaptureFrame(std::vector<uint8_t>& outPixels)
+{
+	if (!config.headless)
+	{
+		throw std::runtime_error("Frames can only be captured in headless mode!");
+	}
+
+	size_t rowSize = static_cast<size_t>(width) * 4;
+	std::vector<uint8_t> pixels(rowSize * height);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, offscreenFramebuffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+	// GL reads bottom row first.
+	outPixels.resize(pixels.size());
+
+	for (int32_t y = 0; y < height; ++y)
+	{
+		memcpy(&outPixels[rowSize * y], &pixels[rowSize * (height - 1 - y)], rowSize);
+	}
+}
+
 void GLRenderer::UpdateCamera()
 {
 	glm::mat4 view = glm::lookAt(camera.pos, camera.pos + camera.dir, camera.up);
@@ -376,6 +826,8 @@ void GLRenderer::UpdateCamera()
 	glUniformMatrix4fv(camera.orthoProjLoc, 1, GL_FALSE, glm::value_ptr(orthoProj));
 	glUniformMatrix4fv(camera.projLoc, 1, GL_FALSE, glm::value_ptr(proj));
 	glUniformMatrix4fv(camera.viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+
+	frustum = CreateFrustum(camera, static_cast<float>(width) / static_cast<float>(height));
 }
 
 void GLRenderer::SetCameraPosition(glm::vec3 position)
@@ -424,3 +876,128 @@ void GLRenderer::CheckShaderLinkError(uint32_t program)
 		throw std::runtime_error(infoLog);
 	}
 }
+
+void GLRenderer::InitInstanceRing()
+{
+	instanceRing = {};
+	glGenBuffers(1, &instanceRing.buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceRing.buffer);
+
+	// Persistent mapping needs GL 4.4 (or ARB_buffer_storage), otherwise orphan the buffer each frame.
+	instanceRing.isPersistent = GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+
+	if (instanceRing.isPersistent)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		size_t ringSize = instanceRingRegionSize * instanceRingRegionCount;
+		glBufferStorage(GL_ARRAY_BUFFER, ringSize, nullptr, flags);
+		instanceRing.mappedPtr = static_cast<uint8_t*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, ringSize, flags));
+
+		if (!instanceRing.mappedPtr)
+		{
+			throw std::runtime_error("Failed to map the instance ring buffer!");
+		}
+	}
+	else
+	{
+		glBufferData(GL_ARRAY_BUFFER, instanceRingRegionSize, nullptr, GL_STREAM_DRAW);
+	}
+}
+
+void GLRenderer::DestroyInstanceRing()
+{
+	for (GLsync fence : instanceRing.fences)
+	{
+		if (fence)
+		{
+			glDeleteSync(fence);
+		}
+	}
+
+	if (instanceRing.isPersistent)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, instanceRing.buffer);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
+
+	glDeleteBuffers(1, &instanceRing.buffer);
+}
+
+void GLRenderer::BeginInstanceRingFrame()
+{
+	instanceRing.cursor = 0;
+
+	if (!instanceRing.isPersistent)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, instanceRing.buffer);
+		glBufferData(GL_ARRAY_BUFFER, instanceRingRegionSize, nullptr, GL_STREAM_DRAW);
+		return;
+	}
+
+	// Wait for the GPU to finish the frame that last used this region.
+	GLsync& fence = instanceRing.fences[instanceRing.region];
+
+	if (!fence)
+	{
+		return;
+	}
+
+	GLenum result;
+
+	do
+	{
+		result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000'000);
+	} while (result == GL_TIMEOUT_EXPIRED);
+
+	if (result == GL_WAIT_FAILED)
+	{
+		throw std::runtime_error("Failed to wait on instance ring fence!");
+	}
+
+	glDeleteSync(fence);
+	fence = nullptr;
+}
+
+void GLRenderer::EndInstanceRingFrame()
+{
+	if (!instanceRing.isPersistent)
+	{
+		return;
+	}
+
+	instanceRing.fences[instanceRing.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	instanceRing.region = (instanceRing.region + 1) % instanceRingRegionCount;
+}
+
+uint8_t* GLRenderer::MapInstanceRange(size_t size, size_t* outOffset)
+{
+	size_t start = (instanceRing.cursor + instanceRingAlignment - 1) & ~(instanceRingAlignment - 1);
+
+	if (start + size > instanceRingRegionSize)
+	{
+		throw std::runtime_error("Instance ring buffer overflowed, too many instances in one frame!");
+	}
+
+	instanceRing.cursor = start + size;
+
+	if (instanceRing.isPersistent)
+	{
+		*outOffset = instanceRing.region * instanceRingRegionSize + start;
+		return instanceRing.mappedPtr + *outOffset;
+	}
+
+	// The buffer was orphaned at the start of the frame, so nothing in flight can alias this range.
+	*outOffset = start;
+	glBindBuffer(GL_ARRAY_BUFFER, instanceRing.buffer);
+
+	return static_cast<uint8_t*>(glMapBufferRange(GL_ARRAY_BUFFER, start, size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+}
+
+void GLRenderer::UnmapInstanceRange()
+{
+	if (!instanceRing.isPersistent)
+	{
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
+}
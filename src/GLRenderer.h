@@ -1,13 +1,48 @@
 #pragma once
 
 #include "Renderer.h"
+#include "FramePacer.h"
+#include "FrameProfiler.h"
+#include "InstanceCuller.h"
+#include "RenderQueue.h"
+#include "TextureDecoder.h"
 
+#include <unordered_map>
 #include <glad/glad.h>
 
+constexpr uint32_t instanceRingRegionCount = 3;
+constexpr size_t instanceRingRegionSize = 4 * 1024 * 1024;
+constexpr size_t instanceRingAlignment = 16;
+// Timer queries are read back when their slot comes around again, so results are this many frames late.
+constexpr uint32_t gpuTimerQueryCount = 4;
+
+// Per-frame instance data is streamed through one buffer split into regions,
+// each region is only rewritten once the GPU has finished the frame that used it.
+struct InstanceRing
+{
+	uint32_t buffer;
+	uint8_t* mappedPtr;
+	bool isPersistent;
+	GLsync fences[instanceRingRegionCount];
+	uint32_t region;
+	size_t cursor;
+};
+
+// A texture array whose layers are uploaded as they finish decoding.
+struct PendingTextureArray
+{
+	// Zero until the first layer arrives and gives the array its size.
+	uint32_t texture;
+	uint32_t layerCount;
+	int32_t width;
+	int32_t height;
+};
+
 class GLRenderer : public Renderer
 {
 public:
-	GLRenderer(const std::string& windowName, int32_t windowWidth, int32_t windowHeight);
+	GLRenderer(const std::string& windowName, int32_t windowWidth, int32_t windowHeight,
+		const RendererConfig& config = RendererConfig{});
 
 	void CloseWindow() override;
 	void ResizeWindow(int32_t width, int32_t height) override;
@@ -19,14 +54,25 @@ public:
 
 	void DrawModel(const Model* model, const TextureArray* textureArray, const Instances* instances) override;
 	void DrawSprite(const Model* model, const TextureArray* textureArray, const Instances* instances) override;
+	void DrawModel(const Model* model, const TextureArray* textureArray, const PackedInstances* instances) override;
+	void DrawSprite(const Model* model, const TextureArray* textureArray, const PackedInstances* instances) override;
 
 	Model CreateModel(const std::vector<float>& vertices, const std::vector<uint32_t>& indices) override;
 	void UpdateModel(Model* model, const std::vector<float>& vertices, const std::vector<uint32_t>& indices) override;
 	void DestroyModel(Model* model) override;
 
 	TextureArray CreateTextureArray(const std::vector<std::string>& images) override;
+	TextureArrayLoad LoadTextureArrayAsync(const std::vector<std::string>& images) override;
+	bool PollTextureArrayLoad(const TextureArrayLoad* load, TextureArray* outTextureArray) override;
+	TextureArray WaitTextureArrayLoad(const TextureArrayLoad* load) override;
+	TextureArray CreateTextureArrayFromPack(const std::string& packFile) override;
+	TextureArray CreateDynamicTextureArray(int32_t width, int32_t height, uint32_t layerCount) override;
+	void UpdateTextureArrayLayer(const TextureArray* textureArray, uint32_t layer, const uint8_t* pixels) override;
 	void DestroyTextureArray(TextureArray* textureArray) override;
 
+	void CaptureFrame(std::vector<uint8_t>& outPixels) override;
+	FrameStats GetFrameStats() override;
+
 	void UpdateCamera() override;
 	void SetCameraPosition(glm::vec3 position) override;
 	void SetCameraRotation(float yRot, float xRot) override;
@@ -35,7 +81,33 @@ public:
 private:
 	void CheckShaderLinkError(uint32_t program);
 	void CheckShaderCompileError(uint32_t shader);
+	// Sorts the frame's draws and issues them, changing state only between batches.
+	void FlushRenderQueue();
+
+	void InitInstanceRing();
+	void DestroyInstanceRing();
+	void BeginInstanceRingFrame();
+	void EndInstanceRingFrame();
+	uint8_t* MapInstanceRange(size_t size, size_t* outOffset);
+	void UnmapInstanceRange();
+
+	bool UploadTextureLayers(uint32_t loadId, bool wait, TextureArray* outTextureArray);
+	uint32_t GenTextureArray();
 
+	void BeginGpuTimer();
+	void EndGpuTimer();
+
+	void InitWindowContext(const std::string& windowName);
+	void InitHeadlessContext();
+	void InitOffscreenFramebuffer();
+	void DestroyOffscreenFramebuffer();
+
+	RendererConfig config;
+	FramePacer framePacer;
+	FrameProfiler frameProfiler;
+	uint32_t gpuTimerQueries[gpuTimerQueryCount];
+	bool isGpuTimerPending[gpuTimerQueryCount];
+	uint32_t gpuTimerIndex;
 	GLFWwindow* window;
 	int32_t width;
 	int32_t height;
@@ -43,4 +115,22 @@ private:
 	uint32_t fragmentShader;
 	uint32_t shaderProgram;
 	Camera camera;
+	Frustum frustum;
+	InstanceRing instanceRing;
+	RenderQueue renderQueue;
+
+	// Headless mode renders into this framebuffer instead of a window.
+	uint32_t offscreenFramebuffer;
+	uint32_t offscreenColor;
+	uint32_t offscreenDepth;
+	// EGLDisplay and EGLContext, kept opaque so EGL's headers stay out of this one.
+	void* eglDisplay;
+	void* eglContext;
+	TextureDecoder textureDecoder;
+	std::unordered_map<uint32_t, PendingTextureArray> pendingTextureArrays;
+	// Sizes of dynamic texture arrays, keyed by texture.
+	std::unordered_map<uint32_t, glm::ivec2> dynamicTextureSizes;
+
+	WorkerPool workerPool;
+	InstanceCuller instanceCuller;
 };
@@ -0,0 +1,248 @@
+#include "InstanceCuller.h"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/packing.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GFPS_CULL_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	glm::vec4 MakePlane(glm::vec3 normal, glm::vec3 point)
+	{
+		normal = glm::normalize(normal);
+
+		return glm::vec4(normal, -glm::dot(normal, point));
+	}
+
+	bool IsSphereVisible(const Frustum& frustum, glm::vec3 center, float radius)
+	{
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Writes the indices of visible instances in [begin, end) to outIndices, returns how many.
+	uint32_t CullRange(const Frustum& frustum, float boundingRadius, const Instances* instances,
+		uint32_t begin, uint32_t end, uint32_t* outIndices)
+	{
+		const glm::vec3* offsets = instances->offsets.data();
+		const float* scales = instances->scales.data();
+		uint32_t visibleCount = 0;
+		uint32_t i = begin;
+
+#ifdef GFPS_CULL_SSE2
+		__m128 planeX[6];
+		__m128 planeY[6];
+		__m128 planeZ[6];
+		__m128 planeW[6];
+
+		for (uint32_t p = 0; p < 6; ++p)
+		{
+			planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+			planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+			planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+			planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+		}
+
+		__m128 radius = _mm_set1_ps(boundingRadius);
+		__m128 signBit = _mm_set1_ps(-0.0f);
+
+		for (; i + 4 <= end; i += 4)
+		{
+			// Offsets are tightly packed vec3s, transpose 4 of them into x, y and z lanes.
+			const float* data = &offsets[i].x;
+			__m128 a = _mm_loadu_ps(data);
+			__m128 b = _mm_loadu_ps(data + 4);
+			__m128 c = _mm_loadu_ps(data + 8);
+			__m128 x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+			__m128 y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+				_mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+				_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+
+			// -(radius * |scale|), a sphere is outside a plane when its distance is below this.
+			__m128 minDistance = _mm_or_ps(_mm_mul_ps(radius, _mm_andnot_ps(signBit, _mm_loadu_ps(&scales[i]))), signBit);
+			__m128 isVisible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+			for (uint32_t p = 0; p < 6; ++p)
+			{
+				__m128 distance = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+					_mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+				isVisible = _mm_and_ps(isVisible, _mm_cmpge_ps(distance, minDistance));
+			}
+
+			int32_t mask = _mm_movemask_ps(isVisible);
+
+			while (mask != 0)
+			{
+				uint32_t lane = 0;
+
+				while (!(mask & (1 << lane)))
+				{
+					++lane;
+				}
+
+				outIndices[visibleCount++] = i + lane;
+				mask &= mask - 1;
+			}
+		}
+#endif
+
+		for (; i < end; ++i)
+		{
+			if (IsSphereVisible(frustum, offsets[i], boundingRadius * std::abs(scales[i])))
+			{
+				outIndices[visibleCount++] = i;
+			}
+		}
+
+		return visibleCount;
+	}
+
+	uint32_t CullPackedRange(const Frustum& frustum, float boundingRadius, const PackedInstance* instances,
+		uint32_t begin, uint32_t end, uint32_t* outIndices)
+	{
+		uint32_t visibleCount = 0;
+
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			float scale = glm::unpackHalf1x16(instances[i].scale);
+
+			if (IsSphereVisible(frustum, instances[i].offset, boundingRadius * std::abs(scale)))
+			{
+				outIndices[visibleCount++] = i;
+			}
+		}
+
+		return visibleCount;
+	}
+}
+
+Frustum CreateFrustum(const Camera& camera, float aspectRatio)
+{
+	glm::vec3 forward = glm::normalize(camera.dir);
+	glm::vec3 right = glm::normalize(glm::cross(forward, camera.up));
+	glm::vec3 up = glm::cross(right, forward);
+
+	float tanHalfFovY = std::tan(glm::radians(camera.fov) * 0.5f);
+	float tanHalfFovX = tanHalfFovY * aspectRatio;
+
+	// Each side plane passes through the camera, tilted in from the view direction.
+	Frustum frustum;
+	frustum.planes[0] = MakePlane(right + forward * tanHalfFovX, camera.pos);
+	frustum.planes[1] = MakePlane(-right + forward * tanHalfFovX, camera.pos);
+	frustum.planes[2] = MakePlane(up + forward * tanHalfFovY, camera.pos);
+	frustum.planes[3] = MakePlane(-up + forward * tanHalfFovY, camera.pos);
+	frustum.planes[4] = MakePlane(forward, camera.pos + forward * camera.zNear);
+	frustum.planes[5] = MakePlane(-forward, camera.pos + forward * camera.zFar);
+
+	return frustum;
+}
+
+InstanceCuller::InstanceCuller(WorkerPool& workerPool)
+	: workerPool(workerPool)
+{
+}
+
+size_t InstanceCuller::Cull(const Frustum& frustum, float boundingRadius, const Instances* instances,
+	PackedInstance* outInstances)
+{
+	return RunJobs(static_cast<uint32_t>(instances->offsets.size()),
+		[&](uint32_t begin, uint32_t end, uint32_t* outIndices)
+		{
+			return CullRange(frustum, boundingRadius, instances, begin, end, outIndices);
+		},
+		[&](uint32_t index, PackedInstance* outInstance)
+		{
+			PackInstance(instances, index, outInstance);
+		},
+		outInstances);
+}
+
+size_t InstanceCuller::Cull(const Frustum& frustum, float boundingRadius, const PackedInstances* instances,
+	PackedInstance* outInstances)
+{
+	const PackedInstance* packedInstances = instances->instances.data();
+
+	return RunJobs(static_cast<uint32_t>(instances->instances.size()),
+		[&](uint32_t begin, uint32_t end, uint32_t* outIndices)
+		{
+			return CullPackedRange(frustum, boundingRadius, packedInstances, begin, end, outIndices);
+		},
+		[&](uint32_t index, PackedInstance* outInstance)
+		{
+			*outInstance = packedInstances[index];
+		},
+		outInstances);
+}
+
+size_t InstanceCuller::RunJobs(uint32_t instanceCount,
+	const std::function<uint32_t(uint32_t, uint32_t, uint32_t*)>& cullRange,
+	const std::function<void(uint32_t, PackedInstance*)>& pack, PackedInstance* outInstances)
+{
+	uint32_t jobCount = (instanceCount + instanceCullJobSize - 1) / instanceCullJobSize;
+
+	if (jobCount == 0)
+	{
+		return 0;
+	}
+
+	visibleIndices.resize(instanceCount);
+	jobVisibleCounts.resize(jobCount);
+	jobFirstOutputs.resize(jobCount);
+
+	auto cullJob = [&](uint32_t jobIndex)
+	{
+		uint32_t begin = jobIndex * instanceCullJobSize;
+		uint32_t end = std::min(begin + instanceCullJobSize, instanceCount);
+		jobVisibleCounts[jobIndex] = cullRange(begin, end, &visibleIndices[begin]);
+	};
+
+	// Visibility is found first so every job knows where its survivors go, then they are
+	// packed straight into the output, which is often mapped GPU memory.
+	auto packJob = [&](uint32_t jobIndex)
+	{
+		const uint32_t* indices = &visibleIndices[jobIndex * instanceCullJobSize];
+		PackedInstance* packed = outInstances + jobFirstOutputs[jobIndex];
+
+		for (uint32_t i = 0; i < jobVisibleCounts[jobIndex]; ++i)
+		{
+			pack(indices[i], &packed[i]);
+		}
+	};
+
+	// Waking the workers costs more than culling a single job.
+	if (jobCount == 1)
+	{
+		cullJob(0);
+		jobFirstOutputs[0] = 0;
+		packJob(0);
+
+		return jobVisibleCounts[0];
+	}
+
+	workerPool.Run(jobCount, cullJob);
+
+	size_t visibleCount = 0;
+
+	for (uint32_t i = 0; i < jobCount; ++i)
+	{
+		jobFirstOutputs[i] = visibleCount;
+		visibleCount += jobVisibleCounts[i];
+	}
+
+	workerPool.Run(jobCount, packJob);
+
+	return visibleCount;
+}
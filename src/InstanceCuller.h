@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Renderer.h"
+#include "WorkerPool.h"
+
+// Draws with more instances than this are culled on worker threads, one job per this many.
+constexpr uint32_t instanceCullJobSize = 4096;
+
+// Planes face inwards, a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all
+// of them. The order is left, right, bottom, top, near, far.
+struct Frustum
+{
+	glm::vec4 planes[6];
+};
+
+// The frustum the renderers' perspective projection sees from the camera.
+Frustum CreateFrustum(const Camera& camera, float aspectRatio);
+
+// Rejects instances whose bounding spheres are entirely outside the frustum before they are
+// uploaded. Spheres are tested 4 at a time with SSE2, straight from the SoA offsets and
+// scales, and the survivors are packed in their original order. Already packed instances
+// are tested one at a time and copied.
+class InstanceCuller
+{
+public:
+	explicit InstanceCuller(WorkerPool& workerPool);
+
+	// outInstances needs room for every instance, returns how many were visible and written.
+	// boundingRadius is the model's, it is scaled per instance.
+	size_t Cull(const Frustum& frustum, float boundingRadius, const Instances* instances,
+		PackedInstance* outInstances);
+	size_t Cull(const Frustum& frustum, float boundingRadius, const PackedInstances* instances,
+		PackedInstance* outInstances);
+
+private:
+	// Finds the visible instances of each job with cullRange, which writes the visible indices
+	// in [begin, end) and returns how many, then writes them out in order with pack.
+	size_t RunJobs(uint32_t instanceCount, const std::function<uint32_t(uint32_t, uint32_t, uint32_t*)>& cullRange,
+		const std::function<void(uint32_t, PackedInstance*)>& pack, PackedInstance* outInstances);
+
+	WorkerPool& workerPool;
+	// Visible indices of each job start at the job's first instance.
+	std::vector<uint32_t> visibleIndices;
+	std::vector<uint32_t> jobVisibleCounts;
+	std::vector<size_t> jobFirstOutputs;
+};
@@ -0,0 +1,117 @@
+#include "Level.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+Level LoadLevel(const std::string& file)
+{
+	std::ifstream stream(file);
+
+	if (!stream)
+	{
+		throw std::runtime_error("Failed to open level: " + file);
+	}
+
+	Level level = { 0, 0 };
+	// Tiles by the char that stands for them in the map.
+	LevelTile legend[256];
+	bool isInLegend[256] = {};
+	std::string line;
+
+	while (std::getline(stream, line))
+	{
+		if (line.empty() || line.compare(0, 2, "//") == 0)
+		{
+			continue;
+		}
+
+		std::istringstream lineStream(line);
+		std::string command;
+		lineStream >> command;
+
+		if (command == "size")
+		{
+			lineStream >> level.width >> level.depth;
+
+			if (!lineStream || level.width < 1 || level.depth < 1)
+			{
+				throw std::runtime_error("Level has an invalid size: " + file);
+			}
+		}
+		else if (command == "wall" || command == "floor")
+		{
+			char symbol;
+			LevelTile tile = {};
+			lineStream >> symbol;
+
+			if (command == "wall")
+			{
+				tile.type = LevelTileType::Wall;
+				lineStream >> tile.wallTexture;
+			}
+			else
+			{
+				tile.type = LevelTileType::Empty;
+				lineStream >> tile.floorTexture >> tile.ceilingTexture;
+			}
+
+			if (!lineStream)
+			{
+				throw std::runtime_error("Level has an invalid tile definition: " + line);
+			}
+
+			uint8_t index = static_cast<uint8_t>(symbol);
+			legend[index] = tile;
+			isInLegend[index] = true;
+		}
+		else if (command == "map")
+		{
+			break;
+		}
+		else
+		{
+			throw std::runtime_error("Level has an unknown command: " + command);
+		}
+	}
+
+	if (level.width < 1)
+	{
+		throw std::runtime_error("Level is missing its size: " + file);
+	}
+
+	level.tiles.reserve(static_cast<size_t>(level.width) * level.depth);
+
+	for (int32_t z = 0; z < level.depth; ++z)
+	{
+		if (!std::getline(stream, line))
+		{
+			throw std::runtime_error("Level has fewer map rows than its depth: " + file);
+		}
+
+		// Tolerate files saved with CRLF line endings.
+		if (!line.empty() && line.back() == '\r')
+		{
+			line.pop_back();
+		}
+
+		if (static_cast<int32_t>(line.size()) != level.width)
+		{
+			throw std::runtime_error("Level has a map row that doesn't match its width: " + line);
+		}
+
+		for (char symbol : line)
+		{
+			uint8_t index = static_cast<uint8_t>(symbol);
+
+			if (!isInLegend[index])
+			{
+				throw std::runtime_error(std::string("Level uses an undefined tile: ") + symbol);
+			}
+
+			level.tiles.push_back(legend[index]);
+		}
+	}
+
+	return level;
+}
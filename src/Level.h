@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cinttypes>
+#include <string>
+#include <vector>
+
+enum class LevelTileType : uint8_t
+{
+	Empty,
+	Wall,
+};
+
+struct LevelTile
+{
+	LevelTileType type;
+	// Texture layer used for every side of a wall.
+	uint16_t wallTexture;
+	// Texture layers under and above an empty tile.
+	uint16_t floorTexture;
+	uint16_t ceilingTexture;
+};
+
+// A grid of tiles on the xz plane, tile (x, z) covers [x, x + 1) and [z, z + 1). Walls,
+// floors and ceilings span y from 0 to 1.
+struct Level
+{
+	int32_t width;
+	int32_t depth;
+	// Row major, tiles[z * width + x].
+	std::vector<LevelTile> tiles;
+};
+
+// Levels are text files made of a header and a map:
+//
+//   size <width> <depth>
+//   wall <char> <wallTexture>
+//   floor <char> <floorTexture> <ceilingTexture>
+//   map
+//   <depth rows of width chars, the first row is z = 0>
+//
+// Every char used in the map needs a wall or floor line. Blank lines and lines starting
+// with "//" are ignored in the header, map rows are read as is. Throws if the file can't
+// be used.
+Level LoadLevel(const std::string& file);
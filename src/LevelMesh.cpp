@@ -0,0 +1,475 @@
+#include "LevelMesh.h"
+#include "LevelVisibility.h"
+#include "OcclusionBuffer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+	bool IsOpen(const Level& level, int32_t x, int32_t z)
+	{
+		if (x < 0 || z < 0 || x >= level.width || z >= level.depth)
+		{
+			return false;
+		}
+
+		return level.tiles[z * level.width + x].type == LevelTileType::Empty;
+	}
+
+	LevelChunkMeshData& GetMeshData(std::vector<LevelChunkMeshData>& meshes, uint16_t textureIndex)
+	{
+		for (LevelChunkMeshData& mesh : meshes)
+		{
+			if (mesh.textureIndex == textureIndex)
+			{
+				return mesh;
+			}
+		}
+
+		meshes.push_back(LevelChunkMeshData{ textureIndex });
+
+		return meshes.back();
+	}
+
+	// Adds a quad whose front faces the viewer when right and up point right and up on
+	// screen. Texture coordinates span width by height so the texture repeats per tile.
+	void AddQuad(LevelChunkMeshData& mesh, glm::vec3 bottomLeft, glm::vec3 right, glm::vec3 up,
+		float width, float height)
+	{
+		uint32_t firstVertex = static_cast<uint32_t>(mesh.vertices.size() / 5);
+		glm::vec3 corners[4] = {
+			bottomLeft,
+			bottomLeft + right * width,
+			bottomLeft + right * width + up * height,
+			bottomLeft + up * height,
+		};
+		glm::vec2 texCoords[4] = {
+			glm::vec2(0.0f, 0.0f),
+			glm::vec2(width, 0.0f),
+			glm::vec2(width, height),
+			glm::vec2(0.0f, height),
+		};
+
+		for (uint32_t i = 0; i < 4; ++i)
+		{
+			mesh.vertices.insert(mesh.vertices.end(), {
+				corners[i].x, corners[i].y, corners[i].z, texCoords[i].x, texCoords[i].y,
+			});
+		}
+
+		mesh.indices.insert(mesh.indices.end(), {
+			firstVertex, firstVertex + 1, firstVertex + 2,
+			firstVertex, firstVertex + 2, firstVertex + 3,
+		});
+	}
+
+	// Merges open tiles with the same floor (or ceiling) layer into rectangles, growing
+	// each one along x first and then along z while whole rows still match.
+	void MeshFlats(const Level& level, int32_t startX, int32_t startZ, int32_t sizeX, int32_t sizeZ,
+		bool isCeiling, std::vector<LevelChunkMeshData>& outMeshes)
+	{
+		bool isMeshed[levelChunkSize * levelChunkSize] = {};
+
+		auto getLayer = [&](int32_t localX, int32_t localZ) -> int32_t
+		{
+			int32_t x = startX + localX;
+			int32_t z = startZ + localZ;
+
+			if (isMeshed[localZ * levelChunkSize + localX] || !IsOpen(level, x, z))
+			{
+				return -1;
+			}
+
+			const LevelTile& tile = level.tiles[z * level.width + x];
+
+			return isCeiling ? tile.ceilingTexture : tile.floorTexture;
+		};
+
+		for (int32_t localZ = 0; localZ < sizeZ; ++localZ)
+		{
+			for (int32_t localX = 0; localX < sizeX; ++localX)
+			{
+				int32_t layer = getLayer(localX, localZ);
+
+				if (layer < 0)
+				{
+					continue;
+				}
+
+				int32_t runX = 1;
+
+				while (localX + runX < sizeX && getLayer(localX + runX, localZ) == layer)
+				{
+					++runX;
+				}
+
+				int32_t runZ = 1;
+
+				while (localZ + runZ < sizeZ)
+				{
+					bool isRowMatching = true;
+
+					for (int32_t i = 0; i < runX && isRowMatching; ++i)
+					{
+						isRowMatching = getLayer(localX + i, localZ + runZ) == layer;
+					}
+
+					if (!isRowMatching)
+					{
+						break;
+					}
+
+					++runZ;
+				}
+
+				for (int32_t z = 0; z < runZ; ++z)
+				{
+					for (int32_t x = 0; x < runX; ++x)
+					{
+						isMeshed[(localZ + z) * levelChunkSize + localX + x] = true;
+					}
+				}
+
+				float x0 = static_cast<float>(startX + localX);
+				float z0 = static_cast<float>(startZ + localZ);
+				LevelChunkMeshData& mesh = GetMeshData(outMeshes, static_cast<uint16_t>(layer));
+
+				// Floors are seen from above with -z up the screen, ceilings from below with +z up.
+				if (isCeiling)
+				{
+					AddQuad(mesh, glm::vec3(x0, 1.0f, z0), glm::vec3(1.0f, 0.0f, 0.0f),
+						glm::vec3(0.0f, 0.0f, 1.0f), static_cast<float>(runX), static_cast<float>(runZ));
+				}
+				else
+				{
+					AddQuad(mesh, glm::vec3(x0, 0.0f, z0 + runZ), glm::vec3(1.0f, 0.0f, 0.0f),
+						glm::vec3(0.0f, 0.0f, -1.0f), static_cast<float>(runX), static_cast<float>(runZ));
+				}
+			}
+		}
+	}
+
+	// Walls are one tile high, so coplanar sides only merge along a row. Each side faces
+	// the open neighbour (normalX, normalZ) and is meshed with the wall tile's chunk.
+	void MeshWalls(const Level& level, int32_t startX, int32_t startZ, int32_t sizeX, int32_t sizeZ,
+		int32_t normalX, int32_t normalZ, std::vector<LevelChunkMeshData>& outMeshes)
+	{
+		// Sides facing along z run along x, and the other way around.
+		bool isRowAlongX = normalZ != 0;
+		int32_t lineCount = isRowAlongX ? sizeZ : sizeX;
+		int32_t lineLength = isRowAlongX ? sizeX : sizeZ;
+
+		auto getLayer = [&](int32_t line, int32_t i) -> int32_t
+		{
+			int32_t x = startX + (isRowAlongX ? i : line);
+			int32_t z = startZ + (isRowAlongX ? line : i);
+			const LevelTile& tile = level.tiles[z * level.width + x];
+
+			if (tile.type != LevelTileType::Wall || !IsOpen(level, x + normalX, z + normalZ))
+			{
+				return -1;
+			}
+
+			return tile.wallTexture;
+		};
+
+		for (int32_t line = 0; line < lineCount; ++line)
+		{
+			for (int32_t i = 0; i < lineLength;)
+			{
+				int32_t layer = getLayer(line, i);
+
+				if (layer < 0)
+				{
+					++i;
+					continue;
+				}
+
+				int32_t runLength = 1;
+
+				while (i + runLength < lineLength && getLayer(line, i + runLength) == layer)
+				{
+					++runLength;
+				}
+
+				// The run covers [start, end) along its row, the side sits on the open
+				// neighbour's edge of the wall tiles.
+				float start = static_cast<float>((isRowAlongX ? startX : startZ) + i);
+				float end = start + runLength;
+				float plane = static_cast<float>((isRowAlongX ? startZ : startX) + line);
+
+				if (normalX + normalZ > 0)
+				{
+					plane += 1.0f;
+				}
+
+				glm::vec3 bottomLeft;
+				glm::vec3 right;
+
+				// Right on screen is the normal turned a quarter clockwise seen from above.
+				if (normalZ > 0)
+				{
+					bottomLeft = glm::vec3(start, 0.0f, plane);
+					right = glm::vec3(1.0f, 0.0f, 0.0f);
+				}
+				else if (normalZ < 0)
+				{
+					bottomLeft = glm::vec3(end, 0.0f, plane);
+					right = glm::vec3(-1.0f, 0.0f, 0.0f);
+				}
+				else if (normalX > 0)
+				{
+					bottomLeft = glm::vec3(plane, 0.0f, end);
+					right = glm::vec3(0.0f, 0.0f, -1.0f);
+				}
+				else
+				{
+					bottomLeft = glm::vec3(plane, 0.0f, start);
+					right = glm::vec3(0.0f, 0.0f, 1.0f);
+				}
+
+				AddQuad(GetMeshData(outMeshes, static_cast<uint16_t>(layer)), bottomLeft, right,
+					glm::vec3(0.0f, 1.0f, 0.0f), static_cast<float>(runLength), 1.0f);
+
+				i += runLength;
+			}
+		}
+	}
+}
+
+glm::vec3 GetLevelChunkCenter(const Level& level, int32_t chunkX, int32_t chunkZ)
+{
+	int32_t startX = chunkX * levelChunkSize;
+	int32_t startZ = chunkZ * levelChunkSize;
+	int32_t sizeX = std::min(levelChunkSize, level.width - startX);
+	int32_t sizeZ = std::min(levelChunkSize, level.depth - startZ);
+
+	return glm::vec3(startX + sizeX * 0.5f, 0.5f, startZ + sizeZ * 0.5f);
+}
+
+void MeshLevelChunk(const Level& level, int32_t chunkX, int32_t chunkZ, std::vector<LevelChunkMeshData>& outMeshes)
+{
+	outMeshes.clear();
+
+	int32_t startX = chunkX * levelChunkSize;
+	int32_t startZ = chunkZ * levelChunkSize;
+	int32_t sizeX = std::min(levelChunkSize, level.width - startX);
+	int32_t sizeZ = std::min(levelChunkSize, level.depth - startZ);
+
+	MeshFlats(level, startX, startZ, sizeX, sizeZ, false, outMeshes);
+	MeshFlats(level, startX, startZ, sizeX, sizeZ, true, outMeshes);
+	MeshWalls(level, startX, startZ, sizeX, sizeZ, 0, 1, outMeshes);
+	MeshWalls(level, startX, startZ, sizeX, sizeZ, 0, -1, outMeshes);
+	MeshWalls(level, startX, startZ, sizeX, sizeZ, 1, 0, outMeshes);
+	MeshWalls(level, startX, startZ, sizeX, sizeZ, -1, 0, outMeshes);
+
+	// Meshed in level space, moved so the chunk's instance offset places it back.
+	glm::vec3 center = GetLevelChunkCenter(level, chunkX, chunkZ);
+
+	for (LevelChunkMeshData& mesh : outMeshes)
+	{
+		for (size_t i = 0; i + 5 <= mesh.vertices.size(); i += 5)
+		{
+			mesh.vertices[i] -= center.x;
+			mesh.vertices[i + 1] -= center.y;
+			mesh.vertices[i + 2] -= center.z;
+		}
+	}
+}
+
+void MeshLevelOccluders(const Level& level, std::vector<float>& outVertices, std::vector<uint32_t>& outIndices)
+{
+	outVertices.clear();
+	outIndices.clear();
+
+	// Meshing the whole level at once lets runs of wall continue across chunks.
+	std::vector<LevelChunkMeshData> meshes;
+	MeshWalls(level, 0, 0, level.width, level.depth, 0, 1, meshes);
+	MeshWalls(level, 0, 0, level.width, level.depth, 0, -1, meshes);
+	MeshWalls(level, 0, 0, level.width, level.depth, 1, 0, meshes);
+	MeshWalls(level, 0, 0, level.width, level.depth, -1, 0, meshes);
+
+	for (const LevelChunkMeshData& mesh : meshes)
+	{
+		uint32_t firstVertex = static_cast<uint32_t>(outVertices.size() / 5);
+		outVertices.insert(outVertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+
+		for (uint32_t index : mesh.indices)
+		{
+			outIndices.push_back(firstVertex + index);
+		}
+	}
+}
+
+LevelMesh::LevelMesh(Renderer* renderer, Level level)
+	: renderer(renderer), level(std::move(level))
+{
+	chunkCountX = (this->level.width + levelChunkSize - 1) / levelChunkSize;
+	chunkCountZ = (this->level.depth + levelChunkSize - 1) / levelChunkSize;
+	chunks.resize(static_cast<size_t>(chunkCountX) * chunkCountZ);
+
+	for (LevelChunk& chunk : chunks)
+	{
+		chunk.isDirty = true;
+	}
+}
+
+const Level& LevelMesh::GetLevel() const
+{
+	return level;
+}
+
+void LevelMesh::SetTile(int32_t x, int32_t z, const LevelTile& tile)
+{
+	if (x < 0 || z < 0 || x >= level.width || z >= level.depth)
+	{
+		throw std::runtime_error("Tried to set a tile outside of the level!");
+	}
+
+	level.tiles[z * level.width + x] = tile;
+
+	// Neighbouring walls may gain or lose the side facing this tile, and they can belong
+	// to the next chunk over.
+	MarkDirty(x, z);
+	MarkDirty(x - 1, z);
+	MarkDirty(x + 1, z);
+	MarkDirty(x, z - 1);
+	MarkDirty(x, z + 1);
+}
+
+void LevelMesh::Update()
+{
+	bool wasEdited = false;
+
+	for (int32_t chunkZ = 0; chunkZ < chunkCountZ; ++chunkZ)
+	{
+		for (int32_t chunkX = 0; chunkX < chunkCountX; ++chunkX)
+		{
+			LevelChunk& chunk = chunks[chunkZ * chunkCountX + chunkX];
+
+			if (chunk.isDirty)
+			{
+				RemeshChunk(chunk, chunkX, chunkZ);
+				chunk.isDirty = false;
+				wasEdited = true;
+			}
+		}
+	}
+
+	// Edits are rare, so the occluders are simply meshed again whole.
+	if (wasEdited)
+	{
+		MeshLevelOccluders(level, occluderVertices, occluderIndices);
+	}
+}
+
+void LevelMesh::Draw(const TextureArray* textureArray)
+{
+	for (LevelChunk& chunk : chunks)
+	{
+		for (LevelChunkModel& chunkModel : chunk.models)
+		{
+			renderer->DrawModel(&chunkModel.model, textureArray, &chunkModel.instances);
+		}
+	}
+}
+
+void LevelMesh::Draw(const TextureArray* textureArray, const LevelVisibility& visibility, int32_t fromCell)
+{
+	for (int32_t chunkZ = 0; chunkZ < chunkCountZ; ++chunkZ)
+	{
+		for (int32_t chunkX = 0; chunkX < chunkCountX; ++chunkX)
+		{
+			if (!visibility.IsChunkVisible(fromCell, chunkX, chunkZ))
+			{
+				continue;
+			}
+
+			for (LevelChunkModel& chunkModel : chunks[chunkZ * chunkCountX + chunkX].models)
+			{
+				renderer->DrawModel(&chunkModel.model, textureArray, &chunkModel.instances);
+			}
+		}
+	}
+}
+
+void LevelMesh::AddOccluders(OcclusionBuffer& occlusionBuffer) const
+{
+	occlusionBuffer.AddOccluder(occluderVertices, occluderIndices);
+}
+
+void LevelMesh::Destroy()
+{
+	for (LevelChunk& chunk : chunks)
+	{
+		for (LevelChunkModel& chunkModel : chunk.models)
+		{
+			renderer->DestroyModel(&chunkModel.model);
+		}
+
+		chunk.models.clear();
+		chunk.isDirty = true;
+	}
+}
+
+void LevelMesh::MarkDirty(int32_t x, int32_t z)
+{
+	if (x < 0 || z < 0 || x >= level.width || z >= level.depth)
+	{
+		return;
+	}
+
+	chunks[(z / levelChunkSize) * chunkCountX + x / levelChunkSize].isDirty = true;
+}
+
+void LevelMesh::RemeshChunk(LevelChunk& chunk, int32_t chunkX, int32_t chunkZ)
+{
+	MeshLevelChunk(level, chunkX, chunkZ, meshData);
+
+	// Layers the chunk no longer uses lose their models, the rest are updated in place.
+	for (size_t i = 0; i < chunk.models.size();)
+	{
+		LevelChunkModel& chunkModel = chunk.models[i];
+		auto it = std::find_if(meshData.begin(), meshData.end(), [&](const LevelChunkMeshData& mesh)
+		{
+			return mesh.textureIndex == chunkModel.textureIndex;
+		});
+
+		if (it == meshData.end())
+		{
+			renderer->DestroyModel(&chunkModel.model);
+			chunk.models.erase(chunk.models.begin() + i);
+			continue;
+		}
+
+		renderer->UpdateModel(&chunkModel.model, it->vertices, it->indices);
+		it->indices.clear();
+		++i;
+	}
+
+	// Meshes whose indices are left are for layers new to the chunk.
+	glm::vec3 center = GetLevelChunkCenter(level, chunkX, chunkZ);
+
+	for (const LevelChunkMeshData& mesh : meshData)
+	{
+		if (mesh.indices.empty())
+		{
+			continue;
+		}
+
+		Instances instances = {
+			{ center },
+			{ 0.0f },
+			{ 1.0f },
+			{ mesh.textureIndex },
+		};
+
+		LevelChunkModel chunkModel;
+		chunkModel.textureIndex = mesh.textureIndex;
+		chunkModel.model = renderer->CreateModel(mesh.vertices, mesh.indices);
+		chunkModel.instances.instances.resize(1);
+		PackInstances(&instances, chunkModel.instances.instances.data());
+		chunk.models.push_back(std::move(chunkModel));
+	}
+}
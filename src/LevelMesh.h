@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Level.h"
+#include "Renderer.h"
+
+class LevelVisibility;
+class OcclusionBuffer;
+
+// Levels are meshed in square chunks of this many tiles, an edit only re-meshes the
+// chunks it touches.
+constexpr int32_t levelChunkSize = 16;
+
+// Geometry of one chunk that uses a single texture layer, in CreateModel's vertex layout.
+struct LevelChunkMeshData
+{
+	uint16_t textureIndex;
+	std::vector<float> vertices;
+	std::vector<uint32_t> indices;
+};
+
+// The middle of a chunk's tiles, halfway between its floor and ceiling.
+glm::vec3 GetLevelChunkCenter(const Level& level, int32_t chunkX, int32_t chunkZ);
+
+// Meshes the floors, ceilings and visible wall sides of one chunk, grouped by texture layer.
+// Coplanar faces that share a layer are merged greedily into larger quads whose texture
+// coordinates repeat once per tile. Vertices are relative to GetLevelChunkCenter, so the
+// model's bounding sphere fits the chunk once it is drawn at that offset. outMeshes is
+// cleared first.
+void MeshLevelChunk(const Level& level, int32_t chunkX, int32_t chunkZ, std::vector<LevelChunkMeshData>& outMeshes);
+
+// Meshes every visible wall side of a level into one mesh, for OcclusionBuffer. Floors and
+// ceilings never hide anything standing on them, so they are left out. Outputs are cleared.
+void MeshLevelOccluders(const Level& level, std::vector<float>& outVertices, std::vector<uint32_t>& outIndices);
+
+// One model per texture layer, the layer is picked by the instance.
+struct LevelChunkModel
+{
+	uint16_t textureIndex;
+	Model model;
+	PackedInstances instances;
+};
+
+struct LevelChunk
+{
+	std::vector<LevelChunkModel> models;
+	bool isDirty;
+};
+
+// Keeps a level and its chunk models in sync. Edits mark chunks dirty and Update re-meshes
+// them, reusing their models through UpdateModel.
+class LevelMesh
+{
+public:
+	LevelMesh(Renderer* renderer, Level level);
+
+	const Level& GetLevel() const;
+	void SetTile(int32_t x, int32_t z, const LevelTile& tile);
+
+	// Re-meshes the chunks edited since the last update, every chunk the first time.
+	void Update();
+	void Draw(const TextureArray* textureArray);
+	// Only draws the chunks in the potentially visible set of fromCell.
+	void Draw(const TextureArray* textureArray, const LevelVisibility& visibility, int32_t fromCell);
+	// Rasterizes the walls as of the last update into an occlusion buffer.
+	void AddOccluders(OcclusionBuffer& occlusionBuffer) const;
+	// Destroys the chunk models, call before the renderer is closed.
+	void Destroy();
+
+private:
+	void MarkDirty(int32_t x, int32_t z);
+	void RemeshChunk(LevelChunk& chunk, int32_t chunkX, int32_t chunkZ);
+
+	Renderer* renderer;
+	Level level;
+	int32_t chunkCountX;
+	int32_t chunkCountZ;
+	// Row major like the tiles.
+	std::vector<LevelChunk> chunks;
+	std::vector<LevelChunkMeshData> meshData;
+	std::vector<float> occluderVertices;
+	std::vector<uint32_t> occluderIndices;
+};
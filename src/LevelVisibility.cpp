@@ -0,0 +1,280 @@
+#include "LevelVisibility.h"
+#include "LevelMesh.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	void SetBit(uint64_t* bits, size_t index)
+	{
+		bits[index / 64] |= uint64_t(1) << (index % 64);
+	}
+
+	bool GetBit(const uint64_t* bits, size_t index)
+	{
+		return (bits[index / 64] >> (index % 64)) & 1;
+	}
+
+	// Walks the cells a line crosses with a DDA, false if any of them is a wall.
+	bool IsLineClear(const std::vector<uint8_t>& isOpen, int32_t width, glm::vec2 from, glm::vec2 to)
+	{
+		int32_t x = static_cast<int32_t>(std::floor(from.x));
+		int32_t z = static_cast<int32_t>(std::floor(from.y));
+		int32_t endX = static_cast<int32_t>(std::floor(to.x));
+		int32_t endZ = static_cast<int32_t>(std::floor(to.y));
+
+		glm::vec2 delta = to - from;
+		int32_t stepX = delta.x > 0.0f ? 1 : -1;
+		int32_t stepZ = delta.y > 0.0f ? 1 : -1;
+		float deltaDistX = delta.x != 0.0f ? std::abs(1.0f / delta.x) : INFINITY;
+		float deltaDistZ = delta.y != 0.0f ? std::abs(1.0f / delta.y) : INFINITY;
+		float sideDistX = (delta.x > 0.0f ? x + 1.0f - from.x : from.x - x) * deltaDistX;
+		float sideDistZ = (delta.y > 0.0f ? z + 1.0f - from.y : from.y - z) * deltaDistZ;
+
+		// Counting steps rather than comparing against the end keeps rounding from overshooting.
+		int32_t stepCount = std::abs(endX - x) + std::abs(endZ - z);
+
+		for (int32_t i = 0; i < stepCount; ++i)
+		{
+			if (sideDistX < sideDistZ)
+			{
+				sideDistX += deltaDistX;
+				x += stepX;
+			}
+			else
+			{
+				sideDistZ += deltaDistZ;
+				z += stepZ;
+			}
+
+			if (!isOpen[z * width + x])
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Samples are inset a little so lines don't start exactly on a cell's edge.
+	void GetSamples(int32_t x, int32_t z, glm::vec2* outSamples)
+	{
+		for (int32_t i = 0; i < levelVisibilitySampleCount; ++i)
+		{
+			for (int32_t j = 0; j < levelVisibilitySampleCount; ++j)
+			{
+				float u = 0.01f + 0.98f * i / (levelVisibilitySampleCount - 1);
+				float v = 0.01f + 0.98f * j / (levelVisibilitySampleCount - 1);
+				outSamples[i * levelVisibilitySampleCount + j] = glm::vec2(x + u, z + v);
+			}
+		}
+	}
+}
+
+void LevelVisibility::Build(const Level& level, uint32_t threadCount)
+{
+	width = level.width;
+	depth = level.depth;
+	chunkCountX = (width + levelChunkSize - 1) / levelChunkSize;
+	chunkCountZ = (depth + levelChunkSize - 1) / levelChunkSize;
+
+	size_t cellCount = static_cast<size_t>(width) * depth;
+	chunkWordCount = (static_cast<size_t>(chunkCountX) * chunkCountZ + 63) / 64;
+	cellSets.assign(cellCount, LevelCellVisibility{});
+	chunkBits.assign(chunkWordCount * cellCount, 0);
+	isOpen.resize(cellCount);
+
+	for (size_t i = 0; i < cellCount; ++i)
+	{
+		isOpen[i] = level.tiles[i].type == LevelTileType::Empty ? 1 : 0;
+	}
+
+	// Every cell only writes its own sets, so the jobs share nothing. Their bits are
+	// gathered into one pool afterwards.
+	std::vector<std::vector<uint64_t>> jobCellBits(cellCount);
+	WorkerPool workerPool(threadCount);
+	workerPool.Run(static_cast<uint32_t>(cellCount), [&](uint32_t cell) {
+		BuildCell(static_cast<int32_t>(cell), jobCellBits[cell]);
+		});
+
+	cellBits.clear();
+
+	for (size_t i = 0; i < cellCount; ++i)
+	{
+		cellSets[i].firstWord = cellBits.size();
+		cellBits.insert(cellBits.end(), jobCellBits[i].begin(), jobCellBits[i].end());
+	}
+}
+
+void LevelVisibility::BuildCell(int32_t cell, std::vector<uint64_t>& outCellBits)
+{
+	if (!isOpen[cell])
+	{
+		return;
+	}
+
+	constexpr int32_t samplesPerCell = levelVisibilitySampleCount * levelVisibilitySampleCount;
+	glm::vec2 fromSamples[samplesPerCell];
+	glm::vec2 toSamples[samplesPerCell];
+	glm::vec2 fromCenter(cell % width + 0.5f, cell / width + 0.5f);
+	GetSamples(cell % width, cell / width, fromSamples);
+
+	// What a cell sees is mostly connected, so it is flood filled outwards from the cell and
+	// only the frontier is tested. Cells only reachable past a neighbour that failed every
+	// sample are missed, testing every pair instead is far slower on large levels.
+	std::vector<uint8_t> isVisited(isOpen.size(), 0);
+	std::vector<int32_t> visibleCells = { cell };
+	isVisited[cell] = 1;
+
+	for (size_t next = 0; next < visibleCells.size(); ++next)
+	{
+		int32_t centerX = visibleCells[next] % width;
+		int32_t centerZ = visibleCells[next] / width;
+
+		for (int32_t z = std::max(centerZ - 1, 0); z <= std::min(centerZ + 1, depth - 1); ++z)
+		{
+			for (int32_t x = std::max(centerX - 1, 0); x <= std::min(centerX + 1, width - 1); ++x)
+			{
+				int32_t neighbour = z * width + x;
+
+				if (isVisited[neighbour] || !isOpen[neighbour])
+				{
+					continue;
+				}
+
+				isVisited[neighbour] = 1;
+
+				// Most pairs are settled by the line between their centres.
+				bool isVisible = IsLineClear(isOpen, width, fromCenter, glm::vec2(x + 0.5f, z + 0.5f));
+
+				if (!isVisible)
+				{
+					GetSamples(x, z, toSamples);
+
+					for (int32_t i = 0; i < samplesPerCell && !isVisible; ++i)
+					{
+						for (int32_t j = 0; j < samplesPerCell && !isVisible; ++j)
+						{
+							isVisible = IsLineClear(isOpen, width, fromSamples[i], toSamples[j]);
+						}
+					}
+				}
+
+				if (isVisible)
+				{
+					visibleCells.push_back(neighbour);
+				}
+			}
+		}
+	}
+
+	// Widening by the 8 neighbours also picks up the walls around every visible cell.
+	LevelCellVisibility& set = cellSets[cell];
+	int32_t maxX = 0;
+	int32_t maxZ = 0;
+	set.minX = width;
+	set.minZ = depth;
+
+	for (int32_t visibleCell : visibleCells)
+	{
+		set.minX = std::min(set.minX, std::max(visibleCell % width - 1, 0));
+		set.minZ = std::min(set.minZ, std::max(visibleCell / width - 1, 0));
+		maxX = std::max(maxX, std::min(visibleCell % width + 1, width - 1));
+		maxZ = std::max(maxZ, std::min(visibleCell / width + 1, depth - 1));
+	}
+
+	set.sizeX = maxX - set.minX + 1;
+	set.sizeZ = maxZ - set.minZ + 1;
+	outCellBits.assign((static_cast<size_t>(set.sizeX) * set.sizeZ + 63) / 64, 0);
+	uint64_t* chunks = &chunkBits[cell * chunkWordCount];
+
+	for (int32_t visibleCell : visibleCells)
+	{
+		int32_t centerX = visibleCell % width;
+		int32_t centerZ = visibleCell / width;
+
+		for (int32_t z = std::max(centerZ - 1, 0); z <= std::min(centerZ + 1, depth - 1); ++z)
+		{
+			for (int32_t x = std::max(centerX - 1, 0); x <= std::min(centerX + 1, width - 1); ++x)
+			{
+				SetBit(outCellBits.data(), (z - set.minZ) * set.sizeX + x - set.minX);
+				SetBit(chunks, (z / levelChunkSize) * chunkCountX + x / levelChunkSize);
+			}
+		}
+	}
+}
+
+int32_t LevelVisibility::GetCell(glm::vec3 position) const
+{
+	int32_t x = static_cast<int32_t>(std::floor(position.x));
+	int32_t z = static_cast<int32_t>(std::floor(position.z));
+
+	if (x < 0 || z < 0 || x >= width || z >= depth || !isOpen[z * width + x])
+	{
+		return -1;
+	}
+
+	return z * width + x;
+}
+
+bool LevelVisibility::IsCellVisible(int32_t fromCell, int32_t x, int32_t z) const
+{
+	if (fromCell < 0)
+	{
+		return true;
+	}
+
+	const LevelCellVisibility& set = cellSets[fromCell];
+	x -= set.minX;
+	z -= set.minZ;
+
+	if (x < 0 || z < 0 || x >= set.sizeX || z >= set.sizeZ)
+	{
+		return false;
+	}
+
+	return GetBit(&cellBits[set.firstWord], z * set.sizeX + x);
+}
+
+bool LevelVisibility::IsChunkVisible(int32_t fromCell, int32_t chunkX, int32_t chunkZ) const
+{
+	if (fromCell < 0)
+	{
+		return true;
+	}
+
+	return GetBit(&chunkBits[fromCell * chunkWordCount], chunkZ * chunkCountX + chunkX);
+}
+
+void LevelVisibility::FilterInstances(int32_t fromCell, const Instances* instances, Instances* outInstances) const
+{
+	outInstances->offsets.clear();
+	outInstances->rotations.clear();
+	outInstances->scales.clear();
+	outInstances->textureIndices.clear();
+
+	for (size_t i = 0; i < instances->offsets.size(); ++i)
+	{
+		glm::vec3 offset = instances->offsets[i];
+		int32_t x = static_cast<int32_t>(std::floor(offset.x));
+		int32_t z = static_cast<int32_t>(std::floor(offset.z));
+		bool isInLevel = x >= 0 && z >= 0 && x < width && z < depth;
+
+		if (isInLevel && !IsCellVisible(fromCell, x, z))
+		{
+			continue;
+		}
+
+		outInstances->offsets.push_back(offset);
+		outInstances->rotations.push_back(instances->rotations[i]);
+		outInstances->scales.push_back(instances->scales[i]);
+		outInstances->textureIndices.push_back(instances->textureIndices[i]);
+	}
+}
+
+size_t LevelVisibility::GetSize() const
+{
+	return cellSets.size() * sizeof(LevelCellVisibility) + (cellBits.size() + chunkBits.size()) * sizeof(uint64_t);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Level.h"
+#include "Renderer.h"
+
+// Sample points per cell along each axis, cells see each other if a line between any two
+// of their samples stays clear of walls.
+constexpr int32_t levelVisibilitySampleCount = 3;
+
+// Visible cells of one cell, as a bitset over the rectangle that bounds them.
+struct LevelCellVisibility
+{
+	int32_t minX;
+	int32_t minZ;
+	int32_t sizeX;
+	int32_t sizeZ;
+	// Index of the set's first word in LevelVisibility's bit pool.
+	size_t firstWord;
+};
+
+// A potentially visible set for every open cell of a level, computed over the tile grid.
+// Each cell stores one bit per cell it may see (walls included, so their sides can be
+// drawn) over the bounds of what it sees, which is small in maze-like levels, and one bit
+// per mesh chunk. Every visible cell is widened by its 8 neighbours, so slivers between
+// samples don't pop, but the sets are not conservative: cells are found by flood filling
+// outwards from visible cells, so a cell only visible past a neighbour whose samples all
+// missed is left out.
+//
+// Visibility only changes when walls do, rebuild after edits that open up new sight lines.
+class LevelVisibility
+{
+public:
+	// Flood fills each open cell's set on a worker pool, testing only the frontier of what
+	// it sees so far. Zero threads picks one per core.
+	void Build(const Level& level, uint32_t threadCount = 0);
+
+	// Cell index of a position, or -1 outside the level or inside a wall, where nothing
+	// should be culled.
+	int32_t GetCell(glm::vec3 position) const;
+	bool IsCellVisible(int32_t fromCell, int32_t x, int32_t z) const;
+	bool IsChunkVisible(int32_t fromCell, int32_t chunkX, int32_t chunkZ) const;
+
+	// Copies the instances in cells visible from fromCell, instances outside of the level are
+	// always kept. outInstances is cleared first.
+	void FilterInstances(int32_t fromCell, const Instances* instances, Instances* outInstances) const;
+
+	// Bytes used by the bitsets.
+	size_t GetSize() const;
+
+private:
+	void BuildCell(int32_t cell, std::vector<uint64_t>& outCellBits);
+
+	int32_t width = 0;
+	int32_t depth = 0;
+	int32_t chunkCountX = 0;
+	int32_t chunkCountZ = 0;
+	// Walls have empty sets.
+	std::vector<LevelCellVisibility> cellSets;
+	std::vector<uint64_t> cellBits;
+	// Chunk bitsets of each cell, chunkWordCount words apart.
+	size_t chunkWordCount = 0;
+	std::vector<uint64_t> chunkBits;
+	std::vector<uint8_t> isOpen;
+};
@@ -0,0 +1,299 @@
+#include "OcclusionBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace
+{
+	// Occluders only have to be ordered among themselves, so these don't need to match the
+	// renderers' exactly.
+	constexpr float occlusionZNear = 0.1f;
+	constexpr float occlusionZFar = 100.0f;
+
+	float GetEdge(glm::vec3 from, glm::vec3 to, float x, float y)
+	{
+		return (to.x - from.x) * (y - from.y) - (to.y - from.y) * (x - from.x);
+	}
+}
+
+OcclusionBuffer::OcclusionBuffer(int32_t width, int32_t height)
+	: width(width), height(height), viewProj(1.0f)
+{
+	int32_t levelWidth = width;
+	int32_t levelHeight = height;
+
+	while (true)
+	{
+		levels.emplace_back(static_cast<size_t>(levelWidth) * levelHeight, 1.0f);
+		levelWidths.push_back(levelWidth);
+		levelHeights.push_back(levelHeight);
+
+		if (levelWidth == 1 && levelHeight == 1)
+		{
+			break;
+		}
+
+		levelWidth = (levelWidth + 1) / 2;
+		levelHeight = (levelHeight + 1) / 2;
+	}
+}
+
+void OcclusionBuffer::Begin(glm::vec3 position, float yRot, float xRot, float fov, float aspectRatio)
+{
+	float xTheta = glm::radians(xRot);
+	float yTheta = glm::radians(yRot + 270.0f);
+	glm::vec3 dir(std::cos(yTheta) * std::cos(xTheta), std::sin(xTheta), std::sin(yTheta) * std::cos(xTheta));
+
+	glm::mat4 view = glm::lookAt(position, position + dir, glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 proj = glm::perspective(glm::radians(fov), aspectRatio, occlusionZNear, occlusionZFar);
+	viewProj = proj * view;
+
+	std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+}
+
+void OcclusionBuffer::AddOccluder(const std::vector<float>& vertices, const std::vector<uint32_t>& indices)
+{
+	for (size_t i = 0; i + 3 <= indices.size(); i += 3)
+	{
+		glm::vec4 triangle[3];
+
+		for (size_t j = 0; j < 3; ++j)
+		{
+			const float* vertex = &vertices[indices[i + j] * 5];
+			triangle[j] = viewProj * glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f);
+		}
+
+		// Clipping against the near plane, where z = -w, leaves at most a quad.
+		glm::vec4 clipped[4];
+		uint32_t clippedCount = 0;
+
+		for (uint32_t j = 0; j < 3; ++j)
+		{
+			const glm::vec4& from = triangle[j];
+			const glm::vec4& to = triangle[(j + 1) % 3];
+			float fromDistance = from.z + from.w;
+			float toDistance = to.z + to.w;
+
+			if (fromDistance >= 0.0f)
+			{
+				clipped[clippedCount++] = from;
+			}
+
+			if ((fromDistance >= 0.0f) != (toDistance >= 0.0f))
+			{
+				clipped[clippedCount++] = from + (to - from) * (fromDistance / (fromDistance - toDistance));
+			}
+		}
+
+		if (clippedCount < 3)
+		{
+			continue;
+		}
+
+		RasterizeTriangle(clipped);
+
+		if (clippedCount == 4)
+		{
+			glm::vec4 second[3] = { clipped[0], clipped[2], clipped[3] };
+			RasterizeTriangle(second);
+		}
+	}
+}
+
+void OcclusionBuffer::RasterizeTriangle(const glm::vec4* clipPositions)
+{
+	glm::vec3 screen[3];
+
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		float invW = 1.0f / clipPositions[i].w;
+		screen[i] = glm::vec3(
+			(clipPositions[i].x * invW * 0.5f + 0.5f) * width,
+			(clipPositions[i].y * invW * 0.5f + 0.5f) * height,
+			clipPositions[i].z * invW * 0.5f + 0.5f);
+	}
+
+	float area = GetEdge(screen[0], screen[1], screen[2].x, screen[2].y);
+
+	if (std::abs(area) < 1e-6f)
+	{
+		return;
+	}
+
+	// Occluders are seen from both sides, so clockwise triangles are flipped.
+	if (area < 0.0f)
+	{
+		std::swap(screen[1], screen[2]);
+		area = -area;
+	}
+
+	int32_t minX = std::max(static_cast<int32_t>(std::floor(std::min({ screen[0].x, screen[1].x, screen[2].x }))), 0);
+	int32_t minY = std::max(static_cast<int32_t>(std::floor(std::min({ screen[0].y, screen[1].y, screen[2].y }))), 0);
+	int32_t maxX = std::min(static_cast<int32_t>(std::ceil(std::max({ screen[0].x, screen[1].x, screen[2].x }))), width - 1);
+	int32_t maxY = std::min(static_cast<int32_t>(std::ceil(std::max({ screen[0].y, screen[1].y, screen[2].y }))), height - 1);
+
+	// Depth is affine in screen space. Adding half a texel's worth of slope in each direction
+	// gives the furthest the triangle gets within a texel.
+	float dz1 = screen[1].z - screen[0].z;
+	float dz2 = screen[2].z - screen[0].z;
+	float dzdx = (dz1 * (screen[2].y - screen[0].y) - dz2 * (screen[1].y - screen[0].y)) / area;
+	float dzdy = (dz2 * (screen[1].x - screen[0].x) - dz1 * (screen[2].x - screen[0].x)) / area;
+	float slack = 0.5f * (std::abs(dzdx) + std::abs(dzdy));
+	float maxDepth = std::min(std::max({ screen[0].z, screen[1].z, screen[2].z }), 1.0f);
+	std::vector<float>& depthBuffer = levels[0];
+
+	for (int32_t y = minY; y <= maxY; ++y)
+	{
+		float centerY = y + 0.5f;
+
+		for (int32_t x = minX; x <= maxX; ++x)
+		{
+			float centerX = x + 0.5f;
+
+			if (GetEdge(screen[0], screen[1], centerX, centerY) < 0.0f ||
+				GetEdge(screen[1], screen[2], centerX, centerY) < 0.0f ||
+				GetEdge(screen[2], screen[0], centerX, centerY) < 0.0f)
+			{
+				continue;
+			}
+
+			float depth = screen[0].z + dzdx * (centerX - screen[0].x) + dzdy * (centerY - screen[0].y);
+			depth = std::min(depth + slack, maxDepth);
+			float& texel = depthBuffer[y * width + x];
+			texel = std::min(texel, depth);
+		}
+	}
+}
+
+void OcclusionBuffer::Finish()
+{
+	// Texel (x, y) covers texels (2x, 2y) to (2x + 1, 2y + 1) of the level below, clamped
+	// to its edge when that level has an odd size.
+	for (size_t level = 1; level < levels.size(); ++level)
+	{
+		const std::vector<float>& source = levels[level - 1];
+		std::vector<float>& destination = levels[level];
+		int32_t sourceWidth = levelWidths[level - 1];
+		int32_t sourceHeight = levelHeights[level - 1];
+
+		for (int32_t y = 0; y < levelHeights[level]; ++y)
+		{
+			const float* row0 = &source[(2 * y) * sourceWidth];
+			const float* row1 = &source[std::min(2 * y + 1, sourceHeight - 1) * sourceWidth];
+
+			for (int32_t x = 0; x < levelWidths[level]; ++x)
+			{
+				int32_t x0 = 2 * x;
+				int32_t x1 = std::min(2 * x + 1, sourceWidth - 1);
+				destination[y * levelWidths[level] + x] = std::max({ row0[x0], row0[x1], row1[x0], row1[x1] });
+			}
+		}
+	}
+}
+
+bool OcclusionBuffer::IsSphereOccluded(glm::vec3 center, float radius) const
+{
+	// The corners of the sphere's bounding box bound it on screen, and the nearest of them
+	// is at least as near as the sphere.
+	float minX = INFINITY;
+	float minY = INFINITY;
+	float maxX = -INFINITY;
+	float maxY = -INFINITY;
+	float minDepth = 1.0f;
+
+	for (uint32_t i = 0; i < 8; ++i)
+	{
+		glm::vec3 corner = center + radius * glm::vec3(
+			(i & 1) ? 1.0f : -1.0f,
+			(i & 2) ? 1.0f : -1.0f,
+			(i & 4) ? 1.0f : -1.0f);
+		glm::vec4 clip = viewProj * glm::vec4(corner, 1.0f);
+
+		// Anything reaching past the near plane can't be behind an occluder.
+		if (clip.z < -clip.w)
+		{
+			return false;
+		}
+
+		float invW = 1.0f / clip.w;
+		float x = (clip.x * invW * 0.5f + 0.5f) * width;
+		float y = (clip.y * invW * 0.5f + 0.5f) * height;
+		minX = std::min(minX, x);
+		minY = std::min(minY, y);
+		maxX = std::max(maxX, x);
+		maxY = std::max(maxY, y);
+		minDepth = std::min(minDepth, clip.z * invW * 0.5f + 0.5f);
+	}
+
+	// Off screen spheres are left to frustum culling.
+	if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height)
+	{
+		return false;
+	}
+
+	int32_t x0 = std::max(static_cast<int32_t>(minX), 0);
+	int32_t y0 = std::max(static_cast<int32_t>(minY), 0);
+	int32_t x1 = std::min(static_cast<int32_t>(maxX), width - 1);
+	int32_t y1 = std::min(static_cast<int32_t>(maxY), height - 1);
+
+	// The first level where the bounds span at most 2x2 texels.
+	size_t level = 0;
+
+	while (level + 1 < levels.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+	{
+		++level;
+	}
+
+	const std::vector<float>& depthBuffer = levels[level];
+	int32_t levelWidth = levelWidths[level];
+
+	for (int32_t y = y0 >> level; y <= y1 >> level; ++y)
+	{
+		for (int32_t x = x0 >> level; x <= x1 >> level; ++x)
+		{
+			if (depthBuffer[y * levelWidth + x] >= minDepth)
+			{
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+void OcclusionBuffer::FilterInstances(float boundingRadius, const Instances* instances, Instances* outInstances) const
+{
+	outInstances->offsets.clear();
+	outInstances->rotations.clear();
+	outInstances->scales.clear();
+	outInstances->textureIndices.clear();
+
+	for (size_t i = 0; i < instances->offsets.size(); ++i)
+	{
+		if (IsSphereOccluded(instances->offsets[i], boundingRadius * std::abs(instances->scales[i])))
+		{
+			continue;
+		}
+
+		outInstances->offsets.push_back(instances->offsets[i]);
+		outInstances->rotations.push_back(instances->rotations[i]);
+		outInstances->scales.push_back(instances->scales[i]);
+		outInstances->textureIndices.push_back(instances->textureIndices[i]);
+	}
+}
+
+int32_t OcclusionBuffer::GetWidth() const
+{
+	return width;
+}
+
+int32_t OcclusionBuffer::GetHeight() const
+{
+	return height;
+}
+
+const std::vector<float>& OcclusionBuffer::GetDepthBuffer() const
+{
+	return levels[0];
+}
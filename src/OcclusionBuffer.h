@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Renderer.h"
+
+// A small software depth buffer for rejecting instances hidden behind walls before they are
+// drawn, for renderers without GPU occlusion culling like GLRenderer. Occluders are rasterized
+// on the CPU, then reduced into a depth pyramid (Hi-Z) where every texel keeps the furthest
+// depth beneath it, so a bounding sphere is tested against at most 2x2 texels of the level
+// that matches its size on screen.
+//
+// Coverage is sampled at texel centres, so something peeking out from behind an occluder by
+// less than a texel can be rejected. Depths are widened to the furthest point of each texel.
+class OcclusionBuffer
+{
+public:
+	OcclusionBuffer(int32_t width, int32_t height);
+
+	// Takes the same rotation and vertical fov as the renderers' cameras, clears the buffer.
+	void Begin(glm::vec3 position, float yRot, float xRot, float fov, float aspectRatio);
+	// Triangles in CreateModel's vertex layout, already in world space. Both sides occlude.
+	void AddOccluder(const std::vector<float>& vertices, const std::vector<uint32_t>& indices);
+	// Builds the depth pyramid, call after the last occluder and before any tests.
+	void Finish();
+
+	bool IsSphereOccluded(glm::vec3 center, float radius) const;
+	// Copies the instances that aren't occluded, boundingRadius is the model's and is scaled
+	// per instance. outInstances is cleared first.
+	void FilterInstances(float boundingRadius, const Instances* instances, Instances* outInstances) const;
+
+	int32_t GetWidth() const;
+	int32_t GetHeight() const;
+	// Bottom row first, from 0 at the near plane to 1 at the far plane.
+	const std::vector<float>& GetDepthBuffer() const;
+
+private:
+	void RasterizeTriangle(const glm::vec4* clipPositions);
+
+	int32_t width;
+	int32_t height;
+	glm::mat4 viewProj;
+
+	// Level 0 is the depth buffer, each level after it is half the size of the one before,
+	// rounded up, down to a single texel.
+	std::vector<std::vector<float>> levels;
+	std::vector<int32_t> levelWidths;
+	std::vector<int32_t> levelHeights;
+};
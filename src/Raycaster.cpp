@@ -0,0 +1,450 @@
+#include "Raycaster.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "TextureDecoder.h"
+#include "TexturePack.h"
+#include "../deps/stb_image.h"
+
+// Sprites closer than this to the camera plane are skipped rather than blown up to fill the screen.
+constexpr float raycastSpriteNear = 0.05f;
+
+Raycaster::Raycaster(int32_t width, int32_t height, uint32_t threadCount)
+	: workerPool(threadCount), width(0), height(0), cameraPos(0.0f), cameraHeight(0.5f), cameraDir(0.0f, -1.0f),
+	cameraRight(1.0f, 0.0f), tanHalfFov(std::tan(glm::radians(22.5f))), textureWidth(0), textureHeight(0),
+	textureLayerCount(0)
+{
+	Resize(width, height);
+}
+
+void Raycaster::Resize(int32_t width, int32_t height)
+{
+	this->width = std::max(width, 0);
+	this->height = std::max(height, 0);
+	pixels.assign(static_cast<size_t>(this->width) * this->height, 0xFF000000);
+	depthBuffer.assign(this->width, std::numeric_limits<float>::infinity());
+}
+
+void Raycaster::LoadTextures(const std::vector<std::string>& images)
+{
+	if (images.size() < 1)
+	{
+		throw std::runtime_error("No images supplied when loading raycaster textures!");
+	}
+
+	TextureDecoder decoder;
+	uint32_t batchId = decoder.Decode(images, STBI_rgb_alpha);
+
+	std::vector<DecodedImage> decodedImages;
+	std::vector<uint32_t> texels;
+	int32_t imageWidth = 0;
+	int32_t imageHeight = 0;
+	bool isDecoded = false;
+
+	try
+	{
+		while (!isDecoded)
+		{
+			isDecoded = decoder.Collect(batchId, decodedImages, true);
+
+			for (DecodedImage& image : decodedImages)
+			{
+				if (texels.empty())
+				{
+					imageWidth = image.width;
+					imageHeight = image.height;
+					texels.resize(static_cast<size_t>(imageWidth) * imageHeight * images.size());
+				}
+				else if (image.width != imageWidth || image.height != imageHeight)
+				{
+					throw std::runtime_error("Raycaster textures must all be the same size!");
+				}
+
+				size_t layerSize = static_cast<size_t>(imageWidth) * imageHeight;
+				uint32_t* layerTexels = &texels[layerSize * image.layer];
+				memcpy(layerTexels, image.pixels, layerSize * sizeof(uint32_t));
+
+				// Sprites only test alpha, like texture packs the #660066 colour key becomes transparent.
+				for (size_t i = 0; i < layerSize; ++i)
+				{
+					if ((layerTexels[i] & 0x00FFFFFF) == 0x660066)
+					{
+						layerTexels[i] = 0;
+					}
+				}
+
+				TextureDecoder::FreeImage(image);
+			}
+
+			decodedImages.clear();
+		}
+	}
+	catch (...)
+	{
+		for (DecodedImage& image : decodedImages)
+		{
+			TextureDecoder::FreeImage(image);
+		}
+
+		decoder.Cancel(batchId);
+		throw;
+	}
+
+	SetTextures(imageWidth, imageHeight, static_cast<uint32_t>(images.size()), texels.data());
+}
+
+void Raycaster::LoadTexturePack(const std::string& packFile)
+{
+	TexturePack pack(packFile);
+	const TexturePackHeader& header = pack.GetHeader();
+	const TexturePackLevel& level = pack.GetLevel(0);
+
+	// Only the top mip is needed, columns are sampled nearest.
+	std::vector<uint32_t> texels(static_cast<size_t>(level.width) * level.height * header.layerCount);
+
+	if (header.format == TexturePackFormat::RGBA8)
+	{
+		memcpy(texels.data(), pack.GetLevelData(0), level.size);
+	}
+	else
+	{
+		size_t layerSize = static_cast<size_t>(level.width) * level.height;
+		size_t compressedLayerSize = GetTexturePackLayerSize(header.format, level.width, level.height);
+
+		for (uint32_t layer = 0; layer < header.layerCount; ++layer)
+		{
+			DecodeBC1Layer(pack.GetLevelData(0) + compressedLayerSize * layer, level.width, level.height,
+				&texels[layerSize * layer]);
+		}
+	}
+
+	SetTextures(static_cast<int32_t>(level.width), static_cast<int32_t>(level.height), header.layerCount,
+		texels.data());
+}
+
+void Raycaster::SetTextures(int32_t width, int32_t height, uint32_t layerCount, const uint32_t* texels)
+{
+	textureWidth = width;
+	textureHeight = height;
+	textureLayerCount = layerCount;
+	textureTexels.resize(static_cast<size_t>(width) * height * layerCount);
+
+	size_t layerSize = static_cast<size_t>(width) * height;
+
+	for (uint32_t layer = 0; layer < layerCount; ++layer)
+	{
+		const uint32_t* src = texels + layerSize * layer;
+		uint32_t* dst = &textureTexels[layerSize * layer];
+
+		for (int32_t y = 0; y < height; ++y)
+		{
+			for (int32_t x = 0; x < width; ++x)
+			{
+				dst[static_cast<size_t>(x) * height + y] = src[static_cast<size_t>(y) * width + x];
+			}
+		}
+	}
+}
+
+void Raycaster::SetCamera(glm::vec3 position, float yRot, float fov)
+{
+	// Matches the renderers' SetCameraRotation with no pitch, right is dir x up.
+	float yTheta = glm::radians(yRot + 270.0f);
+	cameraPos = glm::vec2(position.x, position.z);
+	cameraHeight = position.y;
+	cameraDir = glm::vec2(std::cos(yTheta), std::sin(yTheta));
+	cameraRight = glm::vec2(-cameraDir.y, cameraDir.x);
+	tanHalfFov = std::tan(glm::radians(fov) * 0.5f);
+}
+
+void Raycaster::Render(const RaycastMap& map, const std::vector<RaycastSprite>& sprites)
+{
+	if (textureLayerCount == 0)
+	{
+		throw std::runtime_error("Raycaster textures need to be loaded before rendering!");
+	}
+
+	if (map.tiles.size() != static_cast<size_t>(map.width) * map.depth)
+	{
+		throw std::runtime_error("Raycast map has the wrong number of tiles!");
+	}
+
+	if (width == 0 || height == 0)
+	{
+		return;
+	}
+
+	ProjectSprites(sprites);
+
+	uint32_t stripCount = static_cast<uint32_t>((width + raycastStripWidth - 1) / raycastStripWidth);
+
+	workerPool.Run(stripCount, [&](uint32_t strip) {
+		int32_t startX = static_cast<int32_t>(strip) * raycastStripWidth;
+		RenderStrip(map, startX, std::min(startX + raycastStripWidth, width));
+		});
+}
+
+void Raycaster::ProjectSprites(const std::vector<RaycastSprite>& sprites)
+{
+	projectedSprites.clear();
+
+	float halfHeight = height * 0.5f;
+
+	for (const RaycastSprite& sprite : sprites)
+	{
+		glm::vec2 relative = glm::vec2(sprite.position.x, sprite.position.z) - cameraPos;
+		float depth = glm::dot(relative, cameraDir);
+
+		if (depth < raycastSpriteNear)
+		{
+			continue;
+		}
+
+		// The fov is vertical, so one world unit covers the same number of pixels on both axes.
+		float pixelsPerUnit = halfHeight / (depth * tanHalfFov);
+		float size = sprite.scale * pixelsPerUnit;
+		float left = width * 0.5f + glm::dot(relative, cameraRight) * pixelsPerUnit - size * 0.5f;
+		float bottom = halfHeight + (sprite.position.y - cameraHeight) * pixelsPerUnit;
+
+		if (left + size <= 0.0f || left >= width || bottom + size <= 0.0f || bottom >= height)
+		{
+			continue;
+		}
+
+		projectedSprites.push_back(RaycastProjectedSprite{ depth, left, bottom, size, sprite.textureIndex });
+	}
+
+	std::sort(projectedSprites.begin(), projectedSprites.end(),
+		[](const RaycastProjectedSprite& a, const RaycastProjectedSprite& b) { return a.depth > b.depth; });
+}
+
+void Raycaster::RenderStrip(const RaycastMap& map, int32_t startX, int32_t endX)
+{
+	constexpr float infinity = std::numeric_limits<float>::infinity();
+	float aspect = static_cast<float>(width) / static_cast<float>(height);
+
+	for (int32_t x = startX; x < endX; ++x)
+	{
+		// Rays are dir + right * k, so their parameter at a hit is already the perpendicular
+		// distance and walls don't bulge towards the edges of the screen.
+		float screenX = 2.0f * (x + 0.5f) / width - 1.0f;
+		glm::vec2 ray = cameraDir + cameraRight * (screenX * tanHalfFov * aspect);
+
+		int32_t mapX = static_cast<int32_t>(std::floor(cameraPos.x));
+		int32_t mapZ = static_cast<int32_t>(std::floor(cameraPos.y));
+		int32_t stepX = ray.x < 0.0f ? -1 : 1;
+		int32_t stepZ = ray.y < 0.0f ? -1 : 1;
+		float deltaX = ray.x != 0.0f ? std::abs(1.0f / ray.x) : infinity;
+		float deltaZ = ray.y != 0.0f ? std::abs(1.0f / ray.y) : infinity;
+		float sideX = (ray.x < 0.0f ? cameraPos.x - mapX : mapX + 1.0f - cameraPos.x) * deltaX;
+		float sideZ = (ray.y < 0.0f ? cameraPos.y - mapZ : mapZ + 1.0f - cameraPos.y) * deltaZ;
+
+		// Distance at which the ray entered the current tile, and which kind of edge it crossed.
+		float t = 0.0f;
+		bool crossedX = false;
+
+		float hitDistance = infinity;
+		uint16_t hitTexture = 0;
+		float hitU = 0.0f;
+
+		while (true)
+		{
+			bool isOutsideX = mapX < 0 || mapX >= map.width;
+			bool isOutsideZ = mapZ < 0 || mapZ >= map.depth;
+
+			if (isOutsideX || isOutsideZ)
+			{
+				// Keep walking only while the ray can still reach the map.
+				if ((mapX < 0 && ray.x <= 0.0f) || (mapX >= map.width && ray.x >= 0.0f) ||
+					(mapZ < 0 && ray.y <= 0.0f) || (mapZ >= map.depth && ray.y >= 0.0f))
+				{
+					break;
+				}
+			}
+			else
+			{
+				const RaycastTile& tile = map.tiles[static_cast<size_t>(mapZ) * map.width + mapX];
+				float exitT = std::min(sideX, sideZ);
+
+				// A camera standing inside a wall sees through it.
+				if (tile.type == RaycastTileType::Wall && t > 0.0f)
+				{
+					float hit = crossedX ? cameraPos.y + t * ray.y : cameraPos.x + t * ray.x;
+					hitU = hit - std::floor(hit);
+
+					// Flip so textures read left to right from whichever side they're seen.
+					if (crossedX ? ray.x < 0.0f : ray.y > 0.0f)
+					{
+						hitU = 1.0f - hitU;
+					}
+
+					hitDistance = t;
+					hitTexture = tile.textureIndex;
+					break;
+				}
+
+				if (tile.type == RaycastTileType::DoorX || tile.type == RaycastTileType::DoorZ)
+				{
+					bool isDoorX = tile.type == RaycastTileType::DoorX;
+					float rayAcross = isDoorX ? ray.y : ray.x;
+					float doorPlane = (isDoorX ? mapZ : mapX) + 0.5f;
+					float doorT = rayAcross != 0.0f ? (doorPlane - (isDoorX ? cameraPos.y : cameraPos.x)) / rayAcross : -1.0f;
+
+					if (doorT >= t && doorT < exitT)
+					{
+						float along = isDoorX ? cameraPos.x + doorT * ray.x - mapX : cameraPos.y + doorT * ray.y - mapZ;
+
+						// The open part of the doorway is at the far end, the door has slid back into the wall.
+						if (along < 1.0f - tile.openAmount)
+						{
+							hitU = along + tile.openAmount;
+
+							if (isDoorX ? ray.y > 0.0f : ray.x < 0.0f)
+							{
+								hitU = 1.0f - hitU;
+							}
+
+							hitDistance = doorT;
+							hitTexture = tile.textureIndex;
+							break;
+						}
+					}
+				}
+			}
+
+			if (sideX < sideZ)
+			{
+				t = sideX;
+				sideX += deltaX;
+				mapX += stepX;
+				crossedX = true;
+			}
+			else
+			{
+				t = sideZ;
+				sideZ += deltaZ;
+				mapZ += stepZ;
+				crossedX = false;
+			}
+		}
+
+		depthBuffer[x] = hitDistance;
+		DrawColumn(map, x, hitDistance, hitTexture, hitU);
+	}
+
+	DrawSprites(startX, endX);
+}
+
+void Raycaster::DrawColumn(const RaycastMap& map, int32_t x, float distance, uint16_t textureIndex, float textureU)
+{
+	uint32_t* column = &pixels[x];
+	float halfHeight = height * 0.5f;
+
+	// Rows are bottom first, so the floor fills up to the wall and the ceiling continues above it.
+	int32_t wallStart = static_cast<int32_t>(std::ceil(halfHeight - 0.5f));
+	int32_t wallEnd = wallStart;
+	float wallBottom = 0.0f;
+	float pixelsPerUnit = 0.0f;
+
+	if (distance != std::numeric_limits<float>::infinity())
+	{
+		pixelsPerUnit = halfHeight / (distance * tanHalfFov);
+		wallBottom = halfHeight - cameraHeight * pixelsPerUnit;
+		float wallTop = wallBottom + pixelsPerUnit;
+
+		// Covers the rows whose centres are inside the wall.
+		wallStart = static_cast<int32_t>(std::clamp(std::ceil(wallBottom - 0.5f), 0.0f, static_cast<float>(height)));
+		wallEnd = static_cast<int32_t>(std::clamp(std::ceil(wallTop - 0.5f), 0.0f, static_cast<float>(height)));
+	}
+
+	for (int32_t y = 0; y < wallStart; ++y)
+	{
+		column[static_cast<size_t>(y) * width] = map.floorColor;
+	}
+
+	if (wallEnd > wallStart)
+	{
+		uint32_t layer = std::min<uint32_t>(textureIndex, textureLayerCount - 1);
+		int32_t texelX = std::min(static_cast<int32_t>(textureU * textureWidth), textureWidth - 1);
+		const uint32_t* texels = &textureTexels[(static_cast<size_t>(layer) * textureWidth + texelX) * textureHeight];
+
+		float texelsPerPixel = textureHeight / pixelsPerUnit;
+		float v = (wallStart + 0.5f - wallBottom) * texelsPerPixel;
+
+		for (int32_t y = wallStart; y < wallEnd; ++y)
+		{
+			int32_t texelY = std::min(static_cast<int32_t>(v), textureHeight - 1);
+			column[static_cast<size_t>(y) * width] = texels[texelY] | 0xFF000000;
+			v += texelsPerPixel;
+		}
+	}
+
+	for (int32_t y = wallEnd; y < height; ++y)
+	{
+		column[static_cast<size_t>(y) * width] = map.ceilingColor;
+	}
+}
+
+void Raycaster::DrawSprites(int32_t startX, int32_t endX)
+{
+	for (const RaycastProjectedSprite& sprite : projectedSprites)
+	{
+		int32_t spriteStartX = std::max(startX, static_cast<int32_t>(std::ceil(sprite.left - 0.5f)));
+		int32_t spriteEndX = std::min(endX, static_cast<int32_t>(std::ceil(sprite.left + sprite.size - 0.5f)));
+		int32_t spriteStartY = std::max(0, static_cast<int32_t>(std::ceil(sprite.bottom - 0.5f)));
+		int32_t spriteEndY = std::min(height, static_cast<int32_t>(std::ceil(sprite.bottom + sprite.size - 0.5f)));
+
+		uint32_t layer = std::min<uint32_t>(sprite.textureIndex, textureLayerCount - 1);
+		float texelsPerPixelX = textureWidth / sprite.size;
+		float texelsPerPixelY = textureHeight / sprite.size;
+
+		for (int32_t x = spriteStartX; x < spriteEndX; ++x)
+		{
+			// Sprites are drawn back to front, so only walls need testing.
+			if (sprite.depth >= depthBuffer[x])
+			{
+				continue;
+			}
+
+			int32_t texelX = std::min(static_cast<int32_t>((x + 0.5f - sprite.left) * texelsPerPixelX), textureWidth - 1);
+			const uint32_t* texels = &textureTexels[(static_cast<size_t>(layer) * textureWidth + texelX) * textureHeight];
+			float v = (spriteStartY + 0.5f - sprite.bottom) * texelsPerPixelY;
+
+			for (int32_t y = spriteStartY; y < spriteEndY; ++y)
+			{
+				uint32_t texel = texels[std::min(static_cast<int32_t>(v), textureHeight - 1)];
+
+				if (texel & 0x80000000)
+				{
+					pixels[static_cast<size_t>(y) * width + x] = texel;
+				}
+
+				v += texelsPerPixelY;
+			}
+		}
+	}
+}
+
+int32_t Raycaster::GetWidth() const
+{
+	return width;
+}
+
+int32_t Raycaster::GetHeight() const
+{
+	return height;
+}
+
+const std::vector<uint32_t>& Raycaster::GetPixels() const
+{
+	return pixels;
+}
+
+const std::vector<float>& Raycaster::GetDepthBuffer() const
+{
+	return depthBuffer;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "WorkerPool.h"
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Columns are rendered in strips this wide, one strip per job. Wide enough that threads
+// rarely write to the same cache lines of the frame.
+constexpr int32_t raycastStripWidth = 32;
+
+enum class RaycastTileType : uint8_t
+{
+	Empty,
+	Wall,
+	// A door is a thin wall through the middle of its tile. DoorX runs along x and slides
+	// towards -x as it opens, DoorZ runs along z and slides towards -z.
+	DoorX,
+	DoorZ,
+};
+
+struct RaycastTile
+{
+	RaycastTileType type;
+	// Texture layer used for every side of a wall, or both sides of a door.
+	uint16_t textureIndex;
+	// How far a door has slid open, from 0 (closed) to 1 (open).
+	float openAmount;
+};
+
+// A grid of tiles on the xz plane, tile (x, z) covers [x, x + 1) and [z, z + 1). Walls
+// span y from 0 to 1, anything outside the grid is open space.
+struct RaycastMap
+{
+	int32_t width;
+	int32_t depth;
+	// Row major, tiles[z * width + x].
+	std::vector<RaycastTile> tiles;
+	// RGBA8, packed like the output pixels.
+	uint32_t floorColor;
+	uint32_t ceilingColor;
+};
+
+// A camera facing billboard standing on position.y, scale is its width and height.
+struct RaycastSprite
+{
+	glm::vec3 position;
+	float scale;
+	uint16_t textureIndex;
+};
+
+// Sprite projected to the screen, shared by every strip.
+struct RaycastProjectedSprite
+{
+	float depth;
+	float left;
+	float bottom;
+	float size;
+	uint16_t textureIndex;
+};
+
+// Renders grid maps Wolf3D style: one ray per screen column is walked through the map with
+// a DDA, and the wall it hits is drawn as a single textured column. The cost depends on the
+// screen width rather than the number of walls. Strips of columns are rendered in parallel.
+//
+// The frame is RGBA8, bottom row first, so it can be passed straight to
+// Renderer::UpdateTextureArrayLayer and drawn as a full-screen sprite.
+class Raycaster
+{
+public:
+	// Zero threads picks one per core, see WorkerPool.
+	Raycaster(int32_t width, int32_t height, uint32_t threadCount = 0);
+
+	void Resize(int32_t width, int32_t height);
+
+	// Loads the same images or texture pack a renderer's texture array was made from, so
+	// texture indices mean the same thing to both. Every texture must be the same size.
+	void LoadTextures(const std::vector<std::string>& images);
+	void LoadTexturePack(const std::string& packFile);
+
+	// Takes the same rotation and vertical fov as the renderers' cameras, pitch is ignored.
+	void SetCamera(glm::vec3 position, float yRot, float fov);
+	void Render(const RaycastMap& map, const std::vector<RaycastSprite>& sprites);
+
+	int32_t GetWidth() const;
+	int32_t GetHeight() const;
+	const std::vector<uint32_t>& GetPixels() const;
+	// Distance along the view direction to the wall in each column, infinite where no wall
+	// was hit. Sprites are tested against it.
+	const std::vector<float>& GetDepthBuffer() const;
+
+private:
+	void ProjectSprites(const std::vector<RaycastSprite>& sprites);
+	void RenderStrip(const RaycastMap& map, int32_t startX, int32_t endX);
+	void DrawColumn(const RaycastMap& map, int32_t x, float distance, uint16_t textureIndex, float textureU);
+	void DrawSprites(int32_t startX, int32_t endX);
+	void SetTextures(int32_t width, int32_t height, uint32_t layerCount, const uint32_t* texels);
+
+	WorkerPool workerPool;
+	int32_t width;
+	int32_t height;
+	std::vector<uint32_t> pixels;
+	std::vector<float> depthBuffer;
+
+	glm::vec2 cameraPos;
+	float cameraHeight;
+	glm::vec2 cameraDir;
+	glm::vec2 cameraRight;
+	float tanHalfFov;
+
+	// Layers are stored column major so a wall column reads contiguous texels.
+	std::vector<uint32_t> textureTexels;
+	int32_t textureWidth;
+	int32_t textureHeight;
+	uint32_t textureLayerCount;
+
+	// Back to front.
+	std::vector<RaycastProjectedSprite> projectedSprites;
+};
@@ -0,0 +1,177 @@
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	constexpr uint32_t radixBits = 8;
+	constexpr uint32_t radixSize = 1 << radixBits;
+
+	uint64_t GetKeyField(uint64_t value, uint32_t bits, uint32_t shift)
+	{
+		return (value & ((1ull << bits) - 1)) << shift;
+	}
+
+	uint64_t GetDepthBits(float depth)
+	{
+		// Non-negative floats sort the same as their bits do.
+		depth = std::max(depth, 0.0f);
+		uint32_t bits;
+		memcpy(&bits, &depth, sizeof(bits));
+
+		return bits;
+	}
+}
+
+PackedInstance* RenderQueue::Push(RenderPass pass, uint32_t pipeline, const Model* model,
+	const TextureArray* textureArray, float depth, size_t instanceCount)
+{
+	constexpr uint32_t depthShift = 0;
+	constexpr uint32_t modelShift = depthShift + renderKeyDepthBits;
+	constexpr uint32_t textureArrayShift = modelShift + renderKeyModelBits;
+	constexpr uint32_t pipelineShift = textureArrayShift + renderKeyTextureArrayBits;
+	constexpr uint32_t passShift = pipelineShift + renderKeyPipelineBits;
+	static_assert(passShift + renderKeyPassBits == 64, "Render key fields must fill 64 bits!");
+
+	uint64_t key = GetKeyField(static_cast<uint64_t>(pass), renderKeyPassBits, passShift) |
+		GetKeyField(pipeline, renderKeyPipelineBits, pipelineShift);
+
+	if (pass == RenderPass::Overlay)
+	{
+		// Overlays are painted in order, so the push order takes the place of everything below
+		// the pipeline. Equal neighbours still merge.
+		key |= GetKeyField(overlayCount++, pipelineShift, 0);
+	}
+	else
+	{
+		key |= GetKeyField(textureArray->texture, renderKeyTextureArrayBits, textureArrayShift) |
+			GetKeyField(model->vao, renderKeyModelBits, modelShift) |
+			GetKeyField(GetDepthBits(depth), renderKeyDepthBits, depthShift);
+	}
+
+	size_t firstInstance = instances.size();
+	commands.push_back(RenderCommand{ key, pass, pipeline, *model, *textureArray, firstInstance, instanceCount });
+	instances.resize(firstInstance + instanceCount);
+
+	return &instances[firstInstance];
+}
+
+void RenderQueue::TrimLast(size_t instanceCount)
+{
+	RenderCommand& command = commands.back();
+	instances.resize(command.firstInstance + instanceCount);
+
+	if (instanceCount == 0)
+	{
+		commands.pop_back();
+		return;
+	}
+
+	command.instanceCount = instanceCount;
+}
+
+void RenderQueue::Sort()
+{
+	size_t commandCount = commands.size();
+	sortKeys.resize(commandCount);
+	sortIndices.resize(commandCount);
+	scratchKeys.resize(commandCount);
+	scratchIndices.resize(commandCount);
+
+	for (size_t i = 0; i < commandCount; ++i)
+	{
+		sortKeys[i] = commands[i].key;
+		sortIndices[i] = static_cast<uint32_t>(i);
+	}
+
+	// Least significant digit first, each pass is stable so earlier digits stay in order.
+	for (uint32_t shift = 0; shift < 64; shift += radixBits)
+	{
+		size_t offsets[radixSize] = {};
+
+		for (uint64_t key : sortKeys)
+		{
+			++offsets[(key >> shift) & (radixSize - 1)];
+		}
+
+		// Digits every key shares, like unused fields, can't reorder anything.
+		if (commandCount == 0 || offsets[(sortKeys[0] >> shift) & (radixSize - 1)] == commandCount)
+		{
+			continue;
+		}
+
+		size_t total = 0;
+
+		for (size_t& offset : offsets)
+		{
+			size_t count = offset;
+			offset = total;
+			total += count;
+		}
+
+		for (size_t i = 0; i < commandCount; ++i)
+		{
+			size_t destination = offsets[(sortKeys[i] >> shift) & (radixSize - 1)]++;
+			scratchKeys[destination] = sortKeys[i];
+			scratchIndices[destination] = sortIndices[i];
+		}
+
+		sortKeys.swap(scratchKeys);
+		sortIndices.swap(scratchIndices);
+	}
+
+	batches.clear();
+	size_t instanceCursor = 0;
+
+	for (uint32_t index : sortIndices)
+	{
+		const RenderCommand& command = commands[index];
+
+		bool isMerged = !batches.empty() &&
+			batches.back().pass == command.pass &&
+			batches.back().pipeline == command.pipeline &&
+			batches.back().model.vao == command.model.vao &&
+			batches.back().textureArray.texture == command.textureArray.texture;
+
+		if (isMerged)
+		{
+			batches.back().instanceCount += command.instanceCount;
+			++batches.back().commandCount;
+		}
+		else
+		{
+			batches.push_back(RenderBatch{ command.pass, command.pipeline, command.model, command.textureArray,
+				instanceCursor, command.instanceCount, 1 });
+		}
+
+		instanceCursor += command.instanceCount;
+	}
+}
+
+void RenderQueue::WriteSortedInstances(PackedInstance* outInstances) const
+{
+	for (uint32_t index : sortIndices)
+	{
+		const RenderCommand& command = commands[index];
+		memcpy(outInstances, &instances[command.firstInstance], sizeof(PackedInstance) * command.instanceCount);
+		outInstances += command.instanceCount;
+	}
+}
+
+const std::vector<RenderBatch>& RenderQueue::GetBatches() const
+{
+	return batches;
+}
+
+size_t RenderQueue::GetInstanceCount() const
+{
+	return instances.size();
+}
+
+void RenderQueue::Clear()
+{
+	commands.clear();
+	instances.clear();
+	overlayCount = 0;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Renderer.h"
+
+// Passes are flushed in this order.
+enum class RenderPass : uint8_t
+{
+	// Depth tested, so draws can be reordered freely.
+	Opaque,
+	// Sprites are drawn over everything without depth testing, so they keep their order.
+	Overlay,
+};
+
+// Bit widths of the sort key's fields, from most to least significant. Texture arrays and
+// models are keyed by the low bits of TextureArray::texture and Model::vao, ids that collide
+// only cost a merge, batches always compare the full ids.
+constexpr uint32_t renderKeyPassBits = 4;
+constexpr uint32_t renderKeyPipelineBits = 4;
+constexpr uint32_t renderKeyTextureArrayBits = 12;
+constexpr uint32_t renderKeyModelBits = 12;
+constexpr uint32_t renderKeyDepthBits = 32;
+
+struct RenderCommand
+{
+	uint64_t key;
+	RenderPass pass;
+	uint32_t pipeline;
+	Model model;
+	TextureArray textureArray;
+	// Range in the queue's instances.
+	size_t firstInstance;
+	size_t instanceCount;
+};
+
+// Consecutive commands after sorting that share a pass, pipeline, model and texture array,
+// drawn with one instanced call.
+struct RenderBatch
+{
+	RenderPass pass;
+	uint32_t pipeline;
+	Model model;
+	TextureArray textureArray;
+	// Range in the instances written by WriteSortedInstances.
+	size_t firstInstance;
+	size_t instanceCount;
+	// How many commands were merged into this batch.
+	size_t commandCount;
+};
+
+// Deferred draws for one frame. Draw calls push commands with a 64-bit sort key instead of
+// drawing immediately, then Sort orders them with a radix sort and merges neighbours that
+// share state into batches, so the renderer changes state and issues a draw only when the
+// batch changes. Models and texture arrays must outlive the frame they are drawn in.
+class RenderQueue
+{
+public:
+	// Returns room for instanceCount instances, valid until the next Push. depth orders opaque
+	// draws front to back, overlay draws keep the order they were pushed in instead.
+	PackedInstance* Push(RenderPass pass, uint32_t pipeline, const Model* model, const TextureArray* textureArray,
+		float depth, size_t instanceCount);
+	// Shrinks the last pushed command to instanceCount, for callers that cull while writing.
+	// The command is dropped entirely at zero.
+	void TrimLast(size_t instanceCount);
+
+	// Sorts the commands and builds the batches.
+	void Sort();
+	const std::vector<RenderBatch>& GetBatches() const;
+	// Copies every instance in batch order, outInstances must hold GetInstanceCount entries.
+	// Straight into mapped memory, so instances are only copied once more after being pushed.
+	void WriteSortedInstances(PackedInstance* outInstances) const;
+	size_t GetInstanceCount() const;
+
+	// Call at the start of every frame, keeps the allocations.
+	void Clear();
+
+private:
+	std::vector<RenderCommand> commands;
+	std::vector<PackedInstance> instances;
+	uint32_t overlayCount = 0;
+
+	// Key and command index pairs, sorted back and forth between the two.
+	std::vector<uint64_t> sortKeys;
+	std::vector<uint32_t> sortIndices;
+	std::vector<uint64_t> scratchKeys;
+	std::vector<uint32_t> scratchIndices;
+
+	std::vector<RenderBatch> batches;
+};
@@ -0,0 +1,50 @@
+#include "Renderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <glm/gtc/packing.hpp>
+
+void PackInstances(const Instances* instances, PackedInstance* outInstances)
+{
+	size_t instanceCount = instances->offsets.size();
+
+	for (size_t i = 0; i < instanceCount; ++i)
+	{
+		PackInstance(instances, i, &outInstances[i]);
+	}
+}
+
+void CheckInstances(const Instances* instances)
+{
+	// Packed instances only have 16 bits for the texture index.
+	for (uint32_t textureIndex : instances->textureIndices)
+	{
+		if (textureIndex > UINT16_MAX)
+		{
+			throw std::runtime_error("Instance texture index is out of range of a packed instance!");
+		}
+	}
+}
+
+void PackInstance(const Instances* instances, size_t index, PackedInstance* outInstance)
+{
+	outInstance->offset = instances->offsets[index];
+	outInstance->rotation = glm::packHalf1x16(instances->rotations[index]);
+	outInstance->scale = glm::packHalf1x16(instances->scales[index]);
+	outInstance->textureIndex = static_cast<uint16_t>(instances->textureIndices[index]);
+	outInstance->textureArrayIndex = 0;
+}
+
+float GetBoundingRadius(const std::vector<float>& vertices)
+{
+	float radiusSquared = 0.0f;
+
+	for (size_t i = 0; i + 5 <= vertices.size(); i += 5)
+	{
+		radiusSquared = std::max(radiusSquared,
+			vertices[i] * vertices[i] + vertices[i + 1] * vertices[i + 1] + vertices[i + 2] * vertices[i + 2]);
+	}
+
+	return std::sqrt(radiusSquared);
+}
@@ -10,7 +10,8 @@
 #include <glm/glm.hpp>
 
 // TODO: The structs are specific to GL, move them there are replace the user facing
-// part with hashes into a map of resources.
+// part with hashes into a map of resources. VKRenderer already does this, it uses
+// Model::vao and TextureArray::texture as keys into its own resource maps.
 struct Camera
 {
 	float fov;
@@ -30,11 +31,9 @@ struct Model
 	uint32_t vao;
 	uint32_t vbo;
 	uint32_t ebo;
-	uint32_t instanceOffsetVbo;
-	uint32_t instanceRotationVbo;
-	uint32_t instanceScaleVbo;
-	uint32_t instanceTextureIndexVbo;
 	size_t indexCount;
+	// Distance from the model's origin to its furthest vertex, used for culling.
+	float boundingRadius;
 };
 
 struct TextureArray
@@ -42,6 +41,12 @@ struct TextureArray
 	uint32_t texture;
 };
 
+// Handle to a texture array that is still being decoded and uploaded.
+struct TextureArrayLoad
+{
+	uint32_t id;
+};
+
 struct Instances
 {
 	std::vector<glm::vec3> offsets;
@@ -50,6 +55,102 @@ struct Instances
 	std::vector<uint32_t> textureIndices;
 };
 
+// Interleaved instance record uploaded with a single binding. Rotation (degrees) and
+// scale are stored as half floats, so rotations are precise to about a quarter degree.
+struct PackedInstance
+{
+	glm::vec3 offset;
+	uint16_t rotation;
+	uint16_t scale;
+	uint16_t textureIndex;
+	// Overwritten by renderers that pick the texture array per instance, VKRenderer's
+	// bindless path stores the draw's texture array here.
+	uint16_t textureArrayIndex;
+};
+
+static_assert(sizeof(PackedInstance) == 20, "PackedInstance must stay 20 bytes!");
+
+struct PackedInstances
+{
+	std::vector<PackedInstance> instances;
+};
+
+// Converts SoA instances into packed records, outInstances must hold offsets.size() entries.
+// CheckInstances throws if they don't fit, Draw* calls it before reserving any space.
+void CheckInstances(const Instances* instances);
+void PackInstances(const Instances* instances, PackedInstance* outInstances);
+void PackInstance(const Instances* instances, size_t index, PackedInstance* outInstance);
+
+// Bounding radius of vertices in CreateModel's layout, see Model::boundingRadius.
+float GetBoundingRadius(const std::vector<float>& vertices);
+
+enum class PresentMode
+{
+	Immediate,
+	Mailbox,
+	Fifo,
+	FifoRelaxed,
+};
+
+struct RendererConfig
+{
+	// How many frames the CPU may record ahead of the GPU (1-4), only used by VKRenderer.
+	uint32_t framesInFlight = 2;
+	PresentMode presentMode = PresentMode::Immediate;
+	// Minimum time between frames in seconds, zero disables pacing.
+	double targetFrameTime = 0.0;
+	// Render offscreen without a window, GetWindowPtr returns null and frames are read
+	// back with CaptureFrame. GLRenderer needs to be built with GFPS_HEADLESS_EGL.
+	bool headless = false;
+	// Frustum and occlusion cull instanced models in a compute shader and draw them indirectly,
+	// only used by VKRenderer. Devices without drawIndirectFirstInstance frustum cull on the
+	// CPU instead.
+	bool gpuCulling = true;
+	// Bind every texture array at once through descriptor indexing and select them per
+	// instance, only used by VKRenderer. Devices without it bind a set for each draw instead.
+	bool bindlessTextures = true;
+	// Begin rendering with VK_KHR_dynamic_rendering and synchronization2 barriers instead of
+	// a render pass and framebuffers, only used by VKRenderer. Devices without the extensions
+	// use the render pass instead.
+	bool dynamicRendering = true;
+	// Compiled pipelines are saved here on exit and loaded on the next start, only used by
+	// VKRenderer. Empty keeps the cache in memory only.
+	std::string pipelineCacheFile = "pipeline_cache.bin";
+	// Recompile shaders/ sources with glslc as they are saved and rebuild the pipelines that
+	// use them, only used by VKRenderer on Linux.
+	bool shaderHotReload = false;
+	// Soft limit on device local memory in bytes, only used by VKRenderer. Above it the least
+	// recently used texture arrays are evicted and loaded again when next drawn. Zero uses
+	// most of the budget the driver reports.
+	uint64_t memoryBudget = 0;
+};
+
+// Rolling percentiles in milliseconds.
+struct TimingStats
+{
+	double last;
+	double p50;
+	double p95;
+	double p99;
+};
+
+struct FrameStats
+{
+	// Time between consecutive EndDrawing calls, including any frame pacing.
+	TimingStats frameTime;
+	TimingStats beginDrawingTime;
+	// All Draw* calls of a frame added together.
+	TimingStats drawTime;
+	// Submitting and presenting, frame pacing is not included.
+	TimingStats endDrawingTime;
+	// Measured with GPU timestamps, which arrive a few frames late. Zero if unsupported.
+	TimingStats gpuTime;
+	// Counts for the last completed frame.
+	uint32_t drawCount;
+	uint64_t instanceCount;
+	uint64_t triangleCount;
+};
+
 class Renderer
 {
 public:
@@ -63,14 +164,33 @@ public:
 
 	virtual void DrawModel(const Model* model, const TextureArray* textureArray, const Instances* instances) = 0;
 	virtual void DrawSprite(const Model* model, const TextureArray* textureArray, const Instances* instances) = 0;
+	virtual void DrawModel(const Model* model, const TextureArray* textureArray, const PackedInstances* instances) = 0;
+	virtual void DrawSprite(const Model* model, const TextureArray* textureArray, const PackedInstances* instances) = 0;
 
 	virtual Model CreateModel(const std::vector<float>& vertices, const std::vector<uint32_t>& indices) = 0;
 	virtual void UpdateModel(Model* model, const std::vector<float>& vertices, const std::vector<uint32_t>& indices) = 0;
 	virtual void DestroyModel(Model* model) = 0;
 
 	virtual TextureArray CreateTextureArray(const std::vector<std::string>& images) = 0;
+	// Decodes the images on worker threads, poll or wait on the load to get the texture array.
+	virtual TextureArrayLoad LoadTextureArrayAsync(const std::vector<std::string>& images) = 0;
+	// Uploads layers that have finished decoding, returns true once the texture array is complete.
+	virtual bool PollTextureArrayLoad(const TextureArrayLoad* load, TextureArray* outTextureArray) = 0;
+	virtual TextureArray WaitTextureArrayLoad(const TextureArrayLoad* load) = 0;
+	// Loads a texture array built by tools/texpack, its mips are uploaded as stored.
+	virtual TextureArray CreateTextureArrayFromPack(const std::string& packFile) = 0;
+	// A texture array without mips for contents that change every frame, such as a
+	// software rendered view. Its layers start out opaque black.
+	virtual TextureArray CreateDynamicTextureArray(int32_t width, int32_t height, uint32_t layerCount) = 0;
+	// Replaces one layer of a dynamic texture array with width * height RGBA8 pixels, bottom
+	// row first like decoded images. Update a layer before drawing with it in a frame.
+	virtual void UpdateTextureArrayLayer(const TextureArray* textureArray, uint32_t layer, const uint8_t* pixels) = 0;
 	virtual void DestroyTextureArray(TextureArray* textureArray) = 0;
 
+	// Reads back the last frame as RGBA8, top row first. Only available when headless.
+	virtual void CaptureFrame(std::vector<uint8_t>& outPixels) = 0;
+	virtual FrameStats GetFrameStats() = 0;
+
 	virtual void UpdateCamera() = 0;
 	virtual void SetCameraPosition(glm::vec3 position) = 0;
 	virtual void SetCameraRotation(float yRot, float xRot) = 0;
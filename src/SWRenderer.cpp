@@ -0,0 +1,1265 @@
+#include "SWRenderer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <glad/glad.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#endif
+
+#include "TexturePack.h"
+#include "../deps/stb_image.h"
+
+// Vertices are snapped to 1/16th of a pixel before their edges are set up.
+constexpr float subpixelScale = 16.0f;
+// Triangles reaching further than this past the viewport (in viewport sizes) are clipped,
+// anything closer is rasterized with its bounds clamped to the screen.
+constexpr float guardBand = 4.0f;
+
+namespace
+{
+	// The rasterizer is written against these so it runs 8 pixels at a time with AVX2,
+	// 4 with SSE2 and one at a time anywhere else. Masks are all ones in covered lanes.
+#if defined(__AVX2__)
+	constexpr int32_t laneCount = 8;
+	using VFloat = __m256;
+	using VInt = __m256i;
+
+	inline VFloat Splat(float value) { return _mm256_set1_ps(value); }
+	inline VFloat PixelCenters() { return _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f); }
+	inline VFloat Add(VFloat a, VFloat b) { return _mm256_add_ps(a, b); }
+	inline VFloat Sub(VFloat a, VFloat b) { return _mm256_sub_ps(a, b); }
+	inline VFloat Mul(VFloat a, VFloat b) { return _mm256_mul_ps(a, b); }
+	inline VFloat Div(VFloat a, VFloat b) { return _mm256_div_ps(a, b); }
+	inline VFloat Min(VFloat a, VFloat b) { return _mm256_min_ps(a, b); }
+	inline VFloat Floor(VFloat a) { return _mm256_floor_ps(a); }
+	inline VFloat CmpGt(VFloat a, VFloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+	inline VFloat CmpLt(VFloat a, VFloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	inline VFloat CmpEq(VFloat a, VFloat b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+	inline VFloat And(VFloat a, VFloat b) { return _mm256_and_ps(a, b); }
+	inline VFloat Or(VFloat a, VFloat b) { return _mm256_or_ps(a, b); }
+	inline VFloat AllLanes() { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+	inline bool AnyLane(VFloat mask) { return _mm256_movemask_ps(mask) != 0; }
+	inline VFloat Select(VFloat mask, VFloat a, VFloat b) { return _mm256_blendv_ps(b, a, mask); }
+	inline VFloat LoadF(const float* data) { return _mm256_loadu_ps(data); }
+	inline void StoreF(float* data, VFloat a) { _mm256_storeu_ps(data, a); }
+	inline VInt LoadI(const uint32_t* data) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data)); }
+	inline void StoreI(uint32_t* data, VInt a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(data), a); }
+	inline VInt ToInt(VFloat a) { return _mm256_cvttps_epi32(a); }
+	inline VInt OrI(VInt a, uint32_t b) { return _mm256_or_si256(a, _mm256_set1_epi32(static_cast<int32_t>(b))); }
+	inline VFloat AsFloat(VInt a) { return _mm256_castsi256_ps(a); }
+	inline VInt AsInt(VFloat a) { return _mm256_castps_si256(a); }
+
+	// Lanes outside the mask aren't read, their coordinates may be garbage.
+	inline VInt Gather(const uint32_t* texels, VInt index, VFloat mask)
+	{
+		return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), reinterpret_cast<const int32_t*>(texels), index,
+			AsInt(mask), 4);
+	}
+
+	// Alpha is the top byte, so an alpha of 128 or more makes the texel negative.
+	inline VFloat IsOpaque(VInt texels) { return AsFloat(_mm256_cmpgt_epi32(_mm256_setzero_si256(), texels)); }
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	constexpr int32_t laneCount = 4;
+	using VFloat = __m128;
+	using VInt = __m128i;
+
+	inline VFloat Splat(float value) { return _mm_set1_ps(value); }
+	inline VFloat PixelCenters() { return _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f); }
+	inline VFloat Add(VFloat a, VFloat b) { return _mm_add_ps(a, b); }
+	inline VFloat Sub(VFloat a, VFloat b) { return _mm_sub_ps(a, b); }
+	inline VFloat Mul(VFloat a, VFloat b) { return _mm_mul_ps(a, b); }
+	inline VFloat Div(VFloat a, VFloat b) { return _mm_div_ps(a, b); }
+	inline VFloat Min(VFloat a, VFloat b) { return _mm_min_ps(a, b); }
+	inline VFloat CmpGt(VFloat a, VFloat b) { return _mm_cmpgt_ps(a, b); }
+	inline VFloat CmpLt(VFloat a, VFloat b) { return _mm_cmplt_ps(a, b); }
+	inline VFloat CmpEq(VFloat a, VFloat b) { return _mm_cmpeq_ps(a, b); }
+	inline VFloat And(VFloat a, VFloat b) { return _mm_and_ps(a, b); }
+	inline VFloat Or(VFloat a, VFloat b) { return _mm_or_ps(a, b); }
+	inline VFloat AllLanes() { return _mm_castsi128_ps(_mm_set1_epi32(-1)); }
+	inline bool AnyLane(VFloat mask) { return _mm_movemask_ps(mask) != 0; }
+	inline VFloat Select(VFloat mask, VFloat a, VFloat b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+	inline VFloat LoadF(const float* data) { return _mm_loadu_ps(data); }
+	inline void StoreF(float* data, VFloat a) { _mm_storeu_ps(data, a); }
+	inline VInt LoadI(const uint32_t* data) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)); }
+	inline void StoreI(uint32_t* data, VInt a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(data), a); }
+	inline VInt ToInt(VFloat a) { return _mm_cvttps_epi32(a); }
+	inline VInt OrI(VInt a, uint32_t b) { return _mm_or_si128(a, _mm_set1_epi32(static_cast<int32_t>(b))); }
+	inline VFloat AsFloat(VInt a) { return _mm_castsi128_ps(a); }
+	inline VInt AsInt(VFloat a) { return _mm_castps_si128(a); }
+
+	// SSE2 has no round down, truncate and step back one where that rounded up.
+	inline VFloat Floor(VFloat a)
+	{
+		VFloat truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+		return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, a), _mm_set1_ps(1.0f)));
+	}
+
+	// Lanes outside the mask read texel 0, their coordinates may be garbage.
+	inline VInt Gather(const uint32_t* texels, VInt index, VFloat mask)
+	{
+		alignas(16) int32_t indices[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(indices), _mm_and_si128(index, AsInt(mask)));
+
+		return _mm_setr_epi32(static_cast<int32_t>(texels[indices[0]]), static_cast<int32_t>(texels[indices[1]]),
+			static_cast<int32_t>(texels[indices[2]]), static_cast<int32_t>(texels[indices[3]]));
+	}
+
+	// Alpha is the top byte, so an alpha of 128 or more makes the texel negative.
+	inline VFloat IsOpaque(VInt texels) { return AsFloat(_mm_cmplt_epi32(texels, _mm_setzero_si128())); }
+#else
+	constexpr int32_t laneCount = 1;
+	using VFloat = float;
+	using VInt = uint32_t;
+
+	inline VFloat AsFloat(VInt a) { float f; memcpy(&f, &a, sizeof(f)); return f; }
+	inline VInt AsInt(VFloat a) { uint32_t i; memcpy(&i, &a, sizeof(i)); return i; }
+	inline VFloat MaskOf(bool isSet) { return AsFloat(isSet ? UINT32_MAX : 0); }
+
+	inline VFloat Splat(float value) { return value; }
+	inline VFloat PixelCenters() { return 0.5f; }
+	inline VFloat Add(VFloat a, VFloat b) { return a + b; }
+	inline VFloat Sub(VFloat a, VFloat b) { return a - b; }
+	inline VFloat Mul(VFloat a, VFloat b) { return a * b; }
+	inline VFloat Div(VFloat a, VFloat b) { return a / b; }
+	inline VFloat Min(VFloat a, VFloat b) { return a < b ? a : b; }
+	inline VFloat Floor(VFloat a) { return std::floor(a); }
+	inline VFloat CmpGt(VFloat a, VFloat b) { return MaskOf(a > b); }
+	inline VFloat CmpLt(VFloat a, VFloat b) { return MaskOf(a < b); }
+	inline VFloat CmpEq(VFloat a, VFloat b) { return MaskOf(a == b); }
+	inline VFloat And(VFloat a, VFloat b) { return AsFloat(AsInt(a) & AsInt(b)); }
+	inline VFloat Or(VFloat a, VFloat b) { return AsFloat(AsInt(a) | AsInt(b)); }
+	inline VFloat AllLanes() { return MaskOf(true); }
+	inline bool AnyLane(VFloat mask) { return AsInt(mask) != 0; }
+	inline VFloat Select(VFloat mask, VFloat a, VFloat b) { return AnyLane(mask) ? a : b; }
+	inline VFloat LoadF(const float* data) { return *data; }
+	inline void StoreF(float* data, VFloat a) { *data = a; }
+	inline VInt LoadI(const uint32_t* data) { return *data; }
+	inline void StoreI(uint32_t* data, VInt a) { *data = a; }
+	inline VInt ToInt(VFloat a) { return static_cast<uint32_t>(static_cast<int32_t>(a)); }
+	inline VInt OrI(VInt a, uint32_t b) { return a | b; }
+	inline VInt Gather(const uint32_t* texels, VInt index, VFloat mask) { return AnyLane(mask) ? texels[index] : 0; }
+	inline VFloat IsOpaque(VInt texels) { return MaskOf((texels & 0x80000000) != 0); }
+#endif
+
+	struct ClipVertex
+	{
+		glm::vec4 pos;
+		glm::vec2 texCoord;
+	};
+
+	// Triangles need clipping when they cross the near plane or leave the guard band.
+	const glm::vec4 clipPlanes[] = {
+		glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+		glm::vec4(-1.0f, 0.0f, 0.0f, guardBand),
+		glm::vec4(1.0f, 0.0f, 0.0f, guardBand),
+		glm::vec4(0.0f, -1.0f, 0.0f, guardBand),
+		glm::vec4(0.0f, 1.0f, 0.0f, guardBand),
+	};
+
+	constexpr uint32_t maxClippedVertexCount = 3 + sizeof(clipPlanes) / sizeof(clipPlanes[0]);
+
+	// One bit per frustum plane the position is outside of.
+	uint32_t GetOutcode(const glm::vec4& pos)
+	{
+		return (pos.x > pos.w) | (pos.x < -pos.w) << 1 | (pos.y > pos.w) << 2 | (pos.y < -pos.w) << 3 |
+			(pos.z > pos.w) << 4 | (pos.z < -pos.w) << 5;
+	}
+
+	bool NeedsClipping(const glm::vec4& pos)
+	{
+		for (const glm::vec4& plane : clipPlanes)
+		{
+			if (glm::dot(plane, pos) < 0.0f)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Sutherland-Hodgman against one plane, keeps the side where dot(plane, pos) >= 0.
+	uint32_t ClipPolygon(const ClipVertex* vertices, uint32_t vertexCount, const glm::vec4& plane,
+		ClipVertex* outVertices)
+	{
+		uint32_t outCount = 0;
+
+		for (uint32_t i = 0; i < vertexCount; ++i)
+		{
+			const ClipVertex& a = vertices[i];
+			const ClipVertex& b = vertices[(i + 1) % vertexCount];
+			float distanceA = glm::dot(plane, a.pos);
+			float distanceB = glm::dot(plane, b.pos);
+
+			if (distanceA >= 0.0f)
+			{
+				outVertices[outCount++] = a;
+			}
+
+			if ((distanceA >= 0.0f) != (distanceB >= 0.0f))
+			{
+				float t = distanceA / (distanceA - distanceB);
+				outVertices[outCount++] = ClipVertex{ glm::mix(a.pos, b.pos, t), glm::mix(a.texCoord, b.texCoord, t) };
+			}
+		}
+
+		return outCount;
+	}
+
+	uint32_t PackColor(float r, float g, float b, float a)
+	{
+		auto toByte = [](float value) {
+			return static_cast<uint32_t>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+		};
+
+		return toByte(r) | toByte(g) << 8 | toByte(b) << 16 | toByte(a) << 24;
+	}
+
+	// 2x2 box filter of every layer. Colour is weighted by alpha so the colour key doesn't
+	// bleed into its neighbours, alpha stays binary since it's only used as a cutout.
+	void BuildMips(SWTexture& texture)
+	{
+		while (texture.levels.back().width > 1 || texture.levels.back().height > 1)
+		{
+			SWTextureLevel src = texture.levels.back();
+			SWTextureLevel dst = { std::max(src.width / 2, 1u), std::max(src.height / 2, 1u), texture.texels.size() };
+			texture.texels.resize(dst.offset + static_cast<size_t>(dst.width) * dst.height * texture.layerCount);
+
+			for (uint32_t layer = 0; layer < texture.layerCount; ++layer)
+			{
+				const uint32_t* srcTexels = &texture.texels[src.offset + static_cast<size_t>(layer) * src.width * src.height];
+				uint32_t* dstTexels = &texture.texels[dst.offset + static_cast<size_t>(layer) * dst.width * dst.height];
+
+				for (uint32_t y = 0; y < dst.height; ++y)
+				{
+					for (uint32_t x = 0; x < dst.width; ++x)
+					{
+						uint32_t color[3] = {};
+						uint32_t alpha = 0;
+
+						for (uint32_t sy = 0; sy < 2; ++sy)
+						{
+							for (uint32_t sx = 0; sx < 2; ++sx)
+							{
+								uint32_t srcX = std::min(x * 2 + sx, src.width - 1);
+								uint32_t srcY = std::min(y * 2 + sy, src.height - 1);
+								uint32_t texel = srcTexels[srcY * src.width + srcX];
+								uint32_t texelAlpha = texel >> 24;
+
+								for (uint32_t c = 0; c < 3; ++c)
+								{
+									color[c] += ((texel >> (c * 8)) & 0xFF) * texelAlpha;
+								}
+
+								alpha += texelAlpha;
+							}
+						}
+
+						uint32_t texel = alpha >= 2 * 255 ? 0xFF000000 : 0;
+
+						for (uint32_t c = 0; c < 3; ++c)
+						{
+							uint32_t value = alpha > 0 ? (color[c] + alpha / 2) / alpha : 0;
+							texel |= value << (c * 8);
+						}
+
+						dstTexels[y * dst.width + x] = texel;
+					}
+				}
+			}
+
+			texture.levels.push_back(dst);
+		}
+	}
+
+	// Turns the #660066 colour key into alpha so the rasterizer only has to test alpha.
+	void CopyColorKeyed(uint32_t* outTexels, const uint8_t* pixels, size_t texelCount)
+	{
+		memcpy(outTexels, pixels, texelCount * sizeof(uint32_t));
+
+		for (size_t i = 0; i < texelCount; ++i)
+		{
+			if ((outTexels[i] & 0x00FFFFFF) == 0x660066)
+			{
+				outTexels[i] = 0;
+			}
+		}
+	}
+}
+
+SWRenderer::SWRenderer(const std::string& windowName, int32_t windowWidth, int32_t windowHeight,
+	const RendererConfig& config)
+	: config(config), instanceCuller(workerPool), window(nullptr), width(windowWidth), height(windowHeight),
+	clearColor(0xFF000000), presentTexture(0), presentFramebuffer(0), geometryJobCount(0), nextMeshId(1),
+	nextTextureId(1)
+{
+	if (!config.headless)
+	{
+		InitWindow(windowName);
+	}
+
+	framePacer.SetTargetFrameTime(config.targetFrameTime);
+	InitFramebuffer();
+
+	if (window)
+	{
+		InitPresentTarget();
+	}
+
+	camera = Camera{
+		45.0f,
+		0.1f,
+		100.0f,
+		glm::vec3(0.0f, 0.0f, 0.0f),
+		glm::vec3(0.0f, 0.0f, -1.0f),
+		glm::vec3(0.0f, 1.0f, 0.0f),
+		-1,
+		-1,
+		-1,
+		-1,
+	};
+
+	UpdateCamera();
+}
+
+void SWRenderer::InitWindow(const std::string& windowName)
+{
+	if (!glfwInit())
+	{
+		throw std::runtime_error("Failed to initialize glfw!");
+	}
+
+	// GL is only used to get finished frames onto the screen.
+	window = glfwCreateWindow(width, height, windowName.c_str(), nullptr, nullptr);
+
+	if (!window)
+	{
+		glfwTerminate();
+		throw std::runtime_error("Failed to create a window!");
+	}
+
+	glfwMakeContextCurrent(window);
+	gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+
+	switch (config.presentMode)
+	{
+	case PresentMode::Immediate:
+	case PresentMode::Mailbox:
+		glfwSwapInterval(0);
+		break;
+	case PresentMode::Fifo:
+		glfwSwapInterval(1);
+		break;
+	case PresentMode::FifoRelaxed:
+	{
+		bool canTear = glfwExtensionSupported("WGL_EXT_swap_control_tear") ||
+			glfwExtensionSupported("GLX_EXT_swap_control_tear");
+		glfwSwapInterval(canTear ? -1 : 1);
+		break;
+	}
+	}
+}
+
+void SWRenderer::InitFramebuffer()
+{
+	tileCountX = (std::max(width, 0) + swTileSize - 1) / swTileSize;
+	tileCountY = (std::max(height, 0) + swTileSize - 1) / swTileSize;
+	pitch = tileCountX * swTileSize;
+
+	size_t pixelCount = static_cast<size_t>(pitch) * tileCountY * swTileSize;
+	colorBuffer.assign(pixelCount, clearColor);
+	depthBuffer.assign(pixelCount, 1.0f);
+}
+
+void SWRenderer::InitPresentTarget()
+{
+	glGenTextures(1, &presentTexture);
+	glBindTexture(GL_TEXTURE_2D, presentTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+	glGenFramebuffers(1, &presentFramebuffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, presentFramebuffer);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, presentTexture, 0);
+}
+
+void SWRenderer::DestroyPresentTarget()
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &presentFramebuffer);
+	glDeleteTextures(1, &presentTexture);
+	presentFramebuffer = 0;
+	presentTexture = 0;
+}
+
+void SWRenderer::CloseWindow()
+{
+	if (window)
+	{
+		DestroyPresentTarget();
+	}
+
+	glfwTerminate();
+}
+
+void SWRenderer::ResizeWindow(int32_t width, int32_t height)
+{
+	this->width = width;
+	this->height = height;
+	InitFramebuffer();
+
+	if (window)
+	{
+		DestroyPresentTarget();
+		InitPresentTarget();
+	}
+}
+
+GLFWwindow* SWRenderer::GetWindowPtr()
+{
+	return window;
+}
+
+void SWRenderer::SetClearColor(float r, float g, float b, float a)
+{
+	clearColor = PackColor(r, g, b, a);
+}
+
+void SWRenderer::BeginDrawing()
+{
+	auto start = FrameProfiler::Now();
+
+	frameInstances.clear();
+	drawCommands.clear();
+
+	frameProfiler.EndStage(ProfilerStage::BeginDrawing, start);
+}
+
+void SWRenderer::EndDrawing()
+{
+	auto start = FrameProfiler::Now();
+
+	RenderFrame();
+	frameProfiler.AddGpuTime(std::chrono::duration<double, std::milli>(FrameProfiler::Now() - start).count());
+
+	if (window)
+	{
+		Present();
+	}
+
+	frameProfiler.EndStage(ProfilerStage::EndDrawing, start);
+	framePacer.Wait();
+	frameProfiler.EndFrame();
+
+	if (window)
+	{
+		glfwPollEvents();
+	}
+}
+
+void SWRenderer::Present()
+{
+	if (width <= 0 || height <= 0)
+	{
+		return;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, presentTexture);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, colorBuffer.data());
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, presentFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+	glfwSwapBuffers(window);
+}
+
+void SWRenderer::DrawModel(const Model* model, const TextureArray* textureArray, const Instances* instances)
+{
+	auto start = FrameProfiler::Now();
+	size_t instanceCount = instances->offsets.size();
+
+	if (instanceCount == 0)
+	{
+		return;
+	}
+
+	CheckInstances(instances);
+
+	size_t firstInstance = frameInstances.size();
+	frameInstances.resize(firstInstance + instanceCount);
+	size_t visibleCount = instanceCuller.Cull(frustum, model->boundingRadius, instances, &frameInstances[firstInstance]);
+	frameInstances.resize(firstInstance + visibleCount);
+
+	if (visibleCount == 0)
+	{
+		frameProfiler.EndStage(ProfilerStage::Draw, start);
+		return;
+	}
+
+	RecordDraw(model, textureArray, static_cast<uint32_t>(firstInstance), static_cast<uint32_t>(visibleCount), false);
+	frameProfiler.EndDraw(start, model->indexCount, visibleCount);
+}
+
+void SWRenderer::DrawSprite(const Model* model, const TextureArray* textureArray, const Instances* instances)
+{
+	auto start = FrameProfiler::Now();
+	size_t instanceCount = instances->offsets.size();
+
+	if (instanceCount == 0)
+	{
+		return;
+	}
+
+	CheckInstances(instances);
+
+	size_t firstInstance = frameInstances.size();
+	frameInstances.resize(firstInstance + instanceCount);
+	PackInstances(instances, &frameInstances[firstInstance]);
+
+	RecordDraw(model, textureArray, static_cast<uint32_t>(firstInstance), static_cast<uint32_t>(instanceCount), true);
+	frameProfiler.EndDraw(start, model->indexCount, instanceCount);
+}
+
+void SWRenderer::DrawModel(const Model* model, const TextureArray* textureArray, const PackedInstances* instances)
+{
+	auto start = FrameProfiler::Now();
+	size_t instanceCount = instances->instances.size();
+
+	if (instanceCount == 0)
+	{
+		return;
+	}
+
+	size_t firstInstance = frameInstances.size();
+	frameInstances.resize(firstInstance + instanceCount);
+	size_t visibleCount = instanceCuller.Cull(frustum, model->boundingRadius, instances, &frameInstances[firstInstance]);
+	frameInstances.resize(firstInstance + visibleCount);
+
+	if (visibleCount == 0)
+	{
+		frameProfiler.EndStage(ProfilerStage::Draw, start);
+		return;
+	}
+
+	RecordDraw(model, textureArray, static_cast<uint32_t>(firstInstance), static_cast<uint32_t>(visibleCount), false);
+	frameProfiler.EndDraw(start, model->indexCount, visibleCount);
+}
+
+void SWRenderer::DrawSprite(const Model* model, const TextureArray* textureArray, const PackedInstances* instances)
+{
+	auto start = FrameProfiler::Now();
+	size_t instanceCount = instances->instances.size();
+
+	if (instanceCount == 0)
+	{
+		return;
+	}
+
+	size_t firstInstance = frameInstances.size();
+	frameInstances.insert(frameInstances.end(), instances->instances.begin(), instances->instances.end());
+
+	RecordDraw(model, textureArray, static_cast<uint32_t>(firstInstance), static_cast<uint32_t>(instanceCount), true);
+	frameProfiler.EndDraw(start, model->indexCount, instanceCount);
+}
+
+void SWRenderer::RecordDraw(const Model* model, const TextureArray* textureArray, uint32_t firstInstance,
+	uint32_t instanceCount, bool is2D)
+{
+	drawCommands.push_back(SWDrawCommand{ model->vao, textureArray->texture, firstInstance, instanceCount, is2D });
+}
+
+void SWRenderer::RenderFrame()
+{
+	if (width <= 0 || height <= 0)
+	{
+		return;
+	}
+
+	BuildGeometryJobs();
+
+	workerPool.Run(geometryJobCount, [&](uint32_t jobIndex) {
+		ProcessGeometryJob(geometryJobs[jobIndex]);
+		});
+
+	workerPool.Run(static_cast<uint32_t>(tileCountX * tileCountY), [&](uint32_t tileIndex) {
+		RasterizeTile(tileIndex);
+		});
+}
+
+void SWRenderer::BuildGeometryJobs()
+{
+	drawSegments.clear();
+	geometryJobCount = 0;
+	uint32_t jobTriangleCount = 0;
+
+	// Commands are split or merged into jobs of about swGeometryJobSize triangles, in order.
+	for (const SWDrawCommand& command : drawCommands)
+	{
+		auto meshIt = meshes.find(command.meshId);
+		auto textureIt = textures.find(command.textureId);
+
+		// Resources destroyed after being drawn are skipped rather than read after free.
+		if (meshIt == meshes.end() || textureIt == textures.end() || meshIt->second.indices.size() < 3)
+		{
+			continue;
+		}
+
+		uint32_t triangleCount = static_cast<uint32_t>(meshIt->second.indices.size() / 3);
+		uint32_t instance = 0;
+
+		while (instance < command.instanceCount)
+		{
+			if (geometryJobCount == 0 || jobTriangleCount >= swGeometryJobSize)
+			{
+				if (geometryJobs.size() == geometryJobCount)
+				{
+					geometryJobs.emplace_back();
+				}
+
+				SWGeometryJob& job = geometryJobs[geometryJobCount++];
+				job.firstSegment = static_cast<uint32_t>(drawSegments.size());
+				job.segmentCount = 0;
+				jobTriangleCount = 0;
+			}
+
+			uint32_t room = (swGeometryJobSize - jobTriangleCount + triangleCount - 1) / triangleCount;
+			uint32_t count = std::min(room, command.instanceCount - instance);
+
+			drawSegments.push_back(SWDrawSegment{ &meshIt->second, &textureIt->second, &command, instance, count });
+			++geometryJobs[geometryJobCount - 1].segmentCount;
+			jobTriangleCount += count * triangleCount;
+			instance += count;
+		}
+	}
+
+	for (uint32_t i = 0; i < geometryJobCount; ++i)
+	{
+		geometryJobs[i].tiles.resize(static_cast<size_t>(tileCountX) * tileCountY);
+	}
+}
+
+void SWRenderer::ProcessGeometryJob(SWGeometryJob& job)
+{
+	job.triangles.clear();
+
+	for (std::vector<uint32_t>& tile : job.tiles)
+	{
+		tile.clear();
+	}
+
+	for (uint32_t i = 0; i < job.segmentCount; ++i)
+	{
+		const SWDrawSegment& segment = drawSegments[job.firstSegment + i];
+		const SWMesh& mesh = *segment.mesh;
+		const SWDrawCommand& command = *segment.command;
+		job.positions.resize(mesh.vertices.size());
+
+		for (uint32_t j = 0; j < segment.instanceCount; ++j)
+		{
+			const PackedInstance& instance = frameInstances[command.firstInstance + segment.firstInstance + j];
+			float theta = glm::radians(glm::unpackHalf1x16(instance.rotation));
+			float scale = glm::unpackHalf1x16(instance.scale);
+			float c = cos(theta);
+			float s = sin(theta);
+
+			// Matches the vertex shaders, sprites spin around z and models around y.
+			glm::mat4 transform;
+
+			if (command.is2D)
+			{
+				glm::mat4 zRotation(
+					c, -s, 0, 0,
+					s, c, 0, 0,
+					0, 0, 0, 0,
+					0, 0, 0, 1);
+				transform = glm::translate(glm::mat4(1.0f), instance.offset) * orthoProj * zRotation *
+					glm::scale(glm::mat4(1.0f), glm::vec3(scale));
+			}
+			else
+			{
+				glm::mat4 yRotation(
+					c, 0, s, 0,
+					0, 1, 0, 0,
+					-s, 0, c, 0,
+					0, 0, 0, 1);
+				transform = viewProj * glm::translate(glm::mat4(1.0f), instance.offset) * yRotation *
+					glm::scale(glm::mat4(1.0f), glm::vec3(scale));
+			}
+
+			for (size_t v = 0; v < mesh.vertices.size(); ++v)
+			{
+				job.positions[v] = transform * glm::vec4(mesh.vertices[v].pos, 1.0f);
+			}
+
+			uint32_t layer = std::min<uint32_t>(instance.textureIndex, segment.texture->layerCount - 1);
+
+			for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3)
+			{
+				glm::vec4 positions[3];
+				glm::vec2 texCoords[3];
+				uint32_t outcode = UINT32_MAX;
+				bool needsClipping = false;
+
+				for (uint32_t v = 0; v < 3; ++v)
+				{
+					uint32_t index = mesh.indices[t + v];
+					positions[v] = job.positions[index];
+					texCoords[v] = mesh.vertices[index].texCoord;
+					outcode &= GetOutcode(positions[v]);
+					needsClipping |= NeedsClipping(positions[v]);
+				}
+
+				// Entirely outside one of the frustum planes.
+				if (outcode != 0)
+				{
+					continue;
+				}
+
+				if (!needsClipping)
+				{
+					SetupTriangle(job, positions, texCoords, segment.texture, layer, !command.is2D);
+					continue;
+				}
+
+				ClipVertex polygon[2][maxClippedVertexCount];
+				uint32_t vertexCount = 3;
+
+				for (uint32_t v = 0; v < 3; ++v)
+				{
+					polygon[0][v] = ClipVertex{ positions[v], texCoords[v] };
+				}
+
+				uint32_t current = 0;
+
+				for (const glm::vec4& plane : clipPlanes)
+				{
+					vertexCount = ClipPolygon(polygon[current], vertexCount, plane, polygon[current ^ 1]);
+					current ^= 1;
+				}
+
+				// The clipped polygon is convex, so fan it back into triangles.
+				for (uint32_t v = 2; v < vertexCount; ++v)
+				{
+					const ClipVertex* fan[3] = { &polygon[current][0], &polygon[current][v - 1], &polygon[current][v] };
+
+					for (uint32_t f = 0; f < 3; ++f)
+					{
+						positions[f] = fan[f]->pos;
+						texCoords[f] = fan[f]->texCoord;
+					}
+
+					SetupTriangle(job, positions, texCoords, segment.texture, layer, !command.is2D);
+				}
+			}
+		}
+	}
+}
+
+void SWRenderer::SetupTriangle(SWGeometryJob& job, const glm::vec4* positions, const glm::vec2* texCoords,
+	const SWTexture* texture, uint32_t layer, bool isDepthTested)
+{
+	float x[3];
+	float y[3];
+	double values[4][3];
+
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		float invW = 1.0f / positions[i].w;
+		float screenX = (positions[i].x * invW * 0.5f + 0.5f) * width;
+		float screenY = (positions[i].y * invW * 0.5f + 0.5f) * height;
+		x[i] = std::floor(screenX * subpixelScale + 0.5f) / subpixelScale;
+		y[i] = std::floor(screenY * subpixelScale + 0.5f) / subpixelScale;
+
+		values[0][i] = positions[i].z * invW * 0.5f + 0.5f;
+		values[1][i] = invW;
+		values[2][i] = texCoords[i].x * invW;
+		values[3][i] = texCoords[i].y * invW;
+	}
+
+	double area2 = (static_cast<double>(x[1]) - x[0]) * (static_cast<double>(y[2]) - y[0]) -
+		(static_cast<double>(x[2]) - x[0]) * (static_cast<double>(y[1]) - y[0]);
+
+	// Back faces and degenerate triangles, front faces wind counter-clockwise like GL's default.
+	if (area2 <= 0.0)
+	{
+		return;
+	}
+
+	SWTriangle triangle;
+	triangle.minX = std::max(static_cast<int32_t>(std::ceil(std::min({ x[0], x[1], x[2] }) - 0.5f)), 0);
+	triangle.minY = std::max(static_cast<int32_t>(std::ceil(std::min({ y[0], y[1], y[2] }) - 0.5f)), 0);
+	triangle.maxX = std::min(static_cast<int32_t>(std::floor(std::max({ x[0], x[1], x[2] }) - 0.5f)), width - 1);
+	triangle.maxY = std::min(static_cast<int32_t>(std::floor(std::max({ y[0], y[1], y[2] }) - 0.5f)), height - 1);
+
+	if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+	{
+		return;
+	}
+
+	// Edge i is opposite vertex i. C is worked out in double so an edge shared by two
+	// triangles gets exactly negated coefficients and no pixel is drawn twice or skipped.
+	double edgeC[3];
+
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		uint32_t a = (i + 1) % 3;
+		uint32_t b = (i + 2) % 3;
+		triangle.edgeA[i] = y[a] - y[b];
+		triangle.edgeB[i] = x[b] - x[a];
+		edgeC[i] = static_cast<double>(x[a]) * y[b] - static_cast<double>(x[b]) * y[a];
+		triangle.edgeC[i] = static_cast<float>(edgeC[i]);
+		triangle.isTopLeft[i] = triangle.edgeA[i] > 0.0f || (triangle.edgeA[i] == 0.0f && triangle.edgeB[i] < 0.0f);
+	}
+
+	for (uint32_t k = 0; k < 4; ++k)
+	{
+		double dx = 0.0;
+		double dy = 0.0;
+		double c = 0.0;
+
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			dx += values[k][i] * triangle.edgeA[i];
+			dy += values[k][i] * triangle.edgeB[i];
+			c += values[k][i] * edgeC[i];
+		}
+
+		triangle.planeDx[k] = static_cast<float>(dx / area2);
+		triangle.planeDy[k] = static_cast<float>(dy / area2);
+		triangle.planeC[k] = static_cast<float>(c / area2);
+	}
+
+	// One mip for the whole triangle, from how many texels it covers per pixel. Close to
+	// GL_NEAREST_MIPMAP_NEAREST for small triangles, coarser across large sloped ones.
+	const SWTextureLevel& baseLevel = texture->levels[0];
+	double uvArea2 = std::abs((static_cast<double>(texCoords[1].x) - texCoords[0].x) * (static_cast<double>(texCoords[2].y) - texCoords[0].y) -
+		(static_cast<double>(texCoords[2].x) - texCoords[0].x) * (static_cast<double>(texCoords[1].y) - texCoords[0].y));
+	double texelArea2 = uvArea2 * baseLevel.width * baseLevel.height;
+	uint32_t mip = 0;
+
+	if (texelArea2 > area2)
+	{
+		double lod = 0.5 * std::log2(texelArea2 / area2);
+		mip = std::min(static_cast<uint32_t>(lod + 0.5), static_cast<uint32_t>(texture->levels.size()) - 1);
+	}
+
+	const SWTextureLevel& level = texture->levels[mip];
+	triangle.texels = &texture->texels[level.offset + static_cast<size_t>(layer) * level.width * level.height];
+	triangle.textureWidth = level.width;
+	triangle.textureHeight = level.height;
+	triangle.isDepthTested = isDepthTested;
+
+	uint32_t triangleIndex = static_cast<uint32_t>(job.triangles.size());
+	job.triangles.push_back(triangle);
+
+	for (int32_t tileY = triangle.minY / swTileSize; tileY <= triangle.maxY / swTileSize; ++tileY)
+	{
+		for (int32_t tileX = triangle.minX / swTileSize; tileX <= triangle.maxX / swTileSize; ++tileX)
+		{
+			job.tiles[static_cast<size_t>(tileY) * tileCountX + tileX].push_back(triangleIndex);
+		}
+	}
+}
+
+void SWRenderer::RasterizeTile(uint32_t tileIndex)
+{
+	int32_t tileX = static_cast<int32_t>(tileIndex % tileCountX) * swTileSize;
+	int32_t tileY = static_cast<int32_t>(tileIndex / tileCountX) * swTileSize;
+
+	for (int32_t y = tileY; y < tileY + swTileSize; ++y)
+	{
+		size_t rowStart = static_cast<size_t>(y) * pitch + tileX;
+		std::fill_n(&colorBuffer[rowStart], swTileSize, clearColor);
+		std::fill_n(&depthBuffer[rowStart], swTileSize, 1.0f);
+	}
+
+	for (uint32_t i = 0; i < geometryJobCount; ++i)
+	{
+		const SWGeometryJob& job = geometryJobs[i];
+
+		for (uint32_t triangleIndex : job.tiles[tileIndex])
+		{
+			RasterizeTriangle(job.triangles[triangleIndex], tileX, tileY);
+		}
+	}
+}
+
+void SWRenderer::RasterizeTriangle(const SWTriangle& triangle, int32_t tileX, int32_t tileY)
+{
+	// Rows start on a lane boundary, the buffers are padded so the last group never overruns.
+	int32_t minX = std::max(triangle.minX, tileX) & ~(laneCount - 1);
+	int32_t maxX = std::min(triangle.maxX, tileX + swTileSize - 1);
+	int32_t minY = std::max(triangle.minY, tileY);
+	int32_t maxY = std::min(triangle.maxY, tileY + swTileSize - 1);
+
+	VFloat zero = Splat(0.0f);
+	VFloat edgeA[3];
+	VFloat topLeft[3];
+
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		edgeA[i] = Splat(triangle.edgeA[i]);
+		topLeft[i] = triangle.isTopLeft[i] ? AllLanes() : zero;
+	}
+
+	VFloat planeDx[4];
+
+	for (uint32_t k = 0; k < 4; ++k)
+	{
+		planeDx[k] = Splat(triangle.planeDx[k]);
+	}
+
+	VFloat one = Splat(1.0f);
+	VFloat textureWidth = Splat(static_cast<float>(triangle.textureWidth));
+	VFloat textureHeight = Splat(static_cast<float>(triangle.textureHeight));
+	VFloat maxTexelX = Splat(static_cast<float>(triangle.textureWidth - 1));
+	VFloat maxTexelY = Splat(static_cast<float>(triangle.textureHeight - 1));
+
+	for (int32_t y = minY; y <= maxY; ++y)
+	{
+		float pixelY = y + 0.5f;
+		VFloat rowEdge[3];
+		VFloat rowPlane[4];
+
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			rowEdge[i] = Splat(triangle.edgeB[i] * pixelY + triangle.edgeC[i]);
+		}
+
+		for (uint32_t k = 0; k < 4; ++k)
+		{
+			rowPlane[k] = Splat(triangle.planeDy[k] * pixelY + triangle.planeC[k]);
+		}
+
+		uint32_t* colorRow = &colorBuffer[static_cast<size_t>(y) * pitch];
+		float* depthRow = &depthBuffer[static_cast<size_t>(y) * pitch];
+
+		for (int32_t x = minX; x <= maxX; x += laneCount)
+		{
+			VFloat pixelX = Add(Splat(static_cast<float>(x)), PixelCenters());
+			VFloat mask = AllLanes();
+
+			for (uint32_t i = 0; i < 3; ++i)
+			{
+				VFloat edge = Add(Mul(edgeA[i], pixelX), rowEdge[i]);
+				mask = And(mask, Or(CmpGt(edge, zero), And(CmpEq(edge, zero), topLeft[i])));
+			}
+
+			if (!AnyLane(mask))
+			{
+				continue;
+			}
+
+			VFloat depth = Add(Mul(planeDx[0], pixelX), rowPlane[0]);
+			VFloat oldDepth = zero;
+
+			if (triangle.isDepthTested)
+			{
+				oldDepth = LoadF(depthRow + x);
+				mask = And(mask, CmpLt(depth, oldDepth));
+
+				if (!AnyLane(mask))
+				{
+					continue;
+				}
+			}
+
+			// Perspective correct texture coordinates, wrapped like GL_REPEAT.
+			VFloat w = Div(one, Add(Mul(planeDx[1], pixelX), rowPlane[1]));
+			VFloat u = Mul(Add(Mul(planeDx[2], pixelX), rowPlane[2]), w);
+			VFloat v = Mul(Add(Mul(planeDx[3], pixelX), rowPlane[3]), w);
+			VFloat texelX = Min(Floor(Mul(Sub(u, Floor(u)), textureWidth)), maxTexelX);
+			VFloat texelY = Min(Floor(Mul(Sub(v, Floor(v)), textureHeight)), maxTexelY);
+			VInt texel = Gather(triangle.texels, ToInt(Add(Mul(texelY, textureWidth), texelX)), mask);
+
+			// The colour key was turned into alpha when the texture was loaded.
+			mask = And(mask, IsOpaque(texel));
+
+			if (!AnyLane(mask))
+			{
+				continue;
+			}
+
+			VFloat color = AsFloat(OrI(texel, 0xFF000000));
+			StoreI(colorRow + x, AsInt(Select(mask, color, AsFloat(LoadI(colorRow + x)))));
+
+			if (triangle.isDepthTested)
+			{
+				StoreF(depthRow + x, Select(mask, depth, oldDepth));
+			}
+		}
+	}
+}
+
+Model SWRenderer::CreateModel(const std::vector<float>& vertices, const std::vector<uint32_t>& indices)
+{
+	Model model = { nextMeshId++, 0, 0, 0, 0.0f };
+	meshes[model.vao] = SWMesh{};
+	UpdateModel(&model, vertices, indices);
+
+	return model;
+}
+
+void SWRenderer::UpdateModel(Model* model, const std::vector<float>& vertices, const std::vector<uint32_t>& indices)
+{
+	SWMesh& mesh = meshes.at(model->vao);
+	size_t vertexCount = vertices.size() / 5;
+
+	// Indices are read without bounds checks while rasterizing.
+	for (uint32_t index : indices)
+	{
+		if (index >= vertexCount)
+		{
+			throw std::runtime_error("Model index is out of range of its vertices!");
+		}
+	}
+
+	mesh.vertices.resize(vertexCount);
+
+	for (size_t i = 0; i < vertexCount; ++i)
+	{
+		const float* vertex = &vertices[i * 5];
+		mesh.vertices[i] = SWVertex{ glm::vec3(vertex[0], vertex[1], vertex[2]), glm::vec2(vertex[3], vertex[4]) };
+	}
+
+	mesh.indices = indices;
+	model->indexCount = indices.size();
+	model->boundingRadius = GetBoundingRadius(vertices);
+}
+
+void SWRenderer::DestroyModel(Model* model)
+{
+	meshes.erase(model->vao);
+}
+
+TextureArray SWRenderer::CreateTextureArray(const std::vector<std::string>& images)
+{
+	TextureArrayLoad load = LoadTextureArrayAsync(images);
+
+	return WaitTextureArrayLoad(&load);
+}
+
+TextureArrayLoad SWRenderer::LoadTextureArrayAsync(const std::vector<std::string>& images)
+{
+	if (images.size() < 1)
+	{
+		throw std::runtime_error("No images supplied when creating texture array!");
+	}
+
+	uint32_t id = textureDecoder.Decode(images, STBI_rgb_alpha);
+	pendingTextures[id] = SWPendingTexture{ static_cast<uint32_t>(images.size()), 0, 0, {} };
+
+	return TextureArrayLoad{ id };
+}
+
+bool SWRenderer::PollTextureArrayLoad(const TextureArrayLoad* load, TextureArray* outTextureArray)
+{
+	return CollectTextureLayers(load->id, false, outTextureArray);
+}
+
+TextureArray SWRenderer::WaitTextureArrayLoad(const TextureArrayLoad* load)
+{
+	TextureArray textureArray;
+
+	while (!CollectTextureLayers(load->id, true, &textureArray));
+
+	return textureArray;
+}
+
+bool SWRenderer::CollectTextureLayers(uint32_t loadId, bool wait, TextureArray* outTextureArray)
+{
+	auto it = pendingTextures.find(loadId);
+
+	if (it == pendingTextures.end())
+	{
+		throw std::runtime_error("Tried to poll an unknown texture array load!");
+	}
+
+	SWPendingTexture& pending = it->second;
+	std::vector<DecodedImage> images;
+	bool isDecoded;
+
+	try
+	{
+		isDecoded = textureDecoder.Collect(loadId, images, wait);
+
+		for (DecodedImage& image : images)
+		{
+			if (pending.texels.empty())
+			{
+				pending.width = image.width;
+				pending.height = image.height;
+				pending.texels.resize(static_cast<size_t>(pending.width) * pending.height * pending.layerCount);
+			}
+			else if (image.width != pending.width || image.height != pending.height)
+			{
+				throw std::runtime_error("Can't create array of different sized textures!");
+			}
+
+			size_t layerSize = static_cast<size_t>(pending.width) * pending.height;
+			CopyColorKeyed(&pending.texels[layerSize * image.layer], image.pixels, layerSize);
+
+			TextureDecoder::FreeImage(image);
+		}
+	}
+	catch (...)
+	{
+		for (DecodedImage& image : images)
+		{
+			TextureDecoder::FreeImage(image);
+		}
+
+		textureDecoder.Cancel(loadId);
+		pendingTextures.erase(it);
+		throw;
+	}
+
+	if (!isDecoded)
+	{
+		return false;
+	}
+
+	SWTexture texture;
+	texture.layerCount = pending.layerCount;
+	texture.isDynamic = false;
+	texture.levels.push_back(SWTextureLevel{ static_cast<uint32_t>(pending.width), static_cast<uint32_t>(pending.height), 0 });
+	texture.texels = std::move(pending.texels);
+	BuildMips(texture);
+
+	pendingTextures.erase(it);
+	*outTextureArray = TextureArray{ AddTexture(std::move(texture)) };
+
+	return true;
+}
+
+TextureArray SWRenderer::CreateTextureArrayFromPack(const std::string& packFile)
+{
+	TexturePack pack(packFile);
+	const TexturePackHeader& header = pack.GetHeader();
+
+	SWTexture texture;
+	texture.layerCount = header.layerCount;
+	texture.isDynamic = false;
+
+	for (uint32_t i = 0; i < header.mipCount; ++i)
+	{
+		const TexturePackLevel& level = pack.GetLevel(i);
+		size_t layerSize = static_cast<size_t>(level.width) * level.height;
+		size_t offset = texture.texels.size();
+
+		texture.levels.push_back(SWTextureLevel{ level.width, level.height, offset });
+		texture.texels.resize(offset + layerSize * header.layerCount);
+
+		// Packs already store the colour key as alpha, only compressed ones need decoding.
+		if (header.format == TexturePackFormat::RGBA8)
+		{
+			memcpy(&texture.texels[offset], pack.GetLevelData(i), level.size);
+			continue;
+		}
+
+		size_t compressedLayerSize = GetTexturePackLayerSize(header.format, level.width, level.height);
+
+		for (uint32_t layer = 0; layer < header.layerCount; ++layer)
+		{
+			DecodeBC1Layer(pack.GetLevelData(i) + compressedLayerSize * layer, level.width, level.height,
+				&texture.texels[offset + layerSize * layer]);
+		}
+	}
+
+	return TextureArray{ AddTexture(std::move(texture)) };
+}
+
+TextureArray SWRenderer::CreateDynamicTextureArray(int32_t width, int32_t height, uint32_t layerCount)
+{
+	SWTexture texture;
+	texture.layerCount = layerCount;
+	texture.isDynamic = true;
+	texture.levels.push_back(SWTextureLevel{ static_cast<uint32_t>(width), static_cast<uint32_t>(height), 0 });
+	texture.texels.assign(static_cast<size_t>(width) * height * layerCount, 0xFF000000);
+
+	return TextureArray{ AddTexture(std::move(texture)) };
+}
+
+void SWRenderer::UpdateTextureArrayLayer(const TextureArray* textureArray, uint32_t layer, const uint8_t* pixels)
+{
+	SWTexture& texture = textures.at(textureArray->texture);
+
+	if (!texture.isDynamic)
+	{
+		throw std::runtime_error("Only dynamic texture arrays can be updated!");
+	}
+
+	// Frames are rasterized in EndDrawing, so every draw this frame sees the new contents.
+	size_t layerSize = static_cast<size_t>(texture.levels[0].width) * texture.levels[0].height;
+	CopyColorKeyed(&texture.texels[layerSize * layer], pixels, layerSize);
+}
+
+uint32_t SWRenderer::AddTexture(SWTexture&& texture)
+{
+	uint32_t id = nextTextureId++;
+	textures[id] = std::move(texture);
+
+	return id;
+}
+
+void SWRenderer::DestroyTextureArray(TextureArray* textureArray)
+{
+	textures.erase(textureArray->texture);
+}
+
+void SWRenderer::CaptureFrame(std::vector<uint8_t>& outPixels)
+{
+	outPixels.resize(static_cast<size_t>(width) * height * 4);
+
+	// The colour buffer is bottom row first like GL's.
+	for (int32_t y = 0; y < height; ++y)
+	{
+		memcpy(&outPixels[static_cast<size_t>(height - 1 - y) * width * 4], &colorBuffer[static_cast<size_t>(y) * pitch],
+			static_cast<size_t>(width) * 4);
+	}
+}
+
+FrameStats SWRenderer::GetFrameStats()
+{
+	return frameProfiler.GetStats();
+}
+
+void SWRenderer::UpdateCamera()
+{
+	glm::mat4 view = glm::lookAt(camera.pos, camera.pos + camera.dir, camera.up);
+	glm::mat4 proj = glm::perspective(glm::radians(camera.fov),
+		static_cast<float>(width) / static_cast<float>(height),
+		camera.zNear, camera.zFar);
+	viewProj = proj * view;
+	orthoProj = glm::ortho<float>(-1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f);
+	frustum = CreateFrustum(camera, static_cast<float>(width) / static_cast<float>(height));
+}
+
+void SWRenderer::SetCameraPosition(glm::vec3 position)
+{
+	camera.pos = position;
+}
+
+void SWRenderer::SetCameraRotation(float yRot, float xRot)
+{
+	float xTheta = glm::radians(xRot);
+	float yTheta = glm::radians(yRot + 270.0f);
+	camera.dir.x = cos(yTheta) * cos(xTheta);
+	camera.dir.y = sin(xTheta);
+	camera.dir.z = sin(yTheta) * cos(xTheta);
+}
+
+void SWRenderer::ConfigureCamera(float fov)
+{
+	camera.fov = fov;
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include "Renderer.h"
+#include "FramePacer.h"
+#include "FrameProfiler.h"
+#include "InstanceCuller.h"
+#include "TextureDecoder.h"
+#include "WorkerPool.h"
+
+#include <unordered_map>
+
+constexpr int32_t swTileSize = 64;
+// Roughly how many triangles one geometry job transforms and bins.
+constexpr uint32_t swGeometryJobSize = 2048;
+
+struct SWVertex
+{
+	glm::vec3 pos;
+	glm::vec2 texCoord;
+};
+
+struct SWMesh
+{
+	std::vector<SWVertex> vertices;
+	std::vector<uint32_t> indices;
+};
+
+struct SWTextureLevel
+{
+	uint32_t width;
+	uint32_t height;
+	// Index of the level's first texel, its layers follow each other.
+	size_t offset;
+};
+
+// RGBA8 texels, the #660066 colour key has already been turned into alpha.
+struct SWTexture
+{
+	uint32_t layerCount;
+	std::vector<SWTextureLevel> levels;
+	std::vector<uint32_t> texels;
+	// Dynamic textures have a single level and can be updated.
+	bool isDynamic;
+};
+
+// A texture array whose layers are copied in as they finish decoding.
+struct SWPendingTexture
+{
+	uint32_t layerCount;
+	// Zero until the first layer arrives and gives the array its size.
+	int32_t width;
+	int32_t height;
+	std::vector<uint32_t> texels;
+};
+
+// Draw* calls only record commands, all of the work happens in EndDrawing.
+struct SWDrawCommand
+{
+	uint32_t meshId;
+	uint32_t textureId;
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+	bool is2D;
+};
+
+// A contiguous run of one draw's instances, processed by a single geometry job.
+struct SWDrawSegment
+{
+	const SWMesh* mesh;
+	const SWTexture* texture;
+	const SWDrawCommand* command;
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+};
+
+// A triangle in screen space. Everything is stored as planes over the screen so any
+// pixel can be evaluated directly, which keeps shared edges watertight.
+struct SWTriangle
+{
+	// A pixel is covered when all three edge functions are positive, or zero on a top-left edge.
+	float edgeA[3];
+	float edgeB[3];
+	float edgeC[3];
+	bool isTopLeft[3];
+	// Depth, 1/w, u/w and v/w, each evaluated as dx * x + dy * y + c.
+	float planeDx[4];
+	float planeDy[4];
+	float planeC[4];
+	int32_t minX;
+	int32_t minY;
+	int32_t maxX;
+	int32_t maxY;
+	// One layer of the mip picked for the whole triangle.
+	const uint32_t* texels;
+	uint32_t textureWidth;
+	uint32_t textureHeight;
+	bool isDepthTested;
+};
+
+// What one geometry job produced. Jobs cover the draw list in order and tiles walk the jobs
+// in order, so triangles are still rasterized in submission order.
+struct SWGeometryJob
+{
+	uint32_t firstSegment;
+	uint32_t segmentCount;
+	std::vector<SWTriangle> triangles;
+	// Triangle indices per tile.
+	std::vector<std::vector<uint32_t>> tiles;
+	// Clip space positions of the instance being transformed.
+	std::vector<glm::vec4> positions;
+};
+
+// A tiled, multithreaded software rasterizer for machines without a usable GPU. Vertices
+// are transformed and binned into tiles on a worker pool, then each tile is rasterized
+// with SIMD by a single thread. Windowed frames are presented with a GL framebuffer blit,
+// headless ones never touch a graphics API.
+class SWRenderer : public Renderer
+{
+public:
+	SWRenderer(const std::string& windowName, int32_t windowWidth, int32_t windowHeight,
+		const RendererConfig& config = RendererConfig{});
+
+	void CloseWindow() override;
+	void ResizeWindow(int32_t width, int32_t height) override;
+	GLFWwindow* GetWindowPtr() override;
+
+	void SetClearColor(float r, float g, float b, float a) override;
+	void BeginDrawing() override;
+	void EndDrawing() override;
+
+	void DrawModel(const Model* model, const TextureArray* textureArray, const Instances* instances) override;
+	void DrawSprite(const Model* model, const TextureArray* textureArray, const Instances* instances) override;
+	void DrawModel(const Model* model, const TextureArray* textureArray, const PackedInstances* instances) override;
+	void DrawSprite(const Model* model, const TextureArray* textureArray, const PackedInstances* instances) override;
+
+	Model CreateModel(const std::vector<float>& vertices, const std::vector<uint32_t>& indices) override;
+	void UpdateModel(Model* model, const std::vector<float>& vertices, const std::vector<uint32_t>& indices) override;
+	void DestroyModel(Model* model) override;
+
+	TextureArray CreateTextureArray(const std::vector<std::string>& images) override;
+	TextureArrayLoad LoadTextureArrayAsync(const std::vector<std::string>& images) override;
+	bool PollTextureArrayLoad(const TextureArrayLoad* load, TextureArray* outTextureArray) override;
+	TextureArray WaitTextureArrayLoad(const TextureArrayLoad* load) override;
+	TextureArray CreateTextureArrayFromPack(const std::string& packFile) override;
+	TextureArray CreateDynamicTextureArray(int32_t width, int32_t height, uint32_t layerCount) override;
+	void UpdateTextureArrayLayer(const TextureArray* textureArray, uint32_t layer, const uint8_t* pixels) override;
+	void DestroyTextureArray(TextureArray* textureArray) override;
+
+	// Always available, the frame is already in CPU memory.
+	void CaptureFrame(std::vector<uint8_t>& outPixels) override;
+	// Transforming, binning and rasterizing are reported as GPU time, so the numbers line
+	// up with the other renderers.
+	FrameStats GetFrameStats() override;
+
+	void UpdateCamera() override;
+	void SetCameraPosition(glm::vec3 position) override;
+	void SetCameraRotation(float yRot, float xRot) override;
+	void ConfigureCamera(float fov) override;
+
+private:
+	void InitWindow(const std::string& windowName);
+	void InitFramebuffer();
+	void InitPresentTarget();
+	void DestroyPresentTarget();
+
+	void RecordDraw(const Model* model, const TextureArray* textureArray, uint32_t firstInstance,
+		uint32_t instanceCount, bool is2D);
+	void RenderFrame();
+	void BuildGeometryJobs();
+	void ProcessGeometryJob(SWGeometryJob& job);
+	void SetupTriangle(SWGeometryJob& job, const glm::vec4* positions, const glm::vec2* texCoords,
+		const SWTexture* texture, uint32_t layer, bool isDepthTested);
+	void RasterizeTile(uint32_t tileIndex);
+	void RasterizeTriangle(const SWTriangle& triangle, int32_t tileX, int32_t tileY);
+	void Present();
+
+	bool CollectTextureLayers(uint32_t loadId, bool wait, TextureArray* outTextureArray);
+	uint32_t AddTexture(SWTexture&& texture);
+
+	RendererConfig config;
+	FramePacer framePacer;
+	FrameProfiler frameProfiler;
+	WorkerPool workerPool;
+	InstanceCuller instanceCuller;
+	GLFWwindow* window;
+	int32_t width;
+	int32_t height;
+	uint32_t clearColor;
+
+	Camera camera;
+	Frustum frustum;
+	glm::mat4 viewProj;
+	glm::mat4 orthoProj;
+
+	// Padded up to whole tiles so a tile never needs bounds checks, rows are pitch apart.
+	std::vector<uint32_t> colorBuffer;
+	std::vector<float> depthBuffer;
+	int32_t pitch;
+	int32_t tileCountX;
+	int32_t tileCountY;
+
+	// The colour buffer is uploaded here and blitted to the window.
+	uint32_t presentTexture;
+	uint32_t presentFramebuffer;
+
+	std::vector<PackedInstance> frameInstances;
+	std::vector<SWDrawCommand> drawCommands;
+	std::vector<SWDrawSegment> drawSegments;
+	std::vector<SWGeometryJob> geometryJobs;
+	uint32_t geometryJobCount;
+
+	// Models and texture arrays handed to the game are keys into these maps.
+	std::unordered_map<uint32_t, SWMesh> meshes;
+	std::unordered_map<uint32_t, SWTexture> textures;
+	uint32_t nextMeshId;
+	uint32_t nextTextureId;
+
+	TextureDecoder textureDecoder;
+	std::unordered_map<uint32_t, SWPendingTexture> pendingTextures;
+};
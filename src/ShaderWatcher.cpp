@@ -0,0 +1,156 @@
+#include "ShaderWatcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	bool IsShaderSource(const std::string& fileName)
+	{
+		for (const char* extension : { ".vert", ".frag", ".comp" })
+		{
+			size_t length = strlen(extension);
+
+			if (fileName.size() > length && fileName.compare(fileName.size() - length, length, extension) == 0)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+}
+
+ShaderWatcher::~ShaderWatcher()
+{
+	if (compileResult.valid())
+	{
+		compileResult.wait();
+	}
+
+#ifdef __linux__
+	if (inotifyFd >= 0)
+	{
+		close(inotifyFd);
+	}
+#endif
+}
+
+bool ShaderWatcher::Watch(const std::string& directory, const std::string& compilerPath)
+{
+#ifdef __linux__
+	inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (inotifyFd < 0)
+	{
+		return false;
+	}
+
+	// Editors either write the file in place or write a new one and rename it over the old one.
+	if (inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		close(inotifyFd);
+		inotifyFd = -1;
+		return false;
+	}
+
+	this->directory = directory;
+	this->compilerPath = compilerPath;
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool ShaderWatcher::Poll()
+{
+	if (inotifyFd < 0)
+	{
+		return false;
+	}
+
+	ReadEvents();
+
+	bool hasCompiled = false;
+
+	if (compileResult.valid() && compileResult.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		hasCompiled = compileResult.get();
+	}
+
+	if (!compileResult.valid() && !pendingSources.empty())
+	{
+		compileResult = std::async(std::launch::async, &ShaderWatcher::Compile, this, std::move(pendingSources));
+		pendingSources.clear();
+	}
+
+	return hasCompiled;
+}
+
+void ShaderWatcher::ReadEvents()
+{
+#ifdef __linux__
+	alignas(inotify_event) char buffer[4096];
+
+	while (true)
+	{
+		ssize_t size = read(inotifyFd, buffer, sizeof(buffer));
+
+		if (size <= 0)
+		{
+			break;
+		}
+
+		for (ssize_t offset = 0; offset < size;)
+		{
+			const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+			offset += sizeof(inotify_event) + event->len;
+
+			if (event->len == 0)
+			{
+				continue;
+			}
+
+			std::string fileName = event->name;
+
+			if (IsShaderSource(fileName) &&
+				std::find(pendingSources.begin(), pendingSources.end(), fileName) == pendingSources.end())
+			{
+				pendingSources.push_back(fileName);
+			}
+		}
+	}
+#endif
+}
+
+bool ShaderWatcher::Compile(std::vector<std::string> sources)
+{
+	bool hasCompiled = false;
+
+	for (const std::string& source : sources)
+	{
+		std::string path = directory + "/" + source;
+		std::string command = "\"" + compilerPath + "\" \"" + path + "\" -o \"" + path + ".spv\"";
+
+		// glslc prints its own errors and leaves the old .spv alone when it fails.
+		if (std::system(command.c_str()) != 0)
+		{
+			std::cout << "Failed to compile " << path << ", keeping the previous version.\n";
+			continue;
+		}
+
+		std::cout << "Recompiled " << path << "\n";
+		hasCompiled = true;
+	}
+
+	return hasCompiled;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cinttypes>
+#include <future>
+#include <string>
+#include <vector>
+
+// Recompiles the shader sources in a directory as they are saved, for hot reloading. Saves
+// are noticed with inotify, so this only works on Linux. Sources are compiled on a background
+// thread with glslc, into <source>.spv next to them like the build does.
+class ShaderWatcher
+{
+public:
+	ShaderWatcher() = default;
+	~ShaderWatcher();
+
+	ShaderWatcher(const ShaderWatcher&) = delete;
+	ShaderWatcher& operator=(const ShaderWatcher&) = delete;
+
+	// Returns false if the directory can't be watched.
+	bool Watch(const std::string& directory, const std::string& compilerPath);
+	// Doesn't block. Starts compiling the sources saved since the last call and returns true
+	// once a compile has finished with at least one new .spv written.
+	bool Poll();
+
+private:
+	void ReadEvents();
+	bool Compile(std::vector<std::string> sources);
+
+	int32_t inotifyFd = -1;
+	std::string directory;
+	std::string compilerPath;
+	// Saved while the previous compile was still running, they go into the next one.
+	std::vector<std::string> pendingSources;
+	std::future<bool> compileResult;
+};
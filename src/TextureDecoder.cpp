@@ -0,0 +1,195 @@
+#include "TextureDecoder.h"
+
+#include <stdexcept>
+
+#include "../deps/stb_image.h"
+
+TextureDecoder::TextureDecoder(uint32_t threadCount)
+{
+	if (threadCount == 0)
+	{
+		uint32_t coreCount = std::thread::hardware_concurrency();
+		threadCount = coreCount > 1 ? coreCount - 1 : 1;
+	}
+
+	for (uint32_t i = 0; i < threadCount; ++i)
+	{
+		workers.emplace_back(&TextureDecoder::WorkerLoop, this);
+	}
+}
+
+TextureDecoder::~TextureDecoder()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		isStopping = true;
+		jobs.clear();
+	}
+
+	jobAvailable.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	for (auto& it : batches)
+	{
+		for (DecodedImage& image : it.second.finished)
+		{
+			FreeImage(image);
+		}
+	}
+}
+
+uint32_t TextureDecoder::Decode(const std::vector<std::string>& files, int32_t desiredChannelCount)
+{
+	uint32_t batchId;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		batchId = nextBatchId++;
+		batches[batchId] = Batch{ files.size(), {}, {} };
+
+		for (uint32_t i = 0; i < files.size(); ++i)
+		{
+			jobs.push_back(Job{ batchId, i, files[i], desiredChannelCount });
+		}
+	}
+
+	jobAvailable.notify_all();
+
+	return batchId;
+}
+
+bool TextureDecoder::Collect(uint32_t batchId, std::vector<DecodedImage>& outImages, bool wait)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	auto it = batches.find(batchId);
+
+	if (it == batches.end())
+	{
+		throw std::runtime_error("Tried to collect an unknown texture decode batch!");
+	}
+
+	if (wait)
+	{
+		jobFinished.wait(lock, [&]() {
+			Batch& batch = it->second;
+			return !batch.finished.empty() || !batch.error.empty() || batch.remainingCount == 0;
+			});
+	}
+
+	Batch& batch = it->second;
+
+	if (!batch.error.empty())
+	{
+		std::string error = batch.error;
+		lock.unlock();
+		Cancel(batchId);
+		throw std::runtime_error(error);
+	}
+
+	outImages.insert(outImages.end(), batch.finished.begin(), batch.finished.end());
+	batch.finished.clear();
+
+	if (batch.remainingCount == 0)
+	{
+		batches.erase(it);
+		return true;
+	}
+
+	return false;
+}
+
+void TextureDecoder::Cancel(uint32_t batchId)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto it = batches.find(batchId);
+
+	if (it == batches.end())
+	{
+		return;
+	}
+
+	for (DecodedImage& image : it->second.finished)
+	{
+		FreeImage(image);
+	}
+
+	batches.erase(it);
+
+	for (auto job = jobs.begin(); job != jobs.end();)
+	{
+		job = job->batchId == batchId ? jobs.erase(job) : job + 1;
+	}
+}
+
+void TextureDecoder::FreeImage(DecodedImage& image)
+{
+	stbi_image_free(image.pixels);
+	image.pixels = nullptr;
+}
+
+void TextureDecoder::WorkerLoop()
+{
+	// The flip setting is per thread, the renderers expect images bottom row first.
+	stbi_set_flip_vertically_on_load_thread(true);
+
+	while (true)
+	{
+		Job job;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobAvailable.wait(lock, [&]() { return isStopping || !jobs.empty(); });
+
+			if (isStopping)
+			{
+				return;
+			}
+
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+
+		DecodedImage image = {};
+		image.layer = job.layer;
+		image.pixels = stbi_load(job.file.c_str(), &image.width, &image.height, &image.channelCount,
+			job.desiredChannelCount);
+
+		if (job.desiredChannelCount != 0)
+		{
+			image.channelCount = job.desiredChannelCount;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			auto it = batches.find(job.batchId);
+
+			if (it == batches.end())
+			{
+				// The batch was cancelled while this image was decoding.
+				stbi_image_free(image.pixels);
+				continue;
+			}
+
+			Batch& batch = it->second;
+			--batch.remainingCount;
+
+			if (image.pixels)
+			{
+				batch.finished.push_back(image);
+			}
+			else if (batch.error.empty())
+			{
+				batch.error = std::string("Failed to load: ") + job.file;
+			}
+		}
+
+		jobFinished.notify_all();
+	}
+}
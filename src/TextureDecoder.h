@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cinttypes>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct DecodedImage
+{
+	uint32_t layer;
+	int32_t width;
+	int32_t height;
+	int32_t channelCount;
+	// Owned by the image, release it with TextureDecoder::FreeImage.
+	uint8_t* pixels;
+};
+
+// Decodes images on a pool of worker threads. Each call to Decode starts a batch, its
+// images are collected in whatever order they finish so uploads can start early.
+class TextureDecoder
+{
+public:
+	// Zero picks one thread per core, leaving one for the render thread.
+	explicit TextureDecoder(uint32_t threadCount = 0);
+	~TextureDecoder();
+
+	TextureDecoder(const TextureDecoder&) = delete;
+	TextureDecoder& operator=(const TextureDecoder&) = delete;
+
+	// Queues every file for decoding, a desired channel count of zero keeps the file's own.
+	uint32_t Decode(const std::vector<std::string>& files, int32_t desiredChannelCount);
+	// Moves images that finished since the last call into outImages, returns true once the
+	// whole batch has been collected. Blocks until there is something to collect if wait
+	// is set. Throws if an image failed to decode, the batch is dropped when that happens.
+	bool Collect(uint32_t batchId, std::vector<DecodedImage>& outImages, bool wait);
+	// Drops a batch, images still decoding are freed when they finish.
+	void Cancel(uint32_t batchId);
+
+	static void FreeImage(DecodedImage& image);
+
+private:
+	struct Job
+	{
+		uint32_t batchId;
+		uint32_t layer;
+		std::string file;
+		int32_t desiredChannelCount;
+	};
+
+	struct Batch
+	{
+		size_t remainingCount;
+		std::vector<DecodedImage> finished;
+		std::string error;
+	};
+
+	void WorkerLoop();
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable jobAvailable;
+	std::condition_variable jobFinished;
+	std::deque<Job> jobs;
+	std::unordered_map<uint32_t, Batch> batches;
+	uint32_t nextBatchId = 1;
+	bool isStopping = false;
+};
@@ -0,0 +1,295 @@
+#include "TexturePack.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+size_t GetTexturePackLayerSize(TexturePackFormat format, uint32_t width, uint32_t height)
+{
+	switch (format)
+	{
+	case TexturePackFormat::RGBA8:
+		return static_cast<size_t>(width) * height * 4;
+	case TexturePackFormat::BC1:
+		return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * 8;
+	}
+
+	return 0;
+}
+
+namespace
+{
+	void UnpackColor565(uint16_t packed, uint32_t* outColor)
+	{
+		uint32_t r = (packed >> 11) & 31;
+		uint32_t g = (packed >> 5) & 63;
+		uint32_t b = packed & 31;
+
+		outColor[0] = (r << 3) | (r >> 2);
+		outColor[1] = (g << 2) | (g >> 4);
+		outColor[2] = (b << 3) | (b >> 2);
+	}
+}
+
+void DecodeBC1Layer(const uint8_t* blocks, uint32_t width, uint32_t height, uint32_t* outTexels)
+{
+	for (uint32_t blockY = 0; blockY < height; blockY += 4)
+	{
+		for (uint32_t blockX = 0; blockX < width; blockX += 4)
+		{
+			uint16_t color0 = static_cast<uint16_t>(blocks[0] | blocks[1] << 8);
+			uint16_t color1 = static_cast<uint16_t>(blocks[2] | blocks[3] << 8);
+			uint32_t indices;
+			memcpy(&indices, &blocks[4], sizeof(indices));
+			blocks += 8;
+
+			uint32_t endpoints[2][3];
+			UnpackColor565(color0, endpoints[0]);
+			UnpackColor565(color1, endpoints[1]);
+
+			uint32_t palette[4] = { 0xFF000000, 0xFF000000, 0xFF000000, 0xFF000000 };
+
+			for (uint32_t c = 0; c < 3; ++c)
+			{
+				palette[0] |= endpoints[0][c] << (c * 8);
+				palette[1] |= endpoints[1][c] << (c * 8);
+			}
+
+			// color0 > color1 selects 4 colours, otherwise index 3 is transparent black.
+			if (color0 > color1)
+			{
+				for (uint32_t c = 0; c < 3; ++c)
+				{
+					palette[2] |= ((2 * endpoints[0][c] + endpoints[1][c]) / 3) << (c * 8);
+					palette[3] |= ((endpoints[0][c] + 2 * endpoints[1][c]) / 3) << (c * 8);
+				}
+			}
+			else
+			{
+				palette[3] = 0;
+
+				for (uint32_t c = 0; c < 3; ++c)
+				{
+					palette[2] |= ((endpoints[0][c] + endpoints[1][c]) / 2) << (c * 8);
+				}
+			}
+
+			for (uint32_t y = 0; y < 4 && blockY + y < height; ++y)
+			{
+				for (uint32_t x = 0; x < 4 && blockX + x < width; ++x)
+				{
+					uint32_t index = (indices >> ((y * 4 + x) * 2)) & 3;
+					outTexels[(blockY + y) * width + blockX + x] = palette[index];
+				}
+			}
+		}
+	}
+}
+
+TexturePack::TexturePack(const std::string& file)
+	: data(nullptr), size(0)
+{
+#ifdef _WIN32
+	fileHandle = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+	if (fileHandle == INVALID_HANDLE_VALUE)
+	{
+		throw std::runtime_error(std::string("Failed to open texture pack: ") + file);
+	}
+
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(fileHandle, &fileSize);
+	size = static_cast<size_t>(fileSize.QuadPart);
+
+	mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+	if (mappingHandle)
+	{
+		data = static_cast<const uint8_t*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+	}
+
+	if (!data)
+	{
+		if (mappingHandle)
+		{
+			CloseHandle(mappingHandle);
+		}
+
+		CloseHandle(fileHandle);
+		throw std::runtime_error(std::string("Failed to map texture pack: ") + file);
+	}
+#else
+	int fd = open(file.c_str(), O_RDONLY);
+
+	if (fd < 0)
+	{
+		throw std::runtime_error(std::string("Failed to open texture pack: ") + file);
+	}
+
+	struct stat fileStat;
+
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		close(fd);
+		throw std::runtime_error(std::string("Failed to map texture pack: ") + file);
+	}
+
+	size = static_cast<size_t>(fileStat.st_size);
+	void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps its own reference to the file.
+	close(fd);
+
+	if (mapping == MAP_FAILED)
+	{
+		throw std::runtime_error(std::string("Failed to map texture pack: ") + file);
+	}
+
+	// The whole file is about to be copied into upload memory. Advice values aren't flags, so
+	// each needs its own call.
+	madvise(mapping, size, MADV_SEQUENTIAL);
+	madvise(mapping, size, MADV_WILLNEED);
+	data = static_cast<const uint8_t*>(mapping);
+#endif
+
+	try
+	{
+		Validate(file);
+	}
+	catch (...)
+	{
+		Unmap();
+		throw;
+	}
+}
+
+TexturePack::~TexturePack()
+{
+	Unmap();
+}
+
+void TexturePack::Unmap()
+{
+	if (!data)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle(mappingHandle);
+	CloseHandle(fileHandle);
+#else
+	munmap(const_cast<uint8_t*>(data), size);
+#endif
+
+	data = nullptr;
+}
+
+const TexturePackHeader& TexturePack::GetHeader() const
+{
+	return *reinterpret_cast<const TexturePackHeader*>(data);
+}
+
+const TexturePackLevel& TexturePack::GetLevel(uint32_t mip) const
+{
+	const TexturePackLevel* levels = reinterpret_cast<const TexturePackLevel*>(data + sizeof(TexturePackHeader));
+
+	return levels[mip];
+}
+
+const uint8_t* TexturePack::GetLevelData(uint32_t mip) const
+{
+	return data + GetLevel(mip).offset;
+}
+
+void TexturePack::Validate(const std::string& file)
+{
+	if (size < sizeof(TexturePackHeader))
+	{
+		throw std::runtime_error(std::string("Texture pack is truncated: ") + file);
+	}
+
+	const TexturePackHeader& header = GetHeader();
+
+	if (header.magic != texturePackMagic || header.version != texturePackVersion)
+	{
+		throw std::runtime_error(std::string("Not a texture pack, or built by a different version: ") + file);
+	}
+
+	if (header.format != TexturePackFormat::RGBA8 && header.format != TexturePackFormat::BC1)
+	{
+		throw std::runtime_error(std::string("Texture pack has an unknown format: ") + file);
+	}
+
+	if (header.width == 0 || header.height == 0 || header.layerCount == 0 || header.mipCount == 0 ||
+		header.mipCount > 32)
+	{
+		throw std::runtime_error(std::string("Texture pack has invalid dimensions: ") + file);
+	}
+
+	// A full mip chain ends at 1x1, floor(log2(max(width, height))) + 1 levels.
+	uint32_t maxMipCount = 1;
+
+	for (uint32_t extent = std::max(header.width, header.height); extent > 1; extent /= 2)
+	{
+		++maxMipCount;
+	}
+
+	if (header.mipCount > maxMipCount)
+	{
+		throw std::runtime_error(std::string("Texture pack has invalid dimensions: ") + file);
+	}
+
+	if (size < sizeof(TexturePackHeader) + sizeof(TexturePackLevel) * header.mipCount)
+	{
+		throw std::runtime_error(std::string("Texture pack is truncated: ") + file);
+	}
+
+	// Images are created from the header, so every level has to match the size the image
+	// gives it, halving from the header's size and stopping at 1.
+	uint32_t levelWidth = header.width;
+	uint32_t levelHeight = header.height;
+	// Uploads copy every level at once, from the start of the first to the end of the last,
+	// so levels have to be stored in order without overlapping.
+	uint64_t previousLevelEnd = 0;
+
+	for (uint32_t i = 0; i < header.mipCount; ++i)
+	{
+		const TexturePackLevel& level = GetLevel(i);
+
+		if (level.width != levelWidth || level.height != levelHeight)
+		{
+			throw std::runtime_error(std::string("Texture pack has invalid dimensions: ") + file);
+		}
+
+		levelWidth = std::max(levelWidth / 2, 1u);
+		levelHeight = std::max(levelHeight / 2, 1u);
+
+		size_t expectedSize = GetTexturePackLayerSize(header.format, level.width, level.height) * header.layerCount;
+
+		if (level.size != expectedSize || level.offset % texturePackLevelAlignment != 0 ||
+			level.offset > size || level.size > size - level.offset)
+		{
+			throw std::runtime_error(std::string("Texture pack is truncated: ") + file);
+		}
+
+		if (level.offset < previousLevelEnd)
+		{
+			throw std::runtime_error(std::string("Texture pack has overlapping levels: ") + file);
+		}
+
+		previousLevelEnd = level.offset + level.size;
+	}
+}
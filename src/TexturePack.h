@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+#include <string>
+
+// "gTPK" in little endian.
+constexpr uint32_t texturePackMagic = 0x4B505467;
+constexpr uint32_t texturePackVersion = 1;
+// Level data offsets are aligned so they satisfy copy alignment rules for every format.
+constexpr uint64_t texturePackLevelAlignment = 16;
+
+enum class TexturePackFormat : uint32_t
+{
+	RGBA8 = 0,
+	// 4x4 blocks of 8 bytes, the colour key is stored as punch-through alpha.
+	BC1 = 1,
+};
+
+// A pack is a header, one level entry per mip, then the level data. Each level holds
+// every layer of that mip tightly packed, so a level can be uploaded with one copy.
+struct TexturePackHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	TexturePackFormat format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t layerCount;
+	uint32_t mipCount;
+	uint32_t padding;
+};
+
+struct TexturePackLevel
+{
+	// Relative to the start of the file.
+	uint64_t offset;
+	uint64_t size;
+	uint32_t width;
+	uint32_t height;
+};
+
+static_assert(sizeof(TexturePackHeader) == 32, "TexturePackHeader must stay 32 bytes!");
+static_assert(sizeof(TexturePackLevel) == 24, "TexturePackLevel must stay 24 bytes!");
+
+// Size of one layer of one mip in bytes.
+size_t GetTexturePackLayerSize(TexturePackFormat format, uint32_t width, uint32_t height);
+// Decodes one layer of BC1 blocks to RGBA8 texels, for renderers that sample on the CPU.
+void DecodeBC1Layer(const uint8_t* blocks, uint32_t width, uint32_t height, uint32_t* outTexels);
+
+// A memory mapped texture pack, validated on open. Throws if the file can't be used.
+class TexturePack
+{
+public:
+	explicit TexturePack(const std::string& file);
+	~TexturePack();
+
+	TexturePack(const TexturePack&) = delete;
+	TexturePack& operator=(const TexturePack&) = delete;
+
+	const TexturePackHeader& GetHeader() const;
+	const TexturePackLevel& GetLevel(uint32_t mip) const;
+	const uint8_t* GetLevelData(uint32_t mip) const;
+
+private:
+	void Validate(const std::string& file);
+	void Unmap();
+
+	const uint8_t* data;
+	size_t size;
+#ifdef _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#endif
+};
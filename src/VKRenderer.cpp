@@ -1,7 +1,9 @@
 #include "VKRenderer.h"
 
+#include <algorithm>
 #include <stdexcept>
 #include <cmath>
+#include <cstring>
 #include <sstream>
 #include <fstream>
 #include <iostream>
@@ -14,21 +16,36 @@
 
 #include "../deps/stb_image.h"
 
-VKRenderer::VKRenderer(const std::string& windowName, int32_t windowWidth, int32_t windowHeight)
-	: width(windowWidth), height(windowHeight)
+#include "TexturePack.h"
+
+VKRenderer::VKRenderer(const std::string& windowName, int32_t windowWidth, int32_t windowHeight,
+	const RendererConfig& config)
+	: config(config), window(nullptr), width(windowWidth), height(windowHeight), surface(VK_NULL_HANDLE),
+	swapchain(VK_NULL_HANDLE), renderPass(VK_NULL_HANDLE), frameOverlap(config.framesInFlight), frameNumber(0),
+	completedFrame(-1), swapchainImageIndex(0), isFrameActive(false), isSwapchainDirty(false), isOverMemoryBudget(false),
+	evictionCount(0), nextMeshId(1), nextTextureId(1), instanceCuller(workerPool), nextBindlessIndex(0),
+	timestampQueryPool(VK_NULL_HANDLE)
 {
-	if (!glfwInit())
+	if (frameOverlap < 1 || frameOverlap > maxFrameOverlap)
 	{
-		throw std::runtime_error("Failed to initialize glfw!");
+		throw std::runtime_error("Frames in flight must be between 1 and 4!");
 	}
 
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	window = glfwCreateWindow(width, height, windowName.c_str(), nullptr, nullptr);
-
-	if (!window)
+	if (!config.headless)
 	{
-		glfwTerminate();
-		throw std::runtime_error("Failed to create a window!");
+		if (!glfwInit())
+		{
+			throw std::runtime_error("Failed to initialize glfw!");
+		}
+
+		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+		window = glfwCreateWindow(width, height, windowName.c_str(), nullptr, nullptr);
+
+		if (!window)
+		{
+			glfwTerminate();
+			throw std::runtime_error("Failed to create a window!");
+		}
 	}
 
 	InitVulkan(windowName);
@@ -37,37 +54,41 @@ VKRenderer::VKRenderer(const std::string& windowName, int32_t windowWidth, int32
 	InitDefaultRenderpass();
 	InitFramebuffers();
 	InitSyncStructures();
+	InitTimestampQueries();
 	InitDescriptors();
+	InitPipelineCache();
 	InitPipelines();
+	InitDepthPyramid();
 
-	LoadMeshes();
-	LoadImages();
+	if (config.shaderHotReload && !shaderWatcher.Watch("shaders", GFPS_GLSLC))
+	{
+		std::cout << "Failed to watch shaders/, shader hot reloading is disabled.\n";
+	}
 
 	VkSamplerCreateInfo samplerInfo = SamplerCreateInfo(VK_FILTER_NEAREST);
-	VkSampler sampler = {};
-	vkCreateSampler(device, &samplerInfo, nullptr, &sampler);
-
-	deletionList.push_back([=]() {
-		vkDestroySampler(device, sampler, nullptr);
-		});
-
-	VkDescriptorSetAllocateInfo allocInfo = {};
-	allocInfo.pNext = nullptr;
-	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	allocInfo.descriptorPool = descriptorPool;
-	allocInfo.descriptorSetCount = 1;
-	allocInfo.pSetLayouts = &singleTextureSetLayout;
-
-	vkAllocateDescriptorSets(device, &allocInfo, &testTextureSet);
+	VkResult err = vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler);
+	CheckVkError(err);
 
-	VkDescriptorImageInfo imageBufferInfo;
-	imageBufferInfo.sampler = sampler;
-	imageBufferInfo.imageView = loadedTextures["test"].imageView;
-	imageBufferInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	deletionQueue.samplers.push_back(textureSampler);
+
+	SetClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+	camera = Camera{
+		45.0f,
+		0.1f,
+		100.0f,
+		glm::vec3(0.0f, 0.0f, 0.0f),
+		glm::vec3(0.0f, 0.0f, -1.0f),
+		glm::vec3(0.0f, 1.0f, 0.0f),
+		-1,
+		-1,
+		-1,
+		-1,
+	};
 
-	VkWriteDescriptorSet texture1 = WriteDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, testTextureSet, &imageBufferInfo, 0);
+	UpdateCamera();
 
-	vkUpdateDescriptorSets(device, 1, &texture1, 0, nullptr);
+	framePacer.SetTargetFrameTime(config.targetFrameTime);
 }
 
 void VKRenderer::InitVulkan(const std::string& windowName)
@@ -77,53 +98,234 @@ void VKRenderer::InitVulkan(const std::string& windowName)
 		.request_validation_layers(true)
 		.require_api_version(1, 1, 0)
 		.use_default_debug_messenger()
+		.set_headless(config.headless)
 		.build()
 		.value();
 
 	instance = vkbInstance.instance;
 	debugMessenger = vkbInstance.debug_messenger;
 
-	VkResult error = glfwCreateWindowSurface(instance, window, nullptr, &surface);
-	CheckVkError(error);
-
 	vkb::PhysicalDeviceSelector selector{ vkbInstance };
-	vkb::PhysicalDevice physicalDevice = selector
-		.set_minimum_version(1, 1)
-		.set_surface(surface)
-		.select()
-		.value();
+	selector.set_minimum_version(1, 1);
+	// Bindless textures need descriptor indexing, which is core in 1.2 but an extension here.
+	selector.add_desired_extension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+	// Lets VMA report the driver's real memory budget instead of estimating it.
+	selector.add_desired_extension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+	// Dynamic rendering and the extensions it depends on, all core in 1.3.
+	selector.add_desired_extension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+	selector.add_desired_extension(VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME);
+	selector.add_desired_extension(VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME);
+	selector.add_desired_extension(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+
+	// Without a surface no present support is needed, so CPU devices like lavapipe qualify.
+	if (!config.headless)
+	{
+		VkResult error = glfwCreateWindowSurface(instance, window, nullptr, &surface);
+		CheckVkError(error);
+
+		selector.set_surface(surface);
+	}
+
+	vkb::PhysicalDevice physicalDevice = selector.select().value();
+
+	// BC compression is only needed by compressed texture packs, so it's optional.
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice.physical_device, &supportedFeatures);
+	supportsBC = supportedFeatures.textureCompressionBC;
+	physicalDevice.features.textureCompressionBC = supportedFeatures.textureCompressionBC;
+
+	// Culled draws start at their first instance, which indirect draws can only do with this.
+	supportsGpuCulling = config.gpuCulling && supportedFeatures.drawIndirectFirstInstance;
+	physicalDevice.features.drawIndirectFirstInstance = supportsGpuCulling ? VK_TRUE : VK_FALSE;
+
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(physicalDevice.physical_device, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(physicalDevice.physical_device, nullptr, &extensionCount, extensions.data());
+
+	bool hasDescriptorIndexing = false;
+	bool hasDynamicRendering = false;
+	bool hasSynchronization2 = false;
+	supportsMemoryBudget = false;
+
+	for (const VkExtensionProperties& extension : extensions)
+	{
+		if (strcmp(extension.extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) == 0)
+		{
+			hasDescriptorIndexing = true;
+		}
+		else if (strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+		{
+			supportsMemoryBudget = true;
+		}
+		else if (strcmp(extension.extensionName, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) == 0)
+		{
+			hasDynamicRendering = true;
+		}
+		else if (strcmp(extension.extensionName, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME) == 0)
+		{
+			hasSynchronization2 = true;
+		}
+	}
+
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures = {};
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {};
+	dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+	VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features = {};
+	synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+
+	// Only the feature structures of extensions the device has can be queried.
+	VkPhysicalDeviceFeatures2 features = {};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+
+	if (hasDescriptorIndexing)
+	{
+		indexingFeatures.pNext = features.pNext;
+		features.pNext = &indexingFeatures;
+	}
+
+	if (hasDynamicRendering && hasSynchronization2)
+	{
+		synchronization2Features.pNext = features.pNext;
+		dynamicRenderingFeatures.pNext = &synchronization2Features;
+		features.pNext = &dynamicRenderingFeatures;
+	}
+
+	vkGetPhysicalDeviceFeatures2(physicalDevice.physical_device, &features);
+
+	// Instances index the texture arrays with non-uniform indices, and the set is updated while
+	// frames that don't use the new entries are in flight.
+	supportsBindlessTextures = config.bindlessTextures && hasDescriptorIndexing &&
+		indexingFeatures.shaderSampledImageArrayNonUniformIndexing &&
+		indexingFeatures.runtimeDescriptorArray &&
+		indexingFeatures.descriptorBindingPartiallyBound &&
+		indexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+		indexingFeatures.descriptorBindingUpdateUnusedWhilePending;
+
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT enabledIndexingFeatures = {};
+	enabledIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	enabledIndexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+	enabledIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+	enabledIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+	enabledIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	enabledIndexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+
+	supportsDynamicRendering = config.dynamicRendering && hasDynamicRendering && hasSynchronization2 &&
+		dynamicRenderingFeatures.dynamicRendering && synchronization2Features.synchronization2;
+
+	VkPhysicalDeviceDynamicRenderingFeaturesKHR enabledDynamicRenderingFeatures = {};
+	enabledDynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+	enabledDynamicRenderingFeatures.dynamicRendering = VK_TRUE;
+
+	VkPhysicalDeviceSynchronization2FeaturesKHR enabledSynchronization2Features = {};
+	enabledSynchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+	enabledSynchronization2Features.synchronization2 = VK_TRUE;
 
 	vkb::DeviceBuilder deviceBuilder{ physicalDevice };
+
+	if (supportsBindlessTextures)
+	{
+		deviceBuilder.add_pNext(&enabledIndexingFeatures);
+	}
+
+	if (supportsDynamicRendering)
+	{
+		deviceBuilder.add_pNext(&enabledDynamicRenderingFeatures);
+		deviceBuilder.add_pNext(&enabledSynchronization2Features);
+	}
+
 	vkbDevice = deviceBuilder.build().value();
 	device = vkbDevice.device;
 	chosenGPU = physicalDevice.physical_device;
 
+	// Extension commands aren't exported by the loader, so they are looked up on the device.
+	cmdBeginRendering = nullptr;
+	cmdEndRendering = nullptr;
+	cmdPipelineBarrier2 = nullptr;
+
+	if (supportsDynamicRendering)
+	{
+		cmdBeginRendering = reinterpret_cast<PFN_vkCmdBeginRenderingKHR>(
+			vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR"));
+		cmdEndRendering = reinterpret_cast<PFN_vkCmdEndRenderingKHR>(
+			vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR"));
+		cmdPipelineBarrier2 = reinterpret_cast<PFN_vkCmdPipelineBarrier2KHR>(
+			vkGetDeviceProcAddr(device, "vkCmdPipelineBarrier2KHR"));
+	}
+
 	graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
 	graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
+	// Prefer a transfer only queue so uploads can overlap with rendering.
+	auto dedicatedTransferQueue = vkbDevice.get_dedicated_queue(vkb::QueueType::transfer);
+
+	if (dedicatedTransferQueue.has_value())
+	{
+		transferQueue = dedicatedTransferQueue.value();
+		transferQueueFamily = vkbDevice.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+	}
+	else
+	{
+		transferQueue = graphicsQueue;
+		transferQueueFamily = graphicsQueueFamily;
+	}
+
 	VmaAllocatorCreateInfo allocatorInfo = {};
 	allocatorInfo.physicalDevice = chosenGPU;
 	allocatorInfo.device = device;
 	allocatorInfo.instance = instance;
+	allocatorInfo.vulkanApiVersion = VK_API_VERSION_1_1;
+
+	if (supportsMemoryBudget)
+	{
+		allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+	}
+
 	vmaCreateAllocator(&allocatorInfo, &allocator);
 
 	gpuProperties = vkbDevice.physical_device.properties;
+
+	// GPU timing is optional, some queues can't write timestamps at all.
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(chosenGPU, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(chosenGPU, &queueFamilyCount, queueFamilies.data());
+
+	uint32_t timestampValidBits = queueFamilies[graphicsQueueFamily].timestampValidBits;
+	supportsTimestamps = timestampValidBits > 0 && gpuProperties.limits.timestampPeriod > 0.0f;
+	timestampMask = timestampValidBits >= 64 ? UINT64_MAX : (uint64_t{ 1 } << timestampValidBits) - 1;
 }
 
 void VKRenderer::InitSwapchain()
 {
-	vkb::SwapchainBuilder swapchainBuilder{ vkbDevice, surface };
-	vkb::Swapchain vkbSwapchain = swapchainBuilder
-		.use_default_format_selection()
-		.set_desired_present_mode(VK_PRESENT_MODE_IMMEDIATE_KHR)
-		.set_desired_extent(static_cast<uint32_t>(width), static_cast<uint32_t>(height))
-		.build()
-		.value();
-
-	swapchain = vkbSwapchain.swapchain;
-	swapchainImages = vkbSwapchain.get_images().value();
-	swapchainImageViews = vkbSwapchain.get_image_views().value();
-	swapchainImageFormat = vkbSwapchain.image_format;
+	if (config.headless)
+	{
+		InitOffscreenImage();
+	}
+	else
+	{
+		// Passing the old swapchain lets the driver hand its resources over while frames
+		// already presented to it are still on screen.
+		vkb::SwapchainBuilder swapchainBuilder{ vkbDevice, surface };
+		vkb::Swapchain vkbSwapchain = swapchainBuilder
+			.use_default_format_selection()
+			.set_desired_present_mode(GetVkPresentMode(config.presentMode))
+			.set_desired_extent(static_cast<uint32_t>(width), static_cast<uint32_t>(height))
+			.set_old_swapchain(swapchain)
+			.build()
+			.value();
+
+		swapchain = vkbSwapchain.swapchain;
+		swapchainImages = vkbSwapchain.get_images().value();
+		swapchainImageViews = vkbSwapchain.get_image_views().value();
+		swapchainImageFormat = vkbSwapchain.image_format;
+
+		// The surface may not allow the size that was asked for, everything else matches the
+		// swapchain's images.
+		width = static_cast<int32_t>(vkbSwapchain.extent.width);
+		height = static_cast<int32_t>(vkbSwapchain.extent.height);
+	}
 
 	VkExtent3D depthImageExtent = {
 		static_cast<uint32_t>(width),
@@ -133,43 +335,85 @@ void VKRenderer::InitSwapchain()
 
 	depthFormat = VK_FORMAT_D32_SFLOAT;
 
-	VkImageCreateInfo depthImgInfo = ImageCreateInfo(depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depthImageExtent);
+	// GPU culling reduces the depth image into its depth pyramid.
+	VkImageUsageFlags depthUsage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+
+	if (supportsGpuCulling)
+	{
+		depthUsage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+	}
 
-	VmaAllocationCreateInfo depthImgAllocInfo = {};
-	depthImgAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-	depthImgAllocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	VkImageCreateInfo depthImgInfo = ImageCreateInfo(depthFormat, depthUsage, depthImageExtent);
+	depthImage = CreateImage(depthImgInfo, MemoryCategory::RenderTargets);
 
-	vmaCreateImage(allocator, &depthImgInfo, &depthImgAllocInfo, &depthImage.image, &depthImage.allocation, nullptr);
 	VkImageViewCreateInfo depthViewInfo = ImageViewCreateInfo(depthFormat, depthImage.image, VK_IMAGE_ASPECT_DEPTH_BIT);
 	VkResult err = vkCreateImageView(device, &depthViewInfo, nullptr, &depthImageView);
+	CheckVkError(err);
+
+	swapchainDeletionQueue.imageViews.push_back(depthImageView);
+	swapchainDeletionQueue.images.push_back(depthImage);
+	swapchainDeletionQueue.imageViews.insert(swapchainDeletionQueue.imageViews.end(),
+		swapchainImageViews.begin(), swapchainImageViews.end());
+
+	if (config.headless)
+	{
+		swapchainDeletionQueue.images.push_back(offscreenImage);
+	}
+	else
+	{
+		swapchainDeletionQueue.swapchains.push_back(swapchain);
+	}
+}
+
+void VKRenderer::InitOffscreenImage()
+{
+	// Matches the byte order CaptureFrame returns, and stays sRGB like a swapchain would.
+	swapchainImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+
+	VkExtent3D imageExtent = {
+		static_cast<uint32_t>(width),
+		static_cast<uint32_t>(height),
+		1,
+	};
 
-	swapchainDeletionList.push_back([=]() {
-		vkDestroyImageView(device, depthImageView, nullptr);
-		vmaDestroyImage(allocator, depthImage.image, depthImage.allocation);
-		vkDestroySwapchainKHR(device, swapchain, nullptr);
-		});
+	VkImageCreateInfo imageInfo = ImageCreateInfo(swapchainImageFormat,
+		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, imageExtent);
+	offscreenImage = CreateImage(imageInfo, MemoryCategory::RenderTargets);
+
+	VkImageView imageView;
+	VkImageViewCreateInfo viewInfo = ImageViewCreateInfo(swapchainImageFormat, offscreenImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	VkResult err = vkCreateImageView(device, &viewInfo, nullptr, &imageView);
+	CheckVkError(err);
+
+	swapchainImages = { offscreenImage.image };
+	swapchainImageViews = { imageView };
 }
 
-void VKRenderer::RecreateSwapchain()
+bool VKRenderer::RecreateSwapchain()
 {
-	// If the window is minimized, wait.
+	// Minimized windows have nothing to present to, frames are skipped until it is restored.
 	int32_t frameWidth;
 	int32_t frameHeight;
+	glfwGetFramebufferSize(window, &frameWidth, &frameHeight);
 
-	do
+	if (frameWidth == 0 || frameHeight == 0)
 	{
-		glfwGetFramebufferSize(window, &frameWidth, &frameHeight);
-		glfwWaitEvents();
-	} while (frameWidth == 0 || frameHeight == 0);
-
-	vkDeviceWaitIdle(device);
+		return false;
+	}
 
-	glfwGetWindowSize(window, &width, &height);
+	width = frameWidth;
+	height = frameHeight;
 
-	FlushDeletionList(swapchainDeletionList);
+	// Frames in flight still use the old swapchain and everything sized to it, so it is all
+	// destroyed once they finish instead of waiting for the device to go idle.
+	MoveDeletionQueue(swapchainDeletionQueue, GetDeletionQueue());
 
 	InitSwapchain();
 	InitFramebuffers();
+	InitDepthPyramid();
+	isSwapchainDirty = false;
+
+	return true;
 }
 
 void VKRenderer::InitCommands()
@@ -184,28 +428,46 @@ void VKRenderer::InitCommands()
 		VkCommandBufferAllocateInfo commandAllocInfo = CommandBufferAllocateInfo(frames[i].commandPool, 1);
 		err = vkAllocateCommandBuffers(device, &commandAllocInfo, &frames[i].mainCommandBuffer);
 		CheckVkError(err);
+		err = vkAllocateCommandBuffers(device, &commandAllocInfo, &frames[i].dynamicTextureCommandBuffer);
+		CheckVkError(err);
+		err = vkAllocateCommandBuffers(device, &commandAllocInfo, &frames[i].cullCommandBuffer);
+		CheckVkError(err);
 
-		deletionList.push_back([=]() {
-			vkDestroyCommandPool(device, frames[i].commandPool, nullptr);
-			});
+		deletionQueue.commandPools.push_back(frames[i].commandPool);
 	}
 
-	VkCommandPoolCreateInfo uploadCommandPoolInfo = CommandPoolCreateInfo(graphicsQueueFamily, 0);
+	VkCommandPoolCreateInfo uploadCommandPoolInfo = CommandPoolCreateInfo(transferQueueFamily, 0);
 	VkResult err = vkCreateCommandPool(device, &uploadCommandPoolInfo, nullptr, &uploadContext.commandPool);
 	CheckVkError(err);
 
-	deletionList.push_back([=]() {
-		vkDestroyCommandPool(device, uploadContext.commandPool, nullptr);
-		});
+	deletionQueue.commandPools.push_back(uploadContext.commandPool);
 
 	VkCommandBufferAllocateInfo cmdAllocInfo = CommandBufferAllocateInfo(uploadContext.commandPool, 1);
 	VkCommandBuffer cmd = {};
 	err = vkAllocateCommandBuffers(device, &cmdAllocInfo, &uploadContext.commandBuffer);
 	CheckVkError(err);
+
+	uploadContext.stagingBuffer = CreateBuffer(stagingArenaSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY,
+		MemoryCategory::Staging);
+
+	void* stagingData;
+	vmaMapMemory(allocator, uploadContext.stagingBuffer.allocation, &stagingData);
+	uploadContext.stagingData = static_cast<uint8_t*>(stagingData);
+	uploadContext.stagingCursor = 0;
+	uploadContext.isRecording = false;
+	uploadContext.isInFlight = false;
+	uploadContext.isSemaphorePending = false;
+
+	deletionQueue.mappedBuffers.push_back(uploadContext.stagingBuffer);
 }
 
 void VKRenderer::InitDefaultRenderpass()
 {
+	if (supportsDynamicRendering)
+	{
+		return;
+	}
+
 	VkAttachmentDescription colorAttachment = {};
 	colorAttachment.format = swapchainImageFormat;
 	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -214,7 +476,8 @@ void VKRenderer::InitDefaultRenderpass()
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	// Headless frames are left ready to be copied out by CaptureFrame.
+	colorAttachment.finalLayout = config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	VkAttachmentReference colorAttachmentRef = {};
 	colorAttachmentRef.attachment = 0;
@@ -244,8 +507,10 @@ void VKRenderer::InitDefaultRenderpass()
 	VkSubpassDependency dependency = {};
 	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
 	dependency.dstSubpass = 0;
+	// Frames in flight share the depth image, and the colour image too when headless,
+	// so writes from the previous frame have to finish before this one clears them.
 	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.srcAccessMask = 0;
+	dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
@@ -253,7 +518,7 @@ void VKRenderer::InitDefaultRenderpass()
 	depthDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
 	depthDependency.dstSubpass = 0;
 	depthDependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
-	depthDependency.srcAccessMask = 0;
+	depthDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 	depthDependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
 	depthDependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
@@ -273,13 +538,16 @@ void VKRenderer::InitDefaultRenderpass()
 	VkResult err = vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass);
 	CheckVkError(err);
 
-	deletionList.push_back([=]() {
-		vkDestroyRenderPass(device, renderPass, nullptr);
-		});
+	deletionQueue.renderPasses.push_back(renderPass);
 }
 
 void VKRenderer::InitFramebuffers()
 {
+	if (supportsDynamicRendering)
+	{
+		return;
+	}
+
 	VkFramebufferCreateInfo fbInfo = {};
 	fbInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
 	fbInfo.pNext = nullptr;
@@ -304,10 +572,7 @@ void VKRenderer::InitFramebuffers()
 		VkResult err = vkCreateFramebuffer(device, &fbInfo, nullptr, &framebuffers[i]);
 		CheckVkError(err);
 
-		swapchainDeletionList.push_back([=]() {
-			vkDestroyFramebuffer(device, framebuffers[i], nullptr);
-			vkDestroyImageView(device, swapchainImageViews[i], nullptr);
-			});
+		swapchainDeletionQueue.framebuffers.push_back(framebuffers[i]);
 	}
 }
 
@@ -326,33 +591,57 @@ void VKRenderer::InitSyncStructures()
 		err = vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &frames[i].renderSemaphore);
 		CheckVkError(err);
 
-		deletionList.push_back([=]() {
-			vkDestroyFence(device, frames[i].renderFence, nullptr);
-			vkDestroySemaphore(device, frames[i].presentSemaphore, nullptr);
-			vkDestroySemaphore(device, frames[i].renderSemaphore, nullptr);
-			});
+		frames[i].hasTimestamps = false;
+
+		deletionQueue.fences.push_back(frames[i].renderFence);
+		deletionQueue.semaphores.push_back(frames[i].presentSemaphore);
+		deletionQueue.semaphores.push_back(frames[i].renderSemaphore);
 	}
 
 	VkFenceCreateInfo uploadFenceCreateInfo = FenceCreateInfo(0);
 	VkResult err = vkCreateFence(device, &uploadFenceCreateInfo, nullptr, &uploadContext.uploadFence);
 	CheckVkError(err);
 
-	deletionList.push_back([=]() {
-		vkDestroyFence(device, uploadContext.uploadFence, nullptr);
-		});
+	err = vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &uploadContext.uploadSemaphore);
+	CheckVkError(err);
+
+	deletionQueue.fences.push_back(uploadContext.uploadFence);
+	deletionQueue.semaphores.push_back(uploadContext.uploadSemaphore);
+}
+
+void VKRenderer::InitTimestampQueries()
+{
+	if (!supportsTimestamps)
+	{
+		return;
+	}
+
+	VkQueryPoolCreateInfo queryPoolInfo = {};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.pNext = nullptr;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = frameOverlap * 2;
+
+	VkResult err = vkCreateQueryPool(device, &queryPoolInfo, nullptr, &timestampQueryPool);
+	CheckVkError(err);
+
+	deletionQueue.queryPools.push_back(timestampQueryPool);
 }
 
 void VKRenderer::InitDescriptors()
 {
 	std::vector<VkDescriptorPoolSize> sizes = {
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10 },
-		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 10 },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2 * frameOverlap },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, maxTextureArrays + frameOverlap },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 * frameOverlap },
 	};
 
+	// Texture array sets are freed individually when they are destroyed. Depth pyramid sets
+	// come from a pool of their own, see InitDepthPyramid.
 	VkDescriptorPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolInfo.flags = 0;
-	poolInfo.maxSets = 10;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+	poolInfo.maxSets = 2 * frameOverlap + maxTextureArrays;
 	poolInfo.poolSizeCount = static_cast<uint32_t>(sizes.size());
 	poolInfo.pPoolSizes = sizes.data();
 
@@ -388,9 +677,108 @@ void VKRenderer::InitDescriptors()
 
 	vkCreateDescriptorSetLayout(device, &textureSetInfo, nullptr, &singleTextureSetLayout);
 
+	if (supportsBindlessTextures)
+	{
+		// Entries are only written as texture arrays are created, the rest are never read.
+		VkDescriptorBindingFlagsEXT bindlessBindingFlags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+			VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+
+		VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+		bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+		bindingFlagsInfo.pNext = nullptr;
+		bindingFlagsInfo.bindingCount = 1;
+		bindingFlagsInfo.pBindingFlags = &bindlessBindingFlags;
+
+		VkDescriptorSetLayoutBinding bindlessBinding = textureBinding;
+		bindlessBinding.descriptorCount = maxBindlessTextures;
+
+		VkDescriptorSetLayoutCreateInfo bindlessSetInfo = {};
+		bindlessSetInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		bindlessSetInfo.pNext = &bindingFlagsInfo;
+		bindlessSetInfo.bindingCount = 1;
+		bindlessSetInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+		bindlessSetInfo.pBindings = &bindlessBinding;
+
+		vkCreateDescriptorSetLayout(device, &bindlessSetInfo, nullptr, &bindlessTextureSetLayout);
+
+		// Sets that are updated after being bound need a pool of their own.
+		VkDescriptorPoolSize bindlessSize = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, maxBindlessTextures };
+
+		VkDescriptorPoolCreateInfo bindlessPoolInfo = {};
+		bindlessPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		bindlessPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+		bindlessPoolInfo.maxSets = 1;
+		bindlessPoolInfo.poolSizeCount = 1;
+		bindlessPoolInfo.pPoolSizes = &bindlessSize;
+
+		VkResult err = vkCreateDescriptorPool(device, &bindlessPoolInfo, nullptr, &bindlessDescriptorPool);
+		CheckVkError(err);
+
+		VkDescriptorSetAllocateInfo bindlessAllocInfo = {};
+		bindlessAllocInfo.pNext = nullptr;
+		bindlessAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		bindlessAllocInfo.descriptorPool = bindlessDescriptorPool;
+		bindlessAllocInfo.descriptorSetCount = 1;
+		bindlessAllocInfo.pSetLayouts = &bindlessTextureSetLayout;
+
+		err = vkAllocateDescriptorSets(device, &bindlessAllocInfo, &bindlessTextureSet);
+		CheckVkError(err);
+	}
+
+	// cull.comp reads instanceBuffer, writes culledInstanceBuffer and counts into drawCommandBuffer,
+	// then tests what is left against the depth pyramid.
+	VkDescriptorType cullBindingTypes[5] = {
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+	};
+	VkDescriptorSetLayoutBinding cullBindings[5] = {};
+
+	for (uint32_t i = 0; i < 5; ++i)
+	{
+		cullBindings[i].binding = i;
+		cullBindings[i].descriptorCount = 1;
+		cullBindings[i].descriptorType = cullBindingTypes[i];
+		cullBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo cullSetInfo = {};
+	cullSetInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	cullSetInfo.pNext = nullptr;
+	cullSetInfo.bindingCount = 5;
+	cullSetInfo.flags = 0;
+	cullSetInfo.pBindings = cullBindings;
+
+	// hiz.comp reads one level, or the depth image, and writes the next.
+	VkDescriptorSetLayoutBinding depthPyramidBindings[2] = {};
+	depthPyramidBindings[0].binding = 0;
+	depthPyramidBindings[0].descriptorCount = 1;
+	depthPyramidBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	depthPyramidBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	depthPyramidBindings[1].binding = 1;
+	depthPyramidBindings[1].descriptorCount = 1;
+	depthPyramidBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	depthPyramidBindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutCreateInfo depthPyramidSetInfo = {};
+	depthPyramidSetInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	depthPyramidSetInfo.pNext = nullptr;
+	depthPyramidSetInfo.bindingCount = 2;
+	depthPyramidSetInfo.flags = 0;
+	depthPyramidSetInfo.pBindings = depthPyramidBindings;
+
+	if (supportsGpuCulling)
+	{
+		vkCreateDescriptorSetLayout(device, &cullSetInfo, nullptr, &cullSetLayout);
+		vkCreateDescriptorSetLayout(device, &depthPyramidSetInfo, nullptr, &depthPyramidSetLayout);
+	}
+
 	for (int i = 0; i < frameOverlap; ++i)
 	{
-		frames[i].cameraBuffer = CreateBuffer(sizeof(GPUCameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+		frames[i].cameraBuffer = CreateBuffer(sizeof(GPUCameraData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU,
+			MemoryCategory::Instances);
 
 		VkDescriptorSetAllocateInfo allocInfo = {};
 		allocInfo.pNext = nullptr;
@@ -416,20 +804,102 @@ void VKRenderer::InitDescriptors()
 		setWrite.pBufferInfo = &bufferInfo;
 
 		vkUpdateDescriptorSets(device, 1, &setWrite, 0, nullptr);
+
+		frames[i].instanceBuffer = CreateBuffer(sizeof(PackedInstance) * maxInstancesPerFrame,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU,
+			MemoryCategory::Instances);
+
+		void* instanceData;
+		VkResult err = vmaMapMemory(allocator, frames[i].instanceBuffer.allocation, &instanceData);
+		CheckVkError(err);
+		frames[i].instanceData = static_cast<PackedInstance*>(instanceData);
+		frames[i].instanceCount = 0;
+
+		if (!supportsGpuCulling)
+		{
+			continue;
+		}
+
+		frames[i].culledInstanceBuffer = CreateBuffer(sizeof(PackedInstance) * maxInstancesPerFrame,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY,
+			MemoryCategory::Instances);
+		frames[i].drawCommandBuffer = CreateBuffer(sizeof(VkDrawIndexedIndirectCommand) * maxCulledDrawsPerFrame,
+			VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU,
+			MemoryCategory::Instances);
+
+		frames[i].occlusionDataBuffer = CreateBuffer(sizeof(GPUOcclusionData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+			VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Instances);
+
+		void* drawCommands;
+		err = vmaMapMemory(allocator, frames[i].drawCommandBuffer.allocation, &drawCommands);
+		CheckVkError(err);
+		frames[i].drawCommands = static_cast<VkDrawIndexedIndirectCommand*>(drawCommands);
+
+		VkDescriptorSetAllocateInfo cullAllocInfo = {};
+		cullAllocInfo.pNext = nullptr;
+		cullAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		cullAllocInfo.descriptorPool = descriptorPool;
+		cullAllocInfo.descriptorSetCount = 1;
+		cullAllocInfo.pSetLayouts = &cullSetLayout;
+
+		vkAllocateDescriptorSets(device, &cullAllocInfo, &frames[i].cullDescriptor);
+		frames[i].cullDepthPyramidView = VK_NULL_HANDLE;
+
+		// The depth pyramid is written by BeginRecording, it changes with the swapchain.
+		uint32_t cullBufferBindings[4] = { 0, 1, 2, 4 };
+		VkDescriptorBufferInfo cullBufferInfos[4] = {};
+		cullBufferInfos[0].buffer = frames[i].instanceBuffer.buffer;
+		cullBufferInfos[1].buffer = frames[i].culledInstanceBuffer.buffer;
+		cullBufferInfos[2].buffer = frames[i].drawCommandBuffer.buffer;
+		cullBufferInfos[3].buffer = frames[i].occlusionDataBuffer.buffer;
+		VkWriteDescriptorSet cullSetWrites[4] = {};
+
+		for (uint32_t j = 0; j < 4; ++j)
+		{
+			cullBufferInfos[j].offset = 0;
+			cullBufferInfos[j].range = VK_WHOLE_SIZE;
+
+			cullSetWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			cullSetWrites[j].pNext = nullptr;
+			cullSetWrites[j].dstBinding = cullBufferBindings[j];
+			cullSetWrites[j].dstSet = frames[i].cullDescriptor;
+			cullSetWrites[j].descriptorCount = 1;
+			cullSetWrites[j].descriptorType = cullBindingTypes[cullBufferBindings[j]];
+			cullSetWrites[j].pBufferInfo = &cullBufferInfos[j];
+		}
+
+		vkUpdateDescriptorSets(device, 4, cullSetWrites, 0, nullptr);
 	}
 
 	for (int i = 0; i < frameOverlap; ++i)
 	{
-		deletionList.push_back([=]() {
-			vmaDestroyBuffer(allocator, frames[i].cameraBuffer.buffer, frames[i].cameraBuffer.allocation);
-			});
+		deletionQueue.buffers.push_back(frames[i].cameraBuffer);
+		deletionQueue.mappedBuffers.push_back(frames[i].instanceBuffer);
+
+		if (supportsGpuCulling)
+		{
+			deletionQueue.buffers.push_back(frames[i].culledInstanceBuffer);
+			deletionQueue.mappedBuffers.push_back(frames[i].drawCommandBuffer);
+			deletionQueue.buffers.push_back(frames[i].occlusionDataBuffer);
+		}
+	}
+
+	deletionQueue.descriptorSetLayouts.push_back(globalSetLayout);
+	deletionQueue.descriptorSetLayouts.push_back(singleTextureSetLayout);
+
+	if (supportsBindlessTextures)
+	{
+		deletionQueue.descriptorSetLayouts.push_back(bindlessTextureSetLayout);
+		deletionQueue.descriptorPools.push_back(bindlessDescriptorPool);
+	}
+
+	if (supportsGpuCulling)
+	{
+		deletionQueue.descriptorSetLayouts.push_back(cullSetLayout);
+		deletionQueue.descriptorSetLayouts.push_back(depthPyramidSetLayout);
 	}
 
-	deletionList.push_back([&]() {
-		vkDestroyDescriptorSetLayout(device, globalSetLayout, nullptr);
-		vkDestroyDescriptorSetLayout(device, singleTextureSetLayout, nullptr);
-		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
-		});
+	deletionQueue.descriptorPools.push_back(descriptorPool);
 }
 
 VkCommandPoolCreateInfo VKRenderer::CommandPoolCreateInfo(uint32_t queueFamilyIndex, VkCommandPoolCreateFlags flags)
@@ -594,6 +1064,21 @@ VkRect2D VKRenderer::DefaultScissor()
 	return scissor;
 }
 
+VkPresentModeKHR VKRenderer::GetVkPresentMode(PresentMode presentMode)
+{
+	switch (presentMode)
+	{
+	case PresentMode::Mailbox:
+		return VK_PRESENT_MODE_MAILBOX_KHR;
+	case PresentMode::Fifo:
+		return VK_PRESENT_MODE_FIFO_KHR;
+	case PresentMode::FifoRelaxed:
+		return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+	default:
+		return VK_PRESENT_MODE_IMMEDIATE_KHR;
+	}
+}
+
 VkImageCreateInfo VKRenderer::ImageCreateInfo(VkFormat format, VkImageUsageFlags usageFlags, VkExtent3D extent)
 {
 	VkImageCreateInfo info = {};
@@ -682,6 +1167,8 @@ VkSamplerCreateInfo VKRenderer::SamplerCreateInfo(VkFilter filters, VkSamplerAdd
 	info.addressModeU = samplerAddressMode;
 	info.addressModeV = samplerAddressMode;
 	info.addressModeW = samplerAddressMode;
+	info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	info.maxLod = VK_LOD_CLAMP_NONE;
 
 	return info;
 }
@@ -700,7 +1187,8 @@ VkWriteDescriptorSet VKRenderer::WriteDescriptorImage(VkDescriptorType type, VkD
 	return write;
 }
 
-AllocatedBuffer VKRenderer::CreateBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage)
+AllocatedBuffer VKRenderer::CreateBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage,
+	MemoryCategory category, bool isUploadTarget)
 {
 	VkBufferCreateInfo bufferInfo = {};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -708,12 +1196,27 @@ AllocatedBuffer VKRenderer::CreateBuffer(size_t allocSize, VkBufferUsageFlags us
 	bufferInfo.size = allocSize;
 	bufferInfo.usage = usage;
 
+	// Upload targets are written on the transfer queue and read on the graphics queue.
+	uint32_t queueFamilies[2] = { graphicsQueueFamily, transferQueueFamily };
+
+	if (isUploadTarget && graphicsQueueFamily != transferQueueFamily)
+	{
+		bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferInfo.queueFamilyIndexCount = 2;
+		bufferInfo.pQueueFamilyIndices = queueFamilies;
+	}
+
 	VmaAllocationCreateInfo vmaAllocInfo = {};
 	vmaAllocInfo.usage = memoryUsage;
 
+	uint32_t memoryTypeIndex;
+	VkResult err = vmaFindMemoryTypeIndexForBufferInfo(allocator, &bufferInfo, &vmaAllocInfo, &memoryTypeIndex);
+	CheckVkError(err);
+	vmaAllocInfo.pool = GetMemoryPool(category, memoryTypeIndex);
+
 	AllocatedBuffer newBuffer = {};
 
-	VkResult err = vmaCreateBuffer(allocator, &bufferInfo, &vmaAllocInfo,
+	err = vmaCreateBuffer(allocator, &bufferInfo, &vmaAllocInfo,
 		&newBuffer.buffer,
 		&newBuffer.allocation,
 		nullptr);
@@ -722,216 +1225,891 @@ AllocatedBuffer VKRenderer::CreateBuffer(size_t allocSize, VkBufferUsageFlags us
 	return newBuffer;
 }
 
-void VKRenderer::ImmediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function)
+AllocatedImage VKRenderer::CreateImage(const VkImageCreateInfo& imageInfo, MemoryCategory category)
 {
-	VkCommandBuffer cmd = uploadContext.commandBuffer;
-	VkCommandBufferBeginInfo cmdBeginInfo = CommandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-	VkResult err = vkBeginCommandBuffer(cmd, &cmdBeginInfo);
+	VmaAllocationCreateInfo imageAllocInfo = {};
+	imageAllocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+
+	uint32_t memoryTypeIndex;
+	VkResult err = vmaFindMemoryTypeIndexForImageInfo(allocator, &imageInfo, &imageAllocInfo, &memoryTypeIndex);
 	CheckVkError(err);
+	imageAllocInfo.pool = GetMemoryPool(category, memoryTypeIndex);
 
-	function(cmd);
+	AllocatedImage newImage = {};
+	err = vmaCreateImage(allocator, &imageInfo, &imageAllocInfo, &newImage.image, &newImage.allocation, nullptr);
 
-	err = vkEndCommandBuffer(cmd);
-	CheckVkError(err);
+	// Evicting one array at a time keeps as many resident as will fit.
+	while (err == VK_ERROR_OUT_OF_DEVICE_MEMORY && EvictTextures(1) > 0)
+	{
+		err = vmaCreateImage(allocator, &imageInfo, &imageAllocInfo, &newImage.image, &newImage.allocation, nullptr);
+	}
 
-	VkSubmitInfo submit = SubmitInfo(&cmd);
-	
-	err = vkQueueSubmit(graphicsQueue, 1, &submit, uploadContext.uploadFence);
 	CheckVkError(err);
 
-	vkWaitForFences(device, 1, &uploadContext.uploadFence, true, 9999999999);
-	vkResetFences(device, 1, &uploadContext.uploadFence);
-
-	vkResetCommandPool(device, uploadContext.commandPool, 0);
+	return newImage;
 }
 
-void VKRenderer::LoadImageFromFile(const char* file, AllocatedImage& outImage)
+VmaPool VKRenderer::GetMemoryPool(MemoryCategory category, uint32_t memoryTypeIndex)
 {
-	int32_t texWidth, texHeight, texChannels;
-
-	stbi_uc* pixels = stbi_load(file, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-
-	if (!pixels)
+	for (const MemoryPool& memoryPool : memoryPools)
 	{
-		std::stringstream stream;
-		stream << "Failed to load texture file: ";
-		stream << file;
-		throw std::runtime_error(stream.str());
+		if (memoryPool.category == category && memoryPool.memoryTypeIndex == memoryTypeIndex)
+		{
+			return memoryPool.pool;
+		}
 	}
 
-	void* pixelPtr = pixels;
-	VkDeviceSize imageSize = texWidth * texHeight * 4;
-	VkFormat imageFormat = VK_FORMAT_R8G8B8A8_SRGB;
-
-	AllocatedBuffer stagingBuffer = CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-
-	void* data;
-	vmaMapMemory(allocator, stagingBuffer.allocation, &data);
-	memcpy(data, pixelPtr, static_cast<size_t>(imageSize));
-	vmaUnmapMemory(allocator, stagingBuffer.allocation);
-
-	stbi_image_free(pixels);
+	// With the default block size, allocations too large to share a block get dedicated memory.
+	VmaPoolCreateInfo poolInfo = {};
+	poolInfo.memoryTypeIndex = memoryTypeIndex;
 
-	VkExtent3D imageExtent;
-	imageExtent.width = static_cast<uint32_t>(texWidth);
-	imageExtent.height = static_cast<uint32_t>(texHeight);
-	imageExtent.depth = 1;
+	VmaPool pool;
+	VkResult err = vmaCreatePool(allocator, &poolInfo, &pool);
+	CheckVkError(err);
 
-	VkImageCreateInfo imageInfo = ImageCreateInfo(imageFormat, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent);
-	AllocatedImage newImage;
-	VmaAllocationCreateInfo imageAllocInfo = {};
-	imageAllocInfo.usage = VMA_MEMORY_USAGE_AUTO;
-	imageAllocInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+	memoryPools.push_back(MemoryPool{ category, memoryTypeIndex, pool });
 
-	vmaCreateImage(allocator, &imageInfo, &imageAllocInfo, &newImage.image, &newImage.allocation, nullptr);
+	return pool;
+}
 
-	ImmediateSubmit([&](VkCommandBuffer cmd) {
-		VkImageSubresourceRange range;
-		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		range.baseMipLevel = 0;
-		range.levelCount = 1;
-		range.baseArrayLayer = 0;
-		range.layerCount = 1;
+AllocatedBuffer VKRenderer::UploadBuffer(const void* data, size_t size, VkBufferUsageFlags usage)
+{
+	VkBuffer stagingBuffer;
+	VkDeviceSize stagingOffset;
+	uint8_t* stagingData = AllocateStaging(size, &stagingBuffer, &stagingOffset);
+	memcpy(stagingData, data, size);
 
-		VkImageMemoryBarrier imageBarrierToTransfer = {};
-		imageBarrierToTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-		imageBarrierToTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		imageBarrierToTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		imageBarrierToTransfer.image = newImage.image;
-		imageBarrierToTransfer.subresourceRange = range;
-		imageBarrierToTransfer.srcAccessMask = 0;
-		imageBarrierToTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	AllocatedBuffer newBuffer = CreateBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY,
+		MemoryCategory::Meshes, true);
 
-		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
-			0, 0, nullptr, 0, nullptr, 1, &imageBarrierToTransfer);
+	VkBufferCopy copy;
+	copy.dstOffset = 0;
+	copy.srcOffset = stagingOffset;
+	copy.size = size;
+	vkCmdCopyBuffer(GetUploadCommandBuffer(), stagingBuffer, newBuffer.buffer, 1, &copy);
 
-		VkBufferImageCopy copyRegion = {};
-		copyRegion.bufferOffset = 0;
-		copyRegion.bufferRowLength = 0;
-		copyRegion.bufferImageHeight = 0;
+	return newBuffer;
+}
 
-		copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		copyRegion.imageSubresource.mipLevel = 0;
-		copyRegion.imageSubresource.baseArrayLayer = 0;
-		copyRegion.imageSubresource.layerCount = 1;
-		copyRegion.imageExtent = imageExtent;
+uint8_t* VKRenderer::AllocateStaging(size_t size, VkBuffer* outBuffer, VkDeviceSize* outOffset)
+{
+	BeginUploads();
 
-		vkCmdCopyBufferToImage(cmd, stagingBuffer.buffer, newImage.image,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+	if (size > stagingArenaSize)
+	{
+		AllocatedBuffer stagingBuffer = CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY,
+			MemoryCategory::Staging);
+		uploadContext.oversizedStagingBuffers.push_back(stagingBuffer);
 
-		VkImageMemoryBarrier imageBarrierToReadable = imageBarrierToTransfer;
+		void* data;
+		vmaMapMemory(allocator, stagingBuffer.allocation, &data);
 
-		imageBarrierToReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		imageBarrierToReadable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		*outBuffer = stagingBuffer.buffer;
+		*outOffset = 0;
+		return static_cast<uint8_t*>(data);
+	}
 
-		imageBarrierToReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		imageBarrierToReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	size_t offset = (uploadContext.stagingCursor + stagingAlignment - 1) & ~(stagingAlignment - 1);
 
-		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-			0, 0, nullptr, 0, nullptr, 1, &imageBarrierToReadable);
-		});
+	if (offset + size > stagingArenaSize)
+	{
+		// The arena is full, submit what has been recorded and wait for it before reusing the space.
+		FlushUploads();
+		BeginUploads();
+		offset = 0;
+	}
 
-	deletionList.push_back([=]() {
-		vmaDestroyImage(allocator, newImage.image, newImage.allocation);
-		});
-	vmaDestroyBuffer(allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+	uploadContext.stagingCursor = offset + size;
 
-	outImage = newImage;
+	*outBuffer = uploadContext.stagingBuffer.buffer;
+	*outOffset = offset;
+	return uploadContext.stagingData + offset;
 }
 
-void VKRenderer::LoadImages()
+VkCommandBuffer VKRenderer::GetUploadCommandBuffer()
 {
-	Texture test;
-	LoadImageFromFile("res/test.png", test.image);
-	VkImageViewCreateInfo imageInfo = ImageViewCreateInfo(VK_FORMAT_R8G8B8A8_SRGB, test.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
-	vkCreateImageView(device, &imageInfo, nullptr, &test.imageView);
-
-	deletionList.push_back([=]() {
-		vkDestroyImageView(device, test.imageView, nullptr);
-		});
+	BeginUploads();
 
-	loadedTextures["test"] = test;
+	return uploadContext.commandBuffer;
 }
 
-void VKRenderer::LoadMeshes()
+void VKRenderer::BeginUploads()
 {
-	triangleMesh.vertices.resize(3);
+	if (uploadContext.isRecording)
+	{
+		return;
+	}
 
-	triangleMesh.vertices[0].pos = { 1.0f, 1.0f, 0.0f };
-	triangleMesh.vertices[1].pos = {-1.0f, 1.0f, 0.0f };
-	triangleMesh.vertices[2].pos = { 0.0f,-1.0f, 0.0f };
+	RetireUploads();
 
-	triangleMesh.vertices[0].color = { 0.0f, 1.0f, 0.0f };
-	triangleMesh.vertices[1].color = { 0.0f, 1.0f, 0.0f };
-	triangleMesh.vertices[2].color = { 0.0f, 1.0f, 0.0f };
+	uploadContext.stagingCursor = 0;
 
-	triangleMesh.vertices[0].uv = { 0.0f, 0.0f };
-	triangleMesh.vertices[1].uv = { 0.0f, 1.0f };
-	triangleMesh.vertices[2].uv = { 1.0f, 1.0f };
+	VkCommandBufferBeginInfo cmdBeginInfo = CommandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	VkResult err = vkBeginCommandBuffer(uploadContext.commandBuffer, &cmdBeginInfo);
+	CheckVkError(err);
 
-	UploadMesh(triangleMesh);
+	uploadContext.isRecording = true;
 }
 
-void VKRenderer::UploadMesh(Mesh& mesh)
+void VKRenderer::RetireUploads()
 {
-	const size_t bufferSize = mesh.vertices.size() * sizeof(Vertex);
+	if (!uploadContext.isInFlight)
+	{
+		return;
+	}
 
-	VkBufferCreateInfo stagingBufferInfo = {};
-	stagingBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	stagingBufferInfo.size = bufferSize;
-	stagingBufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	// Usually finished long before the next batch starts, so this rarely blocks.
+	vkWaitForFences(device, 1, &uploadContext.uploadFence, true, 9999999999);
+	vkResetFences(device, 1, &uploadContext.uploadFence);
+	vkResetCommandPool(device, uploadContext.commandPool, 0);
 
+	for (AllocatedBuffer& stagingBuffer : uploadContext.oversizedStagingBuffers)
+	{
+		vmaUnmapMemory(allocator, stagingBuffer.allocation);
+		vmaDestroyBuffer(allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+	}
 
-	VmaAllocationCreateInfo vmaAllocInfo = {};
-	vmaAllocInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
-		VMA_ALLOCATION_CREATE_MAPPED_BIT;
-	vmaAllocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+	uploadContext.oversizedStagingBuffers.clear();
+	uploadContext.isInFlight = false;
+}
 
-	AllocatedBuffer stagingBuffer;
+void VKRenderer::FlushUploads()
+{
+	if (!uploadContext.isRecording)
+	{
+		return;
+	}
 
-	VkResult err = vmaCreateBuffer(allocator, &stagingBufferInfo, &vmaAllocInfo,
-		&stagingBuffer.buffer, &stagingBuffer.allocation, nullptr);
+	VkCommandBuffer cmd = uploadContext.commandBuffer;
+	VkResult err = vkEndCommandBuffer(cmd);
 	CheckVkError(err);
 
-	deletionList.push_back([=]() {
-        vmaDestroyBuffer(allocator, mesh.vertexBuffer.buffer, mesh.vertexBuffer.allocation);
-		});
+	VkSubmitInfo submit = SubmitInfo(&cmd);
 
-	void* data;
-	vmaMapMemory(allocator, stagingBuffer.allocation, &data);
-	memcpy(data, mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
-	vmaUnmapMemory(allocator, stagingBuffer.allocation);
+	// A binary semaphore can't be signalled twice, so if no frame has consumed the
+	// last signal this batch waits on it instead.
+	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
 
-	VkBufferCreateInfo vertexBufferInfo = {};
-	vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	vertexBufferInfo.pNext = nullptr;
-	vertexBufferInfo.size = bufferSize;
-	vertexBufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	if (uploadContext.isSemaphorePending)
+	{
+		submit.waitSemaphoreCount = 1;
+		submit.pWaitSemaphores = &uploadContext.uploadSemaphore;
+		submit.pWaitDstStageMask = &waitStage;
+	}
 
-	vmaAllocInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+	submit.signalSemaphoreCount = 1;
+	submit.pSignalSemaphores = &uploadContext.uploadSemaphore;
 
-	err = vmaCreateBuffer(allocator, &vertexBufferInfo, &vmaAllocInfo,
-		&mesh.vertexBuffer.buffer,
-		&mesh.vertexBuffer.allocation,
-		nullptr);
+	err = vkQueueSubmit(transferQueue, 1, &submit, uploadContext.uploadFence);
 	CheckVkError(err);
 
-	ImmediateSubmit([=](VkCommandBuffer cmd) {
-		VkBufferCopy copy;
-		copy.dstOffset = 0;
-		copy.srcOffset = 0;
-		copy.size = bufferSize;
-		vkCmdCopyBuffer(cmd, stagingBuffer.buffer, mesh.vertexBuffer.buffer, 1, &copy);
-		});
+	uploadContext.isRecording = false;
+	uploadContext.isInFlight = true;
+	uploadContext.isSemaphorePending = true;
+}
+
+AllocatedImage VKRenderer::CreateTextureImage(VkFormat format, uint32_t width, uint32_t height, uint32_t layerCount,
+	uint32_t mipCount)
+{
+	VkExtent3D imageExtent;
+	imageExtent.width = width;
+	imageExtent.height = height;
+	imageExtent.depth = 1;
+
+	VkImageCreateInfo imageInfo = ImageCreateInfo(format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent);
+	imageInfo.arrayLayers = layerCount;
+	imageInfo.mipLevels = mipCount;
 
-	deletionList.push_back([=]() {
-		vmaDestroyBuffer(allocator, mesh.vertexBuffer.buffer, mesh.vertexBuffer.allocation);
-		});
+	uint32_t queueFamilies[2] = { graphicsQueueFamily, transferQueueFamily };
 
-	vmaDestroyBuffer(allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+	if (graphicsQueueFamily != transferQueueFamily)
+	{
+		imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		imageInfo.queueFamilyIndexCount = 2;
+		imageInfo.pQueueFamilyIndices = queueFamilies;
+	}
+
+	AllocatedImage newImage = CreateImage(imageInfo, MemoryCategory::Textures);
+
+	VkImageSubresourceRange range;
+	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.baseMipLevel = 0;
+	range.levelCount = mipCount;
+	range.baseArrayLayer = 0;
+	range.layerCount = layerCount;
+
+	VkImageMemoryBarrier imageBarrierToTransfer = {};
+	imageBarrierToTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imageBarrierToTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageBarrierToTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	imageBarrierToTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrierToTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrierToTransfer.image = newImage.image;
+	imageBarrierToTransfer.subresourceRange = range;
+	imageBarrierToTransfer.srcAccessMask = 0;
+	imageBarrierToTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(GetUploadCommandBuffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &imageBarrierToTransfer);
+
+	return newImage;
 }
 
-VkPipeline PipelineBuilder::BuildPipeline(VkDevice device, VkRenderPass pass)
+void VKRenderer::UploadTextureLayer(PendingTexture& pending, const DecodedImage& image)
+{
+	size_t layerSize = static_cast<size_t>(pending.width) * pending.height * 4;
+
+	VkBuffer stagingBuffer;
+	VkDeviceSize stagingOffset;
+	uint8_t* stagingData = AllocateStaging(layerSize, &stagingBuffer, &stagingOffset);
+	memcpy(stagingData, image.pixels, layerSize);
+
+	VkBufferImageCopy copyRegion = {};
+	copyRegion.bufferOffset = stagingOffset;
+	copyRegion.bufferRowLength = 0;
+	copyRegion.bufferImageHeight = 0;
+
+	copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	copyRegion.imageSubresource.mipLevel = 0;
+	copyRegion.imageSubresource.baseArrayLayer = image.layer;
+	copyRegion.imageSubresource.layerCount = 1;
+	copyRegion.imageExtent = { static_cast<uint32_t>(pending.width), static_cast<uint32_t>(pending.height), 1 };
+
+	vkCmdCopyBufferToImage(GetUploadCommandBuffer(), stagingBuffer, pending.texture.image.image,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+}
+
+void VKRenderer::FinishTextureImage(Texture& texture, VkFormat format, uint32_t layerCount, uint32_t mipCount)
+{
+	VkImageSubresourceRange range;
+	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.baseMipLevel = 0;
+	range.levelCount = mipCount;
+	range.baseArrayLayer = 0;
+	range.layerCount = layerCount;
+
+	// The transfer queue may not support fragment shader stages, visibility for
+	// the fragment shader comes from the frame waiting on the upload semaphore.
+	VkImageMemoryBarrier imageBarrierToReadable = {};
+	imageBarrierToReadable.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imageBarrierToReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	imageBarrierToReadable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageBarrierToReadable.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrierToReadable.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrierToReadable.image = texture.image.image;
+	imageBarrierToReadable.subresourceRange = range;
+	imageBarrierToReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	imageBarrierToReadable.dstAccessMask = 0;
+
+	vkCmdPipelineBarrier(GetUploadCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &imageBarrierToReadable);
+
+	CreateTextureDescriptor(texture, format, layerCount, mipCount);
+}
+
+void VKRenderer::CreateTextureDescriptor(Texture& texture, VkFormat format, uint32_t layerCount, uint32_t mipCount)
+{
+	VkImageViewCreateInfo viewInfo = ImageViewCreateInfo(format, texture.image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	viewInfo.subresourceRange.levelCount = mipCount;
+	viewInfo.subresourceRange.layerCount = layerCount;
+
+	VkResult err = vkCreateImageView(device, &viewInfo, nullptr, &texture.imageView);
+	CheckVkError(err);
+
+	VkDescriptorImageInfo imageBufferInfo;
+	imageBufferInfo.sampler = textureSampler;
+	imageBufferInfo.imageView = texture.imageView;
+	imageBufferInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	if (supportsBindlessTextures)
+	{
+		if (!freeBindlessIndices.empty())
+		{
+			texture.descriptorIndex = freeBindlessIndices.back();
+			freeBindlessIndices.pop_back();
+		}
+		else if (nextBindlessIndex < maxBindlessTextures)
+		{
+			texture.descriptorIndex = nextBindlessIndex++;
+		}
+		else
+		{
+			throw std::runtime_error("Out of bindless texture descriptors!");
+		}
+
+		VkWriteDescriptorSet bindlessWrite = WriteDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			bindlessTextureSet, &imageBufferInfo, 0);
+		bindlessWrite.dstArrayElement = texture.descriptorIndex;
+
+		vkUpdateDescriptorSets(device, 1, &bindlessWrite, 0, nullptr);
+		return;
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.pNext = nullptr;
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &singleTextureSetLayout;
+
+	err = vkAllocateDescriptorSets(device, &allocInfo, &texture.descriptorSet);
+	CheckVkError(err);
+
+	VkWriteDescriptorSet textureWrite = WriteDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, texture.descriptorSet, &imageBufferInfo, 0);
+
+	vkUpdateDescriptorSets(device, 1, &textureWrite, 0, nullptr);
+}
+
+void VKRenderer::UploadMesh(Mesh& mesh, const std::vector<float>& vertices, const std::vector<uint32_t>& indices)
+{
+	mesh.vertexBuffer = UploadBuffer(vertices.data(), vertices.size() * sizeof(float),
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	mesh.indexBuffer = UploadBuffer(indices.data(), indices.size() * sizeof(uint32_t),
+		VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+}
+
+void VKRenderer::DestroyMesh(Mesh& mesh, DeletionQueue& queue)
+{
+	queue.buffers.push_back(mesh.vertexBuffer);
+	queue.buffers.push_back(mesh.indexBuffer);
+}
+
+void VKRenderer::DestroyTexture(Texture& texture, DeletionQueue& queue)
+{
+	// Bindless entries are only reused once no frame can sample them.
+	if (supportsBindlessTextures)
+	{
+		queue.bindlessIndices.push_back(texture.descriptorIndex);
+	}
+	else
+	{
+		queue.descriptorSets.push_back(texture.descriptorSet);
+	}
+
+	queue.imageViews.push_back(texture.imageView);
+	queue.images.push_back(texture.image);
+}
+
+void VKRenderer::DestroyDynamicTexture(DynamicTexture& dynamicTexture, DeletionQueue& queue)
+{
+	for (uint32_t i = 0; i < frameOverlap; ++i)
+	{
+		DestroyTexture(dynamicTexture.slotTextures[i], queue);
+		queue.mappedBuffers.push_back(dynamicTexture.slotStagingBuffers[i]);
+	}
+}
+
+const Texture& VKRenderer::GetTexture(uint32_t id)
+{
+	auto it = textures.find(id);
+
+	if (it != textures.end())
+	{
+		return it->second;
+	}
+
+	return dynamicTextures.at(id).slotTextures[frameNumber % frameOverlap];
+}
+
+const Texture& VKRenderer::UseTexture(uint32_t id)
+{
+	auto it = textures.find(id);
+
+	// Dynamic texture arrays are never evicted.
+	if (it == textures.end())
+	{
+		return GetTexture(id);
+	}
+
+	if (it->second.image.image == VK_NULL_HANDLE)
+	{
+		// Loaded as a new array, then moved into the evicted one's entry so the game's handle
+		// stays valid. Its uploads are submitted ahead of the frame that draws it.
+		const TextureSource& source = textureSources.at(id);
+		TextureArray restored = source.packFile.empty() ? CreateTextureArray(source.images) :
+			CreateTextureArrayFromPack(source.packFile);
+
+		textures.at(id) = textures.at(restored.texture);
+		textures.erase(restored.texture);
+		textureSources.erase(restored.texture);
+	}
+
+	Texture& texture = textures.at(id);
+	texture.lastUsedFrame = frameNumber;
+
+	return texture;
+}
+
+VkDeviceSize VKRenderer::EvictTextures(VkDeviceSize bytes)
+{
+	std::vector<std::pair<int32_t, uint32_t>> candidates;
+
+	for (auto& it : textures)
+	{
+		if (it.second.image.image != VK_NULL_HANDLE && it.second.lastUsedFrame <= completedFrame)
+		{
+			candidates.emplace_back(it.second.lastUsedFrame, it.first);
+		}
+	}
+
+	std::sort(candidates.begin(), candidates.end());
+
+	VkDeviceSize freedBytes = 0;
+
+	for (const auto& candidate : candidates)
+	{
+		if (freedBytes >= bytes)
+		{
+			break;
+		}
+
+		Texture& texture = textures.at(candidate.second);
+		VmaAllocationInfo allocationInfo;
+		vmaGetAllocationInfo(allocator, texture.image.allocation, &allocationInfo);
+		freedBytes += allocationInfo.size;
+
+		DestroyTexture(texture, evictionQueue);
+		texture.image = {};
+		texture.imageView = VK_NULL_HANDLE;
+		++evictionCount;
+	}
+
+	// The GPU is done with every candidate, and the memory has to be free right away.
+	FlushDeletionQueue(evictionQueue);
+
+	return freedBytes;
+}
+
+VkDeviceSize VKRenderer::GetDeviceLocalUsage()
+{
+	const VkPhysicalDeviceMemoryProperties* memoryProperties;
+	vmaGetMemoryProperties(allocator, &memoryProperties);
+	VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+	vmaGetHeapBudgets(allocator, budgets);
+
+	VkDeviceSize usage = 0;
+
+	for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; ++i)
+	{
+		if ((memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) == 0)
+		{
+			continue;
+		}
+
+		// Unused space in VMA's blocks is filled before new blocks are allocated, so only
+		// what allocations occupy counts. Freeing an allocation lowers this right away.
+		VkDeviceSize unusedBytes = budgets[i].statistics.blockBytes - budgets[i].statistics.allocationBytes;
+		usage += budgets[i].usage > unusedBytes ? budgets[i].usage - unusedBytes : 0;
+	}
+
+	return usage;
+}
+
+VkDeviceSize VKRenderer::GetMemoryBudget()
+{
+	if (config.memoryBudget > 0)
+	{
+		return config.memoryBudget;
+	}
+
+	const VkPhysicalDeviceMemoryProperties* memoryProperties;
+	vmaGetMemoryProperties(allocator, &memoryProperties);
+	VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+	vmaGetHeapBudgets(allocator, budgets);
+
+	VkDeviceSize budget = 0;
+
+	for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; ++i)
+	{
+		if ((memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0)
+		{
+			budget += budgets[i].budget;
+		}
+	}
+
+	return static_cast<VkDeviceSize>(budget * defaultMemoryBudgetFraction);
+}
+
+void VKRenderer::EnforceMemoryBudget()
+{
+	VkDeviceSize usage = GetDeviceLocalUsage();
+	VkDeviceSize budget = GetMemoryBudget();
+
+	if (usage <= budget)
+	{
+		isOverMemoryBudget = false;
+		return;
+	}
+
+	VkDeviceSize freedBytes = EvictTextures(usage - budget);
+	bool isStillOver = freedBytes < usage - budget;
+
+	if (isStillOver && !isOverMemoryBudget)
+	{
+		std::cout << "Using " << (usage - freedBytes) / (1024 * 1024) << " MiB of device memory, over the budget of " <<
+			budget / (1024 * 1024) << " MiB, with no texture arrays left to evict.\n";
+	}
+
+	isOverMemoryBudget = isStillOver;
+}
+
+bool VKRenderer::RecordDynamicTextureCopies(FrameData& frame)
+{
+	uint32_t slot = frameNumber % frameOverlap;
+	VkCommandBuffer cmd = frame.dynamicTextureCommandBuffer;
+	bool isRecording = false;
+
+	std::vector<VkImageMemoryBarrier> barriers;
+
+	for (auto& it : dynamicTextures)
+	{
+		DynamicTexture& dynamicTexture = it.second;
+
+		if (dynamicTexture.slotVersions[slot] == dynamicTexture.version)
+		{
+			continue;
+		}
+
+		if (!isRecording)
+		{
+			VkResult err = vkResetCommandBuffer(cmd, 0);
+			CheckVkError(err);
+
+			VkCommandBufferBeginInfo cmdBeginInfo = CommandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+			err = vkBeginCommandBuffer(cmd, &cmdBeginInfo);
+			CheckVkError(err);
+
+			isRecording = true;
+		}
+
+		// The slot's last frame has finished, so its staging buffer and image are free to reuse.
+		memcpy(dynamicTexture.slotStagingData[slot], dynamicTexture.shadow.data(), dynamicTexture.shadow.size());
+
+		// The staging buffer may not be host coherent.
+		VkResult err = vmaFlushAllocation(allocator, dynamicTexture.slotStagingBuffers[slot].allocation, 0,
+			dynamicTexture.shadow.size());
+		CheckVkError(err);
+
+		VkImageSubresourceRange range;
+		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		range.baseMipLevel = 0;
+		range.levelCount = 1;
+		range.baseArrayLayer = 0;
+		range.layerCount = dynamicTexture.layerCount;
+
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = dynamicTexture.slotVersions[slot] == 0 ? VK_IMAGE_LAYOUT_UNDEFINED :
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = dynamicTexture.slotTextures[slot].image.image;
+		barrier.subresourceRange = range;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		VkBufferImageCopy copyRegion = {};
+		copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		copyRegion.imageSubresource.mipLevel = 0;
+		copyRegion.imageSubresource.baseArrayLayer = 0;
+		copyRegion.imageSubresource.layerCount = dynamicTexture.layerCount;
+		copyRegion.imageExtent = { dynamicTexture.width, dynamicTexture.height, 1 };
+
+		vkCmdCopyBufferToImage(cmd, dynamicTexture.slotStagingBuffers[slot].buffer, barrier.image,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+		// Transitioned back together once every copy has been recorded.
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barriers.push_back(barrier);
+
+		dynamicTexture.slotVersions[slot] = dynamicTexture.version;
+	}
+
+	if (!isRecording)
+	{
+		return false;
+	}
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+	CheckVkError(vkEndCommandBuffer(cmd));
+
+	return true;
+}
+
+void VKRenderer::RecordDepthPyramid(VkCommandBuffer cmd)
+{
+	// The depth image is read once the render pass is done with it. The whole pyramid is
+	// rewritten, so its old contents can go, once the previous culling is done reading them.
+	VkImageMemoryBarrier startBarriers[2] = {};
+	startBarriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	startBarriers[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	startBarriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	startBarriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	startBarriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	startBarriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	startBarriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	startBarriers[0].image = depthImage.image;
+	startBarriers[0].subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+
+	startBarriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	startBarriers[1].srcAccessMask = 0;
+	startBarriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	startBarriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	startBarriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	startBarriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	startBarriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	startBarriers[1].image = depthPyramid.image;
+	startBarriers[1].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, depthPyramidLevelCount, 0, 1 };
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 2, startBarriers);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramidPipeline);
+
+	// Each level reads the one written before it, the last barrier also covers the next
+	// frame's culling.
+	VkMemoryBarrier levelBarrier = {};
+	levelBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	levelBarrier.pNext = nullptr;
+	levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	DepthPyramidPushConstants constants = {};
+	constants.destinationSize[0] = width;
+	constants.destinationSize[1] = height;
+
+	for (uint32_t i = 0; i < depthPyramidLevelCount; ++i)
+	{
+		constants.sourceSize[0] = constants.destinationSize[0];
+		constants.sourceSize[1] = constants.destinationSize[1];
+		constants.destinationSize[0] = (constants.sourceSize[0] + 1) / 2;
+		constants.destinationSize[1] = (constants.sourceSize[1] + 1) / 2;
+
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, depthPyramidPipelineLayout, 0, 1,
+			&depthPyramidDescriptors[i], 0, nullptr);
+		vkCmdPushConstants(cmd, depthPyramidPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+			sizeof(DepthPyramidPushConstants), &constants);
+		vkCmdDispatch(cmd, (constants.destinationSize[0] + depthPyramidGroupSize - 1) / depthPyramidGroupSize,
+			(constants.destinationSize[1] + depthPyramidGroupSize - 1) / depthPyramidGroupSize, 1);
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &levelBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	// The next render pass clears the depth image, after the reads above.
+	VkImageMemoryBarrier endBarrier = startBarriers[0];
+	endBarrier.srcAccessMask = 0;
+	endBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	endBarrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	endBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &endBarrier);
+}
+
+void VKRenderer::RecordBeginRendering(VkCommandBuffer cmd)
+{
+	VkClearValue depthClear;
+	depthClear.depthStencil.depth = 1.0f;
+
+	VkRect2D renderArea = {};
+	renderArea.extent = VkExtent2D{
+		static_cast<uint32_t>(width),
+		static_cast<uint32_t>(height)
+	};
+
+	if (!supportsDynamicRendering)
+	{
+		VkClearValue clearValues[] = { clearColor, depthClear };
+
+		VkRenderPassBeginInfo rpInfo = {};
+		rpInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		rpInfo.pNext = nullptr;
+		rpInfo.renderPass = renderPass;
+		rpInfo.renderArea = renderArea;
+		rpInfo.framebuffer = framebuffers[swapchainImageIndex];
+		rpInfo.clearValueCount = 2;
+		rpInfo.pClearValues = &clearValues[0];
+
+		vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+		return;
+	}
+
+	// The same dependencies as the render pass's. Frames in flight share the depth image, and
+	// the colour image too when headless, so writes from the previous frame have to finish
+	// before this one clears them. Both are cleared, so their old contents can go.
+	VkImageMemoryBarrier2KHR barriers[2] = {};
+	barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+	barriers[0].srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR;
+	barriers[0].srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR;
+	barriers[0].dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR;
+	barriers[0].dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR;
+	barriers[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barriers[0].newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barriers[0].image = swapchainImages[swapchainImageIndex];
+	barriers[0].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+	// RecordDepthPyramid expects the depth image to stay in this layout after rendering.
+	barriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+	barriers[1].srcStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR |
+		VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR;
+	barriers[1].srcAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR;
+	barriers[1].dstStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR |
+		VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR;
+	barriers[1].dstAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT_KHR |
+		VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR;
+	barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barriers[1].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	barriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barriers[1].image = depthImage.image;
+	barriers[1].subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+
+	VkDependencyInfoKHR dependencyInfo = {};
+	dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+	dependencyInfo.pNext = nullptr;
+	dependencyInfo.imageMemoryBarrierCount = 2;
+	dependencyInfo.pImageMemoryBarriers = barriers;
+
+	cmdPipelineBarrier2(cmd, &dependencyInfo);
+
+	VkRenderingAttachmentInfoKHR colorAttachment = {};
+	colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+	colorAttachment.pNext = nullptr;
+	colorAttachment.imageView = swapchainImageViews[swapchainImageIndex];
+	colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	colorAttachment.clearValue = clearColor;
+
+	VkRenderingAttachmentInfoKHR depthAttachment = {};
+	depthAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+	depthAttachment.pNext = nullptr;
+	depthAttachment.imageView = depthImageView;
+	depthAttachment.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	depthAttachment.clearValue = depthClear;
+
+	VkRenderingInfoKHR renderingInfo = {};
+	renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+	renderingInfo.pNext = nullptr;
+	renderingInfo.renderArea = renderArea;
+	renderingInfo.layerCount = 1;
+	renderingInfo.colorAttachmentCount = 1;
+	renderingInfo.pColorAttachments = &colorAttachment;
+	renderingInfo.pDepthAttachment = &depthAttachment;
+
+	cmdBeginRendering(cmd, &renderingInfo);
+}
+
+void VKRenderer::RecordEndRendering(VkCommandBuffer cmd)
+{
+	if (!supportsDynamicRendering)
+	{
+		vkCmdEndRenderPass(cmd);
+		return;
+	}
+
+	cmdEndRendering(cmd);
+
+	// The render pass's final layout. Presenting waits on the frame's semaphore, which
+	// already covers the writes, and headless frames are left ready to be copied out by
+	// CaptureFrame.
+	VkImageMemoryBarrier2KHR barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+	barrier.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR;
+	barrier.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR;
+	barrier.dstStageMask = config.headless ? VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR : VK_PIPELINE_STAGE_2_NONE_KHR;
+	barrier.dstAccessMask = config.headless ? VK_ACCESS_2_TRANSFER_READ_BIT_KHR : VK_ACCESS_2_NONE_KHR;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	barrier.newLayout = config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = swapchainImages[swapchainImageIndex];
+	barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+	VkDependencyInfoKHR dependencyInfo = {};
+	dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+	dependencyInfo.pNext = nullptr;
+	dependencyInfo.imageMemoryBarrierCount = 1;
+	dependencyInfo.pImageMemoryBarriers = &barrier;
+
+	cmdPipelineBarrier2(cmd, &dependencyInfo);
+}
+
+bool VKRenderer::RecordCulling(FrameData& frame)
+{
+	if (frame.culledDraws.empty())
+	{
+		return false;
+	}
+
+	VkCommandBuffer cmd = frame.cullCommandBuffer;
+	CheckVkError(vkResetCommandBuffer(cmd, 0));
+
+	VkCommandBufferBeginInfo beginInfo = CommandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	CheckVkError(vkBeginCommandBuffer(cmd, &beginInfo));
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &frame.cullDescriptor, 0, nullptr);
+
+	// The planes are shared by every draw, only the per draw fields are pushed again.
+	CullPushConstants constants = {};
+
+	for (uint32_t i = 0; i < 6; ++i)
+	{
+		constants.planes[i] = frustum.planes[i];
+	}
+
+	vkCmdPushConstants(cmd, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants.planes), constants.planes);
+
+	constexpr uint32_t drawFieldsOffset = offsetof(CullPushConstants, firstInstance);
+
+	for (uint32_t i = 0; i < frame.culledDraws.size(); ++i)
+	{
+		const CulledDraw& draw = frame.culledDraws[i];
+		constants.firstInstance = draw.firstInstance;
+		constants.instanceCount = draw.instanceCount;
+		constants.drawIndex = i;
+		constants.boundingRadius = draw.boundingRadius;
+
+		vkCmdPushConstants(cmd, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, drawFieldsOffset,
+			sizeof(CullPushConstants) - drawFieldsOffset, &constants.firstInstance);
+		vkCmdDispatch(cmd, (draw.instanceCount + cullGroupSize - 1) / cullGroupSize, 1, 1);
+	}
+
+	// The main command buffer is submitted after this one, its indirect draws and instance
+	// reads wait for the culling to finish.
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	CheckVkError(vkEndCommandBuffer(cmd));
+
+	return true;
+}
+
+VkPipeline PipelineBuilder::BuildPipeline(VkDevice device, VkRenderPass pass)
 {
 	VkPipelineViewportStateCreateInfo viewportState = {};
 	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
@@ -976,379 +2154,1786 @@ VkPipeline PipelineBuilder::BuildPipeline(VkDevice device, VkRenderPass pass)
 	pipelineInfo.subpass = 0;
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-	VkPipeline newPipeline;
+	VkPipelineRenderingCreateInfoKHR renderingInfo = {};
+	renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+	renderingInfo.pNext = nullptr;
+	renderingInfo.colorAttachmentCount = 1;
+	renderingInfo.pColorAttachmentFormats = &colorAttachmentFormat;
+	renderingInfo.depthAttachmentFormat = depthAttachmentFormat;
+
+	if (pass == VK_NULL_HANDLE)
+	{
+		pipelineInfo.pNext = &renderingInfo;
+	}
+
+	VkPipeline newPipeline;
+
+	if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create pipeline");
+	}
+	else
+	{
+		return newPipeline;
+	}
+}
+
+VkPipeline PipelineBuilder::BuildComputePipeline(VkDevice device)
+{
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.pNext = nullptr;
+	pipelineInfo.stage = shaderStages[0];
+	pipelineInfo.layout = pipelineLayout;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+	VkPipeline newPipeline;
+
+	if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create compute pipeline");
+	}
+
+	return newPipeline;
+}
+
+VertexInputDescription Vertex::GetVertexDescription()
+{
+	VertexInputDescription description;
+
+	VkVertexInputBindingDescription mainBinding = {};
+	mainBinding.binding = 0;
+	mainBinding.stride = sizeof(Vertex);
+	mainBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	description.bindings.push_back(mainBinding);
+
+	VkVertexInputAttributeDescription positionAttribute = {};
+	positionAttribute.binding = 0;
+	positionAttribute.location = 0;
+	positionAttribute.format = VK_FORMAT_R32G32B32_SFLOAT;
+	positionAttribute.offset = offsetof(Vertex, pos);
+
+	VkVertexInputAttributeDescription uvAttribute = {};
+	uvAttribute.binding = 0;
+	uvAttribute.location = 1;
+	uvAttribute.format = VK_FORMAT_R32G32_SFLOAT;
+	uvAttribute.offset = offsetof(Vertex, uv);
+
+	description.attributes.push_back(positionAttribute);
+	description.attributes.push_back(uvAttribute);
+
+	// Packed instances are read from a second, per-instance binding.
+	VkVertexInputBindingDescription instanceBinding = {};
+	instanceBinding.binding = 1;
+	instanceBinding.stride = sizeof(PackedInstance);
+	instanceBinding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+	description.bindings.push_back(instanceBinding);
+
+	VkVertexInputAttributeDescription offsetAttribute = {};
+	offsetAttribute.binding = 1;
+	offsetAttribute.location = 2;
+	offsetAttribute.format = VK_FORMAT_R32G32B32_SFLOAT;
+	offsetAttribute.offset = offsetof(PackedInstance, offset);
+
+	VkVertexInputAttributeDescription rotationScaleAttribute = {};
+	rotationScaleAttribute.binding = 1;
+	rotationScaleAttribute.location = 3;
+	rotationScaleAttribute.format = VK_FORMAT_R16G16_SFLOAT;
+	rotationScaleAttribute.offset = offsetof(PackedInstance, rotation);
+
+	// The layer and the texture array index together.
+	VkVertexInputAttributeDescription textureAttribute = {};
+	textureAttribute.binding = 1;
+	textureAttribute.location = 4;
+	textureAttribute.format = VK_FORMAT_R16G16_UINT;
+	textureAttribute.offset = offsetof(PackedInstance, textureIndex);
+
+	description.attributes.push_back(offsetAttribute);
+	description.attributes.push_back(rotationScaleAttribute);
+	description.attributes.push_back(textureAttribute);
+
+	return description;
+}
+
+FrameData& VKRenderer::GetCurrentFrame()
+{
+	return frames[frameNumber % frameOverlap];
+}
+
+void VKRenderer::FlushDeletionQueue(DeletionQueue& queue)
+{
+	// Everything is destroyed before what it was created from or allocated in.
+	for (VkPipeline pipeline : queue.pipelines)
+	{
+		vkDestroyPipeline(device, pipeline, nullptr);
+	}
+
+	for (VkPipelineLayout pipelineLayout : queue.pipelineLayouts)
+	{
+		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	}
+
+	for (VkPipelineCache cache : queue.pipelineCaches)
+	{
+		vkDestroyPipelineCache(device, cache, nullptr);
+	}
+
+	for (VkFramebuffer framebuffer : queue.framebuffers)
+	{
+		vkDestroyFramebuffer(device, framebuffer, nullptr);
+	}
+
+	for (VkRenderPass pass : queue.renderPasses)
+	{
+		vkDestroyRenderPass(device, pass, nullptr);
+	}
+
+	if (!queue.descriptorSets.empty())
+	{
+		vkFreeDescriptorSets(device, descriptorPool, static_cast<uint32_t>(queue.descriptorSets.size()),
+			queue.descriptorSets.data());
+	}
+
+	for (VkDescriptorPool pool : queue.descriptorPools)
+	{
+		vkDestroyDescriptorPool(device, pool, nullptr);
+	}
+
+	for (VkDescriptorSetLayout setLayout : queue.descriptorSetLayouts)
+	{
+		vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+	}
+
+	freeBindlessIndices.insert(freeBindlessIndices.end(), queue.bindlessIndices.begin(), queue.bindlessIndices.end());
+
+	for (VkSampler sampler : queue.samplers)
+	{
+		vkDestroySampler(device, sampler, nullptr);
+	}
+
+	for (VkImageView imageView : queue.imageViews)
+	{
+		vkDestroyImageView(device, imageView, nullptr);
+	}
+
+	for (const AllocatedImage& image : queue.images)
+	{
+		vmaDestroyImage(allocator, image.image, image.allocation);
+	}
+
+	for (const AllocatedBuffer& buffer : queue.buffers)
+	{
+		vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
+	}
+
+	for (const AllocatedBuffer& buffer : queue.mappedBuffers)
+	{
+		vmaUnmapMemory(allocator, buffer.allocation);
+		vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
+	}
+
+	for (VkSwapchainKHR oldSwapchain : queue.swapchains)
+	{
+		vkDestroySwapchainKHR(device, oldSwapchain, nullptr);
+	}
+
+	for (VkQueryPool queryPool : queue.queryPools)
+	{
+		vkDestroyQueryPool(device, queryPool, nullptr);
+	}
+
+	for (VkCommandPool commandPool : queue.commandPools)
+	{
+		vkDestroyCommandPool(device, commandPool, nullptr);
+	}
+
+	for (VkFence fence : queue.fences)
+	{
+		vkDestroyFence(device, fence, nullptr);
+	}
+
+	for (VkSemaphore semaphore : queue.semaphores)
+	{
+		vkDestroySemaphore(device, semaphore, nullptr);
+	}
+
+	// Clearing keeps the capacity, so queueing doesn't allocate again.
+	queue.pipelines.clear();
+	queue.pipelineLayouts.clear();
+	queue.pipelineCaches.clear();
+	queue.framebuffers.clear();
+	queue.renderPasses.clear();
+	queue.descriptorSets.clear();
+	queue.descriptorPools.clear();
+	queue.descriptorSetLayouts.clear();
+	queue.bindlessIndices.clear();
+	queue.samplers.clear();
+	queue.imageViews.clear();
+	queue.images.clear();
+	queue.buffers.clear();
+	queue.mappedBuffers.clear();
+	queue.swapchains.clear();
+	queue.queryPools.clear();
+	queue.commandPools.clear();
+	queue.fences.clear();
+	queue.semaphores.clear();
+}
+
+template <typename T>
+static void MoveHandles(std::vector<T>& source, std::vector<T>& destination)
+{
+	destination.insert(destination.end(), source.begin(), source.end());
+	source.clear();
+}
+
+void VKRenderer::MoveDeletionQueue(DeletionQueue& source, DeletionQueue& destination)
+{
+	MoveHandles(source.pipelines, destination.pipelines);
+	MoveHandles(source.pipelineLayouts, destination.pipelineLayouts);
+	MoveHandles(source.pipelineCaches, destination.pipelineCaches);
+	MoveHandles(source.framebuffers, destination.framebuffers);
+	MoveHandles(source.renderPasses, destination.renderPasses);
+	MoveHandles(source.descriptorSets, destination.descriptorSets);
+	MoveHandles(source.descriptorPools, destination.descriptorPools);
+	MoveHandles(source.descriptorSetLayouts, destination.descriptorSetLayouts);
+	MoveHandles(source.bindlessIndices, destination.bindlessIndices);
+	MoveHandles(source.samplers, destination.samplers);
+	MoveHandles(source.imageViews, destination.imageViews);
+	MoveHandles(source.images, destination.images);
+	MoveHandles(source.buffers, destination.buffers);
+	MoveHandles(source.mappedBuffers, destination.mappedBuffers);
+	MoveHandles(source.swapchains, destination.swapchains);
+	MoveHandles(source.queryPools, destination.queryPools);
+	MoveHandles(source.commandPools, destination.commandPools);
+	MoveHandles(source.fences, destination.fences);
+	MoveHandles(source.semaphores, destination.semaphores);
+}
+
+DeletionQueue& VKRenderer::GetDeletionQueue()
+{
+	// Uploads that haven't been waited on by a frame yet are waited on by the next one, which
+	// may use anything released now, as may the frame being recorded. Otherwise the last
+	// submitted frame is the last one that can.
+	bool isNextFrameUsing = isFrameActive || uploadContext.isRecording || uploadContext.isSemaphorePending;
+	int32_t lastFrame = isNextFrameUsing ? frameNumber : frameNumber - 1;
+
+	// Flushed once the frame's slot is acquired again, when the frame has finished.
+	uint32_t slot = static_cast<uint32_t>(lastFrame + static_cast<int32_t>(frameOverlap)) % frameOverlap;
+	DeletionQueue& queue = frames[slot].deletionQueue;
+	queue.lastFrame = std::max(queue.lastFrame, lastFrame);
+
+	return queue;
+}
+
+void VKRenderer::CleanupVulkan()
+{
+	vkDeviceWaitIdle(device);
+
+	RetireUploads();
+
+	for (AllocatedBuffer& stagingBuffer : uploadContext.oversizedStagingBuffers)
+	{
+		vmaUnmapMemory(allocator, stagingBuffer.allocation);
+		vmaDestroyBuffer(allocator, stagingBuffer.buffer, stagingBuffer.allocation);
+	}
+
+	uploadContext.oversizedStagingBuffers.clear();
+
+	for (uint32_t i = 0; i < frameOverlap; ++i)
+	{
+		FlushDeletionQueue(frames[i].deletionQueue);
+	}
+
+	for (auto& it : meshes)
+	{
+		DestroyMesh(it.second, deletionQueue);
+	}
+
+	for (auto& it : textures)
+	{
+		if (it.second.image.image != VK_NULL_HANDLE)
+		{
+			DestroyTexture(it.second, deletionQueue);
+		}
+	}
+
+	for (auto& it : dynamicTextures)
+	{
+		DestroyDynamicTexture(it.second, deletionQueue);
+	}
+
+	for (auto& it : pendingTextures)
+	{
+		if (it.second.texture.image.image != VK_NULL_HANDLE)
+		{
+			deletionQueue.images.push_back(it.second.texture.image);
+		}
+	}
+
+	deletionQueue.pipelines.push_back(modelPipeline);
+	deletionQueue.pipelines.push_back(spritePipeline);
+
+	if (supportsGpuCulling)
+	{
+		deletionQueue.pipelines.push_back(cullPipeline);
+		deletionQueue.pipelines.push_back(depthPyramidPipeline);
+	}
+
+	SavePipelineCache();
+
+	meshes.clear();
+	textures.clear();
+	textureSources.clear();
+	dynamicTextures.clear();
+	pendingTextures.clear();
+
+	FlushDeletionQueue(swapchainDeletionQueue);
+	FlushDeletionQueue(deletionQueue);
+
+	for (const MemoryPool& memoryPool : memoryPools)
+	{
+		vmaDestroyPool(allocator, memoryPool.pool);
+	}
+
+	memoryPools.clear();
+
+	vmaDestroyAllocator(allocator);
+
+	if (surface != VK_NULL_HANDLE)
+	{
+		vkDestroySurfaceKHR(instance, surface, nullptr);
+	}
+	vkb::destroy_device(vkbDevice);
+	vkb::destroy_instance(vkbInstance);
+}
+
+void VKRenderer::CloseWindow()
+{
+	CleanupVulkan();
+	glfwTerminate();
+}
+
+void VKRenderer::ResizeWindow(int32_t width, int32_t height)
+{
+	// The swapchain is recreated when the next frame is acquired, so a live resize only
+	// rebuilds it once per frame no matter how many events arrive in between.
+	isSwapchainDirty = true;
+}
+
+GLFWwindow* VKRenderer::GetWindowPtr()
+{
+	return window;
+}
+
+void VKRenderer::SetClearColor(float r, float g, float b, float a)
+{
+	clearColor.color = { { r, g, b, a } };
+}
+
+void VKRenderer::BeginDrawing()
+{
+	auto start = FrameProfiler::Now();
+
+	// Pipelines are only swapped between frames, never while one is being recorded.
+	if (shaderWatcher.Poll())
+	{
+		ReloadPipelines();
+	}
+
+	isFrameActive = AcquireFrame();
+	EnforceMemoryBudget();
+
+	if (isFrameActive)
+	{
+		BeginRecording();
+	}
+
+	frameProfiler.EndStage(ProfilerStage::BeginDrawing, start);
+}
+
+bool VKRenderer::AcquireFrame()
+{
+	FrameData& currentFrame = GetCurrentFrame();
+
+	// Only blocks while the GPU is still rendering the frame that last used this slot,
+	// the other slots let the game simulate ahead of the GPU.
+	VkResult err = vkWaitForFences(device, 1, &currentFrame.renderFence, true, 1'000'000'000);
+	CheckVkError(err);
+	completedFrame = frameNumber - static_cast<int32_t>(frameOverlap);
+
+	if (currentFrame.deletionQueue.lastFrame <= completedFrame)
+	{
+		FlushDeletionQueue(currentFrame.deletionQueue);
+	}
+
+	if (config.headless)
+	{
+		swapchainImageIndex = 0;
+		return true;
+	}
+
+	if (isSwapchainDirty && !RecreateSwapchain())
+	{
+		return false;
+	}
+
+	err = vkAcquireNextImageKHR(device, swapchain, 1'000'000'000, currentFrame.presentSemaphore, nullptr, &swapchainImageIndex);
+
+	if (err == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		// Skip this frame, the next one renders into the new swapchain.
+		isSwapchainDirty = true;
+		return false;
+	}
+	else if (err != VK_SUBOPTIMAL_KHR)
+	{
+		CheckVkError(err);
+	}
+
+	return true;
+}
+
+void VKRenderer::BeginRecording()
+{
+	FrameData& currentFrame = GetCurrentFrame();
+
+	// Only reset if we are submitting work.
+	VkResult err = vkResetFences(device, 1, &currentFrame.renderFence);
+	CheckVkError(err);
+
+	err = vkResetCommandBuffer(currentFrame.mainCommandBuffer, 0);
+	CheckVkError(err);
+
+	// The fence guarantees the GPU is done with this frame's instances, camera data and timestamps.
+	currentFrame.instanceCount = 0;
+	currentFrame.culledDraws.clear();
+	ReadFrameTimestamps(currentFrame);
+
+	void* data;
+	vmaMapMemory(allocator, currentFrame.cameraBuffer.allocation, &data);
+	memcpy(data, &cameraData, sizeof(GPUCameraData));
+	vmaUnmapMemory(allocator, currentFrame.cameraBuffer.allocation);
+
+	// Culling tests against the pyramid the previous frame built, this frame's replaces it
+	// once it is submitted.
+	if (supportsGpuCulling)
+	{
+		GPUOcclusionData occlusionData = {};
+		occlusionData.viewProj = depthPyramidViewProj;
+		occlusionData.depthSize = glm::vec4(static_cast<float>(width), static_cast<float>(height),
+			static_cast<float>(depthPyramidLevelCount), isDepthPyramidValid ? 1.0f : 0.0f);
+
+		vmaMapMemory(allocator, currentFrame.occlusionDataBuffer.allocation, &data);
+		memcpy(data, &occlusionData, sizeof(GPUOcclusionData));
+		vmaUnmapMemory(allocator, currentFrame.occlusionDataBuffer.allocation);
+
+		depthPyramidViewProj = cameraData.viewProj;
+		isDepthPyramidValid = true;
+
+		// Frames in flight may still be culling against an older pyramid, so each frame's set
+		// is only pointed at the current one once its fence has been waited on.
+		if (currentFrame.cullDepthPyramidView != depthPyramidView)
+		{
+			VkDescriptorImageInfo pyramidInfo = {};
+			pyramidInfo.sampler = depthPyramidSampler;
+			pyramidInfo.imageView = depthPyramidView;
+			pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+			VkWriteDescriptorSet write = WriteDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				currentFrame.cullDescriptor, &pyramidInfo, 3);
+			vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+			currentFrame.cullDepthPyramidView = depthPyramidView;
+		}
+	}
+
+	VkCommandBuffer cmd = currentFrame.mainCommandBuffer;
+	VkCommandBufferBeginInfo cmdBeginInfo = CommandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	err = vkBeginCommandBuffer(cmd, &cmdBeginInfo);
+	CheckVkError(err);
+
+	if (supportsTimestamps)
+	{
+		uint32_t firstQuery = (frameNumber % frameOverlap) * 2;
+		vkCmdResetQueryPool(cmd, timestampQueryPool, firstQuery, 2);
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, firstQuery);
+	}
+
+	RecordBeginRendering(cmd);
+
+	VkViewport viewport = DefaultViewport();
+	VkRect2D scissor = DefaultScissor();
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, modelPipelineLayout, 0, 1, &currentFrame.globalDescriptor, 0, nullptr);
+
+	if (supportsBindlessTextures)
+	{
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, modelPipelineLayout, 1, 1, &bindlessTextureSet, 0, nullptr);
+	}
+}
+
+void VKRenderer::InitPipelineCache()
+{
+	std::vector<uint8_t> cacheData;
+
+	if (!config.pipelineCacheFile.empty())
+	{
+		std::ifstream file(config.pipelineCacheFile, std::ios::ate | std::ios::binary);
+
+		if (file.is_open())
+		{
+			cacheData.resize(static_cast<size_t>(file.tellg()));
+			file.seekg(0);
+			file.read(reinterpret_cast<char*>(cacheData.data()), cacheData.size());
+		}
+	}
+
+	// The header is headerSize, headerVersion, vendorID and deviceID followed by the cache UUID.
+	// Drivers should reject caches from other devices or driver versions themselves, but
+	// not all of them do, so anything that doesn't match starts from an empty cache.
+	constexpr size_t headerSize = 4 * sizeof(uint32_t) + VK_UUID_SIZE;
+	bool isValid = cacheData.size() >= headerSize;
+
+	if (isValid)
+	{
+		uint32_t header[4];
+		memcpy(header, cacheData.data(), sizeof(header));
+
+		isValid = header[0] >= headerSize &&
+			header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+			header[2] == gpuProperties.vendorID &&
+			header[3] == gpuProperties.deviceID &&
+			memcmp(cacheData.data() + sizeof(header), gpuProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+	}
+
+	if (!cacheData.empty() && !isValid)
+	{
+		std::cout << "Ignoring a pipeline cache from another device or driver.\n";
+	}
+
+	VkPipelineCacheCreateInfo cacheInfo = {};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.pNext = nullptr;
+	cacheInfo.initialDataSize = isValid ? cacheData.size() : 0;
+	cacheInfo.pInitialData = isValid ? cacheData.data() : nullptr;
+
+	VkResult err = vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache);
+	CheckVkError(err);
+
+	// Saved on the way out, so it includes every pipeline built while running.
+	deletionQueue.pipelineCaches.push_back(pipelineCache);
+}
+
+void VKRenderer::SavePipelineCache()
+{
+	if (config.pipelineCacheFile.empty())
+	{
+		return;
+	}
+
+	size_t dataSize = 0;
+	VkResult err = vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr);
+	CheckVkError(err);
+
+	std::vector<uint8_t> cacheData(dataSize);
+	err = vkGetPipelineCacheData(device, pipelineCache, &dataSize, cacheData.data());
+	CheckVkError(err);
+
+	// Not being able to save only costs the next start-up some time.
+	std::ofstream file(config.pipelineCacheFile, std::ios::binary | std::ios::trunc);
+
+	if (!file.is_open())
+	{
+		std::cout << "Failed to save the pipeline cache to " << config.pipelineCacheFile << "\n";
+		return;
+	}
+
+	file.write(reinterpret_cast<const char*>(cacheData.data()), dataSize);
+}
+
+void VKRenderer::BuildPipelineVariants(std::vector<PipelineVariant>& variants)
+{
+	// Pipeline caches are internally synchronized, so every variant can compile at once.
+	std::vector<VkPipeline> pipelines(variants.size(), VK_NULL_HANDLE);
+
+	try
+	{
+		workerPool.Run(static_cast<uint32_t>(variants.size()), [&](uint32_t i) {
+			PipelineVariant& variant = variants[i];
+			variant.builder.pipelineCache = pipelineCache;
+			pipelines[i] = variant.isCompute ?
+				variant.builder.BuildComputePipeline(device) :
+				variant.builder.BuildPipeline(device, renderPass);
+			});
+	}
+	catch (...)
+	{
+		// Nothing is replaced unless every variant built, reloads keep the old pipelines.
+		for (VkPipeline pipeline : pipelines)
+		{
+			if (pipeline != VK_NULL_HANDLE)
+			{
+				vkDestroyPipeline(device, pipeline, nullptr);
+			}
+		}
+
+		throw;
+	}
+
+	for (size_t i = 0; i < variants.size(); ++i)
+	{
+		*variants[i].outPipeline = pipelines[i];
+	}
+}
+
+void VKRenderer::InitPipelines()
+{
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = PipelineLayoutCreateInfo();
+
+	VkPushConstantRange pushConstant = {};
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(MeshPushConstants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+
+	VkDescriptorSetLayout setLayouts[] = {
+		globalSetLayout,
+		supportsBindlessTextures ? bindlessTextureSetLayout : singleTextureSetLayout,
+	};
+
+	pipelineLayoutInfo.setLayoutCount = 2;
+	pipelineLayoutInfo.pSetLayouts = &setLayouts[0];
+
+	VkResult err = vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &modelPipelineLayout);
+	CheckVkError(err);
+
+	if (supportsGpuCulling)
+	{
+		VkPipelineLayoutCreateInfo cullLayoutInfo = PipelineLayoutCreateInfo();
+
+		VkPushConstantRange cullPushConstant = {};
+		cullPushConstant.offset = 0;
+		cullPushConstant.size = sizeof(CullPushConstants);
+		cullPushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		cullLayoutInfo.pPushConstantRanges = &cullPushConstant;
+		cullLayoutInfo.pushConstantRangeCount = 1;
+		cullLayoutInfo.setLayoutCount = 1;
+		cullLayoutInfo.pSetLayouts = &cullSetLayout;
+
+		err = vkCreatePipelineLayout(device, &cullLayoutInfo, nullptr, &cullPipelineLayout);
+		CheckVkError(err);
+
+		VkPipelineLayoutCreateInfo depthPyramidLayoutInfo = PipelineLayoutCreateInfo();
+
+		VkPushConstantRange depthPyramidPushConstant = {};
+		depthPyramidPushConstant.offset = 0;
+		depthPyramidPushConstant.size = sizeof(DepthPyramidPushConstants);
+		depthPyramidPushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+		depthPyramidLayoutInfo.pPushConstantRanges = &depthPyramidPushConstant;
+		depthPyramidLayoutInfo.pushConstantRangeCount = 1;
+		depthPyramidLayoutInfo.setLayoutCount = 1;
+		depthPyramidLayoutInfo.pSetLayouts = &depthPyramidSetLayout;
+
+		err = vkCreatePipelineLayout(device, &depthPyramidLayoutInfo, nullptr, &depthPyramidPipelineLayout);
+		CheckVkError(err);
+
+		// Texels are fetched directly, the sampler only has to exist.
+		VkSamplerCreateInfo samplerInfo = SamplerCreateInfo(VK_FILTER_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+		err = vkCreateSampler(device, &samplerInfo, nullptr, &depthPyramidSampler);
+		CheckVkError(err);
+	}
+
+	BuildPipelines();
+
+	// The pipelines themselves are replaced by reloads, CleanupVulkan queues whichever are current.
+	deletionQueue.pipelineLayouts.push_back(modelPipelineLayout);
+
+	if (supportsGpuCulling)
+	{
+		deletionQueue.pipelineLayouts.push_back(cullPipelineLayout);
+		deletionQueue.pipelineLayouts.push_back(depthPyramidPipelineLayout);
+		deletionQueue.samplers.push_back(depthPyramidSampler);
+	}
+}
+
+void VKRenderer::BuildPipelines()
+{
+	std::vector<VkShaderModule> shaderModules;
+
+	auto loadShaderModule = [&](const char* filePath) {
+		VkShaderModule shaderModule;
+
+		if (!LoadShaderModule(filePath, &shaderModule))
+		{
+			throw std::runtime_error(std::string("Error when building the shader module ") + filePath + "!");
+		}
+
+		shaderModules.push_back(shaderModule);
+
+		return shaderModule;
+	};
+
+	try
+	{
+		VkShaderModule modelVertexShader = loadShaderModule("shaders/model.vert.spv");
+		VkShaderModule modelFragShader = loadShaderModule(supportsBindlessTextures ?
+			"shaders/model_bindless.frag.spv" : "shaders/model.frag.spv");
+
+		PipelineBuilder pipelineBuilder;
+
+		pipelineBuilder.shaderStages.push_back(
+			PipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, modelVertexShader));
+
+		pipelineBuilder.shaderStages.push_back(
+			PipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, modelFragShader));
+
+		pipelineBuilder.vertexInputInfo = VertexInputStateCreateInfo();
+		pipelineBuilder.inputAssembly = InputAssemblyCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+		pipelineBuilder.viewport = DefaultViewport();
+		pipelineBuilder.scissor = DefaultScissor();
+
+		pipelineBuilder.rasterizer = RasterizationStateCreateInfo(VK_POLYGON_MODE_FILL);
+		pipelineBuilder.multisampling = MulitsamplingStateCreateInfo();
+		pipelineBuilder.colorBlendAttachment = ColorBlendAttachmentState();
+		pipelineBuilder.pipelineLayout = modelPipelineLayout;
+
+		VertexInputDescription vertexDescription = Vertex::GetVertexDescription();
+		pipelineBuilder.vertexInputInfo.pVertexAttributeDescriptions = vertexDescription.attributes.data();
+		pipelineBuilder.vertexInputInfo.vertexAttributeDescriptionCount = vertexDescription.attributes.size();
+		pipelineBuilder.vertexInputInfo.pVertexBindingDescriptions = vertexDescription.bindings.data();
+		pipelineBuilder.vertexInputInfo.vertexBindingDescriptionCount = vertexDescription.bindings.size();
+
+		pipelineBuilder.depthStencil = DepthStencilCreateInfo(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
+		pipelineBuilder.colorAttachmentFormat = swapchainImageFormat;
+		pipelineBuilder.depthAttachmentFormat = depthFormat;
+
+		// Every variant is only described here, they are all built at once at the end.
+		std::vector<PipelineVariant> variants;
+		variants.push_back(PipelineVariant{ pipelineBuilder, false, &modelPipeline });
+
+		// Sprites are drawn on top of the scene, like GL does by disabling the depth test.
+		pipelineBuilder.depthStencil = DepthStencilCreateInfo(false, false, VK_COMPARE_OP_ALWAYS);
+
+		variants.push_back(PipelineVariant{ pipelineBuilder, false, &spritePipeline });
+
+		if (supportsGpuCulling)
+		{
+			PipelineBuilder cullPipelineBuilder;
+			cullPipelineBuilder.shaderStages.push_back(PipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT,
+				loadShaderModule("shaders/cull.comp.spv")));
+			cullPipelineBuilder.pipelineLayout = cullPipelineLayout;
+
+			variants.push_back(PipelineVariant{ cullPipelineBuilder, true, &cullPipeline });
+
+			PipelineBuilder depthPyramidPipelineBuilder;
+			depthPyramidPipelineBuilder.shaderStages.push_back(PipelineShaderStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT,
+				loadShaderModule("shaders/hiz.comp.spv")));
+			depthPyramidPipelineBuilder.pipelineLayout = depthPyramidPipelineLayout;
+
+			variants.push_back(PipelineVariant{ depthPyramidPipelineBuilder, true, &depthPyramidPipeline });
+		}
+
+		BuildPipelineVariants(variants);
+	}
+	catch (...)
+	{
+		for (VkShaderModule shaderModule : shaderModules)
+		{
+			vkDestroyShaderModule(device, shaderModule, nullptr);
+		}
+
+		throw;
+	}
+
+	for (VkShaderModule shaderModule : shaderModules)
+	{
+		vkDestroyShaderModule(device, shaderModule, nullptr);
+	}
+}
+
+void VKRenderer::ReloadPipelines()
+{
+	std::vector<VkPipeline> oldPipelines = { modelPipeline, spritePipeline };
+
+	if (supportsGpuCulling)
+	{
+		oldPipelines.push_back(cullPipeline);
+		oldPipelines.push_back(depthPyramidPipeline);
+	}
+
+	// Unchanged shaders come straight back out of the pipeline cache, so everything is rebuilt.
+	try
+	{
+		BuildPipelines();
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << e.what() << " Keeping the previous pipelines.\n";
+		return;
+	}
+
+	DeletionQueue& queue = GetDeletionQueue();
+
+	for (VkPipeline pipeline : oldPipelines)
+	{
+		queue.pipelines.push_back(pipeline);
+	}
+
+	std::cout << "Pipelines reloaded!\n";
+}
+
+void VKRenderer::InitDepthPyramid()
+{
+	if (!supportsGpuCulling)
+	{
+		return;
+	}
+
+	// Level 0 is half the depth image's size, every level halves the one before it rounding
+	// up, so each texel covers 2x2 texels of the level below.
+	uint32_t levelWidths[maxDepthPyramidLevels];
+	uint32_t levelHeights[maxDepthPyramidLevels];
+	levelWidths[0] = (static_cast<uint32_t>(width) + 1) / 2;
+	levelHeights[0] = (static_cast<uint32_t>(height) + 1) / 2;
+	depthPyramidLevelCount = 1;
+
+	while (levelWidths[depthPyramidLevelCount - 1] > 1 || levelHeights[depthPyramidLevelCount - 1] > 1)
+	{
+		if (depthPyramidLevelCount == maxDepthPyramidLevels)
+		{
+			throw std::runtime_error("Depth buffer is too large for its depth pyramid!");
+		}
+
+		levelWidths[depthPyramidLevelCount] = (levelWidths[depthPyramidLevelCount - 1] + 1) / 2;
+		levelHeights[depthPyramidLevelCount] = (levelHeights[depthPyramidLevelCount - 1] + 1) / 2;
+		++depthPyramidLevelCount;
+	}
+
+	VkExtent3D extent = { levelWidths[0], levelHeights[0], 1 };
+	VkImageCreateInfo imageInfo = ImageCreateInfo(VK_FORMAT_R32_SFLOAT,
+		VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent);
+	imageInfo.mipLevels = depthPyramidLevelCount;
+	depthPyramid = CreateImage(imageInfo, MemoryCategory::RenderTargets);
+
+	VkImageViewCreateInfo viewInfo = ImageViewCreateInfo(VK_FORMAT_R32_SFLOAT, depthPyramid.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	viewInfo.subresourceRange.levelCount = depthPyramidLevelCount;
+	VkResult err = vkCreateImageView(device, &viewInfo, nullptr, &depthPyramidView);
+	CheckVkError(err);
+
+	depthPyramidLevelViews.resize(depthPyramidLevelCount);
+	viewInfo.subresourceRange.levelCount = 1;
+
+	for (uint32_t i = 0; i < depthPyramidLevelCount; ++i)
+	{
+		viewInfo.subresourceRange.baseMipLevel = i;
+		err = vkCreateImageView(device, &viewInfo, nullptr, &depthPyramidLevelViews[i]);
+		CheckVkError(err);
+	}
+
+	// Every swapchain gets a pool sized for its pyramid, retired along with it, since the old
+	// pyramid's sets stay allocated until the frames still using them have finished.
+	VkDescriptorPoolSize poolSizes[2] = {
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, depthPyramidLevelCount },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, depthPyramidLevelCount },
+	};
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = 0;
+	poolInfo.maxSets = depthPyramidLevelCount;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
+
+	VkDescriptorPool depthPyramidDescriptorPool;
+	err = vkCreateDescriptorPool(device, &poolInfo, nullptr, &depthPyramidDescriptorPool);
+	CheckVkError(err);
+
+	std::vector<VkDescriptorSetLayout> setLayouts(depthPyramidLevelCount, depthPyramidSetLayout);
+	depthPyramidDescriptors.resize(depthPyramidLevelCount);
+
+	VkDescriptorSetAllocateInfo setAllocInfo = {};
+	setAllocInfo.pNext = nullptr;
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = depthPyramidDescriptorPool;
+	setAllocInfo.descriptorSetCount = depthPyramidLevelCount;
+	setAllocInfo.pSetLayouts = setLayouts.data();
+
+	err = vkAllocateDescriptorSets(device, &setAllocInfo, depthPyramidDescriptors.data());
+	CheckVkError(err);
+
+	// The pyramid stays in the general layout, it is both written and sampled.
+	for (uint32_t i = 0; i < depthPyramidLevelCount; ++i)
+	{
+		VkDescriptorImageInfo sourceInfo = {};
+		sourceInfo.sampler = depthPyramidSampler;
+		sourceInfo.imageView = i == 0 ? depthImageView : depthPyramidLevelViews[i - 1];
+		sourceInfo.imageLayout = i == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+		VkDescriptorImageInfo destinationInfo = {};
+		destinationInfo.imageView = depthPyramidLevelViews[i];
+		destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		VkWriteDescriptorSet writes[2] = {
+			WriteDescriptorImage(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, depthPyramidDescriptors[i], &sourceInfo, 0),
+			WriteDescriptorImage(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, depthPyramidDescriptors[i], &destinationInfo, 1),
+		};
+
+		vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+	}
+
+	isDepthPyramidValid = false;
+
+	// Destroying the pool frees the level sets.
+	swapchainDeletionQueue.descriptorPools.push_back(depthPyramidDescriptorPool);
+
+	for (uint32_t i = 0; i < depthPyramidLevelCount; ++i)
+	{
+		swapchainDeletionQueue.imageViews.push_back(depthPyramidLevelViews[i]);
+	}
+
+	swapchainDeletionQueue.imageViews.push_back(depthPyramidView);
+	swapchainDeletionQueue.images.push_back(depthPyramid);
+}
+
+void VKRenderer::EndDrawing()
+{
+	auto start = FrameProfiler::Now();
+
+	if (isFrameActive)
+	{
+		SubmitFrame();
+
+		if (!config.headless)
+		{
+			PresentFrame();
+		}
+
+		++frameNumber;
+	}
+
+	isFrameActive = false;
+	frameProfiler.EndStage(ProfilerStage::EndDrawing, start);
+
+	if (config.targetFrameTime > 0.0)
+	{
+		// Block on the next slot now rather than in BeginDrawing, so that neither GPU
+		// back-pressure nor the pacer's sleep sits between input sampling and submit.
+		VkResult err = vkWaitForFences(device, 1, &GetCurrentFrame().renderFence, true, 1'000'000'000);
+		CheckVkError(err);
+		framePacer.Wait();
+	}
+
+	frameProfiler.EndFrame();
+
+	if (!config.headless)
+	{
+		glfwPollEvents();
+	}
+}
+
+void VKRenderer::SubmitFrame()
+{
+	FrameData& currentFrame = GetCurrentFrame();
+	VkCommandBuffer cmd = currentFrame.mainCommandBuffer;
+
+	RecordEndRendering(cmd);
+
+	if (supportsGpuCulling)
+	{
+		RecordDepthPyramid(cmd);
+	}
+
+	if (supportsTimestamps)
+	{
+		uint32_t firstQuery = (frameNumber % frameOverlap) * 2;
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, firstQuery + 1);
+		currentFrame.hasTimestamps = true;
+	}
+
+	CheckVkError(vkEndCommandBuffer(cmd));
+
+	// The instance and draw command buffers may not be host coherent.
+	VkResult err = vmaFlushAllocation(allocator, currentFrame.instanceBuffer.allocation, 0,
+		sizeof(PackedInstance) * currentFrame.instanceCount);
+	CheckVkError(err);
+
+	if (!currentFrame.culledDraws.empty())
+	{
+		err = vmaFlushAllocation(allocator, currentFrame.drawCommandBuffer.allocation, 0,
+			sizeof(VkDrawIndexedIndirectCommand) * currentFrame.culledDraws.size());
+		CheckVkError(err);
+	}
+
+	// Anything uploaded since the last frame goes out now, and this frame waits for it.
+	FlushUploads();
+
+	// Dynamic texture copies are recorded last so they pick up updates made during the frame.
+	// Culling goes right before the main command buffer, whose indirect draws it fills in.
+	VkCommandBuffer cmds[3];
+	uint32_t cmdCount = 0;
+
+	if (RecordDynamicTextureCopies(currentFrame))
+	{
+		cmds[cmdCount++] = currentFrame.dynamicTextureCommandBuffer;
+	}
+
+	if (RecordCulling(currentFrame))
+	{
+		cmds[cmdCount++] = currentFrame.cullCommandBuffer;
+	}
+
+	cmds[cmdCount++] = cmd;
+
+	VkSubmitInfo submit = SubmitInfo(&cmds[0]);
+	submit.commandBufferCount = cmdCount;
+
+	VkSemaphore waitSemaphores[2];
+	VkPipelineStageFlags waitStages[2];
+	uint32_t waitCount = 0;
+
+	// Headless frames have no swapchain image to wait for or present.
+	if (!config.headless)
+	{
+		waitSemaphores[waitCount] = currentFrame.presentSemaphore;
+		waitStages[waitCount] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		++waitCount;
+	}
+
+	if (uploadContext.isSemaphorePending)
+	{
+		waitSemaphores[waitCount] = uploadContext.uploadSemaphore;
+		waitStages[waitCount] = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		++waitCount;
+		uploadContext.isSemaphorePending = false;
+	}
+
+	submit.pWaitDstStageMask = waitStages;
+	submit.waitSemaphoreCount = waitCount;
+	submit.pWaitSemaphores = waitSemaphores;
+	submit.signalSemaphoreCount = config.headless ? 0 : 1;
+	submit.pSignalSemaphores = &currentFrame.renderSemaphore;
+
+	err = vkQueueSubmit(graphicsQueue, 1, &submit, currentFrame.renderFence);
+	CheckVkError(err);
+}
+
+void VKRenderer::ReadFrameTimestamps(FrameData& frame)
+{
+	if (!frame.hasTimestamps)
+	{
+		return;
+	}
+
+	frame.hasTimestamps = false;
+
+	// The frame's fence has signaled so the results are ready, no need to wait on them.
+	uint64_t timestamps[2];
+	uint32_t firstQuery = static_cast<uint32_t>(&frame - frames) * 2;
+	VkResult err = vkGetQueryPoolResults(device, timestampQueryPool, firstQuery, 2, sizeof(timestamps), timestamps,
+		sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+	if (err != VK_SUCCESS)
+	{
+		return;
+	}
+
+	uint64_t ticks = (timestamps[1] - timestamps[0]) & timestampMask;
+	frameProfiler.AddGpuTime(ticks * gpuProperties.limits.timestampPeriod / 1'000'000.0);
+}
+
+FrameStats VKRenderer::GetFrameStats()
+{
+	return frameProfiler.GetStats();
+}
+
+MemoryStats VKRenderer::GetMemoryStats()
+{
+	MemoryStats stats = {};
+
+	const VkPhysicalDeviceMemoryProperties* memoryProperties;
+	vmaGetMemoryProperties(allocator, &memoryProperties);
+	VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+	vmaGetHeapBudgets(allocator, budgets);
+
+	for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; ++i)
+	{
+		const VmaBudget& budget = budgets[i];
+		stats.heaps.push_back(MemoryHeapStats{
+			memoryProperties->memoryHeaps[i].size,
+			(memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0,
+			budget.usage,
+			budget.budget,
+			budget.statistics.allocationBytes,
+			budget.statistics.blockBytes,
+			});
+	}
+
+	for (const MemoryPool& memoryPool : memoryPools)
+	{
+		VmaStatistics poolStats;
+		vmaGetPoolStatistics(allocator, memoryPool.pool, &poolStats);
+
+		MemoryCategoryStats& categoryStats = stats.categories[static_cast<size_t>(memoryPool.category)];
+		categoryStats.allocationCount += poolStats.allocationCount;
+		categoryStats.allocationBytes += poolStats.allocationBytes;
+		categoryStats.blockBytes += poolStats.blockBytes;
+	}
+
+	for (auto& it : textures)
+	{
+		if (it.second.image.image == VK_NULL_HANDLE)
+		{
+			++stats.evictedTextureArrays;
+		}
+	}
+
+	stats.deviceLocalUsage = GetDeviceLocalUsage();
+	stats.softBudget = GetMemoryBudget();
+	stats.evictionCount = evictionCount;
+
+	return stats;
+}
+
+void VKRenderer::PresentFrame()
+{
+	FrameData& currentFrame = GetCurrentFrame();
+
+	VkPresentInfoKHR presentInfo = {};
+	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	presentInfo.pNext = nullptr;
+	presentInfo.pSwapchains = &swapchain;
+	presentInfo.swapchainCount = 1;
+	presentInfo.pWaitSemaphores = &currentFrame.renderSemaphore;
+	presentInfo.waitSemaphoreCount = 1;
+	presentInfo.pImageIndices = &swapchainImageIndex;
+
+	VkResult err = vkQueuePresentKHR(graphicsQueue, &presentInfo);
+
+	// Recreated once the next frame's slot is acquired, the frame that was just submitted
+	// may still be rendering.
+	if (err == VK_ERROR_OUT_OF_DATE_KHR || err == VK_SUBOPTIMAL_KHR)
+	{
+		isSwapchainDirty = true;
+	}
+	else
+	{
+		CheckVkError(err);
+	}
+}
+
+void VKRenderer::DrawModel(const Model* model, const TextureArray* textureArray, const Instances* instances)
+{
+	auto start = FrameProfiler::Now();
+	size_t instanceCount = instances->offsets.size();
 
-	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to create pipeline");
+	if (!isFrameActive || instanceCount == 0)
+	{
+		return;
 	}
-	else
+
+	CheckInstances(instances);
+
+	uint32_t firstInstance;
+
+	// Every instance is uploaded and culled later by cull.comp, the CPU only packs them.
+	if (supportsGpuCulling)
 	{
-		return newPipeline;
+		PackedInstance* packedInstances = AllocateInstances(instanceCount, &firstInstance);
+		PackInstances(instances, packedInstances);
+		SetInstanceTextureArray(packedInstances, instanceCount, textureArray);
+		RecordCulledDraw(model, textureArray, firstInstance, static_cast<uint32_t>(instanceCount));
+		frameProfiler.EndDraw(start, model->indexCount, instanceCount);
+		return;
+	}
+
+	// Culled instances are handed back to the frame's instance buffer straight away.
+	PackedInstance* packedInstances = AllocateInstances(instanceCount, &firstInstance);
+	size_t visibleCount = instanceCuller.Cull(frustum, model->boundingRadius, instances, packedInstances);
+	GetCurrentFrame().instanceCount -= static_cast<uint32_t>(instanceCount - visibleCount);
+	SetInstanceTextureArray(packedInstances, visibleCount, textureArray);
+
+	if (visibleCount == 0)
+	{
+		frameProfiler.EndStage(ProfilerStage::Draw, start);
+		return;
 	}
+
+	RecordDraw(model, textureArray, firstInstance, static_cast<uint32_t>(visibleCount), false);
+	frameProfiler.EndDraw(start, model->indexCount, visibleCount);
 }
 
-VertexInputDescription Vertex::GetVertexDescription()
+void VKRenderer::DrawSprite(const Model* model, const TextureArray* textureArray, const Instances* instances)
 {
-	VertexInputDescription description;
+	auto start = FrameProfiler::Now();
+	size_t instanceCount = instances->offsets.size();
 
-	VkVertexInputBindingDescription mainBinding = {};
-	mainBinding.binding = 0;
-	mainBinding.stride = sizeof(Vertex);
-	mainBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	if (!isFrameActive || instanceCount == 0)
+	{
+		return;
+	}
 
-	description.bindings.push_back(mainBinding);
+	CheckInstances(instances);
 
-	VkVertexInputAttributeDescription positionAttribute = {};
-	positionAttribute.binding = 0;
-	positionAttribute.location = 0;
-	positionAttribute.format = VK_FORMAT_R32G32B32_SFLOAT;
-	positionAttribute.offset = offsetof(Vertex, pos);
+	uint32_t firstInstance;
+	PackedInstance* packedInstances = AllocateInstances(instanceCount, &firstInstance);
+	PackInstances(instances, packedInstances);
+	SetInstanceTextureArray(packedInstances, instanceCount, textureArray);
+	RecordDraw(model, textureArray, firstInstance, static_cast<uint32_t>(instanceCount), true);
+	frameProfiler.EndDraw(start, model->indexCount, instanceCount);
+}
 
-	VkVertexInputAttributeDescription normalAttribute = {};
-	normalAttribute.binding = 0;
-	normalAttribute.location = 1;
-	normalAttribute.format = VK_FORMAT_R32G32B32_SFLOAT;
-	normalAttribute.offset = offsetof(Vertex, normal);
+void VKRenderer::DrawModel(const Model* model, const TextureArray* textureArray, const PackedInstances* instances)
+{
+	auto start = FrameProfiler::Now();
+	size_t instanceCount = instances->instances.size();
 
-	VkVertexInputAttributeDescription colorAttribute = {};
-	colorAttribute.binding = 0;
-	colorAttribute.location = 2;
-	colorAttribute.format = VK_FORMAT_R32G32B32_SFLOAT;
-	colorAttribute.offset = offsetof(Vertex, color);
+	if (!isFrameActive || instanceCount == 0)
+	{
+		return;
+	}
 
-	VkVertexInputAttributeDescription uvAttribute = {};
-	uvAttribute.binding = 0;
-	uvAttribute.location = 3;
-	uvAttribute.format = VK_FORMAT_R32G32_SFLOAT;
-	uvAttribute.offset = offsetof(Vertex, uv);
+	uint32_t firstInstance;
 
-	description.attributes.push_back(positionAttribute);
-	description.attributes.push_back(normalAttribute);
-	description.attributes.push_back(colorAttribute);
-	description.attributes.push_back(uvAttribute);
+	// Culled like unpacked instances, only the packing is skipped.
+	if (supportsGpuCulling)
+	{
+		PackedInstance* packedInstances = AllocateInstances(instanceCount, &firstInstance);
+		memcpy(packedInstances, instances->instances.data(), sizeof(PackedInstance) * instanceCount);
+		SetInstanceTextureArray(packedInstances, instanceCount, textureArray);
+		RecordCulledDraw(model, textureArray, firstInstance, static_cast<uint32_t>(instanceCount));
+		frameProfiler.EndDraw(start, model->indexCount, instanceCount);
+		return;
+	}
 
-	return description;
+	PackedInstance* packedInstances = AllocateInstances(instanceCount, &firstInstance);
+	size_t visibleCount = instanceCuller.Cull(frustum, model->boundingRadius, instances, packedInstances);
+	GetCurrentFrame().instanceCount -= static_cast<uint32_t>(instanceCount - visibleCount);
+	SetInstanceTextureArray(packedInstances, visibleCount, textureArray);
+
+	if (visibleCount == 0)
+	{
+		frameProfiler.EndStage(ProfilerStage::Draw, start);
+		return;
+	}
+
+	RecordDraw(model, textureArray, firstInstance, static_cast<uint32_t>(visibleCount), false);
+	frameProfiler.EndDraw(start, model->indexCount, visibleCount);
 }
 
-FrameData& VKRenderer::GetCurrentFrame()
+void VKRenderer::DrawSprite(const Model* model, const TextureArray* textureArray, const PackedInstances* instances)
 {
-	return frames[frameNumber % frameOverlap];
+	auto start = FrameProfiler::Now();
+	size_t instanceCount = instances->instances.size();
+
+	if (!isFrameActive || instanceCount == 0)
+	{
+		return;
+	}
+
+	uint32_t firstInstance;
+	PackedInstance* packedInstances = AllocateInstances(instanceCount, &firstInstance);
+	memcpy(packedInstances, instances->instances.data(), sizeof(PackedInstance) * instanceCount);
+	SetInstanceTextureArray(packedInstances, instanceCount, textureArray);
+	RecordDraw(model, textureArray, firstInstance, static_cast<uint32_t>(instanceCount), true);
+	frameProfiler.EndDraw(start, model->indexCount, instanceCount);
 }
 
-void VKRenderer::FlushDeletionList(std::vector<std::function<void()>>& list)
+PackedInstance* VKRenderer::AllocateInstances(size_t instanceCount, uint32_t* outFirstInstance)
 {
-	for (auto it : list)
+	FrameData& currentFrame = GetCurrentFrame();
+
+	if (currentFrame.instanceCount + instanceCount > maxInstancesPerFrame)
 	{
-		it();
+		throw std::runtime_error("Instance buffer overflowed, too many instances in one frame!");
 	}
 
-	list.clear();
+	*outFirstInstance = currentFrame.instanceCount;
+	currentFrame.instanceCount += static_cast<uint32_t>(instanceCount);
+
+	return currentFrame.instanceData + *outFirstInstance;
 }
 
-void VKRenderer::CleanupVulkan()
+void VKRenderer::SetInstanceTextureArray(PackedInstance* instances, size_t instanceCount,
+	const TextureArray* textureArray)
 {
-	vkDeviceWaitIdle(device);
+	// Every draw passes through here before BindDraw, so this is where arrays are marked used.
+	const Texture& texture = UseTexture(textureArray->texture);
 
-	FlushDeletionList(swapchainDeletionList);
-	FlushDeletionList(deletionList);
+	if (!supportsBindlessTextures)
+	{
+		return;
+	}
 
-	vmaDestroyAllocator(allocator);
+	uint16_t descriptorIndex = static_cast<uint16_t>(texture.descriptorIndex);
 
-	vkDestroySurfaceKHR(instance, surface, nullptr);
-	vkb::destroy_device(vkbDevice);
-	vkb::destroy_instance(vkbInstance);
+	for (size_t i = 0; i < instanceCount; ++i)
+	{
+		instances[i].textureArrayIndex = descriptorIndex;
+	}
 }
 
-void VKRenderer::CloseWindow()
+void VKRenderer::BindDraw(const Model* model, const TextureArray* textureArray, VkBuffer instanceBuffer, bool is2D)
 {
-	CleanupVulkan();
-	glfwTerminate();
+	VkCommandBuffer cmd = GetCurrentFrame().mainCommandBuffer;
+	const Mesh& mesh = meshes.at(model->vao);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, is2D ? spritePipeline : modelPipeline);
+
+	// Bindless texture arrays are picked per instance, see SetInstanceTextureArray.
+	if (!supportsBindlessTextures)
+	{
+		const Texture& texture = GetTexture(textureArray->texture);
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, modelPipelineLayout, 1, 1, &texture.descriptorSet, 0, nullptr);
+	}
+
+	VkBuffer vertexBuffers[] = { mesh.vertexBuffer.buffer, instanceBuffer };
+	VkDeviceSize offsets[] = { 0, 0 };
+	vkCmdBindVertexBuffers(cmd, 0, 2, vertexBuffers, offsets);
+	vkCmdBindIndexBuffer(cmd, mesh.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+
+	MeshPushConstants constants = {};
+	constants.data.x = is2D ? 1.0f : 0.0f;
+	vkCmdPushConstants(cmd, modelPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
 }
 
-void VKRenderer::ResizeWindow(int32_t width, int32_t height)
+void VKRenderer::RecordDraw(const Model* model, const TextureArray* textureArray, uint32_t firstInstance,
+	uint32_t instanceCount, bool is2D)
 {
+	FrameData& currentFrame = GetCurrentFrame();
+	BindDraw(model, textureArray, currentFrame.instanceBuffer.buffer, is2D);
 
+	// The instance binding starts at 0, firstInstance selects this draw's instances.
+	vkCmdDrawIndexed(currentFrame.mainCommandBuffer, static_cast<uint32_t>(model->indexCount), instanceCount, 0, 0,
+		firstInstance);
 }
 
-GLFWwindow* VKRenderer::GetWindowPtr()
+void VKRenderer::RecordCulledDraw(const Model* model, const TextureArray* textureArray, uint32_t firstInstance,
+	uint32_t instanceCount)
 {
-	return window;
+	FrameData& currentFrame = GetCurrentFrame();
+	uint32_t drawIndex = static_cast<uint32_t>(currentFrame.culledDraws.size());
+
+	if (drawIndex >= maxCulledDrawsPerFrame)
+	{
+		throw std::runtime_error("Draw command buffer overflowed, too many culled draws in one frame!");
+	}
+
+	currentFrame.culledDraws.push_back(CulledDraw{ firstInstance, instanceCount, model->boundingRadius });
+
+	// cull.comp counts the visible instances, so a fully culled draw costs the GPU nothing.
+	VkDrawIndexedIndirectCommand& command = currentFrame.drawCommands[drawIndex];
+	command.indexCount = static_cast<uint32_t>(model->indexCount);
+	command.instanceCount = 0;
+	command.firstIndex = 0;
+	command.vertexOffset = 0;
+	command.firstInstance = firstInstance;
+
+	BindDraw(model, textureArray, currentFrame.culledInstanceBuffer.buffer, false);
+	vkCmdDrawIndexedIndirect(currentFrame.mainCommandBuffer, currentFrame.drawCommandBuffer.buffer,
+		sizeof(VkDrawIndexedIndirectCommand) * drawIndex, 1, sizeof(VkDrawIndexedIndirectCommand));
 }
 
-void VKRenderer::SetClearColor(float r, float g, float b, float a)
+Model VKRenderer::CreateModel(const std::vector<float>& vertices, const std::vector<uint32_t>& indices)
 {
+	Mesh mesh = {};
+	UploadMesh(mesh, vertices, indices);
+
+	uint32_t id = nextMeshId++;
+	meshes[id] = mesh;
+
+	return Model{
+		id, 0, 0,
+		indices.size(),
+		GetBoundingRadius(vertices),
+	};
 }
 
-void VKRenderer::BeginDrawing()
+void VKRenderer::UpdateModel(Model* model, const std::vector<float>& vertices, const std::vector<uint32_t>& indices)
 {
-	++frameNumber;
+	Mesh& mesh = meshes.at(model->vao);
 
-	FrameData& currentFrame = GetCurrentFrame();
+	// The old buffers may still be used by frames in flight.
+	DestroyMesh(mesh, GetDeletionQueue());
+	UploadMesh(mesh, vertices, indices);
 
-	VkResult err = vkWaitForFences(device, 1, &currentFrame.renderFence, true, 1'000'000'000);
-	CheckVkError(err);
+	model->indexCount = indices.size();
+	model->boundingRadius = GetBoundingRadius(vertices);
+}
 
-	uint32_t swapchainImageIndex;
-	err = vkAcquireNextImageKHR(device, swapchain, 1'000'000'000, currentFrame.presentSemaphore, nullptr, &swapchainImageIndex);
+void VKRenderer::DestroyModel(Model* model)
+{
+	auto it = meshes.find(model->vao);
 
-	if (err == VK_ERROR_OUT_OF_DATE_KHR)
+	if (it == meshes.end())
 	{
-		RecreateSwapchain();
 		return;
 	}
-	else
+
+	DestroyMesh(it->second, GetDeletionQueue());
+	meshes.erase(it);
+}
+
+TextureArray VKRenderer::CreateTextureArray(const std::vector<std::string>& images)
+{
+	TextureArrayLoad load = LoadTextureArrayAsync(images);
+
+	return WaitTextureArrayLoad(&load);
+}
+
+TextureArrayLoad VKRenderer::LoadTextureArrayAsync(const std::vector<std::string>& images)
+{
+	if (images.size() < 1)
 	{
-		CheckVkError(err);
+		throw std::runtime_error("No images supplied when creating texture array!");
 	}
 
-	// Only reset if we are submitting work.
-	err = vkResetFences(device, 1, &currentFrame.renderFence);
-	CheckVkError(err);
+	uint32_t id = textureDecoder.Decode(images, STBI_rgb_alpha);
+	pendingTextures[id] = PendingTexture{ {}, static_cast<uint32_t>(images.size()), 0, 0, images };
 
-	err = vkResetCommandBuffer(GetCurrentFrame().mainCommandBuffer, 0);
-	CheckVkError(err);
+	return TextureArrayLoad{ id };
+}
 
-	VkCommandBuffer cmd = currentFrame.mainCommandBuffer;
-	VkCommandBufferBeginInfo cmdBeginInfo = {};
-	cmdBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	cmdBeginInfo.pNext = nullptr;
-	cmdBeginInfo.pInheritanceInfo = nullptr;
-	cmdBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-	err = vkBeginCommandBuffer(cmd, &cmdBeginInfo);
-	CheckVkError(err);
+bool VKRenderer::PollTextureArrayLoad(const TextureArrayLoad* load, TextureArray* outTextureArray)
+{
+	return UploadTextureLayers(load->id, false, outTextureArray);
+}
 
-	VkClearValue clearValue;
-	clearValue.color = { { 0.0f, 0.0f, 0.5f, 1.0f } };
+TextureArray VKRenderer::WaitTextureArrayLoad(const TextureArrayLoad* load)
+{
+	TextureArray textureArray;
 
-	VkClearValue depthClear;
-	depthClear.depthStencil.depth = 1.0f;
+	while (!UploadTextureLayers(load->id, true, &textureArray));
 
-	VkClearValue clearValues[] = { clearValue, depthClear };
+	return textureArray;
+}
 
-	VkRenderPassBeginInfo rpInfo = {};
-	rpInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	rpInfo.pNext = nullptr;
-	rpInfo.renderPass = renderPass;
-	rpInfo.renderArea.offset.x = 0;
-	rpInfo.renderArea.offset.y = 0;
-	rpInfo.renderArea.extent = VkExtent2D{
-		static_cast<uint32_t>(width),
-		static_cast<uint32_t>(height)
-	};
-	rpInfo.framebuffer = framebuffers[swapchainImageIndex];
-	rpInfo.clearValueCount = 2;
-	rpInfo.pClearValues = &clearValues[0];
-
-	vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
-	{
-		/*
-		 * Push constant calculations:
-		 */
-		glm::vec3 camPos = { 0.0f, 0.0f, -2.0f };
-		glm::mat4 view = glm::translate(glm::mat4(1.0f), camPos);
-		glm::mat4 projection = glm::perspective(glm::radians(70.0f), 1700.0f / 900.0f, 0.1f, 200.0f);
-		projection[1][1] *= -1;
-		glm::mat4 model = glm::rotate(glm::mat4{ 1.0f }, glm::radians(frameNumber * 0.4f), glm::vec3(0, 1, 0));
-		glm::mat4 meshMatrix = projection * view * model;
-
-		GPUCameraData camData = {};
-		camData.proj = projection;
-		camData.view = view;
-		camData.viewProj = projection * view;
+bool VKRenderer::UploadTextureLayers(uint32_t loadId, bool wait, TextureArray* outTextureArray)
+{
+	auto it = pendingTextures.find(loadId);
 
-		void* data;
-		vmaMapMemory(allocator, currentFrame.cameraBuffer.allocation, &data);
-		memcpy(data, &camData, sizeof(GPUCameraData));
-		vmaUnmapMemory(allocator, currentFrame.cameraBuffer.allocation);
+	if (it == pendingTextures.end())
+	{
+		throw std::runtime_error("Tried to poll an unknown texture array load!");
+	}
 
-		MeshPushConstants constants;
-		constants.renderMatrix = meshMatrix;
+	PendingTexture& pending = it->second;
+	std::vector<DecodedImage> images;
+	bool isDecoded;
 
-		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, trianglePipeline);
-		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, trianglePipelineLayout, 0, 1, &currentFrame.globalDescriptor, 0, nullptr);
-		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, trianglePipelineLayout, 1, 1, &testTextureSet, 0, nullptr);
+	try
+	{
+		isDecoded = textureDecoder.Collect(loadId, images, wait);
+
+		for (DecodedImage& image : images)
+		{
+			if (pending.texture.image.image == VK_NULL_HANDLE)
+			{
+				pending.width = image.width;
+				pending.height = image.height;
+				pending.texture.image = CreateTextureImage(VK_FORMAT_R8G8B8A8_SRGB, static_cast<uint32_t>(pending.width),
+					static_cast<uint32_t>(pending.height), pending.layerCount, 1);
+			}
+			else if (image.width != pending.width || image.height != pending.height)
+			{
+				throw std::runtime_error("Can't create array of different sized textures!");
+			}
+
+			UploadTextureLayer(pending, image);
+			TextureDecoder::FreeImage(image);
+		}
+	}
+	catch (...)
+	{
+		for (DecodedImage& image : images)
+		{
+			TextureDecoder::FreeImage(image);
+		}
 
-		VkViewport viewport = DefaultViewport();
-		VkRect2D scissor = DefaultScissor();
-		vkCmdSetViewport(cmd, 0, 1, &viewport);
-		vkCmdSetScissor(cmd, 0, 1, &scissor);
+		textureDecoder.Cancel(loadId);
 
-		VkDeviceSize offset = 0;
-		vkCmdBindVertexBuffers(cmd, 0, 1, &triangleMesh.vertexBuffer.buffer, &offset);
+		if (pending.texture.image.image != VK_NULL_HANDLE)
+		{
+			// Recorded uploads may still reference the image.
+			GetDeletionQueue().images.push_back(pending.texture.image);
+		}
 
-		vkCmdPushConstants(cmd, trianglePipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+		pendingTextures.erase(it);
+		throw;
+	}
 
-		vkCmdDraw(cmd, triangleMesh.vertices.size(), 1, 0, 0);
+	if (!isDecoded)
+	{
+		return false;
 	}
-	vkCmdEndRenderPass(cmd);
-	CheckVkError(vkEndCommandBuffer(cmd));
 
-	VkSubmitInfo submit = {};
-	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submit.pNext = nullptr;
+	FinishTextureImage(pending.texture, VK_FORMAT_R8G8B8A8_SRGB, pending.layerCount, 1);
 
-	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	// Counts as used by the frame its uploads are submitted with.
+	pending.texture.lastUsedFrame = frameNumber;
 
-	submit.pWaitDstStageMask = &waitStage;
-	submit.waitSemaphoreCount = 1;
-	submit.pWaitSemaphores = &currentFrame.presentSemaphore;
-	submit.signalSemaphoreCount = 1;
-	submit.pSignalSemaphores = &currentFrame.renderSemaphore;
-	submit.commandBufferCount = 1;
-	submit.pCommandBuffers = &cmd;
+	uint32_t id = nextTextureId++;
+	textures[id] = pending.texture;
+	textureSources[id] = TextureSource{ std::move(pending.images), {} };
+	pendingTextures.erase(it);
 
-	err = vkQueueSubmit(graphicsQueue, 1, &submit, currentFrame.renderFence);
-	CheckVkError(err);
+	*outTextureArray = TextureArray{ id };
 
-	VkPresentInfoKHR presentInfo = {};
-	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-	presentInfo.pNext = nullptr;
-	presentInfo.pSwapchains = &swapchain;
-	presentInfo.swapchainCount = 1;
-	presentInfo.pWaitSemaphores = &currentFrame.renderSemaphore;
-	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pImageIndices = &swapchainImageIndex;
+	return true;
+}
 
-	err = vkQueuePresentKHR(graphicsQueue, &presentInfo);
+TextureArray VKRenderer::CreateTextureArrayFromPack(const std::string& packFile)
+{
+	TexturePack pack(packFile);
+	const TexturePackHeader& header = pack.GetHeader();
+	VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
 
-	if (err == VK_ERROR_OUT_OF_DATE_KHR || err == VK_SUBOPTIMAL_KHR)
+	if (header.format == TexturePackFormat::BC1)
 	{
-		RecreateSwapchain();
+		if (!supportsBC)
+		{
+			throw std::runtime_error(std::string("Texture pack is BC1 compressed but the GPU doesn't support it: ") + packFile);
+		}
+
+		format = VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
 	}
-	else
+
+	// Levels are stored back to back, so the whole pack goes through one staging copy.
+	const TexturePackLevel& firstLevel = pack.GetLevel(0);
+	const TexturePackLevel& lastLevel = pack.GetLevel(header.mipCount - 1);
+	size_t dataSize = static_cast<size_t>(lastLevel.offset + lastLevel.size - firstLevel.offset);
+
+	VkBuffer stagingBuffer;
+	VkDeviceSize stagingOffset;
+	uint8_t* stagingData = AllocateStaging(dataSize, &stagingBuffer, &stagingOffset);
+	memcpy(stagingData, pack.GetLevelData(0), dataSize);
+
+	Texture texture = {};
+	texture.image = CreateTextureImage(format, header.width, header.height, header.layerCount, header.mipCount);
+
+	std::vector<VkBufferImageCopy> copyRegions(header.mipCount);
+
+	for (uint32_t i = 0; i < header.mipCount; ++i)
 	{
-		CheckVkError(err);
+		const TexturePackLevel& level = pack.GetLevel(i);
+
+		VkBufferImageCopy& copyRegion = copyRegions[i];
+		copyRegion = {};
+		copyRegion.bufferOffset = stagingOffset + (level.offset - firstLevel.offset);
+		copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		copyRegion.imageSubresource.mipLevel = i;
+		copyRegion.imageSubresource.baseArrayLayer = 0;
+		copyRegion.imageSubresource.layerCount = header.layerCount;
+		copyRegion.imageExtent = { level.width, level.height, 1 };
 	}
+
+	vkCmdCopyBufferToImage(GetUploadCommandBuffer(), stagingBuffer, texture.image.image,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+
+	FinishTextureImage(texture, format, header.layerCount, header.mipCount);
+	texture.lastUsedFrame = frameNumber;
+
+	uint32_t id = nextTextureId++;
+	textures[id] = texture;
+	textureSources[id] = TextureSource{ {}, packFile };
+
+	return TextureArray{ id };
 }
 
-void VKRenderer::InitPipelines()
+TextureArray VKRenderer::CreateDynamicTextureArray(int32_t width, int32_t height, uint32_t layerCount)
 {
-	VkShaderModule triangleFragShader;
-	VkShaderModule triangleVertexShader;
+	DynamicTexture dynamicTexture = {};
+	dynamicTexture.width = static_cast<uint32_t>(width);
+	dynamicTexture.height = static_cast<uint32_t>(height);
+	dynamicTexture.layerCount = layerCount;
+	// Every slot starts out behind, so each one is filled before its first frame samples it.
+	dynamicTexture.version = 1;
 
-	if (!LoadShaderModule("shaders/triangle.frag.spv", &triangleFragShader))
-	{
-		throw std::runtime_error("Error when building the triangle fragment shader module");
-	}
-	else
-	{
-		std::cout << "Triangle fragment shader successfully loaded!\n";
-	}
+	size_t layerSize = static_cast<size_t>(width) * height * 4;
+	dynamicTexture.shadow.resize(layerSize * layerCount);
 
-	if (!LoadShaderModule("shaders/triangle.vert.spv", &triangleVertexShader))
+	for (size_t i = 0; i < dynamicTexture.shadow.size(); i += 4)
 	{
-		throw std::runtime_error("Error when building the triangle vertex shader module");
+		dynamicTexture.shadow[i + 3] = 255;
 	}
-	else
+
+	VkExtent3D imageExtent = { dynamicTexture.width, dynamicTexture.height, 1 };
+
+	// Only touched by the graphics queue, unlike textures uploaded through the transfer queue.
+	VkImageCreateInfo imageInfo = ImageCreateInfo(VK_FORMAT_R8G8B8A8_SRGB,
+		VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent);
+	imageInfo.arrayLayers = layerCount;
+
+	for (uint32_t i = 0; i < frameOverlap; ++i)
 	{
-		std::cout << "Triangle vertex shader successfully loaded!\n";
+		Texture& texture = dynamicTexture.slotTextures[i];
+		texture.image = CreateImage(imageInfo, MemoryCategory::Textures);
+
+		CreateTextureDescriptor(texture, VK_FORMAT_R8G8B8A8_SRGB, layerCount, 1);
+
+		dynamicTexture.slotStagingBuffers[i] = CreateBuffer(dynamicTexture.shadow.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VMA_MEMORY_USAGE_CPU_ONLY, MemoryCategory::Staging);
+
+		void* data;
+		vmaMapMemory(allocator, dynamicTexture.slotStagingBuffers[i].allocation, &data);
+		dynamicTexture.slotStagingData[i] = static_cast<uint8_t*>(data);
 	}
 
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo = PipelineLayoutCreateInfo();
+	uint32_t id = nextTextureId++;
+	dynamicTextures[id] = std::move(dynamicTexture);
 
-	VkPushConstantRange pushConstant = {};
-	pushConstant.offset = 0;
-	pushConstant.size = sizeof(MeshPushConstants);
-	pushConstant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	return TextureArray{ id };
+}
 
-	pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
-	pipelineLayoutInfo.pushConstantRangeCount = 1;
+void VKRenderer::UpdateTextureArrayLayer(const TextureArray* textureArray, uint32_t layer, const uint8_t* pixels)
+{
+	auto it = dynamicTextures.find(textureArray->texture);
 
-	VkDescriptorSetLayout setLayouts[] = { globalSetLayout, singleTextureSetLayout };
+	if (it == dynamicTextures.end())
+	{
+		throw std::runtime_error("Only dynamic texture arrays can be updated!");
+	}
 
-	pipelineLayoutInfo.setLayoutCount = 2;
-	pipelineLayoutInfo.pSetLayouts = &setLayouts[0];
+	DynamicTexture& dynamicTexture = it->second;
+	size_t layerSize = static_cast<size_t>(dynamicTexture.width) * dynamicTexture.height * 4;
+	memcpy(&dynamicTexture.shadow[layerSize * layer], pixels, layerSize);
+	++dynamicTexture.version;
+}
 
-	VkResult err = vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &trianglePipelineLayout);
-	CheckVkError(err);
+void VKRenderer::DestroyTextureArray(TextureArray* textureArray)
+{
+	auto it = textures.find(textureArray->texture);
 
-	PipelineBuilder pipelineBuilder;
+	if (it != textures.end())
+	{
+		// Evicted arrays have nothing left to destroy.
+		if (it->second.image.image != VK_NULL_HANDLE)
+		{
+			DestroyTexture(it->second, GetDeletionQueue());
+		}
+
+		textures.erase(it);
+		textureSources.erase(textureArray->texture);
+		return;
+	}
 
-	pipelineBuilder.shaderStages.push_back(
-		PipelineShaderStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT, triangleVertexShader));
+	auto dynamicIt = dynamicTextures.find(textureArray->texture);
 
-	pipelineBuilder.shaderStages.push_back(
-		PipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, triangleFragShader));
+	if (dynamicIt != dynamicTextures.end())
+	{
+		DestroyDynamicTexture(dynamicIt->second, GetDeletionQueue());
+		dynamicTextures.erase(dynamicIt);
+	}
+}
 
-	pipelineBuilder.vertexInputInfo = VertexInputStateCreateInfo();
-	pipelineBuilder.inputAssembly = InputAssemblyCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-	pipelineBuilder.viewport = DefaultViewport();
-	pipelineBuilder.scissor = DefaultScissor();
+void VKRenderer::CaptureFrame(std::vector<uint8_t>& outPixels)
+{
+	if (!config.headless)
+	{
+		throw std::runtime_error("Frames can only be captured in headless mode!");
+	}
 
-	pipelineBuilder.rasterizer = RasterizationStateCreateInfo(VK_POLYGON_MODE_FILL);
-	pipelineBuilder.multisampling = MulitsamplingStateCreateInfo();
-	pipelineBuilder.colorBlendAttachment = ColorBlendAttachmentState();
-	pipelineBuilder.pipelineLayout = trianglePipelineLayout;
+	if (frameNumber == 0)
+	{
+		throw std::runtime_error("No frame has been drawn to capture!");
+	}
 
-	VertexInputDescription vertexDescription = Vertex::GetVertexDescription();
-	pipelineBuilder.vertexInputInfo.pVertexAttributeDescriptions = vertexDescription.attributes.data();
-	pipelineBuilder.vertexInputInfo.vertexAttributeDescriptionCount = vertexDescription.attributes.size();
-	pipelineBuilder.vertexInputInfo.pVertexBindingDescriptions = vertexDescription.bindings.data();
-	pipelineBuilder.vertexInputInfo.vertexBindingDescriptionCount = vertexDescription.bindings.size();
+	vkDeviceWaitIdle(device);
 
-	pipelineBuilder.depthStencil = DepthStencilCreateInfo(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
+	size_t size = static_cast<size_t>(width) * height * 4;
+	AllocatedBuffer readbackBuffer = CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU,
+		MemoryCategory::Staging);
 
-	trianglePipeline = pipelineBuilder.BuildPipeline(device, renderPass);
+	// Captures are rare, so they get their own short lived command pool.
+	VkCommandPool commandPool;
+	VkCommandPoolCreateInfo commandPoolInfo = CommandPoolCreateInfo(graphicsQueueFamily, 0);
+	VkResult err = vkCreateCommandPool(device, &commandPoolInfo, nullptr, &commandPool);
+	CheckVkError(err);
 
-	vkDestroyShaderModule(device, triangleFragShader, nullptr);
-	vkDestroyShaderModule(device, triangleVertexShader, nullptr);
+	VkCommandBuffer cmd;
+	VkCommandBufferAllocateInfo cmdAllocInfo = CommandBufferAllocateInfo(commandPool, 1);
+	err = vkAllocateCommandBuffers(device, &cmdAllocInfo, &cmd);
+	CheckVkError(err);
 
-	deletionList.push_back([=]() {
-		vkDestroyPipeline(device, trianglePipeline, nullptr);
-		vkDestroyPipelineLayout(device, trianglePipelineLayout, nullptr);
-		});
-}
+	VkCommandBufferBeginInfo cmdBeginInfo = CommandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	err = vkBeginCommandBuffer(cmd, &cmdBeginInfo);
+	CheckVkError(err);
 
-void VKRenderer::EndDrawing()
-{
-	glfwSwapBuffers(window);
-	glfwPollEvents();
-}
+	VkBufferImageCopy copyRegion = {};
+	copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	copyRegion.imageSubresource.mipLevel = 0;
+	copyRegion.imageSubresource.baseArrayLayer = 0;
+	copyRegion.imageSubresource.layerCount = 1;
+	copyRegion.imageExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1 };
 
-void VKRenderer::DrawModel(const Model* model, const TextureArray* textureArray, const Instances* instances)
-{
-}
+	vkCmdCopyImageToBuffer(cmd, offscreenImage.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer.buffer, 1, &copyRegion);
 
-void VKRenderer::DrawSprite(const Model* model, const TextureArray* textureArray, const Instances* instances)
-{
-}
+	VkBufferMemoryBarrier hostBarrier = {};
+	hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	hostBarrier.buffer = readbackBuffer.buffer;
+	hostBarrier.offset = 0;
+	hostBarrier.size = VK_WHOLE_SIZE;
 
-Model VKRenderer::CreateModel(const std::vector<float>& vertices, const std::vector<uint32_t>& indices)
-{
-	return Model{};
-}
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+		0, 0, nullptr, 1, &hostBarrier, 0, nullptr);
 
-void VKRenderer::UpdateModel(Model* model, const std::vector<float>& vertices, const std::vector<uint32_t>& indices)
-{
-}
+	err = vkEndCommandBuffer(cmd);
+	CheckVkError(err);
 
-void VKRenderer::DestroyModel(Model* model)
-{
-}
+	VkSubmitInfo submit = SubmitInfo(&cmd);
+	err = vkQueueSubmit(graphicsQueue, 1, &submit, VK_NULL_HANDLE);
+	CheckVkError(err);
+	vkQueueWaitIdle(graphicsQueue);
 
-TextureArray VKRenderer::CreateTextureArray(const std::vector<std::string>& images)
-{
-	return TextureArray{};
-}
+	void* data;
+	vmaMapMemory(allocator, readbackBuffer.allocation, &data);
+	vmaInvalidateAllocation(allocator, readbackBuffer.allocation, 0, VK_WHOLE_SIZE);
+	outPixels.assign(static_cast<uint8_t*>(data), static_cast<uint8_t*>(data) + size);
+	vmaUnmapMemory(allocator, readbackBuffer.allocation);
 
-void VKRenderer::DestroyTextureArray(TextureArray* textureArray)
-{
+	vmaDestroyBuffer(allocator, readbackBuffer.buffer, readbackBuffer.allocation);
+	vkDestroyCommandPool(device, commandPool, nullptr);
 }
 
 void VKRenderer::UpdateCamera()
 {
+	// The shaders convert from GL's clip space, so the matrices match GLRenderer's.
+	cameraData.view = glm::lookAt(camera.pos, camera.pos + camera.dir, camera.up);
+	cameraData.proj = glm::perspective(glm::radians(camera.fov),
+		static_cast<float>(width) / static_cast<float>(height),
+		camera.zNear, camera.zFar);
+	cameraData.viewProj = cameraData.proj * cameraData.view;
+	cameraData.orthoProj = glm::ortho<float>(-1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f);
+
+	frustum = CreateFrustum(camera, static_cast<float>(width) / static_cast<float>(height));
 }
 
 void VKRenderer::SetCameraPosition(glm::vec3 position)
 {
+	camera.pos = position;
 }
 
 void VKRenderer::SetCameraRotation(float yRot, float xRot)
 {
+	float xTheta = glm::radians(xRot);
+	float yTheta = glm::radians(yRot + 270.0f);
+	camera.dir.x = cos(yTheta) * cos(xTheta);
+	camera.dir.y = sin(xTheta);
+	camera.dir.z = sin(yTheta) * cos(xTheta);
 }
 
 void VKRenderer::ConfigureCamera(float fov)
 {
+	camera.fov = fov;
 }
 
 bool VKRenderer::LoadShaderModule(const char* filePath, VkShaderModule* outShaderModule)
@@ -2,14 +2,38 @@
 
 #define GLFW_INCLUDE_VULKAN
 #include "Renderer.h"
+#include "FramePacer.h"
+#include "FrameProfiler.h"
+#include "InstanceCuller.h"
+#include "ShaderWatcher.h"
+#include "TextureDecoder.h"
 
-#include <functional>
 #include <unordered_map>
 #include <VkBootstrap.h>
 
 #include "../deps/vk_mem_alloc.h"
 
-constexpr uint32_t frameOverlap = 2;
+constexpr uint32_t maxFrameOverlap = 4;
+constexpr uint32_t maxInstancesPerFrame = 1 << 16;
+constexpr uint32_t maxTextureArrays = 64;
+// Size of the bindless texture array, dynamic texture arrays take one entry per frame slot.
+constexpr uint32_t maxBindlessTextures = 1024;
+constexpr uint32_t maxCulledDrawsPerFrame = 4096;
+// Matches local_size_x in cull.comp.
+constexpr uint32_t cullGroupSize = 64;
+// Matches local_size_x and local_size_y in hiz.comp.
+constexpr uint32_t depthPyramidGroupSize = 8;
+// Enough for a 65536 pixel wide depth buffer.
+constexpr uint32_t maxDepthPyramidLevels = 16;
+constexpr size_t stagingArenaSize = 64 * 1024 * 1024;
+constexpr size_t stagingAlignment = 16;
+// Share of the driver's memory budget used as the soft budget when none is configured.
+constexpr double defaultMemoryBudgetFraction = 0.9;
+
+// Compiles edited shaders when hot reloading, the build points this at the glslc it found.
+#ifndef GFPS_GLSLC
+#define GFPS_GLSLC "glslc"
+#endif
 
 // TODO:
 // https://vkguide.dev/docs/chapter_5 (check comments, VMA_MEMORY_USAGE depric)
@@ -25,6 +49,63 @@ struct AllocatedImage
 	VmaAllocation allocation;
 };
 
+// Resources are sub-allocated from a pool per category and memory type, so every category's
+// memory use can be read back from its pools.
+enum class MemoryCategory : uint32_t
+{
+	Textures,
+	Meshes,
+	// Per-frame instance buffers, along with the camera and culling buffers next to them.
+	Instances,
+	// Upload, dynamic texture and readback buffers.
+	Staging,
+	// The depth image, headless colour image and depth pyramid, sized to the swapchain.
+	RenderTargets,
+	Count,
+};
+
+constexpr size_t memoryCategoryCount = static_cast<size_t>(MemoryCategory::Count);
+
+struct MemoryPool
+{
+	MemoryCategory category;
+	uint32_t memoryTypeIndex;
+	VmaPool pool;
+};
+
+struct MemoryCategoryStats
+{
+	uint32_t allocationCount;
+	uint64_t allocationBytes;
+	// Memory blocks the category's allocations live in, including their unused space.
+	uint64_t blockBytes;
+};
+
+struct MemoryHeapStats
+{
+	uint64_t size;
+	bool isDeviceLocal;
+	// Estimated use by the whole process and the amount available to it, from the driver
+	// when it supports VK_EXT_memory_budget and from VMA's own bookkeeping otherwise.
+	uint64_t usage;
+	uint64_t budget;
+	uint64_t allocationBytes;
+	uint64_t blockBytes;
+};
+
+struct MemoryStats
+{
+	std::vector<MemoryHeapStats> heaps;
+	MemoryCategoryStats categories[memoryCategoryCount];
+	// Device local memory in use, not counting unused space in VMA's blocks, against the
+	// soft budget that texture arrays are evicted to stay under.
+	uint64_t deviceLocalUsage;
+	uint64_t softBudget;
+	uint32_t evictedTextureArrays;
+	// Evictions since the renderer was created, each one is loaded again when next drawn.
+	uint32_t evictionCount;
+};
+
 struct VertexInputDescription
 {
 	std::vector<VkVertexInputBindingDescription> bindings;
@@ -33,32 +114,108 @@ struct VertexInputDescription
 	VkPipelineVertexInputStateCreateFlags flags = 0;
 };
 
+// Matches the vertex layout CreateModel receives: position followed by uv.
 struct Vertex
 {
 	static VertexInputDescription GetVertexDescription();
 
 	glm::vec3 pos;
-	glm::vec3 normal;
-	glm::vec3 color;
 	glm::vec2 uv;
 };
 
 struct Mesh
 {
-	std::vector<Vertex> vertices;
 	AllocatedBuffer vertexBuffer = {};
+	AllocatedBuffer indexBuffer = {};
 };
 
 struct MeshPushConstants
 {
+	// x: Non-zero when drawing sprites.
 	glm::vec4 data;
-	glm::mat4 renderMatrix;
+};
+
+// Everything cull.comp needs for one draw, the planes are pushed once per frame.
+struct CullPushConstants
+{
+	glm::vec4 planes[6];
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+	uint32_t drawIndex;
+	float boundingRadius;
+};
+
+struct DepthPyramidPushConstants
+{
+	int32_t sourceSize[2];
+	int32_t destinationSize[2];
+};
+
+// Read by cull.comp to test instances against the previous frame's depth pyramid.
+struct GPUOcclusionData
+{
+	// The camera the pyramid was rendered with.
+	glm::mat4 viewProj;
+	// xy: Depth buffer size, z: pyramid level count, w: non-zero once the pyramid is valid.
+	glm::vec4 depthSize;
+};
+
+// A draw whose instances are culled on the GPU, its indirect command has the same index.
+struct CulledDraw
+{
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+	float boundingRadius;
 };
 
 struct Texture
 {
 	AllocatedImage image;
 	VkImageView imageView;
+	// With bindless textures the array lives at descriptorIndex in the bindless set,
+	// otherwise it has a set of its own.
+	VkDescriptorSet descriptorSet;
+	uint32_t descriptorIndex;
+	// The last frame that drew the array, arrays the GPU is done with can be evicted.
+	int32_t lastUsedFrame;
+};
+
+// Where a texture array was loaded from, so it can be loaded again after being evicted.
+struct TextureSource
+{
+	std::vector<std::string> images;
+	// Used instead of images when not empty.
+	std::string packFile;
+};
+
+// A texture array whose layers are uploaded as they finish decoding.
+struct PendingTexture
+{
+	// Null until the first layer arrives and gives the array its size.
+	Texture texture;
+	uint32_t layerCount;
+	int32_t width;
+	int32_t height;
+	std::vector<std::string> images;
+};
+
+// A texture array rewritten from the CPU. Every frame slot samples its own copy, so a frame
+// can update it while earlier frames are still in flight. Updates go to the shadow copy and
+// each slot catches up when its next frame is submitted.
+struct DynamicTexture
+{
+	Texture slotTextures[maxFrameOverlap];
+	// Persistently mapped, only copied from by the frame that owns the slot.
+	AllocatedBuffer slotStagingBuffers[maxFrameOverlap];
+	uint8_t* slotStagingData[maxFrameOverlap];
+	// Zero until a slot has been written to.
+	uint64_t slotVersions[maxFrameOverlap];
+	uint64_t version;
+
+	std::vector<uint8_t> shadow;
+	uint32_t width;
+	uint32_t height;
+	uint32_t layerCount;
 };
 
 struct GPUCameraData
@@ -66,6 +223,38 @@ struct GPUCameraData
 	glm::mat4 view;
 	glm::mat4 proj;
 	glm::mat4 viewProj;
+	glm::mat4 orthoProj;
+};
+
+// Resources waiting to be destroyed, kept by handle type so queueing one doesn't allocate
+// once the vectors have grown. See VKRenderer::FlushDeletionQueue for the order they are
+// destroyed in.
+struct DeletionQueue
+{
+	std::vector<VkPipeline> pipelines;
+	std::vector<VkPipelineLayout> pipelineLayouts;
+	std::vector<VkPipelineCache> pipelineCaches;
+	std::vector<VkFramebuffer> framebuffers;
+	std::vector<VkRenderPass> renderPasses;
+	// Freed back to the renderer's descriptor pool.
+	std::vector<VkDescriptorSet> descriptorSets;
+	std::vector<VkDescriptorPool> descriptorPools;
+	std::vector<VkDescriptorSetLayout> descriptorSetLayouts;
+	// Entries in the bindless texture set, handed out again once flushed.
+	std::vector<uint32_t> bindlessIndices;
+	std::vector<VkSampler> samplers;
+	std::vector<VkImageView> imageViews;
+	std::vector<AllocatedImage> images;
+	std::vector<AllocatedBuffer> buffers;
+	// Unmapped before they are destroyed.
+	std::vector<AllocatedBuffer> mappedBuffers;
+	std::vector<VkSwapchainKHR> swapchains;
+	std::vector<VkQueryPool> queryPools;
+	std::vector<VkCommandPool> commandPools;
+	std::vector<VkFence> fences;
+	std::vector<VkSemaphore> semaphores;
+	// The last frame that may use any of the resources, only for frame slots' queues.
+	int32_t lastFrame = -1;
 };
 
 struct FrameData
@@ -76,22 +265,70 @@ struct FrameData
 
 	VkCommandPool commandPool;
 	VkCommandBuffer mainCommandBuffer;
+	// Submitted ahead of the main command buffer when dynamic textures need copying.
+	VkCommandBuffer dynamicTextureCommandBuffer;
+	// Submitted ahead of the main command buffer when the frame has culled draws.
+	VkCommandBuffer cullCommandBuffer;
 
 	AllocatedBuffer cameraBuffer;
 	VkDescriptorSet globalDescriptor;
+
+	// Persistently mapped, holds every instance drawn during the frame.
+	AllocatedBuffer instanceBuffer;
+	PackedInstance* instanceData;
+	uint32_t instanceCount;
+
+	// Culled draws read the visible instances that cull.comp compacts into this buffer,
+	// at the same indices as their instances in instanceBuffer.
+	AllocatedBuffer culledInstanceBuffer;
+	// Persistently mapped, instance counts start at zero and are filled in by cull.comp.
+	AllocatedBuffer drawCommandBuffer;
+	VkDrawIndexedIndirectCommand* drawCommands;
+	std::vector<CulledDraw> culledDraws;
+	VkDescriptorSet cullDescriptor;
+	// The depth pyramid view cullDescriptor was last written with.
+	VkImageView cullDepthPyramidView;
+	// Written when recording starts, like the camera buffer.
+	AllocatedBuffer occlusionDataBuffer;
+
+	// Set once the frame's start and end timestamps have been submitted and not yet read.
+	bool hasTimestamps;
+
+	// Resources released while this slot's frame may still use them, flushed once the slot
+	// is acquired again after its frame has finished.
+	DeletionQueue deletionQueue;
 };
 
+// Uploads are recorded into one command buffer and submitted as a batch, either when
+// the next frame is submitted or when the staging arena fills up.
 struct UploadContext
 {
 	VkFence uploadFence;
+	VkSemaphore uploadSemaphore;
 	VkCommandPool commandPool;
 	VkCommandBuffer commandBuffer;
+
+	// Persistently mapped, reused for every batch once the previous one completes.
+	AllocatedBuffer stagingBuffer;
+	uint8_t* stagingData;
+	size_t stagingCursor;
+	// Uploads too large for the arena, freed when their batch completes.
+	std::vector<AllocatedBuffer> oversizedStagingBuffers;
+
+	bool isRecording;
+	bool isInFlight;
+	// Set when uploadSemaphore has been signalled but nothing has waited on it yet.
+	bool isSemaphorePending;
 };
 
 class PipelineBuilder
 {
 public:
+	// Without a render pass the pipeline is built for dynamic rendering into the attachment
+	// formats below.
 	VkPipeline BuildPipeline(VkDevice device, VkRenderPass pass);
+	// Only uses the first shader stage and the pipeline layout.
+	VkPipeline BuildComputePipeline(VkDevice device);
 
 	std::vector<VkPipelineShaderStageCreateInfo> shaderStages;
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
@@ -103,12 +340,25 @@ public:
 	VkPipelineMultisampleStateCreateInfo multisampling = {};
 	VkPipelineLayout pipelineLayout = {};
 	VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+	VkFormat colorAttachmentFormat = VK_FORMAT_UNDEFINED;
+	VkFormat depthAttachmentFormat = VK_FORMAT_UNDEFINED;
+};
+
+// A pipeline to build with BuildPipelineVariants. The builder's pointers, like its vertex
+// input descriptions, must stay valid until then.
+struct PipelineVariant
+{
+	PipelineBuilder builder;
+	bool isCompute;
+	VkPipeline* outPipeline;
 };
 
 class VKRenderer : public Renderer
 {
 public:
-	VKRenderer(const std::string& windowName, int32_t windowWidth, int32_t windowHeight);
+	VKRenderer(const std::string& windowName, int32_t windowWidth, int32_t windowHeight,
+		const RendererConfig& config = RendererConfig{});
 
 	void CloseWindow() override;
 	void ResizeWindow(int32_t width, int32_t height) override;
@@ -120,14 +370,26 @@ public:
 
 	void DrawModel(const Model* model, const TextureArray* textureArray, const Instances* instances) override;
 	void DrawSprite(const Model* model, const TextureArray* textureArray, const Instances* instances) override;
+	void DrawModel(const Model* model, const TextureArray* textureArray, const PackedInstances* instances) override;
+	void DrawSprite(const Model* model, const TextureArray* textureArray, const PackedInstances* instances) override;
 
 	Model CreateModel(const std::vector<float>& vertices, const std::vector<uint32_t>& indices) override;
 	void UpdateModel(Model* model, const std::vector<float>& vertices, const std::vector<uint32_t>& indices) override;
 	void DestroyModel(Model* model) override;
 
 	TextureArray CreateTextureArray(const std::vector<std::string>& images) override;
+	TextureArrayLoad LoadTextureArrayAsync(const std::vector<std::string>& images) override;
+	bool PollTextureArrayLoad(const TextureArrayLoad* load, TextureArray* outTextureArray) override;
+	TextureArray WaitTextureArrayLoad(const TextureArrayLoad* load) override;
+	TextureArray CreateTextureArrayFromPack(const std::string& packFile) override;
+	TextureArray CreateDynamicTextureArray(int32_t width, int32_t height, uint32_t layerCount) override;
+	void UpdateTextureArrayLayer(const TextureArray* textureArray, uint32_t layer, const uint8_t* pixels) override;
 	void DestroyTextureArray(TextureArray* textureArray) override;
 
+	void CaptureFrame(std::vector<uint8_t>& outPixels) override;
+	FrameStats GetFrameStats() override;
+	MemoryStats GetMemoryStats();
+
 	void UpdateCamera() override;
 	void SetCameraPosition(glm::vec3 position) override;
 	void SetCameraRotation(float yRot, float xRot) override;
@@ -136,26 +398,88 @@ public:
 private:
 	void InitVulkan(const std::string& windowName);
 	void InitSwapchain();
+	void InitOffscreenImage();
 	void InitCommands();
 	void InitDefaultRenderpass();
 	void InitFramebuffers();
 	void InitSyncStructures();
+	void InitTimestampQueries();
 	void InitDescriptors();
+	void InitPipelineCache();
+	void SavePipelineCache();
 	void InitPipelines();
-	void LoadImages();
-
-	void LoadMeshes();
-	void UploadMesh(Mesh& mesh);
-
-	void FlushDeletionList(std::vector<std::function<void()>>& list);
-	void RecreateSwapchain();
+	// Loads the shaders and builds every pipeline that uses them, replacing the current ones
+	// only if all of them build.
+	void BuildPipelines();
+	// Builds every variant in parallel on the worker pool.
+	void BuildPipelineVariants(std::vector<PipelineVariant>& variants);
+	void ReloadPipelines();
+	void InitDepthPyramid();
+
+	// A frame is acquired, recorded by the Draw* calls, then submitted and presented.
+	bool AcquireFrame();
+	void BeginRecording();
+	void SubmitFrame();
+	void PresentFrame();
+	void ReadFrameTimestamps(FrameData& frame);
+
+	void UploadMesh(Mesh& mesh, const std::vector<float>& vertices, const std::vector<uint32_t>& indices);
+	void DestroyMesh(Mesh& mesh, DeletionQueue& queue);
+	void DestroyTexture(Texture& texture, DeletionQueue& queue);
+	void DestroyDynamicTexture(DynamicTexture& dynamicTexture, DeletionQueue& queue);
+	const Texture& GetTexture(uint32_t id);
+	// Loads the array again if it was evicted and marks it as used by the current frame.
+	const Texture& UseTexture(uint32_t id);
+	// Evicts the least recently used texture arrays the GPU is done with until at least
+	// bytes have been freed, returns how many were.
+	VkDeviceSize EvictTextures(VkDeviceSize bytes);
+	VkDeviceSize GetDeviceLocalUsage();
+	VkDeviceSize GetMemoryBudget();
+	void EnforceMemoryBudget();
+	bool RecordDynamicTextureCopies(FrameData& frame);
+	bool RecordCulling(FrameData& frame);
+	void RecordDepthPyramid(VkCommandBuffer cmd);
+	// Starts and ends drawing into the acquired swapchain image and the depth image, with
+	// either dynamic rendering or the render pass.
+	void RecordBeginRendering(VkCommandBuffer cmd);
+	void RecordEndRendering(VkCommandBuffer cmd);
+	PackedInstance* AllocateInstances(size_t instanceCount, uint32_t* outFirstInstance);
+	void SetInstanceTextureArray(PackedInstance* instances, size_t instanceCount, const TextureArray* textureArray);
+	void BindDraw(const Model* model, const TextureArray* textureArray, VkBuffer instanceBuffer, bool is2D);
+	void RecordDraw(const Model* model, const TextureArray* textureArray, uint32_t firstInstance,
+		uint32_t instanceCount, bool is2D);
+	void RecordCulledDraw(const Model* model, const TextureArray* textureArray, uint32_t firstInstance,
+		uint32_t instanceCount);
+
+	void FlushDeletionQueue(DeletionQueue& queue);
+	void MoveDeletionQueue(DeletionQueue& source, DeletionQueue& destination);
+	// The queue of the last frame that may use resources released now, their memory is
+	// reclaimed once that frame finishes instead of waiting for the device to go idle.
+	DeletionQueue& GetDeletionQueue();
+	// Returns false while the window is minimized.
+	bool RecreateSwapchain();
 	void CleanupVulkan();
 	bool LoadShaderModule(const char* filePath, VkShaderModule* outShaderModule);
 	FrameData& GetCurrentFrame();
 	void CheckVkError(VkResult err);
-	AllocatedBuffer CreateBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage);
-	void ImmediateSubmit(std::function<void(VkCommandBuffer cmd)>&& function);
-	void LoadImageFromFile(const char* file, AllocatedImage& outImage);
+	AllocatedBuffer CreateBuffer(size_t allocSize, VkBufferUsageFlags usage, VmaMemoryUsage memoryUsage,
+		MemoryCategory category, bool isUploadTarget = false);
+	// Evicts texture arrays to make room when device memory runs out.
+	AllocatedImage CreateImage(const VkImageCreateInfo& imageInfo, MemoryCategory category);
+	// Creates the category's pool for the memory type on first use.
+	VmaPool GetMemoryPool(MemoryCategory category, uint32_t memoryTypeIndex);
+	AllocatedBuffer UploadBuffer(const void* data, size_t size, VkBufferUsageFlags usage);
+	uint8_t* AllocateStaging(size_t size, VkBuffer* outBuffer, VkDeviceSize* outOffset);
+	VkCommandBuffer GetUploadCommandBuffer();
+	void BeginUploads();
+	void RetireUploads();
+	void FlushUploads();
+	bool UploadTextureLayers(uint32_t loadId, bool wait, TextureArray* outTextureArray);
+	AllocatedImage CreateTextureImage(VkFormat format, uint32_t width, uint32_t height, uint32_t layerCount,
+		uint32_t mipCount);
+	void UploadTextureLayer(PendingTexture& pending, const DecodedImage& image);
+	void FinishTextureImage(Texture& texture, VkFormat format, uint32_t layerCount, uint32_t mipCount);
+	void CreateTextureDescriptor(Texture& texture, VkFormat format, uint32_t layerCount, uint32_t mipCount);
 
 	VkCommandPoolCreateInfo CommandPoolCreateInfo(uint32_t queueFamilyIndex, VkCommandPoolCreateFlags flags);
 	VkCommandBufferAllocateInfo CommandBufferAllocateInfo(VkCommandPool pool, uint32_t count = 1, VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
@@ -170,6 +494,7 @@ private:
 	VkSemaphoreCreateInfo SemaphoreCreateInfo(VkSemaphoreCreateFlags flags);
 	VkViewport DefaultViewport();
 	VkRect2D DefaultScissor();
+	VkPresentModeKHR GetVkPresentMode(PresentMode presentMode);
 	VkImageCreateInfo ImageCreateInfo(VkFormat format, VkImageUsageFlags usageFlags, VkExtent3D extent);
 	VkImageViewCreateInfo ImageViewCreateInfo(VkFormat format, VkImage image, VkImageAspectFlags aspectFlags);
 	VkPipelineDepthStencilStateCreateInfo DepthStencilCreateInfo(bool depthTest, bool depthWrite, VkCompareOp compareOp);
@@ -178,13 +503,22 @@ private:
 	VkSamplerCreateInfo SamplerCreateInfo(VkFilter filters, VkSamplerAddressMode samplerAddressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT);
 	VkWriteDescriptorSet WriteDescriptorImage(VkDescriptorType type, VkDescriptorSet dstSet, VkDescriptorImageInfo* imageInfo, uint32_t binding);
 
+	RendererConfig config;
+	FramePacer framePacer;
+	FrameProfiler frameProfiler;
 	GLFWwindow* window;
 	int32_t width;
 	int32_t height;
 	Camera camera;
+	GPUCameraData cameraData;
+	Frustum frustum;
+	VkClearValue clearColor;
 
-	std::vector<std::function<void()>> deletionList;
-	std::vector<std::function<void()>> swapchainDeletionList;
+	// Flushed when the renderer is destroyed and when the swapchain is recreated.
+	DeletionQueue deletionQueue;
+	DeletionQueue swapchainDeletionQueue;
+	// For evicted texture arrays, which the GPU is already done with.
+	DeletionQueue evictionQueue;
 
 	vkb::Instance vkbInstance;
 	vkb::Device vkbDevice;
@@ -199,23 +533,75 @@ private:
 	VkFormat swapchainImageFormat;
 	std::vector<VkImage> swapchainImages;
 	std::vector<VkImageView> swapchainImageViews;
+	// Headless mode renders into this instead of a swapchain, it is the only swapchain image.
+	AllocatedImage offscreenImage;
 
 	VkQueue graphicsQueue;
 	uint32_t graphicsQueueFamily;
-
+	// The same as the graphics queue when there is no dedicated transfer queue.
+	VkQueue transferQueue;
+	uint32_t transferQueueFamily;
+
+	// Frames begin and end rendering themselves, with synchronization2 barriers for the layout
+	// transitions the render pass would otherwise make, so there are no render pass or
+	// framebuffers to build or rebuild with the swapchain. Devices without it use them instead.
+	bool supportsDynamicRendering;
+	PFN_vkCmdBeginRenderingKHR cmdBeginRendering;
+	PFN_vkCmdEndRenderingKHR cmdEndRendering;
+	PFN_vkCmdPipelineBarrier2KHR cmdPipelineBarrier2;
+	// Only created without dynamic rendering.
 	VkRenderPass renderPass;
 	std::vector<VkFramebuffer> framebuffers;
 
-	FrameData frames[frameOverlap];
+	FrameData frames[maxFrameOverlap];
+	uint32_t frameOverlap;
 	int32_t frameNumber;
-
-	VkPipelineLayout trianglePipelineLayout;
-	VkPipeline trianglePipeline;
+	// The last frame the GPU is known to have finished, updated as frame slots are acquired.
+	int32_t completedFrame;
+	uint32_t swapchainImageIndex;
+	bool isFrameActive;
+	// Set by resizes and out of date presents, the swapchain is recreated by AcquireFrame.
+	bool isSwapchainDirty;
+
+	// Loaded from and saved to config.pipelineCacheFile.
+	VkPipelineCache pipelineCache;
+
+	VkPipelineLayout modelPipelineLayout;
+	VkPipeline modelPipeline;
+	VkPipeline spritePipeline;
+
+	// Only watches anything with config.shaderHotReload.
+	ShaderWatcher shaderWatcher;
+
+	// Only created when supportsGpuCulling is set.
+	VkDescriptorSetLayout cullSetLayout;
+	VkPipelineLayout cullPipelineLayout;
+	VkPipeline cullPipeline;
+	bool supportsGpuCulling;
+
+	// Every frame reduces its depth buffer into this pyramid, whose texels keep the furthest
+	// depth beneath them, and the next frame's culling tests against it. Level 0 is half the
+	// depth buffer's size. Recreated with the swapchain, like the depth image.
+	AllocatedImage depthPyramid;
+	VkImageView depthPyramidView;
+	std::vector<VkImageView> depthPyramidLevelViews;
+	// Each level's set reads the level below it, or the depth image for level 0.
+	std::vector<VkDescriptorSet> depthPyramidDescriptors;
+	uint32_t depthPyramidLevelCount;
+	VkDescriptorSetLayout depthPyramidSetLayout;
+	VkPipelineLayout depthPyramidPipelineLayout;
+	VkPipeline depthPyramidPipeline;
+	VkSampler depthPyramidSampler;
+	glm::mat4 depthPyramidViewProj;
+	// False until a frame has built the pyramid since it was last recreated.
+	bool isDepthPyramidValid;
 
 	VmaAllocator allocator;
-
-	//VkPipeline meshPipeline;
-	Mesh triangleMesh;
+	std::vector<MemoryPool> memoryPools;
+	bool supportsMemoryBudget;
+	// Set while over the soft budget with nothing left to evict, so the warning prints once.
+	bool isOverMemoryBudget;
+	uint32_t evictionCount;
 
 	VkImageView depthImageView;
 	AllocatedImage depthImage;
@@ -226,10 +612,40 @@ private:
 
 	UploadContext uploadContext;
 
-	std::unordered_map<std::string, Texture> loadedTextures;
+	// Models and texture arrays handed to the game are keys into these maps.
+	std::unordered_map<uint32_t, Mesh> meshes;
+	std::unordered_map<uint32_t, Texture> textures;
+	std::unordered_map<uint32_t, DynamicTexture> dynamicTextures;
+	// Static texture arrays are evicted by destroying their image, their entry stays in
+	// textures with a null image until it is loaded again from here.
+	std::unordered_map<uint32_t, TextureSource> textureSources;
+	uint32_t nextMeshId;
+	uint32_t nextTextureId;
+
+	TextureDecoder textureDecoder;
+	std::unordered_map<uint32_t, PendingTexture> pendingTextures;
+
+	WorkerPool workerPool;
+	InstanceCuller instanceCuller;
 
 	VkDescriptorSetLayout singleTextureSetLayout;
-	VkDescriptorSet testTextureSet = { VK_NULL_HANDLE };
+	VkSampler textureSampler;
+
+	// Every texture array is bound through one set that stays bound for the whole frame.
+	// It is updated after being bound, so arrays can be created while frames are in flight
+	// as long as their entries aren't used by them.
+	bool supportsBindlessTextures;
+	VkDescriptorSetLayout bindlessTextureSetLayout;
+	VkDescriptorPool bindlessDescriptorPool;
+	VkDescriptorSet bindlessTextureSet;
+	std::vector<uint32_t> freeBindlessIndices;
+	uint32_t nextBindlessIndex;
 
 	VkPhysicalDeviceProperties gpuProperties;
+	bool supportsBC;
+
+	// Two timestamps per frame slot, written at the start and end of its command buffer.
+	VkQueryPool timestampQueryPool;
+	bool supportsTimestamps;
+	uint64_t timestampMask;
 };
@@ -0,0 +1,115 @@
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(uint32_t threadCount)
+{
+	if (threadCount == 0)
+	{
+		uint32_t coreCount = std::thread::hardware_concurrency();
+		threadCount = coreCount > 1 ? coreCount - 1 : 0;
+	}
+
+	for (uint32_t i = 0; i < threadCount; ++i)
+	{
+		workers.emplace_back(&WorkerPool::WorkerLoop, this);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		isStopping = true;
+	}
+
+	batchAvailable.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+uint32_t WorkerPool::GetThreadCount() const
+{
+	return static_cast<uint32_t>(workers.size()) + 1;
+}
+
+void WorkerPool::Run(uint32_t jobCount, const std::function<void(uint32_t)>& job)
+{
+	if (jobCount == 0)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		batchJob = &job;
+		batchJobCount = jobCount;
+		nextJob = 0;
+		pendingWorkerCount = static_cast<uint32_t>(workers.size());
+		batchError = nullptr;
+		++batchGeneration;
+	}
+
+	batchAvailable.notify_all();
+	RunJobs();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	batchFinished.wait(lock, [&]() { return pendingWorkerCount == 0; });
+	batchJob = nullptr;
+
+	if (batchError)
+	{
+		std::rethrow_exception(batchError);
+	}
+}
+
+void WorkerPool::WorkerLoop()
+{
+	uint64_t seenGeneration = 0;
+
+	while (true)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		batchAvailable.wait(lock, [&]() { return isStopping || batchGeneration != seenGeneration; });
+
+		if (isStopping)
+		{
+			return;
+		}
+
+		seenGeneration = batchGeneration;
+		lock.unlock();
+
+		RunJobs();
+
+		lock.lock();
+
+		if (--pendingWorkerCount == 0)
+		{
+			batchFinished.notify_one();
+		}
+	}
+}
+
+void WorkerPool::RunJobs()
+{
+	uint32_t job;
+
+	while ((job = nextJob.fetch_add(1)) < batchJobCount)
+	{
+		try
+		{
+			(*batchJob)(job);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (!batchError)
+			{
+				batchError = std::current_exception();
+			}
+		}
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cinttypes>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs batches of indexed jobs on persistent worker threads. The calling thread works on
+// the batch too, Run only returns once every job in it has finished.
+class WorkerPool
+{
+public:
+	// Zero picks one worker per core, leaving one for the calling thread.
+	explicit WorkerPool(uint32_t threadCount = 0);
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	// Workers plus the calling thread.
+	uint32_t GetThreadCount() const;
+	// Calls job once for every index below jobCount. If any job throws, the first exception
+	// is rethrown here after the rest of the batch has finished.
+	void Run(uint32_t jobCount, const std::function<void(uint32_t)>& job);
+
+private:
+	void WorkerLoop();
+	void RunJobs();
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable batchAvailable;
+	std::condition_variable batchFinished;
+
+	const std::function<void(uint32_t)>* batchJob = nullptr;
+	uint32_t batchJobCount = 0;
+	std::atomic<uint32_t> nextJob{ 0 };
+	// Every worker takes part in every batch, so none of them can miss one.
+	uint32_t pendingWorkerCount = 0;
+	uint64_t batchGeneration = 0;
+	std::exception_ptr batchError;
+	bool isStopping = false;
+};
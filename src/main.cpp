@@ -2,10 +2,17 @@
 #include <cinttypes>
 #include <vector>
 #include <iostream>
+#include <fstream>
+#include <cstring>
 #include <glm/glm.hpp>
 
 // #include "GLRenderer.h"
+// #include "SWRenderer.h"
 #include "VKRenderer.h"
+#include "Raycaster.h"
+#include "LevelMesh.h"
+#include "LevelVisibility.h"
+#include "OcclusionBuffer.h"
 
 /*
  * To implement:
@@ -28,13 +35,73 @@
  */
 
 void ResizeCallback(GLFWwindow* window, int32_t width, int32_t height);
+void WriteCapture(const std::string& file, int32_t width, int32_t height, const std::vector<uint8_t>& pixels);
+void PrintFrameStats(const FrameStats& stats);
+void PrintMemoryStats(const MemoryStats& stats);
+RaycastMap CreateDemoMap();
 
-int main(void)
+int main(int argc, char** argv)
 {
-	VKRenderer rend("gFps", 640, 480);
+	// "--headless <frames>" renders that many frames offscreen and saves the last one,
+	// for running on machines without a display. "--raycast" draws a raycast grid map
+	// and "--level <file>" a meshed level instead of the model scene. "--cpu-culling" culls
+	// instances on the CPU in VKRenderer, to compare against the compute shader, and
+	// "--bound-textures" binds a descriptor set per draw instead of using bindless textures.
+	// "--render-pass" renders through a render pass instead of dynamic rendering.
+	// "--hot-reload" recompiles and reloads shaders as they are saved, and "--memory-budget <MiB>"
+	// evicts texture arrays to keep device memory under that much.
+	RendererConfig config;
+	int32_t headlessFrameCount = 0;
+	bool isRaycasting = false;
+	std::string levelFile;
+
+	for (int32_t i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc)
+		{
+			config.headless = true;
+			headlessFrameCount = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--raycast") == 0)
+		{
+			isRaycasting = true;
+		}
+		else if (strcmp(argv[i], "--level") == 0 && i + 1 < argc)
+		{
+			levelFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "--cpu-culling") == 0)
+		{
+			config.gpuCulling = false;
+		}
+		else if (strcmp(argv[i], "--bound-textures") == 0)
+		{
+			config.bindlessTextures = false;
+		}
+		else if (strcmp(argv[i], "--render-pass") == 0)
+		{
+			config.dynamicRendering = false;
+		}
+		else if (strcmp(argv[i], "--hot-reload") == 0)
+		{
+			config.shaderHotReload = true;
+		}
+		else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc)
+		{
+			config.memoryBudget = static_cast<uint64_t>(atoi(argv[++i])) * 1024 * 1024;
+		}
+	}
+
+	const int32_t windowWidth = 640;
+	const int32_t windowHeight = 480;
+	VKRenderer rend("gFps", windowWidth, windowHeight, config);
 	GLFWwindow* window = rend.GetWindowPtr();
-	glfwSetWindowUserPointer(window, &rend);
-	glfwSetFramebufferSizeCallback(window, ResizeCallback);
+
+	if (window)
+	{
+		glfwSetWindowUserPointer(window, &rend);
+		glfwSetFramebufferSizeCallback(window, ResizeCallback);
+	}
 
 	rend.SetClearColor(0, 0, 0.2f, 1);
 
@@ -51,8 +118,8 @@ int main(void)
 	};
 
 	Model model = rend.CreateModel(vertices, indices);
-	std::vector<std::string> images = { "res/test.png", "res/test2.png" };
-	TextureArray textureArray = rend.CreateTextureArray(images);
+	// Built from res/test.png and res/test2.png by tools/texpack.
+	TextureArray textureArray = rend.CreateTextureArrayFromPack("res/test.pack");
 	Instances instances = {
 		{ glm::vec3{ -0.5f, 0.0f, 0.0f }, glm::vec3{ 0.1f, 0.1f, -5.1f } },
 		{ 0, 45.0f },
@@ -67,25 +134,126 @@ int main(void)
 		{ 1, 0 },
 	};
 
+	// The occlusion buffer rasterizes from the renderer's camera, so both are given these.
+	float cameraYRot = 0.0f;
+	float cameraXRot = 0.0f;
+	float cameraFov = 45.0f;
 	rend.SetCameraPosition(glm::vec3(0.0f, 0.5f, 5.0f));
-	rend.SetCameraRotation(0.0f, 0.0f);
+	rend.SetCameraRotation(cameraYRot, cameraXRot);
+	rend.ConfigureCamera(cameraFov);
 
-	// double time = glfwGetTime();
-	// glfwSwapInterval(0);
+	// The raycaster renders at half resolution, its frame is stretched over the screen
+	// as a single sprite.
+	Raycaster raycaster(320, 240);
+	RaycastMap raycastMap = CreateDemoMap();
+	std::vector<RaycastSprite> raycastSprites = {
+		{ glm::vec3{ 3.6f, 0.0f, 4.6f }, 0.6f, 1 },
+	};
+	TextureArray raycastFrame = {};
+	Instances raycastFrameInstances = {
+		{ glm::vec3{ 0.0f, 0.0f, 0.0f } },
+		{ 0.0f },
+		{ 2.0f },
+		{ 0 },
+	};
+
+	if (isRaycasting)
+	{
+		raycaster.LoadTexturePack("res/test.pack");
+		raycaster.SetCamera(glm::vec3(3.2f, 0.5f, 6.5f), 10.0f, 45.0f);
+		raycastFrame = rend.CreateDynamicTextureArray(raycaster.GetWidth(), raycaster.GetHeight(), 1);
+	}
+
+	// Empty unless a level was passed, so it owns no models.
+	LevelMesh levelMesh(&rend, levelFile.empty() ? Level{ 0, 0 } : LoadLevel(levelFile));
+	LevelVisibility levelVisibility;
+	glm::vec3 levelCameraPos = glm::vec3(8.0f, 0.5f, 10.5f);
+	// Props standing in the level, only those in cells the camera may see are drawn.
+	Instances levelProps = {
+		{ glm::vec3{ 5.5f, 0.5f, 6.5f }, glm::vec3{ 30.5f, 0.5f, 4.5f }, glm::vec3{ 20.5f, 0.5f, 18.5f } },
+		{ 0.0f, 45.0f, 90.0f },
+		{ 1.0f, 1.0f, 1.0f },
+		{ 1, 0, 1 },
+	};
+	Instances visibleLevelProps;
+	Instances unoccludedLevelProps;
+	// Props hidden behind walls are dropped on the CPU as well, VKRenderer would also reject
+	// them on the GPU but GLRenderer can't.
+	OcclusionBuffer occlusionBuffer(160, 120);
 
-	while (!glfwWindowShouldClose(window))
+	if (!levelFile.empty())
 	{
-		// double newTime = glfwGetTime();
-		// std::cout << 1000.0 * (newTime - time) << "\n";
-		// time = newTime;
+		levelVisibility.Build(levelMesh.GetLevel());
+		rend.SetCameraPosition(levelCameraPos);
+	}
 
+	// glfwSwapInterval(0);
+
+	int32_t frameCount = 0;
+
+	while (config.headless ? frameCount < headlessFrameCount : !glfwWindowShouldClose(window))
+	{
 		rend.UpdateCamera();
 		rend.BeginDrawing();
-		rend.DrawModel(&model, &textureArray, &instances);
-		rend.DrawSprite(&model, &textureArray, &spriteInstances);
+
+		if (isRaycasting)
+		{
+			raycaster.Render(raycastMap, raycastSprites);
+			rend.UpdateTextureArrayLayer(&raycastFrame, 0, reinterpret_cast<const uint8_t*>(raycaster.GetPixels().data()));
+			rend.DrawSprite(&model, &raycastFrame, &raycastFrameInstances);
+		}
+		else if (!levelFile.empty())
+		{
+			// Only chunks edited since the last frame are re-meshed.
+			int32_t cameraCell = levelVisibility.GetCell(levelCameraPos);
+			levelMesh.Update();
+			levelMesh.Draw(&textureArray, levelVisibility, cameraCell);
+			levelVisibility.FilterInstances(cameraCell, &levelProps, &visibleLevelProps);
+
+			// The renderer's aspect ratio follows the framebuffer, which is zero sized
+			// while minimized.
+			int32_t frameWidth = windowWidth;
+			int32_t frameHeight = windowHeight;
+
+			if (window)
+			{
+				glfwGetFramebufferSize(window, &frameWidth, &frameHeight);
+			}
+
+			float aspectRatio = frameHeight > 0
+				? static_cast<float>(frameWidth) / static_cast<float>(frameHeight)
+				: static_cast<float>(windowWidth) / static_cast<float>(windowHeight);
+			occlusionBuffer.Begin(levelCameraPos, cameraYRot, cameraXRot, cameraFov, aspectRatio);
+			levelMesh.AddOccluders(occlusionBuffer);
+			occlusionBuffer.Finish();
+			occlusionBuffer.FilterInstances(model.boundingRadius, &visibleLevelProps, &unoccludedLevelProps);
+			rend.DrawModel(&model, &textureArray, &unoccludedLevelProps);
+		}
+		else
+		{
+			rend.DrawModel(&model, &textureArray, &instances);
+			rend.DrawSprite(&model, &textureArray, &spriteInstances);
+		}
+
 		rend.EndDrawing();
+		++frameCount;
+	}
+
+	if (config.headless && frameCount > 0)
+	{
+		std::vector<uint8_t> pixels;
+		rend.CaptureFrame(pixels);
+		WriteCapture("capture.ppm", windowWidth, windowHeight, pixels);
+		PrintFrameStats(rend.GetFrameStats());
+		PrintMemoryStats(rend.GetMemoryStats());
+	}
+
+	if (isRaycasting)
+	{
+		rend.DestroyTextureArray(&raycastFrame);
 	}
 
+	levelMesh.Destroy();
 	rend.DestroyModel(&model);
 	rend.DestroyTextureArray(&textureArray);
 	rend.CloseWindow();
@@ -97,3 +265,97 @@ void ResizeCallback(GLFWwindow* window, int32_t width, int32_t height)
 {
 	static_cast<Renderer*>(glfwGetWindowUserPointer(window))->ResizeWindow(width, height);
 }
+
+// An 8x8 room with a pillar and a half open door in a dividing wall.
+RaycastMap CreateDemoMap()
+{
+	const char* rows[] = {
+		"########",
+		"#......#",
+		"#......#",
+		"###D####",
+		"#......#",
+		"#....#.#",
+		"#......#",
+		"########",
+	};
+
+	RaycastMap map;
+	map.width = 8;
+	map.depth = 8;
+	map.floorColor = 0xFF404040;
+	map.ceilingColor = 0xFF706050;
+
+	for (const char* row : rows)
+	{
+		for (int32_t x = 0; x < map.width; ++x)
+		{
+			switch (row[x])
+			{
+			case '#':
+				map.tiles.push_back(RaycastTile{ RaycastTileType::Wall, 0, 0.0f });
+				break;
+			case 'D':
+				map.tiles.push_back(RaycastTile{ RaycastTileType::DoorX, 1, 0.5f });
+				break;
+			default:
+				map.tiles.push_back(RaycastTile{ RaycastTileType::Empty, 0, 0.0f });
+				break;
+			}
+		}
+	}
+
+	return map;
+}
+
+void PrintTimingStats(const char* name, const TimingStats& stats)
+{
+	printf("%-14s p50 %7.3f ms  p95 %7.3f ms  p99 %7.3f ms\n", name, stats.p50, stats.p95, stats.p99);
+}
+
+void PrintFrameStats(const FrameStats& stats)
+{
+	PrintTimingStats("Frame", stats.frameTime);
+	PrintTimingStats("BeginDrawing", stats.beginDrawingTime);
+	PrintTimingStats("Draw", stats.drawTime);
+	PrintTimingStats("EndDrawing", stats.endDrawingTime);
+	PrintTimingStats("GPU", stats.gpuTime);
+	printf("%u draws, %" PRIu64 " instances, %" PRIu64 " triangles\n", stats.drawCount, stats.instanceCount,
+		stats.triangleCount);
+}
+
+void PrintMemoryStats(const MemoryStats& stats)
+{
+	constexpr double mib = 1024.0 * 1024.0;
+	const char* categoryNames[memoryCategoryCount] = { "Textures", "Meshes", "Instances", "Staging",
+		"Render targets" };
+
+	for (size_t i = 0; i < stats.heaps.size(); ++i)
+	{
+		const MemoryHeapStats& heap = stats.heaps[i];
+		printf("Heap %zu%-9s %8.1f MiB used of %8.1f MiB budget, %8.1f MiB allocated\n", i,
+			heap.isDeviceLocal ? " (device)" : "", heap.usage / mib, heap.budget / mib, heap.allocationBytes / mib);
+	}
+
+	for (size_t i = 0; i < memoryCategoryCount; ++i)
+	{
+		const MemoryCategoryStats& category = stats.categories[i];
+		printf("%-14s %8.1f MiB in %u allocations, %8.1f MiB of blocks\n", categoryNames[i],
+			category.allocationBytes / mib, category.allocationCount, category.blockBytes / mib);
+	}
+
+	printf("%.1f MiB of %.1f MiB soft budget, %u texture arrays evicted, %u evictions\n", stats.deviceLocalUsage / mib,
+		stats.softBudget / mib, stats.evictedTextureArrays, stats.evictionCount);
+}
+
+// Binary PPM, so captures can be diffed without an image library.
+void WriteCapture(const std::string& file, int32_t width, int32_t height, const std::vector<uint8_t>& pixels)
+{
+	std::ofstream stream(file, std::ios::binary);
+	stream << "P6\n" << width << " " << height << "\n255\n";
+
+	for (size_t i = 0; i < pixels.size(); i += 4)
+	{
+		stream.write(reinterpret_cast<const char*>(&pixels[i]), 3);
+	}
+}
@@ -0,0 +1,375 @@
+// Packs images into a texture pack that the renderers load with CreateTextureArrayFromPack.
+// Usage: texpack [--bc1] <output.pack> <image>...
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../src/TexturePack.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../deps/stb_image.h"
+
+struct Image
+{
+	uint32_t width;
+	uint32_t height;
+	std::vector<uint8_t> pixels;
+};
+
+// The renderers treat #660066 as transparent, the pack stores it as alpha instead so
+// it survives filtering and compression.
+void ApplyColorKey(Image& image)
+{
+	for (size_t i = 0; i < image.pixels.size(); i += 4)
+	{
+		uint8_t* pixel = &image.pixels[i];
+
+		if (pixel[0] == 0x66 && pixel[1] == 0x00 && pixel[2] == 0x66)
+		{
+			pixel[3] = 0;
+		}
+	}
+}
+
+// 2x2 box filter. Colour is weighted by alpha so transparent texels don't bleed into
+// their neighbours, alpha is kept binary since the shaders use it as a cutout.
+Image Downsample(const Image& image)
+{
+	Image mip;
+	mip.width = std::max(image.width / 2, 1u);
+	mip.height = std::max(image.height / 2, 1u);
+	mip.pixels.resize(static_cast<size_t>(mip.width) * mip.height * 4);
+
+	for (uint32_t y = 0; y < mip.height; ++y)
+	{
+		for (uint32_t x = 0; x < mip.width; ++x)
+		{
+			uint32_t color[3] = {};
+			uint32_t alpha = 0;
+
+			for (uint32_t sy = 0; sy < 2; ++sy)
+			{
+				for (uint32_t sx = 0; sx < 2; ++sx)
+				{
+					uint32_t srcX = std::min(x * 2 + sx, image.width - 1);
+					uint32_t srcY = std::min(y * 2 + sy, image.height - 1);
+					const uint8_t* src = &image.pixels[(static_cast<size_t>(srcY) * image.width + srcX) * 4];
+
+					for (uint32_t c = 0; c < 3; ++c)
+					{
+						color[c] += src[c] * src[3];
+					}
+
+					alpha += src[3];
+				}
+			}
+
+			uint8_t* dst = &mip.pixels[(static_cast<size_t>(y) * mip.width + x) * 4];
+
+			for (uint32_t c = 0; c < 3; ++c)
+			{
+				dst[c] = alpha > 0 ? static_cast<uint8_t>((color[c] + alpha / 2) / alpha) : 0;
+			}
+
+			dst[3] = alpha >= 2 * 255 ? 255 : 0;
+		}
+	}
+
+	return mip;
+}
+
+uint16_t PackColor565(const uint8_t* color)
+{
+	uint32_t r = (color[0] * 31 + 127) / 255;
+	uint32_t g = (color[1] * 63 + 127) / 255;
+	uint32_t b = (color[2] * 31 + 127) / 255;
+
+	return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+void UnpackColor565(uint16_t packed, int32_t* outColor)
+{
+	int32_t r = (packed >> 11) & 31;
+	int32_t g = (packed >> 5) & 63;
+	int32_t b = packed & 31;
+
+	outColor[0] = (r << 3) | (r >> 2);
+	outColor[1] = (g << 2) | (g >> 4);
+	outColor[2] = (b << 3) | (b >> 2);
+}
+
+// Endpoints are the darkest and brightest opaque texels, which is cheap and good enough
+// for low resolution art. Blocks with transparent texels use the 3 colour mode.
+void EncodeBC1Block(const uint8_t texels[16][4], uint8_t* outBlock)
+{
+	int32_t minLuma = INT32_MAX;
+	int32_t maxLuma = -1;
+	const uint8_t* minColor = nullptr;
+	const uint8_t* maxColor = nullptr;
+	bool hasTransparent = false;
+
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		if (texels[i][3] < 128)
+		{
+			hasTransparent = true;
+			continue;
+		}
+
+		int32_t luma = texels[i][0] * 2 + texels[i][1] * 4 + texels[i][2];
+
+		if (luma < minLuma)
+		{
+			minLuma = luma;
+			minColor = texels[i];
+		}
+
+		if (luma > maxLuma)
+		{
+			maxLuma = luma;
+			maxColor = texels[i];
+		}
+	}
+
+	uint16_t color0 = maxColor ? PackColor565(maxColor) : 0;
+	uint16_t color1 = minColor ? PackColor565(minColor) : 0;
+
+	// color0 > color1 selects 4 colours, otherwise index 3 is transparent black.
+	if (hasTransparent ? color0 > color1 : color0 < color1)
+	{
+		std::swap(color0, color1);
+	}
+
+	int32_t palette[4][3];
+	UnpackColor565(color0, palette[0]);
+	UnpackColor565(color1, palette[1]);
+	uint32_t paletteSize;
+
+	if (color0 > color1)
+	{
+		for (uint32_t c = 0; c < 3; ++c)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		paletteSize = 4;
+	}
+	else
+	{
+		for (uint32_t c = 0; c < 3; ++c)
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+		}
+
+		paletteSize = 3;
+	}
+
+	uint32_t indices = 0;
+
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		uint32_t bestIndex = 3;
+
+		if (texels[i][3] >= 128)
+		{
+			int32_t bestDistance = INT32_MAX;
+
+			for (uint32_t p = 0; p < paletteSize; ++p)
+			{
+				int32_t distance = 0;
+
+				for (uint32_t c = 0; c < 3; ++c)
+				{
+					int32_t delta = texels[i][c] - palette[p][c];
+					distance += delta * delta;
+				}
+
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					bestIndex = p;
+				}
+			}
+		}
+
+		indices |= bestIndex << (i * 2);
+	}
+
+	outBlock[0] = static_cast<uint8_t>(color0);
+	outBlock[1] = static_cast<uint8_t>(color0 >> 8);
+	outBlock[2] = static_cast<uint8_t>(color1);
+	outBlock[3] = static_cast<uint8_t>(color1 >> 8);
+	memcpy(&outBlock[4], &indices, 4);
+}
+
+void EncodeLayer(const Image& image, TexturePackFormat format, std::vector<uint8_t>& outData)
+{
+	if (format == TexturePackFormat::RGBA8)
+	{
+		outData.insert(outData.end(), image.pixels.begin(), image.pixels.end());
+		return;
+	}
+
+	for (uint32_t blockY = 0; blockY < image.height; blockY += 4)
+	{
+		for (uint32_t blockX = 0; blockX < image.width; blockX += 4)
+		{
+			// Edge blocks repeat the last row and column.
+			uint8_t texels[16][4];
+
+			for (uint32_t y = 0; y < 4; ++y)
+			{
+				for (uint32_t x = 0; x < 4; ++x)
+				{
+					uint32_t srcX = std::min(blockX + x, image.width - 1);
+					uint32_t srcY = std::min(blockY + y, image.height - 1);
+					memcpy(texels[y * 4 + x], &image.pixels[(static_cast<size_t>(srcY) * image.width + srcX) * 4], 4);
+				}
+			}
+
+			uint8_t block[8];
+			EncodeBC1Block(texels, block);
+			outData.insert(outData.end(), block, block + 8);
+		}
+	}
+}
+
+Image LoadImage(const std::string& file)
+{
+	int32_t width;
+	int32_t height;
+	int32_t channelCount;
+	uint8_t* pixels = stbi_load(file.c_str(), &width, &height, &channelCount, STBI_rgb_alpha);
+
+	if (!pixels)
+	{
+		throw std::runtime_error(std::string("Failed to load: ") + file);
+	}
+
+	Image image;
+	image.width = static_cast<uint32_t>(width);
+	image.height = static_cast<uint32_t>(height);
+	image.pixels.assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+	stbi_image_free(pixels);
+
+	ApplyColorKey(image);
+
+	return image;
+}
+
+void WritePack(const std::string& file, TexturePackFormat format, const std::vector<Image>& layers)
+{
+	std::vector<std::vector<Image>> mipChains;
+
+	for (const Image& layer : layers)
+	{
+		std::vector<Image> chain = { layer };
+
+		while (chain.back().width > 1 || chain.back().height > 1)
+		{
+			chain.push_back(Downsample(chain.back()));
+		}
+
+		mipChains.push_back(std::move(chain));
+	}
+
+	TexturePackHeader header = {};
+	header.magic = texturePackMagic;
+	header.version = texturePackVersion;
+	header.format = format;
+	header.width = layers[0].width;
+	header.height = layers[0].height;
+	header.layerCount = static_cast<uint32_t>(layers.size());
+	header.mipCount = static_cast<uint32_t>(mipChains[0].size());
+
+	std::vector<TexturePackLevel> levels(header.mipCount);
+	std::vector<uint8_t> data;
+	uint64_t dataStart = sizeof(TexturePackHeader) + sizeof(TexturePackLevel) * header.mipCount;
+
+	for (uint32_t mip = 0; mip < header.mipCount; ++mip)
+	{
+		uint64_t alignedSize = (dataStart + data.size() + texturePackLevelAlignment - 1) & ~(texturePackLevelAlignment - 1);
+		data.resize(alignedSize - dataStart, 0);
+
+		levels[mip].offset = dataStart + data.size();
+		levels[mip].width = mipChains[0][mip].width;
+		levels[mip].height = mipChains[0][mip].height;
+
+		for (const std::vector<Image>& chain : mipChains)
+		{
+			EncodeLayer(chain[mip], format, data);
+		}
+
+		levels[mip].size = dataStart + data.size() - levels[mip].offset;
+	}
+
+	std::ofstream stream(file, std::ios::binary);
+
+	if (!stream)
+	{
+		throw std::runtime_error(std::string("Failed to open output: ") + file);
+	}
+
+	stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	stream.write(reinterpret_cast<const char*>(levels.data()), sizeof(TexturePackLevel) * levels.size());
+	stream.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+	if (!stream)
+	{
+		throw std::runtime_error(std::string("Failed to write output: ") + file);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	TexturePackFormat format = TexturePackFormat::RGBA8;
+	int32_t argIndex = 1;
+
+	if (argIndex < argc && std::string(argv[argIndex]) == "--bc1")
+	{
+		format = TexturePackFormat::BC1;
+		++argIndex;
+	}
+
+	if (argc - argIndex < 2)
+	{
+		std::cerr << "Usage: texpack [--bc1] <output.pack> <image>...\n";
+		return 1;
+	}
+
+	std::string output = argv[argIndex++];
+
+	// Match the renderers, which expect images bottom row first.
+	stbi_set_flip_vertically_on_load(true);
+
+	try
+	{
+		std::vector<Image> layers;
+
+		for (int32_t i = argIndex; i < argc; ++i)
+		{
+			layers.push_back(LoadImage(argv[i]));
+
+			if (layers.back().width != layers[0].width || layers.back().height != layers[0].height)
+			{
+				throw std::runtime_error("Can't create array of different sized textures!");
+			}
+		}
+
+		WritePack(output, format, layers);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << "\n";
+		return 1;
+	}
+
+	return 0;
+}